@@ -133,7 +133,7 @@ typedef struct iteminfo_s
 	int number;							//number of the item info
 } iteminfo_t;
 
-#define ITEMINFO_OFS(x)	(int)&(((iteminfo_t *)0)->x)
+#define ITEMINFO_OFS(x)	(int)(intptr_t)&(((iteminfo_t *)0)->x)
 
 fielddef_t iteminfo_fields[] =
 {
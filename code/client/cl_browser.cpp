@@ -39,14 +39,22 @@ static serverStatus_t cl_serverStatusList[MAX_SERVERSTATUSREQUESTS];
 static int serverStatusCount;
 
 
+static void CL_ServerAddressToAdr( const serverAddress_t* address, netadr_t* adr )
+{
+	Com_Memset( adr, 0, sizeof(*adr) );
+	adr->type  = address->type;
+	adr->ip[0] = address->ip[0];
+	adr->ip[1] = address->ip[1];
+	adr->ip[2] = address->ip[2];
+	adr->ip[3] = address->ip[3];
+	Com_Memcpy( adr->ip6, address->ip6, sizeof(adr->ip6) );
+	adr->port  = address->port;
+}
+
+
 static void CL_InitServerInfo( serverInfo_t *server, const serverAddress_t* address )
 {
-	server->adr.type  = NA_IP;
-	server->adr.ip[0] = address->ip[0];
-	server->adr.ip[1] = address->ip[1];
-	server->adr.ip[2] = address->ip[2];
-	server->adr.ip[3] = address->ip[3];
-	server->adr.port  = address->port;
+	CL_ServerAddressToAdr( address, &server->adr );
 	server->clients = 0;
 	server->hostName[0] = '\0';
 	server->mapName[0] = '\0';
@@ -87,39 +95,49 @@ void CL_ServersResponsePacket( const netadr_t& from, msg_t *msg )
 	buffptr    = msg->data;
 	buffend    = buffptr + msg->cursize;
 	while (buffptr+1 < buffend) {
-		// advance to initial token
+		// advance to initial token: '\\' starts an IPv4 entry and '/' an IPv6 one
+		byte separator;
 		do {
-			if (*buffptr++ == '\\')
+			separator = *buffptr++;
+			if (separator == '\\' || separator == '/')
 				break;
 		}
 		while (buffptr < buffend);
 
-		if ( buffptr >= buffend - 6 ) {
+		const int addressLength = (separator == '/') ? 16 : 4;
+		if ( buffptr >= buffend - (addressLength + 2) ) {
 			break;
 		}
 
+		serverAddress_t* address = &addresses[numservers];
+		Com_Memset( address, 0, sizeof(*address) );
+
 		// parse out ip
-		addresses[numservers].ip[0] = *buffptr++;
-		addresses[numservers].ip[1] = *buffptr++;
-		addresses[numservers].ip[2] = *buffptr++;
-		addresses[numservers].ip[3] = *buffptr++;
+		if (separator == '/') {
+			address->type = NA_IP6;
+			Com_Memcpy( address->ip6, buffptr, 16 );
+			buffptr += 16;
+		} else {
+			address->type = NA_IP;
+			address->ip[0] = *buffptr++;
+			address->ip[1] = *buffptr++;
+			address->ip[2] = *buffptr++;
+			address->ip[3] = *buffptr++;
+		}
 
 		// parse out port
-		addresses[numservers].port = (*buffptr++)<<8;
-		addresses[numservers].port += *buffptr++;
-		addresses[numservers].port = BigShort( addresses[numservers].port );
+		address->port = (*buffptr++)<<8;
+		address->port += *buffptr++;
+		address->port = BigShort( address->port );
 
 		// syntax check
-		if (*buffptr != '\\') {
+		if (*buffptr != '\\' && *buffptr != '/') {
 			break;
 		}
 
-		Com_DPrintf( "server: %d ip: %d.%d.%d.%d:%d\n",numservers,
-				addresses[numservers].ip[0],
-				addresses[numservers].ip[1],
-				addresses[numservers].ip[2],
-				addresses[numservers].ip[3],
-				addresses[numservers].port );
+		netadr_t adr;
+		CL_ServerAddressToAdr( address, &adr );
+		Com_DPrintf( "server: %d ip: %s\n", numservers, NET_AdrToString( adr ) );
 
 		numservers++;
 		if (numservers >= MAX_SERVERSPERPACKET) {
@@ -157,11 +175,7 @@ void CL_ServersResponsePacket( const netadr_t& from, msg_t *msg )
 				serverAddress_t *addr;
 				// just store the addresses in an additional list
 				addr = &cls.globalServerAddresses[cls.numGlobalServerAddresses++];
-				addr->ip[0] = addresses[i].ip[0];
-				addr->ip[1] = addresses[i].ip[1];
-				addr->ip[2] = addresses[i].ip[2];
-				addr->ip[3] = addresses[i].ip[3];
-				addr->port  = addresses[i].port;
+				*addr = addresses[i];
 			}
 		}
 	}
@@ -351,6 +365,7 @@ void CL_ServerInfoPacket( netadr_t from, msg_t *msg ) {
 			{
 				case NA_BROADCAST:
 				case NA_IP:
+				case NA_IP6:
 					type = 1;
 					break;
 				default:
@@ -556,10 +571,11 @@ CL_GlobalServers_f
 */
 void CL_GlobalServers_f( void ) {
 	netadr_t	to;
+	netadr_t	to6;
 	int			i;
 	int			count;
-	char		*buffptr;
 	char		command[1024];
+	char		keywords[1024];
 
 	if ( Cmd_Argc() < 3) {
 		Com_Printf( "usage: globalservers <master# 0-1> <protocol> [keywords]\n");
@@ -574,27 +590,33 @@ void CL_GlobalServers_f( void ) {
 	// -1 is used to distinguish a "no response"
 
 	if( cls.masterNum == 1 ) {
-		NET_StringToAdr( MASTER_SERVER_NAME, &to );
 		cls.nummplayerservers = -1;
 		cls.pingUpdateSource = AS_MPLAYER;
 	}
 	else {
-		NET_StringToAdr( MASTER_SERVER_NAME, &to );
 		cls.numglobalservers = -1;
 		cls.pingUpdateSource = AS_GLOBAL;
 	}
-	to.type = NA_IP;
-	to.port = BigShort(PORT_MASTER);
-
-	sprintf( command, "getservers %s", Cmd_Argv(2) );
 
 	// tack on keywords
-	buffptr = command + strlen( command );
+	keywords[0] = 0;
 	count   = Cmd_Argc();
 	for (i=3; i<count; i++)
-		buffptr += sprintf( buffptr, " %s", Cmd_Argv(i) );
+		Q_strcat( keywords, sizeof(keywords), va( " %s", Cmd_Argv(i) ) );
 
-	NET_OutOfBandPrint( NS_SERVER, to, command );
+	// the original request only ever returns IPv4 servers, so IPv6 ones
+	// have to be asked for separately with the extended (dpmaster) one
+	if ( NET_StringToAdr( MASTER_SERVER_NAME, &to, NA_IP ) ) {
+		to.port = BigShort(PORT_MASTER);
+		Com_sprintf( command, sizeof(command), "getservers %s%s", Cmd_Argv(2), keywords );
+		NET_OutOfBandPrint( NS_SERVER, to, command );
+	}
+
+	if ( NET_StringToAdr( MASTER_SERVER_NAME, &to6, NA_IP6 ) ) {
+		to6.port = BigShort(PORT_MASTER);
+		Com_sprintf( command, sizeof(command), "getserversExt Quake3Arena %s ipv6%s", Cmd_Argv(2), keywords );
+		NET_OutOfBandPrint( NS_SERVER, to6, command );
+	}
 }
 
 
@@ -552,6 +552,22 @@ static intptr_t CL_CgameSystemCalls( intptr_t *args )
 }
 
 
+// the traps above that the vm can run by itself
+
+static const vmLeafTrapDef_t cl_cgameLeafTraps[] = {
+	{ CG_MEMSET, VM_LEAF_MEMSET },
+	{ CG_MEMCPY, VM_LEAF_MEMCPY },
+	{ CG_STRNCPY, VM_LEAF_STRNCPY },
+	{ CG_SIN, VM_LEAF_SIN },
+	{ CG_COS, VM_LEAF_COS },
+	{ CG_ATAN2, VM_LEAF_ATAN2 },
+	{ CG_SQRT, VM_LEAF_SQRT },
+	{ CG_FLOOR, VM_LEAF_FLOOR },
+	{ CG_CEIL, VM_LEAF_CEIL },
+	{ CG_ACOS, VM_LEAF_ACOS }
+};
+
+
 void CL_InitCGame()
 {
 	int t = Sys_Milliseconds();
@@ -567,7 +583,7 @@ void CL_InitCGame()
 	// if sv_pure is set we only allow qvms to be loaded
 	vmInterpret_t interpret = cl_connectedToPureServer ? VMI_COMPILED : (vmInterpret_t)Cvar_VariableIntegerValue("vm_cgame");
 
-	cgvm = VM_Create( "cgame", CL_CgameSystemCalls, interpret );
+	cgvm = VM_Create( "cgame", CL_CgameSystemCalls, cl_cgameLeafTraps, sizeof(cl_cgameLeafTraps) / sizeof(cl_cgameLeafTraps[0]), interpret );
 	if ( !cgvm ) {
 		Com_Error( ERR_DROP, "VM_Create on cgame failed" );
 	}
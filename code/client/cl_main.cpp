@@ -535,16 +535,14 @@ static void CL_RequestAuthorization()
 
 	if ( !cls.authorizeServer.port ) {
 		Com_Printf( "Resolving %s\n", AUTHORIZE_SERVER_NAME );
-		if ( !NET_StringToAdr( AUTHORIZE_SERVER_NAME, &cls.authorizeServer  ) ) {
+		if ( !NET_StringToAdr( AUTHORIZE_SERVER_NAME, &cls.authorizeServer, NA_IP ) ) {
 			Com_Printf( "Couldn't resolve address\n" );
 			return;
 		}
 
 		cls.authorizeServer.port = BigShort( PORT_AUTHORIZE );
-		Com_Printf( "%s resolved to %i.%i.%i.%i:%i\n", AUTHORIZE_SERVER_NAME,
-			cls.authorizeServer.ip[0], cls.authorizeServer.ip[1],
-			cls.authorizeServer.ip[2], cls.authorizeServer.ip[3],
-			BigShort( cls.authorizeServer.port ) );
+		Com_Printf( "%s resolved to %s\n", AUTHORIZE_SERVER_NAME,
+			NET_AdrToString( cls.authorizeServer ) );
 	}
 	if ( cls.authorizeServer.type == NA_BAD ) {
 		return;
@@ -818,16 +816,14 @@ static void CL_RequestMotd()
 	}
 
 	Com_Printf( "Resolving %s\n", UPDATE_SERVER_NAME );
-	if ( !NET_StringToAdr( UPDATE_SERVER_NAME, &cls.updateServer  ) ) {
+	if ( !NET_StringToAdr( UPDATE_SERVER_NAME, &cls.updateServer, NA_IP ) ) {
 		Com_Printf( "Couldn't resolve address\n" );
 		return;
 	}
 
 	cls.updateServer.port = BigShort( PORT_UPDATE );
-	Com_Printf( "%s resolved to %i.%i.%i.%i:%i\n", UPDATE_SERVER_NAME,
-		cls.updateServer.ip[0], cls.updateServer.ip[1],
-		cls.updateServer.ip[2], cls.updateServer.ip[3],
-		BigShort( cls.updateServer.port ) );
+	Com_Printf( "%s resolved to %s\n", UPDATE_SERVER_NAME,
+		NET_AdrToString( cls.updateServer ) );
 
 	info[0] = 0;
 	// NOTE TTimo xoring against Com_Milliseconds, otherwise we may not have a qtrue randomization
@@ -923,10 +919,8 @@ static void CL_Connect_f()
 	if (clc.serverAddress.port == 0) {
 		clc.serverAddress.port = BigShort( PORT_SERVER );
 	}
-	Com_Printf( "%s resolved to %i.%i.%i.%i:%i\n", cls.servername,
-		clc.serverAddress.ip[0], clc.serverAddress.ip[1],
-		clc.serverAddress.ip[2], clc.serverAddress.ip[3],
-		BigShort( clc.serverAddress.port ) );
+	Com_Printf( "%s resolved to %s\n", cls.servername,
+		NET_AdrToString( clc.serverAddress ) );
 
 	// if we aren't playing on a lan, we need to authenticate
 	// with the cd key
@@ -1427,7 +1421,7 @@ static void CL_ConnectionlessPacket( const netadr_t& from, msg_t* msg )
 	}
 
 	// echo request from server
-	if ( !Q_strncmp(c, "getserversResponse", 18) ) {
+	if ( !Q_strncmp(c, "getserversResponse", 18) || !Q_strncmp(c, "getserversExtResponse", 21) ) {
 		CL_ServersResponsePacket( from, msg );
 		return;
 	}
@@ -1085,6 +1085,21 @@ static intptr_t CL_UISystemCalls( intptr_t* args )
 	return 0;
 }
 
+
+// the traps above that the vm can run by itself
+
+static const vmLeafTrapDef_t cl_uiLeafTraps[] = {
+	{ UI_MEMSET, VM_LEAF_MEMSET },
+	{ UI_MEMCPY, VM_LEAF_MEMCPY },
+	{ UI_STRNCPY, VM_LEAF_STRNCPY },
+	{ UI_SIN, VM_LEAF_SIN },
+	{ UI_COS, VM_LEAF_COS },
+	{ UI_ATAN2, VM_LEAF_ATAN2 },
+	{ UI_SQRT, VM_LEAF_SQRT },
+	{ UI_FLOOR, VM_LEAF_FLOOR },
+	{ UI_CEIL, VM_LEAF_CEIL }
+};
+
 /*
 ====================
 CL_ShutdownUI
@@ -1107,7 +1122,7 @@ void CL_InitUI( void )
 	// if sv_pure is set we only allow qvms to be loaded
 	vmInterpret_t interpret = cl_connectedToPureServer ? VMI_COMPILED : (vmInterpret_t)Cvar_VariableIntegerValue("vm_ui");
 
-	uivm = VM_Create( "ui", CL_UISystemCalls, interpret );
+	uivm = VM_Create( "ui", CL_UISystemCalls, cl_uiLeafTraps, sizeof(cl_uiLeafTraps) / sizeof(cl_uiLeafTraps[0]), interpret );
 	if ( !uivm )
 		Com_Error( ERR_FATAL, "VM_Create on UI failed" );
 
@@ -257,7 +257,9 @@ typedef struct {
 } serverInfo_t;
 
 typedef struct {
+	netadrtype_t	type;
 	byte	ip[4];
+	byte	ip6[16];
 	unsigned short	port;
 } serverAddress_t;
 
@@ -22,6 +22,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 // cmodel.c -- model loading
 
 #include "cm_local.h"
+#include "cm_patch.h"
 
 
 // to allow boxes to be treated as brush models, we allocate
@@ -33,7 +34,6 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 
 clipMap_t cm;
-int c_traces, c_brush_traces, c_patch_traces, c_pointcontents;
 
 const byte* cmod_base;
 
@@ -110,7 +110,7 @@ static void CMod_LoadShaders( const lump_t* l )
 	if (cm.numShaders < 1)
 		Com_Error(ERR_DROP, "Map has no shaders");
 
-	cm.shaders = H_New<dshader_t>( cm.numShaders, h_high );
+	cm.shaders = H_New<dshader_t>( cm.numShaders, h_low );
 
 	Com_Memcpy( cm.shaders, in, cm.numShaders * sizeof( *cm.shaders ) );
 
@@ -135,7 +135,7 @@ static void CMod_LoadSubmodels( const lump_t* l )
 	if (cm.numSubModels > MAX_SUBMODELS)
 		Com_Error(ERR_DROP, "MAX_SUBMODELS exceeded");
 
-	cm.cmodels = H_New<cmodel_t>( cm.numSubModels, h_high );
+	cm.cmodels = H_New<cmodel_t>( cm.numSubModels, h_low );
 
 	int j;
 	int* indexes;
@@ -156,14 +156,14 @@ static void CMod_LoadSubmodels( const lump_t* l )
 
 		// make a "leaf" just to hold the model's brushes and surfaces
 		out->leaf.numLeafBrushes = LittleLong( in->numBrushes );
-		indexes = H_New<int>( out->leaf.numLeafBrushes, h_high );
+		indexes = H_New<int>( out->leaf.numLeafBrushes, h_low );
 		out->leaf.firstLeafBrush = indexes - cm.leafbrushes;
 		for ( j = 0 ; j < out->leaf.numLeafBrushes ; j++ ) {
 			indexes[j] = LittleLong( in->firstBrush ) + j;
 		}
 
 		out->leaf.numLeafSurfaces = LittleLong( in->numSurfaces );
-		indexes = H_New<int>( out->leaf.numLeafSurfaces, h_high );
+		indexes = H_New<int>( out->leaf.numLeafSurfaces, h_low );
 		out->leaf.firstLeafSurface = indexes - cm.leafsurfaces;
 		for ( j = 0 ; j < out->leaf.numLeafSurfaces ; j++ ) {
 			indexes[j] = LittleLong( in->firstSurface ) + j;
@@ -182,7 +182,7 @@ static void CMod_LoadNodes( const lump_t* l )
 	if (cm.numNodes < 1)
 		Com_Error(ERR_DROP, "Map has no nodes");
 
-	cm.nodes = H_New<cNode_t>( cm.numNodes, h_high );
+	cm.nodes = H_New<cNode_t>( cm.numNodes, h_low );
 
 	cNode_t* out = cm.nodes;
 	for (int i = 0; i < cm.numNodes; ++i, ++in, ++out)
@@ -215,7 +215,7 @@ static void CMod_LoadBrushes( const lump_t* l )
 
 	cm.numBrushes = l->filelen / sizeof(*in);
 
-	cm.brushes = H_New<cbrush_t>( BOX_BRUSHES + cm.numBrushes, h_high );
+	cm.brushes = H_New<cbrush_t>( BOX_BRUSHES + cm.numBrushes, h_low );
 
 	cbrush_t* out = cm.brushes;
 	for (int i = 0; i < cm.numBrushes; ++i, ++in, ++out)
@@ -230,6 +230,19 @@ static void CMod_LoadBrushes( const lump_t* l )
 		out->contents = cm.shaders[out->shaderNum].contentFlags;
 		CM_BoundBrush( out );
 	}
+
+#if defined(CM_SSE)
+	// the planes were loaded first, so the sides can be laid out for SSE now
+	int numSides4 = 0;
+	for (int i = 0; i < cm.numBrushes; ++i)
+		numSides4 += (cm.brushes[i].numsides + 3) / 4;
+
+	cbrushsides4_t* sides4 = H_New<cbrushsides4_t>( numSides4, h_low );
+	for (int i = 0; i < cm.numBrushes; ++i) {
+		CM_SetBrushSides4( &cm.brushes[i], sides4 );
+		sides4 += (cm.brushes[i].numsides + 3) / 4;
+	}
+#endif
 }
 
 
@@ -243,7 +256,7 @@ static void CMod_LoadLeafs( const lump_t* l )
 	if (cm.numLeafs < 1)
 		Com_Error(ERR_DROP, "Map has no leafs");
 
-	cm.leafs = H_New<cLeaf_t>( BOX_LEAFS + cm.numLeafs, h_high );
+	cm.leafs = H_New<cLeaf_t>( BOX_LEAFS + cm.numLeafs, h_low );
 
 	cLeaf_t* out = cm.leafs;
 	for (int i = 0; i < cm.numLeafs; ++i, ++in, ++out)
@@ -261,8 +274,8 @@ static void CMod_LoadLeafs( const lump_t* l )
 			cm.numAreas = out->area + 1;
 	}
 
-	cm.areas = H_New<cArea_t>( cm.numAreas, h_high );
-	cm.areaPortals = H_New<int>( cm.numAreas * cm.numAreas, h_high );
+	cm.areas = H_New<cArea_t>( cm.numAreas, h_low );
+	cm.areaPortals = H_New<int>( cm.numAreas * cm.numAreas, h_low );
 }
 
 
@@ -276,7 +289,7 @@ static void CMod_LoadPlanes( const lump_t* l )
 	if (cm.numPlanes < 1)
 		Com_Error(ERR_DROP, "Map has no planes");
 
-	cm.planes = H_New<cplane_t>( BOX_PLANES + cm.numPlanes, h_high );
+	cm.planes = H_New<cplane_t>( BOX_PLANES + cm.numPlanes, h_low );
 
 	cplane_t* out = cm.planes;
 	for (int i = 0; i < cm.numPlanes; ++i, ++in, ++out)
@@ -302,7 +315,7 @@ static void CMod_LoadLeafBrushes( const lump_t* l )
 
 	cm.numLeafBrushes = l->filelen / sizeof(*in);
 
-	cm.leafbrushes = H_New<int>( BOX_BRUSHES + cm.numLeafBrushes, h_high );
+	cm.leafbrushes = H_New<int>( BOX_BRUSHES + cm.numLeafBrushes, h_low );
 
 	int* out = cm.leafbrushes;
 	for (int i = 0; i < cm.numLeafBrushes; ++i, ++in, ++out)
@@ -320,7 +333,7 @@ static void CMod_LoadLeafSurfaces( const lump_t* l )
 
 	cm.numLeafSurfaces = l->filelen / sizeof(*in);
 
-	cm.leafsurfaces = H_New<int>( cm.numLeafSurfaces, h_high );
+	cm.leafsurfaces = H_New<int>( cm.numLeafSurfaces, h_low );
 
 	int* out = cm.leafsurfaces;
 	for (int i = 0; i < cm.numLeafSurfaces; ++i, ++in, ++out)
@@ -338,7 +351,7 @@ static void CMod_LoadBrushSides( const lump_t* l )
 
 	cm.numBrushSides = l->filelen / sizeof(*in);
 
-	cm.brushsides = H_New<cbrushside_t>( BOX_SIDES + cm.numBrushSides, h_high );
+	cm.brushsides = H_New<cbrushside_t>( BOX_SIDES + cm.numBrushSides, h_low );
 
 	cbrushside_t* out = cm.brushsides;
 	for (int i = 0; i < cm.numBrushSides; ++i, ++in, ++out)
@@ -354,7 +367,7 @@ static void CMod_LoadBrushSides( const lump_t* l )
 
 static void CMod_LoadEntityString( const lump_t* l )
 {
-	cm.entityString = H_New<char>( l->filelen, h_high );
+	cm.entityString = H_New<char>( l->filelen, h_low );
 	cm.numEntityChars = l->filelen;
 	Com_Memcpy( cm.entityString, cmod_base + l->fileofs, l->filelen );
 }
@@ -366,7 +379,7 @@ static void CMod_LoadVisibility( const lump_t* l )
 
 	if ( !l->filelen ) {
 		cm.clusterBytes = ( cm.numClusters + 31 ) & ~31;
-		cm.visibility = H_New<byte>( cm.clusterBytes, h_high );
+		cm.visibility = H_New<byte>( cm.clusterBytes, h_low );
 		Com_Memset( cm.visibility, 255, cm.clusterBytes );
 		return;
 	}
@@ -374,7 +387,7 @@ static void CMod_LoadVisibility( const lump_t* l )
 	const byte* buf = (const byte*)(cmod_base + l->fileofs);
 
 	cm.vised = qtrue;
-	cm.visibility = H_New<byte>( l->filelen, h_high );
+	cm.visibility = H_New<byte>( l->filelen, h_low );
 	cm.numClusters = LittleLong( ((const int*)buf)[0] );
 	cm.clusterBytes = LittleLong( ((const int*)buf)[1] );
 	Com_Memcpy( cm.visibility, buf + VIS_HEADER, l->filelen - VIS_HEADER );
@@ -390,7 +403,7 @@ static void CMod_LoadPatches( const lump_t* surfs, const lump_t* verts )
 	if (surfs->filelen % sizeof(*in))
 		Com_Error(ERR_DROP, "CMod_LoadPatches: funny lump size");
 	cm.numSurfaces = surfs->filelen / sizeof(*in);
-	cm.surfaces = H_New<cPatch_t*>( cm.numSurfaces, h_high );
+	cm.surfaces = H_New<cPatch_t*>( cm.numSurfaces, h_low );
 
 	const drawVert_t* dvBase = (const drawVert_t*)(cmod_base + verts->fileofs);
 	if (verts->filelen % sizeof(*dvBase))
@@ -430,8 +443,92 @@ static void CMod_LoadPatches( const lump_t* surfs, const lump_t* verts )
 }
 
 
+// brushes are listed in every leaf they touch, but a box trace can hit their
+// expanded planes anywhere in their bounds, which can stick out of those leafs
+// across slanted node planes: the node's reach is how far, so that
+// CM_TraceThroughTree doesn't have to assume anything
+
+static qbool CM_BoundNode_r( int num, vec3_t mins, vec3_t maxs )
+{
+	ClearBounds( mins, maxs );
+
+	if (num < 0) {
+		const cLeaf_t* leaf = &cm.leafs[-1-num];
+		for (int i = 0; i < leaf->numLeafBrushes; ++i) {
+			const cbrush_t* b = &cm.brushes[ cm.leafbrushes[leaf->firstLeafBrush + i] ];
+			AddPointToBounds( b->bounds[0], mins, maxs );
+			AddPointToBounds( b->bounds[1], mins, maxs );
+		}
+		for (int i = 0; i < leaf->numLeafSurfaces; ++i) {
+			const cPatch_t* patch = cm.surfaces[ cm.leafsurfaces[leaf->firstLeafSurface + i] ];
+			if (patch) {
+				AddPointToBounds( patch->pc->bounds[0], mins, maxs );
+				AddPointToBounds( patch->pc->bounds[1], mins, maxs );
+			}
+		}
+		return (mins[0] <= maxs[0]);
+	}
+
+	cNode_t* node = &cm.nodes[num];
+	const cplane_t* plane = node->plane;
+	for (int i = 0; i < 2; ++i) {
+		vec3_t childMins, childMaxs, corner;
+		node->reach[i] = 0;
+		if (!CM_BoundNode_r( node->children[i], childMins, childMaxs ))
+			continue;
+
+		// the corner farthest over on the other side: behind the plane for the front child
+		for (int j = 0; j < 3; ++j)
+			corner[j] = ((plane->normal[j] < 0) == (i == 0)) ? childMaxs[j] : childMins[j];
+		const float d = DotProduct( plane->normal, corner ) - plane->dist;
+		const float reach = i ? d : -d;
+		if (reach > 0)
+			node->reach[i] = reach;
+
+		AddPointToBounds( childMins, mins, maxs );
+		AddPointToBounds( childMaxs, mins, maxs );
+	}
+
+	return (mins[0] <= maxs[0]);
+}
+
+
+#ifndef BSPC
+
+// the server's clip map is kept at the bottom of the hunk through Hunk_Clear,
+// and reloading the same map (map_restart cycling, votes, etc)
+// only has to reset the little state that traces and area portals change
+
+static clipMap_t cm_retained;
+static int cm_retainedSize;
+
+static qbool CM_RetainedValid()
+{
+	return ( cm_retainedSize && cm_retainedSize == Hunk_Retained() );
+}
+
+static void CM_ResetMap()
+{
+	// the game will open the area portals of the new level again
+	Com_Memset( cm.areaPortals, 0, cm.numAreas * cm.numAreas * sizeof( *cm.areaPortals ) );
+	CM_InitBoxHull();
+	CM_FloodAreaConnections();
+}
+
+#endif
+
+
 void CM_ClearMap()
 {
+#ifndef BSPC
+	CM_FinishTraceRecord();
+	CM_ReleaseWorks();
+
+	// keep the flood counter that the hunk data was last stamped with
+	if ( CM_RetainedValid() && cm.shaders == cm_retained.shaders )
+		cm_retained = cm;
+#endif
+
 	Com_Memset( &cm, 0, sizeof( cm ) );
 	CM_ClearLevelPatches();
 }
@@ -456,6 +553,9 @@ void CM_LoadMap( const char* name, qbool clientload, int* checksum )
 
 	int length;
 	byte* buf = 0;
+#ifndef BSPC
+	qbool retain = qfalse;
+#endif
 
 #ifndef BSPC
 	cm_noAreas = Cvar_Get("cm_noAreas", "0", CVAR_CHEAT);
@@ -472,6 +572,23 @@ void CM_LoadMap( const char* name, qbool clientload, int* checksum )
 	last_checksum = LittleLong( Com_BlockChecksum( buf, length ) );
 	*checksum = last_checksum;
 
+#ifndef BSPC
+	if ( !clientload ) {
+		if ( CM_RetainedValid() && !strcmp( cm_retained.name, name ) && cm_retained.checksum == last_checksum ) {
+			FS_FreeFile( buf );
+			cm = cm_retained;
+			CM_ResetMap();
+			Com_Printf( "CM_LoadMap: reusing the clip map of %s\n", name );
+			return;
+		}
+
+		// the file is on the temp side, so this doesn't
+		// move it if the old clip map is dropped
+		cm_retainedSize = 0;
+		retain = Hunk_BeginRetained();
+	}
+#endif
+
 	dheader_t header = *(dheader_t*)buf;
 	for (int i = 0; i < sizeof(dheader_t) / 4; ++i)
 		((int*)&header)[i] = LittleLong( ((int*)&header)[i] );
@@ -496,6 +613,9 @@ void CM_LoadMap( const char* name, qbool clientload, int* checksum )
 	CMod_LoadVisibility( &header.lumps[LUMP_VISIBILITY] );
 	CMod_LoadPatches( &header.lumps[LUMP_SURFACES], &header.lumps[LUMP_DRAWVERTS] );
 
+	vec3_t mins, maxs;
+	CM_BoundNode_r( 0, mins, maxs );
+
 	// we are NOT freeing the file, because it is cached for the ref
 	FS_FreeFile(buf);
 
@@ -506,6 +626,13 @@ void CM_LoadMap( const char* name, qbool clientload, int* checksum )
 	// allow this to be cached if it is loaded by the server
 	if ( !clientload ) {
 		Q_strncpyz( cm.name, name, sizeof( cm.name ) );
+#ifndef BSPC
+		cm.checksum = last_checksum;
+		if ( retain ) {
+			cm_retainedSize = Hunk_EndRetained();
+			cm_retained = cm;
+		}
+#endif
 	}
 }
 
@@ -32,6 +32,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 typedef struct {
 	cplane_t	*plane;
 	int			children[2];		// negative numbers are leafs
+	float		reach[2];			// how far the brushes and patches of each child stick out across the plane
 } cNode_t;
 
 typedef struct {
@@ -56,18 +57,31 @@ typedef struct {
 	int			shaderNum;
 } cbrushside_t;
 
+// the brush plane tests do 4 sides at once with SSE where the scalar code
+// does its float math with SSE too, since the results have to match it exactly
+#if defined(__SSE_MATH__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define CM_SSE
+#include <xmmintrin.h>
+#endif
+
+// 4 brush sides laid out for the SSE plane tests, unused lanes are all 0
+typedef struct {
+	float		normal[3][4];	// [axis][lane]
+	float		dist[4];
+	int			signs[3][4];	// ~0 where that bit of the plane's signbits is set
+} cbrushsides4_t;
+
 typedef struct {
 	int			shaderNum;		// the shader that determined the contents
 	int			contents;
 	vec3_t		bounds[2];
 	int			numsides;
 	cbrushside_t	*sides;
-	int			checkcount;		// to avoid repeated testings
+	cbrushsides4_t	*sides4;	// [ (numsides + 3) / 4 ], NULL for the box brush
 } cbrush_t;
 
 
 typedef struct {
-	int			checkcount;				// to avoid repeated testings
 	int			surfaceFlags;
 	int			contents;
 	struct patchCollide_s	*pc;
@@ -81,6 +95,7 @@ typedef struct {
 
 typedef struct {
 	char		name[MAX_QPATH];
+	unsigned	checksum;		// of the bsp file, only set for server loads
 
 	int			numShaders;
 	dshader_t	*shaders;
@@ -125,7 +140,6 @@ typedef struct {
 	cPatch_t	**surfaces;			// non-patches will be NULL
 
 	int			floodvalid;
-	int			checkcount;					// incremented on each trace
 } clipMap_t;
 
 
@@ -134,8 +148,6 @@ typedef struct {
 #define	SURFACE_CLIP_EPSILON	(0.125)
 
 extern	clipMap_t	cm;
-extern	int			c_pointcontents;
-extern	int			c_traces, c_brush_traces, c_patch_traces;
 extern	cvar_t		*cm_noAreas;
 extern	cvar_t		*cm_noCurves;
 extern	cvar_t		*cm_playerCurveClip;
@@ -143,6 +155,42 @@ extern	cvar_t		*cm_playerCurveClip;
 // cm_test.c
 extern void CM_FloodAreaConnections();
 
+// everything a query writes while it runs, so that any number of traces
+// can run at once on different threads: each one takes a free work for
+// its duration and stamps what it has already tested with its generation
+// instead of the brushes and patches themselves
+typedef struct {
+	volatile int	busy;
+	unsigned	generation;
+	int			numBrushStamps;
+	int			numPatchStamps;
+	unsigned	*brushStamps;		// [ cm.numBrushes + the box brush ]
+	unsigned	*patchStamps;		// [ cm.numSurfaces ]
+
+	// statistics, only ever added to by the owner
+	int			traces;
+	int			brushTraces;
+	int			patchTraces;
+	int			treeNodes;			// visited by CM_TraceThroughTree
+	int			treeLeafs;
+} cmWork_t;
+
+cmWork_t* CM_BeginWork();
+void CM_EndWork( cmWork_t* work );
+
+// point contents queries don't need a work, so they're just counted
+extern volatile int cm_pointContents;
+
+// qtrue the first time a query gets to a brush or patch that's in several leafs
+static ID_INLINE qbool CM_FirstVisit( unsigned* stamps, int index, unsigned generation )
+{
+	if ( stamps[index] == generation ) {
+		return qfalse;
+	}
+	stamps[index] = generation;
+	return qtrue;
+}
+
 // Used for oriented capsule collision detection
 typedef struct
 {
@@ -152,6 +200,15 @@ typedef struct
 	vec3_t		offset;
 } sphere_t;
 
+#if defined(CM_SSE)
+// the trace's start, end and size broadcast to all lanes
+typedef struct {
+	__m128		start[3];
+	__m128		end[3];
+	__m128		size[2][3];
+} traceWork4_t;
+#endif
+
 typedef struct {
 	vec3_t		start;
 	vec3_t		end;
@@ -165,6 +222,10 @@ typedef struct {
 	qbool	isPoint;	// optimized case
 	trace_t		trace;		// returned from trace call
 	sphere_t	sphere;		// sphere for oriendted capsule collision
+	cmWork_t	*work;
+#if defined(CM_SSE)
+	traceWork4_t	tw4;	// only valid for box traces, capsules never use it
+#endif
 } traceWork_t;
 
 typedef struct leafList_s {
@@ -175,11 +236,18 @@ typedef struct leafList_s {
 	vec3_t	bounds[2];
 	int		lastLeaf;		// for overflows where each leaf can't be stored individually
 	void	(*storeLeafs)( struct leafList_s *ll, int nodenum );
+	cmWork_t	*work;		// only CM_StoreBrushes needs one
 } leafList_t;
 
 
 int CM_BoxBrushes( const vec3_t mins, const vec3_t maxs, cbrush_t **list, int listsize );
 
+// fills the brush's sides4 from its sides
+void CM_SetBrushSides4( cbrush_t* brush, cbrushsides4_t* sides4 );
+
+// writes out the traces recorded by "cmtracerecord", if any
+void CM_FinishTraceRecord();
+
 void CM_StoreLeafs( leafList_t *ll, int nodenum );
 void CM_StoreBrushes( leafList_t *ll, int nodenum );
 
@@ -89,6 +89,12 @@ static const facet_t		*debugFacet;
 static qbool		debugBlock;
 static vec3_t		debugBlockPoints[4];
 
+// registered with the map rather than by the first trace to hit a patch,
+// which can be running on a job thread
+#ifndef BSPC
+static cvar_t		*cm_debugSurfaceUpdate;
+#endif
+
 /*
 =================
 CM_ClearLevelPatches
@@ -97,6 +103,9 @@ CM_ClearLevelPatches
 void CM_ClearLevelPatches( void ) {
 	debugPatchCollide = NULL;
 	debugFacet = NULL;
+#ifndef BSPC
+	cm_debugSurfaceUpdate = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
+#endif
 }
 
 /*
@@ -1110,9 +1119,9 @@ static void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf ) {
 	// copy the results out
 	pf->numPlanes = numPlanes;
 	pf->numFacets = numFacets;
-	pf->facets = (facet_t*)Hunk_Alloc( numFacets * sizeof( *pf->facets ), h_high );
+	pf->facets = (facet_t*)Hunk_Alloc( numFacets * sizeof( *pf->facets ), h_low );
 	Com_Memcpy( pf->facets, facets, numFacets * sizeof( *pf->facets ) );
-	pf->planes = (patchPlane_t*)Hunk_Alloc( numPlanes * sizeof( *pf->planes ), h_high );
+	pf->planes = (patchPlane_t*)Hunk_Alloc( numPlanes * sizeof( *pf->planes ), h_low );
 	Com_Memcpy( pf->planes, planes, numPlanes * sizeof( *pf->planes ) );
 }
 
@@ -1170,7 +1179,7 @@ struct patchCollide_s* CM_GeneratePatchCollide( int width, int height, const vec
 	// we now have a grid of points exactly on the curve
 	// the aproximate surface defined by these points will be
 	// collided against
-	patchCollide_t* pf = (patchCollide_t*)Hunk_Alloc( sizeof( *pf ), h_high );
+	patchCollide_t* pf = (patchCollide_t*)Hunk_Alloc( sizeof( *pf ), h_low );
 	ClearBounds( pf->bounds[0], pf->bounds[1] );
 	for ( i = 0 ; i < grid.width ; i++ ) {
 		for ( j = 0 ; j < grid.height ; j++ ) {
@@ -1219,9 +1228,6 @@ static void CM_TracePointThroughPatchCollide( traceWork_t *tw, const struct patc
 	int			i, j, k;
 	float		offset;
 	float		d1, d2;
-#ifndef BSPC
-	static cvar_t *cv;
-#endif //BSPC
 
 #ifndef BSPC
 	if ( !cm_playerCurveClip->integer || !tw->isPoint ) {
@@ -1279,10 +1285,7 @@ static void CM_TracePointThroughPatchCollide( traceWork_t *tw, const struct patc
 		if ( j == facet->numBorders ) {
 			// we hit this facet
 #ifndef BSPC
-			if (!cv) {
-				cv = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
-			}
-			if (cv->integer) {
+			if (cm_debugSurfaceUpdate->integer) {
 				debugPatchCollide = pc;
 				debugFacet = facet;
 			}
@@ -1363,9 +1366,6 @@ void CM_TraceThroughPatchCollide( traceWork_t *tw, const struct patchCollide_s *
 	facet_t	*facet;
 	float plane[4] = {0, 0, 0, 0}, bestplane[4] = {0, 0, 0, 0};
 	vec3_t startp, endp;
-#ifndef BSPC
-	static cvar_t *cv;
-#endif //BSPC
 
 	if (!CM_BoundsIntersect( tw->bounds[0], tw->bounds[1], pc->bounds[0], pc->bounds[1] ))
 		return;
@@ -1464,10 +1464,7 @@ void CM_TraceThroughPatchCollide( traceWork_t *tw, const struct patchCollide_s *
 					enterFrac = 0;
 				}
 #ifndef BSPC
-				if (!cv) {
-					cv = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
-				}
-				if (cv && cv->integer) {
+				if (cm_debugSurfaceUpdate->integer) {
 					debugPatchCollide = pc;
 					debugFacet = facet;
 				}
@@ -25,6 +25,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 void CM_LoadMap( const char* name, qbool clientload, int* checksum );
 void CM_ClearMap();
+void CM_ReleaseWorks();	// frees the queries' works, only when no query can be running on any other thread
 clipHandle_t CM_InlineModel( int index );		// 0 = world, 1 + are bmodels
 clipHandle_t CM_TempBoxModel( const vec3_t mins, const vec3_t maxs, int capsule );
 
@@ -45,7 +46,15 @@ void		CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t
 						  clipHandle_t model, int brushmask,
 						  const vec3_t origin, const vec3_t angles, int capsule );
 
+// the traces and point contents queries can run on any number of threads at once,
+// as long as none of them is against a temp box model or the map is being changed
+void		CM_TraceStats( int* traces, int* brushTraces, int* patchTraces, int* pointContents );
+void		CM_TraceTest_f();
+void		CM_TraceRecord_f();
+void		CM_TraceBench_f();
+
 const byte* CM_ClusterPVS( int cluster );
+int			CM_NumClusters();
 
 int			CM_PointLeafnum( const vec3_t p );
 
@@ -48,8 +48,6 @@ int CM_PointLeafnum_r( const vec3_t p, int num ) {
 			num = node->children[0];
 	}
 
-	c_pointcontents++;		// optimize counter
-
 	return -1 - num;
 }
 
@@ -100,11 +98,10 @@ void CM_StoreBrushes( leafList_t *ll, int nodenum ) {
 
 	for ( k = 0 ; k < leaf->numLeafBrushes ; k++ ) {
 		brushnum = cm.leafbrushes[leaf->firstLeafBrush+k];
-		b = &cm.brushes[brushnum];
-		if ( b->checkcount == cm.checkcount ) {
+		if ( !CM_FirstVisit( ll->work->brushStamps, brushnum, ll->work->generation ) ) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = cm.checkcount;
+		b = &cm.brushes[brushnum];
 		for ( i = 0 ; i < 3 ; i++ ) {
 			if ( b->bounds[0][i] >= ll->bounds[1][i] || b->bounds[1][i] <= ll->bounds[0][i] ) {
 				break;
@@ -172,8 +169,6 @@ CM_BoxLeafnums
 int	CM_BoxLeafnums( const vec3_t mins, const vec3_t maxs, int *list, int listsize, int *lastLeaf) {
 	leafList_t	ll;
 
-	cm.checkcount++;
-
 	VectorCopy( mins, ll.bounds[0] );
 	VectorCopy( maxs, ll.bounds[1] );
 	ll.count = 0;
@@ -182,6 +177,7 @@ int	CM_BoxLeafnums( const vec3_t mins, const vec3_t maxs, int *list, int listsiz
 	ll.storeLeafs = CM_StoreLeafs;
 	ll.lastLeaf = 0;
 	ll.overflowed = qfalse;
+	ll.work = NULL;
 
 	CM_BoxLeafnums_r( &ll, 0 );
 
@@ -197,8 +193,6 @@ CM_BoxBrushes
 int CM_BoxBrushes( const vec3_t mins, const vec3_t maxs, cbrush_t **list, int listsize ) {
 	leafList_t	ll;
 
-	cm.checkcount++;
-
 	VectorCopy( mins, ll.bounds[0] );
 	VectorCopy( maxs, ll.bounds[1] );
 	ll.count = 0;
@@ -207,9 +201,12 @@ int CM_BoxBrushes( const vec3_t mins, const vec3_t maxs, cbrush_t **list, int li
 	ll.storeLeafs = CM_StoreBrushes;
 	ll.lastLeaf = 0;
 	ll.overflowed = qfalse;
+	ll.work = CM_BeginWork();
 
 	CM_BoxLeafnums_r( &ll, 0 );
 
+	CM_EndWork( ll.work );
+
 	return ll.count;
 }
 
@@ -267,6 +264,8 @@ int CM_PointContents( const vec3_t p, clipHandle_t model ) {
 		}
 	}
 
+	Sys_AtomicAdd( &cm_pointContents, 1 );
+
 	return contents;
 }
 
@@ -322,6 +321,12 @@ const byte* CM_ClusterPVS( int cluster )
 }
 
 
+int CM_NumClusters()
+{
+	return cm.numClusters;
+}
+
+
 
 /*
 ===============================================================================
@@ -148,6 +148,181 @@ float SquareRootFloat(float number) {
 }
 
 
+/*
+===============================================================================
+
+QUERY WORK
+
+traces used to stamp cm.checkcount into every brush and patch they tested,
+so two of them could never run at the same time: now each one takes a work
+from this pool and keeps its stamps and statistics to itself
+
+the temp box model is still shared, CM_TempBoxModel writes it in place
+
+===============================================================================
+*/
+
+// room for every job thread, the main thread and the network thread
+// to each be in the middle of a query, and for a nested one on each
+#define MAX_CM_WORKS	(2 * (MAX_JOB_THREADS + 2))
+
+static cmWork_t cm_works[MAX_CM_WORKS];
+
+volatile int cm_pointContents;
+
+
+static void CM_SizeStamps( unsigned** stamps, int* numStamps, int count )
+{
+	if ( *numStamps >= count )
+		return;
+
+	// queries can run on the job threads, so this can't use the zone or the hunk
+	free( *stamps );
+	*stamps = (unsigned*)calloc( count, sizeof(unsigned) );
+	if ( !*stamps )
+		Sys_Error( "CM_BeginWork: failed to allocate %i stamps", count );
+	*numStamps = count;
+}
+
+
+cmWork_t* CM_BeginWork()
+{
+	cmWork_t* work = NULL;
+
+	// there are more works than there can ever be queries running,
+	// so this finds one on the first pass unless something leaks them
+	// this can be on a job thread, so it can't be a Com_Error
+	for ( int i = 0; !work; ++i ) {
+		if ( i == MAX_CM_WORKS )
+			Sys_Error( "CM_BeginWork: all %i works are busy, one of them was never ended", MAX_CM_WORKS );
+		if ( !cm_works[i].busy && Sys_AtomicCompareExchange( &cm_works[i].busy, 0, 1 ) )
+			work = &cm_works[i];
+	}
+
+	// the stamps of the last map are always older than the generation,
+	// so the arrays only ever need to grow
+	CM_SizeStamps( &work->brushStamps, &work->numBrushStamps, cm.numBrushes + 1 );
+	CM_SizeStamps( &work->patchStamps, &work->numPatchStamps, cm.numSurfaces );
+
+	if ( ++work->generation == 0 ) {
+		Com_Memset( work->brushStamps, 0, work->numBrushStamps * sizeof(unsigned) );
+		Com_Memset( work->patchStamps, 0, work->numPatchStamps * sizeof(unsigned) );
+		work->generation = 1;
+	}
+
+	return work;
+}
+
+
+void CM_EndWork( cmWork_t* work )
+{
+	Sys_AtomicAdd( &work->busy, -1 );
+}
+
+
+// a query that a Com_Error jumped out of never ends its work,
+// so they're all given back when the map is cleared and on errors
+
+void CM_ReleaseWorks()
+{
+	for ( int i = 0; i < MAX_CM_WORKS; ++i )
+		cm_works[i].busy = 0;
+}
+
+
+// the totals since the engine started, summed over all the works
+// they can be a query or so behind for works that are busy on other threads
+
+void CM_TraceStats( int* traces, int* brushTraces, int* patchTraces, int* pointContents )
+{
+	*traces = *brushTraces = *patchTraces = 0;
+	*pointContents = cm_pointContents;
+
+	for ( int i = 0; i < MAX_CM_WORKS; ++i ) {
+		const cmWork_t* work = &cm_works[i];
+		*traces += work->traces;
+		*brushTraces += work->brushTraces;
+		*patchTraces += work->patchTraces;
+	}
+}
+
+
+/*
+===============================================================================
+
+SSE BRUSH SIDES
+
+===============================================================================
+*/
+
+#if defined(CM_SSE)
+
+void CM_SetBrushSides4( cbrush_t* brush, cbrushsides4_t* sides4 )
+{
+	// sides4 comes zero filled, which is what the unused lanes need
+	brush->sides4 = sides4;
+	for ( int i = 0; i < brush->numsides; ++i ) {
+		const cplane_t* plane = brush->sides[i].plane;
+		cbrushsides4_t* s = &sides4[i / 4];
+		const int lane = i % 4;
+		for ( int j = 0; j < 3; ++j ) {
+			s->normal[j][lane] = plane->normal[j];
+			s->signs[j][lane] = (plane->signbits & (1 << j)) ? ~0 : 0;
+		}
+		s->dist[lane] = plane->dist;
+	}
+}
+
+
+static void CM_SetTraceWork4( traceWork_t* tw )
+{
+	traceWork4_t* tw4 = &tw->tw4;
+	for ( int j = 0; j < 3; ++j ) {
+		tw4->start[j] = _mm_set1_ps( tw->start[j] );
+		tw4->end[j] = _mm_set1_ps( tw->end[j] );
+		tw4->size[0][j] = _mm_set1_ps( tw->size[0][j] );
+		tw4->size[1][j] = _mm_set1_ps( tw->size[1][j] );
+	}
+}
+
+
+// DotProduct( v, normal ) for 4 sides, added up in the same order
+static ID_INLINE __m128 CM_DotProduct4( const __m128* v, const cbrushsides4_t* s )
+{
+	const __m128 x = _mm_mul_ps( v[0], _mm_loadu_ps( s->normal[0] ) );
+	const __m128 y = _mm_mul_ps( v[1], _mm_loadu_ps( s->normal[1] ) );
+	const __m128 z = _mm_mul_ps( v[2], _mm_loadu_ps( s->normal[2] ) );
+	return _mm_add_ps( _mm_add_ps( x, y ), z );
+}
+
+
+// plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal ) for 4 sides
+static ID_INLINE __m128 CM_SideDist4( const traceWork4_t* tw4, const cbrushsides4_t* s )
+{
+	__m128 offset[3];
+	for ( int j = 0; j < 3; ++j ) {
+		const __m128 sign = _mm_loadu_ps( (const float*)s->signs[j] );
+		offset[j] = _mm_or_ps( _mm_and_ps( sign, tw4->size[1][j] ), _mm_andnot_ps( sign, tw4->size[0][j] ) );
+	}
+
+	return _mm_sub_ps( _mm_loadu_ps( s->dist ), CM_DotProduct4( offset, s ) );
+}
+
+
+// a mask of the lanes of sides4[i / 4] that hold sides first to count - 1
+static ID_INLINE int CM_LaneMask4( int i, int first, int count )
+{
+	int mask = 15;
+	if ( i < first )
+		mask &= 15 << (first - i);
+	if ( i + 4 > count )
+		mask &= 15 >> (i + 4 - count);
+	return mask;
+}
+
+#endif
+
+
 /*
 ===============================================================================
 
@@ -210,7 +385,20 @@ void CM_TestBoxInBrush( traceWork_t *tw, cbrush_t *brush ) {
 				return;
 			}
 		}
-	} else {
+	}
+#if defined(CM_SSE)
+	else if ( brush->sides4 ) {
+		// the same test as below, 4 sides at a time
+		for ( i = 4 ; i < brush->numsides ; i += 4 ) {
+			const cbrushsides4_t* s = &brush->sides4[i / 4];
+			const __m128 d1 = _mm_sub_ps( CM_DotProduct4( tw->tw4.start, s ), CM_SideDist4( &tw->tw4, s ) );
+			if ( _mm_movemask_ps( _mm_cmpgt_ps( d1, _mm_setzero_ps() ) ) & CM_LaneMask4( i, 6, brush->numsides ) ) {
+				return;
+			}
+		}
+	}
+#endif
+	else {
 		// the first six planes are the axial planes, so we only
 		// need to test the remainder
 		for ( i = 6 ; i < brush->numsides ; i++ ) {
@@ -246,11 +434,10 @@ static void CM_TestInLeaf( traceWork_t* tw, const cLeaf_t* leaf )
 	// test box position against all brushes in the leaf
 	for (k=0 ; k<leaf->numLeafBrushes ; k++) {
 		brushnum = cm.leafbrushes[leaf->firstLeafBrush+k];
-		b = &cm.brushes[brushnum];
-		if (b->checkcount == cm.checkcount) {
+		if ( !CM_FirstVisit( tw->work->brushStamps, brushnum, tw->work->generation ) ) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = cm.checkcount;
+		b = &cm.brushes[brushnum];
 
 		if ( !(b->contents & tw->contents)) {
 			continue;
@@ -269,14 +456,14 @@ static void CM_TestInLeaf( traceWork_t* tw, const cLeaf_t* leaf )
 	if ( !cm_noCurves->integer ) {
 #endif //BSPC
 		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
-			patch = cm.surfaces[ cm.leafsurfaces[ leaf->firstLeafSurface + k ] ];
+			const int surfaceNum = cm.leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = cm.surfaces[ surfaceNum ];
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == cm.checkcount ) {
-				continue;	// already checked this brush in another leaf
+			if ( !CM_FirstVisit( tw->work->patchStamps, surfaceNum, tw->work->generation ) ) {
+				continue;	// already checked this patch in another leaf
 			}
-			patch->checkcount = cm.checkcount;
 
 			if ( !(patch->contents & tw->contents)) {
 				continue;
@@ -424,14 +611,10 @@ void CM_PositionTest( traceWork_t *tw ) {
 	ll.storeLeafs = CM_StoreLeafs;
 	ll.lastLeaf = 0;
 	ll.overflowed = qfalse;
-
-	cm.checkcount++;
+	ll.work = tw->work;
 
 	CM_BoxLeafnums_r( &ll, 0 );
 
-
-	cm.checkcount++;
-
 	// test the contents of the leafs
 	for (i=0 ; i < ll.count ; i++) {
 		CM_TestInLeaf( tw, &cm.leafs[leafs[i]] );
@@ -459,7 +642,7 @@ CM_TraceThroughPatch
 void CM_TraceThroughPatch( traceWork_t *tw, cPatch_t *patch ) {
 	float		oldFrac;
 
-	c_patch_traces++;
+	tw->work->patchTraces++;
 
 	oldFrac = tw->trace.fraction;
 
@@ -497,7 +680,7 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush ) {
 		return;
 	}
 
-	c_brush_traces++;
+	tw->work->brushTraces++;
 
 	getout = qfalse;
 	startout = qfalse;
@@ -571,7 +754,79 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush ) {
 				}
 			}
 		}
-	} else {
+	}
+#if defined(CM_SSE)
+	else if ( brush->sides4 ) {
+		// the same as below, but with the distances of 4 sides at a time
+		// so that most brushes the trace is in front of are out after a group or two
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 epsilon = _mm_set1_ps( SURFACE_CLIP_EPSILON );
+		for (i = 0; i < brush->numsides; i += 4) {
+			const cbrushsides4_t* s = &brush->sides4[i / 4];
+			const __m128 dist = CM_SideDist4( &tw->tw4, s );
+			const __m128 d14 = _mm_sub_ps( CM_DotProduct4( tw->tw4.start, s ), dist );
+			const __m128 d24 = _mm_sub_ps( CM_DotProduct4( tw->tw4.end, s ), dist );
+			const int laneMask = CM_LaneMask4( i, 0, brush->numsides );
+
+			// if completely in front of any face, no intersection with the entire brush
+			const __m128 front = _mm_and_ps( _mm_cmpgt_ps( d14, zero ),
+				_mm_or_ps( _mm_cmpge_ps( d24, epsilon ), _mm_cmpge_ps( d24, d14 ) ) );
+			if ( _mm_movemask_ps( front ) & laneMask ) {
+				return;
+			}
+
+			const int out1 = _mm_movemask_ps( _mm_cmpgt_ps( d14, zero ) ) & laneMask;
+			const int out2 = _mm_movemask_ps( _mm_cmpgt_ps( d24, zero ) ) & laneMask;
+			if (out2) {
+				getout = qtrue;	// endpoint is not in solid
+			}
+			if (out1) {
+				startout = qtrue;
+			}
+
+			// only the sides the trace crosses are relevent
+			const int crosses = out1 | out2;
+			if (!crosses) {
+				continue;
+			}
+
+			float d1s[4], d2s[4];
+			_mm_storeu_ps( d1s, d14 );
+			_mm_storeu_ps( d2s, d24 );
+			for (int lane = 0; lane < 4; lane++) {
+				if ( !(crosses & (1 << lane)) ) {
+					continue;
+				}
+
+				d1 = d1s[lane];
+				d2 = d2s[lane];
+
+				// crosses face
+				if (d1 > d2) {	// enter
+					f = (d1-SURFACE_CLIP_EPSILON) / (d1-d2);
+					if ( f < 0 ) {
+						f = 0;
+					}
+					if (f > enterFrac) {
+						enterFrac = f;
+						side = brush->sides + i + lane;
+						clipplane = side->plane;
+						leadside = side;
+					}
+				} else {	// leave
+					f = (d1+SURFACE_CLIP_EPSILON) / (d1-d2);
+					if ( f > 1 ) {
+						f = 1;
+					}
+					if (f < leaveFrac) {
+						leaveFrac = f;
+					}
+				}
+			}
+		}
+	}
+#endif
+	else {
 		//
 		// compare the trace against all planes of the brush
 		// find the latest time the trace crosses a plane towards the interior
@@ -666,11 +921,10 @@ static void CM_TraceThroughLeaf( traceWork_t* tw, const cLeaf_t* leaf )
 	for ( k = 0 ; k < leaf->numLeafBrushes ; k++ ) {
 		brushnum = cm.leafbrushes[leaf->firstLeafBrush+k];
 
-		b = &cm.brushes[brushnum];
-		if ( b->checkcount == cm.checkcount ) {
+		if ( !CM_FirstVisit( tw->work->brushStamps, brushnum, tw->work->generation ) ) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = cm.checkcount;
+		b = &cm.brushes[brushnum];
 
 		if ( !(b->contents & tw->contents) ) {
 			continue;
@@ -692,14 +946,14 @@ static void CM_TraceThroughLeaf( traceWork_t* tw, const cLeaf_t* leaf )
 	if ( !cm_noCurves->integer ) {
 #endif
 		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
-			patch = cm.surfaces[ cm.leafsurfaces[ leaf->firstLeafSurface + k ] ];
+			const int surfaceNum = cm.leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = cm.surfaces[ surfaceNum ];
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == cm.checkcount ) {
+			if ( !CM_FirstVisit( tw->work->patchStamps, surfaceNum, tw->work->generation ) ) {
 				continue;	// already checked this patch in another leaf
 			}
-			patch->checkcount = cm.checkcount;
 
 			if ( !(patch->contents & tw->contents) ) {
 				continue;
@@ -1007,6 +1261,9 @@ void CM_TraceBoundingBoxThroughCapsule( traceWork_t *tw, clipHandle_t model ) {
 
 //=========================================================================================
 
+// only set by cmtracebench, to compare against the old fixed offset for slanted planes
+static qbool cm_fixedNodeOffset = qfalse;
+
 /*
 ==================
 CM_TraceThroughTree
@@ -1020,7 +1277,7 @@ a smaller intercept fraction.
 void CM_TraceThroughTree( traceWork_t *tw, int num, float p1f, float p2f, vec3_t p1, vec3_t p2) {
 	cNode_t		*node;
 	cplane_t	*plane;
-	float		t1, t2, offset;
+	float		t1, t2, offset[2];
 	float		frac, frac2;
 	float		idist;
 	vec3_t		mid;
@@ -1033,10 +1290,13 @@ void CM_TraceThroughTree( traceWork_t *tw, int num, float p1f, float p2f, vec3_t
 
 	// if < 0, we are in a leaf node
 	if (num < 0) {
+		tw->work->treeLeafs++;
 		CM_TraceThroughLeaf( tw, &cm.leafs[-1-num] );
 		return;
 	}
 
+	tw->work->treeNodes++;
+
 	//
 	// find the point distances to the seperating plane
 	// and the offset for the size of the box
@@ -1045,38 +1305,35 @@ void CM_TraceThroughTree( traceWork_t *tw, int num, float p1f, float p2f, vec3_t
 	plane = node->plane;
 
 	// adjust the plane distance apropriately for mins/maxs
+	// offset[0] is how far behind the plane the front child can be hit, offset[1] the reverse
 	if ( plane->type < 3 ) {
 		t1 = p1[plane->type] - plane->dist;
 		t2 = p2[plane->type] - plane->dist;
-		offset = tw->extents[plane->type];
+		offset[0] = offset[1] = tw->extents[plane->type];
 	} else {
 		t1 = DotProduct (plane->normal, p1) - plane->dist;
 		t2 = DotProduct (plane->normal, p2) - plane->dist;
 		if ( tw->isPoint ) {
-			offset = 0;
+			offset[0] = offset[1] = 0;
+		} else if ( cm_fixedNodeOffset ) {
+			offset[0] = offset[1] = 2048;
 		} else {
-#if 0 // bk010201 - DEAD
 			// an axial brush right behind a slanted bsp plane
-			// will poke through when expanded, so adjust
-			// by sqrt(3)
-			offset = fabs(tw->extents[0]*plane->normal[0]) +
+			// will poke through when expanded, which the node's reach covers
+			const float extent = fabs(tw->extents[0]*plane->normal[0]) +
 				fabs(tw->extents[1]*plane->normal[1]) +
 				fabs(tw->extents[2]*plane->normal[2]);
-
-			offset *= 2;
-			offset = tw->maxOffset;
-#endif
-			// this is silly
-			offset = 2048;
+			offset[0] = extent + node->reach[0];
+			offset[1] = extent + node->reach[1];
 		}
 	}
 
 	// see which sides we need to consider
-	if ( t1 >= offset + 1 && t2 >= offset + 1 ) {
+	if ( t1 >= offset[1] + 1 && t2 >= offset[1] + 1 ) {
 		CM_TraceThroughTree( tw, node->children[0], p1f, p2f, p1, p2 );
 		return;
 	}
-	if ( t1 < -offset - 1 && t2 < -offset - 1 ) {
+	if ( t1 < -offset[0] - 1 && t2 < -offset[0] - 1 ) {
 		CM_TraceThroughTree( tw, node->children[1], p1f, p2f, p1, p2 );
 		return;
 	}
@@ -1085,13 +1342,13 @@ void CM_TraceThroughTree( traceWork_t *tw, int num, float p1f, float p2f, vec3_t
 	if ( t1 < t2 ) {
 		idist = 1.0/(t1-t2);
 		side = 1;
-		frac2 = (t1 + offset + SURFACE_CLIP_EPSILON)*idist;
-		frac = (t1 - offset + SURFACE_CLIP_EPSILON)*idist;
+		frac2 = (t1 + offset[0] + SURFACE_CLIP_EPSILON)*idist;
+		frac = (t1 - offset[1] + SURFACE_CLIP_EPSILON)*idist;
 	} else if (t1 > t2) {
 		idist = 1.0/(t1-t2);
 		side = 0;
-		frac2 = (t1 - offset - SURFACE_CLIP_EPSILON)*idist;
-		frac = (t1 + offset + SURFACE_CLIP_EPSILON)*idist;
+		frac2 = (t1 - offset[1] - SURFACE_CLIP_EPSILON)*idist;
+		frac = (t1 + offset[0] + SURFACE_CLIP_EPSILON)*idist;
 	} else {
 		side = 0;
 		frac = 1;
@@ -1149,10 +1406,6 @@ void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, const vec
 
 	const cmodel_t* cmod = CM_ClipHandleToModel( model );
 
-	cm.checkcount++;		// for multi-check avoidance
-
-	c_traces++;				// for statistics, may be zeroed
-
 	// fill in a default trace
 	Com_Memset( &tw, 0, sizeof(tw) );
 	tw.trace.fraction = 1;	// assume it goes the entire distance until shown otherwise
@@ -1163,6 +1416,9 @@ void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, const vec
 		return;	// map not loaded, shouldn't happen
 	}
 
+	tw.work = CM_BeginWork();	// for multi-check avoidance
+	tw.work->traces++;
+
 	// allow NULL to be passed in for 0,0,0
 	if ( !mins ) {
 		mins = vec3_origin;
@@ -1231,6 +1487,10 @@ void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, const vec
 	tw.offsets[7][1] = tw.size[1][1];
 	tw.offsets[7][2] = tw.size[1][2];
 
+#if defined(CM_SSE)
+	CM_SetTraceWork4( &tw );
+#endif
+
 	//
 	// calculate bounds
 	//
@@ -1350,8 +1610,156 @@ void CM_Trace( trace_t *results, const vec3_t start, const vec3_t end, const vec
                tw.trace.fraction == 1.0 ||
                VectorLengthSquared(tw.trace.plane.normal) > 0.9999);
 	*results = tw.trace;
+
+	CM_EndWork( tw.work );
 }
 
+/*
+===============================================================================
+
+TRACE RECORDING
+
+"cmtracerecord <file> [traces]" saves the traces made against the world and
+the inline models until "cmtracerecord stop" or the map changes,
+"cmtracebench" replays them
+
+===============================================================================
+*/
+
+typedef struct {
+	vec3_t			start, end;
+	vec3_t			mins, maxs;
+	vec3_t			origin, angles;	// only for CM_TransformedBoxTrace
+	clipHandle_t	model;
+	int				brushmask;
+	int				capsule;
+	qbool			transformed;
+} cmTraceRecord_t;
+
+#define CM_RECORD_ID		"CMTR"
+#define CM_RECORD_VERSION	1
+
+typedef struct {
+	char			id[4];
+	int				version;
+	char			map[MAX_QPATH];
+	int				count;
+} cmTraceRecordHeader_t;
+
+// the header and the records are a single block so that they can be written out as is
+static cmTraceRecordHeader_t* cm_recordHeader;	// NULL unless recording
+static cmTraceRecord_t* cm_records;
+static int cm_maxRecords;
+static volatile int cm_numRecords;
+static char cm_recordPath[MAX_QPATH];
+
+
+// traces can be running on several threads, so each one just claims the next slot
+static void CM_RecordTrace( const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs,
+						clipHandle_t model, int brushmask, const vec3_t origin, const vec3_t angles, int capsule, qbool transformed )
+{
+	// the temp box models are set up right before the trace and can't be replayed
+	if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE ) {
+		return;
+	}
+
+	// once it's full, the count stops just past the end instead of going on
+	// for as long as the recording is left running and wrapping around
+	if ( cm_numRecords >= cm_maxRecords ) {
+		return;
+	}
+
+	const int index = Sys_AtomicAdd( &cm_numRecords, 1 ) - 1;
+	if ( index < 0 || index >= cm_maxRecords ) {
+		return;
+	}
+
+	cmTraceRecord_t* r = &cm_records[index];
+	VectorCopy( start, r->start );
+	VectorCopy( end, r->end );
+	VectorCopy( mins ? mins : vec3_origin, r->mins );
+	VectorCopy( maxs ? maxs : vec3_origin, r->maxs );
+	VectorCopy( origin, r->origin );
+	VectorCopy( angles, r->angles );
+	r->model = model;
+	r->brushmask = brushmask;
+	r->capsule = capsule;
+	r->transformed = transformed;
+}
+
+
+void CM_FinishTraceRecord()
+{
+	if ( !cm_recordHeader ) {
+		return;
+	}
+
+	const int count = min( (int)cm_numRecords, cm_maxRecords );
+	cm_recordHeader->count = count;
+	FS_WriteFile( cm_recordPath, cm_recordHeader, sizeof(cmTraceRecordHeader_t) + count * sizeof(cmTraceRecord_t) );
+	Com_Printf( "cmtracerecord: wrote %i traces to %s", count, cm_recordPath );
+	if ( count == cm_maxRecords ) {
+		Com_Printf( ", the buffer is full so any traces after them weren't recorded" );
+	}
+	Com_Printf( "\n" );
+
+	free( cm_recordHeader );
+	cm_recordHeader = NULL;
+	cm_records = NULL;
+	cm_maxRecords = 0;
+	cm_numRecords = 0;
+}
+
+
+void CM_TraceRecord_f()
+{
+	if ( Cmd_Argc() < 2 ) {
+		Com_Printf( "usage: cmtracerecord <file> [traces] | stop\n" );
+		return;
+	}
+
+	if ( !Q_stricmp( Cmd_Argv(1), "stop" ) ) {
+		if ( !cm_recordHeader ) {
+			Com_Printf( "cmtracerecord: not recording\n" );
+		}
+		CM_FinishTraceRecord();
+		return;
+	}
+
+	if ( cm_recordHeader ) {
+		Com_Printf( "cmtracerecord: already recording to %s\n", cm_recordPath );
+		return;
+	}
+
+	if ( !cm.numNodes || !cm.name[0] ) {
+		Com_Printf( "cmtracerecord: no server map loaded\n" );
+		return;
+	}
+
+	const int traces = (Cmd_Argc() > 2) ? atoi( Cmd_Argv(2) ) : 100000;
+	if ( traces <= 0 ) {
+		Com_Printf( "cmtracerecord: invalid trace count\n" );
+		return;
+	}
+
+	cm_recordHeader = (cmTraceRecordHeader_t*)calloc( 1, sizeof(cmTraceRecordHeader_t) + traces * sizeof(cmTraceRecord_t) );
+	if ( !cm_recordHeader ) {
+		Com_Printf( "cmtracerecord: couldn't allocate %i traces\n", traces );
+		return;
+	}
+
+	Com_Memcpy( cm_recordHeader->id, CM_RECORD_ID, sizeof(cm_recordHeader->id) );
+	cm_recordHeader->version = CM_RECORD_VERSION;
+	Q_strncpyz( cm_recordHeader->map, cm.name, sizeof(cm_recordHeader->map) );
+	Q_strncpyz( cm_recordPath, Cmd_Argv(1), sizeof(cm_recordPath) );
+	cm_numRecords = 0;
+	cm_maxRecords = traces;
+	cm_records = (cmTraceRecord_t*)(cm_recordHeader + 1);
+
+	Com_Printf( "cmtracerecord: recording up to %i traces on %s\n", traces, cm.name );
+}
+
+
 /*
 ==================
 CM_BoxTrace
@@ -1360,6 +1768,9 @@ CM_BoxTrace
 void CM_BoxTrace( trace_t *results, const vec3_t start, const vec3_t end,
 						  const vec3_t mins, const vec3_t maxs,
 						  clipHandle_t model, int brushmask, int capsule ) {
+	if ( cm_records ) {
+		CM_RecordTrace( start, end, mins, maxs, model, brushmask, vec3_origin, vec3_origin, capsule, qfalse );
+	}
 	CM_Trace( results, start, end, mins, maxs, model, vec3_origin, brushmask, capsule, NULL );
 }
 
@@ -1387,6 +1798,10 @@ void CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t
 	float		t;
 	sphere_t	sphere;
 
+	if ( cm_records ) {
+		CM_RecordTrace( start, end, mins, maxs, model, brushmask, origin, angles, capsule, qtrue );
+	}
+
 	if ( !mins ) {
 		mins = vec3_origin;
 	}
@@ -1462,3 +1877,332 @@ void CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t
 
 	*results = trace;
 }
+
+
+/*
+===============================================================================
+
+developer test
+
+"cmtracetest [traces] [threads] [seed]" runs random traces and point contents
+queries against the world and the inline models of the loaded map on that
+many job threads, and complains about any result that doesn't match running
+the same queries one after the other on the main thread
+
+the temp box models are left out since CM_TempBoxModel isn't re-entrant
+
+===============================================================================
+*/
+
+typedef struct {
+	vec3_t			start, end;
+	vec3_t			mins, maxs;
+	vec3_t			origin, angles;
+	clipHandle_t	model;
+	int				brushmask;
+	int				capsule;
+	trace_t			trace[2];		// serial, parallel
+	int				contents[2];
+} cmTraceTest_t;
+
+typedef struct {
+	cmTraceTest_t*	tests;
+	int				count;
+	int				pass;
+} cmTraceTestBatch_t;
+
+enum { CM_TEST_BATCH = 4096, CM_TEST_JOBS = 64 };
+
+static unsigned cmTestSeed;
+
+static unsigned CM_TestRand()
+{
+	cmTestSeed = cmTestSeed * 1664525 + 1013904223;
+	return (cmTestSeed >> 8);
+}
+
+static float CM_TestRandom( float min, float max )
+{
+	return min + (max - min) * (float)(CM_TestRand() & 0xFFFF) / 65535.0f;
+}
+
+
+static void CM_TraceTestCreate( cmTraceTest_t* t, int numModels )
+{
+	static const int brushmasks[] = {
+		CONTENTS_SOLID,
+		CONTENTS_SOLID | CONTENTS_PLAYERCLIP | CONTENTS_BODY,
+		CONTENTS_SOLID | CONTENTS_BODY | CONTENTS_CORPSE,
+		CONTENTS_WATER | CONTENTS_SLIME | CONTENTS_LAVA,
+		-1
+	};
+	vec3_t mins, maxs;
+	int i;
+
+	Com_Memset( t, 0, sizeof(*t) );
+	t->model = CM_TestRand() % numModels;
+	t->brushmask = brushmasks[CM_TestRand() % (sizeof(brushmasks) / sizeof(brushmasks[0]))];
+	t->capsule = ((CM_TestRand() % 4) == 0);
+
+	// inline models get moved and turned around their own bounds
+	CM_ModelBounds( t->model, mins, maxs );
+	if ( t->model ) {
+		for ( i = 0; i < 3; ++i ) {
+			mins[i] -= 64;
+			maxs[i] += 64;
+			t->origin[i] = CM_TestRandom( -32, 32 );
+		}
+		if ( CM_TestRand() & 1 ) {
+			for ( i = 0; i < 3; ++i ) {
+				t->angles[i] = CM_TestRandom( 0, 360 );
+			}
+		}
+	}
+
+	for ( i = 0; i < 3; ++i ) {
+		t->start[i] = CM_TestRandom( mins[i], maxs[i] );
+	}
+
+	// position tests, short moves and long lines of sight
+	switch ( CM_TestRand() % 4 ) {
+		case 0:
+			VectorCopy( t->start, t->end );
+			break;
+		case 1:
+			for ( i = 0; i < 3; ++i ) {
+				t->end[i] = t->start[i] + CM_TestRandom( -32, 32 );
+			}
+			break;
+		default:
+			for ( i = 0; i < 3; ++i ) {
+				t->end[i] = CM_TestRandom( mins[i], maxs[i] );
+			}
+			break;
+	}
+
+	// points, player boxes and lopsided boxes
+	switch ( CM_TestRand() % 3 ) {
+		case 0:
+			break;
+		case 1:
+			VectorSet( t->mins, -15, -15, -24 );
+			VectorSet( t->maxs, 15, 15, 32 );
+			break;
+		default:
+			for ( i = 0; i < 3; ++i ) {
+				t->mins[i] = -CM_TestRandom( 0, 48 );
+				t->maxs[i] = CM_TestRandom( 0, 48 );
+			}
+			break;
+	}
+}
+
+
+static void CM_TraceTestRun( cmTraceTest_t* t, int pass )
+{
+	if ( t->model ) {
+		CM_TransformedBoxTrace( &t->trace[pass], t->start, t->end, t->mins, t->maxs,
+				t->model, t->brushmask, t->origin, t->angles, t->capsule );
+		t->contents[pass] = CM_TransformedPointContents( t->end, t->model, t->origin, t->angles );
+	} else {
+		CM_BoxTrace( &t->trace[pass], t->start, t->end, t->mins, t->maxs, 0, t->brushmask, t->capsule );
+		t->contents[pass] = CM_PointContents( t->end, 0 );
+	}
+}
+
+
+static void CM_TraceTestJob( void* data, int index )
+{
+	const cmTraceTestBatch_t* batch = (const cmTraceTestBatch_t*)data;
+	const int first = batch->count * index / CM_TEST_JOBS;
+	const int last = batch->count * (index + 1) / CM_TEST_JOBS;
+
+	for ( int i = first; i < last; ++i ) {
+		CM_TraceTestRun( &batch->tests[i], batch->pass );
+	}
+}
+
+
+void CM_TraceTest_f()
+{
+	if ( !cm.numNodes ) {
+		Com_Printf( "cmtracetest: no map loaded\n" );
+		return;
+	}
+
+	const int traces = (Cmd_Argc() > 1) ? atoi( Cmd_Argv(1) ) : 1000000;
+	const int threads = (Cmd_Argc() > 2) ? atoi( Cmd_Argv(2) ) : Sys_ProcessorCount();
+	cmTestSeed = (Cmd_Argc() > 3) ? atoi( Cmd_Argv(3) ) : Sys_Milliseconds();
+	Com_Printf( "cmtracetest: %i traces on %i threads, seed %u\n", traces, threads, cmTestSeed );
+
+	// the server puts its own thread count back on its next frame
+	Sys_SetJobThreads( threads );
+
+	cmTraceTestBatch_t batch;
+	batch.tests = (cmTraceTest_t*)Z_Malloc( CM_TEST_BATCH * sizeof(cmTraceTest_t) );
+	const int numModels = CM_NumInlineModels();
+	int done = 0, errors = 0, serialTime = 0, parallelTime = 0;
+
+	while ( done < traces && errors < 10 ) {
+		batch.count = min( traces - done, (int)CM_TEST_BATCH );
+		for ( int i = 0; i < batch.count; ++i ) {
+			CM_TraceTestCreate( &batch.tests[i], numModels );
+		}
+
+		int start = Sys_Milliseconds();
+		for ( int i = 0; i < batch.count; ++i ) {
+			CM_TraceTestRun( &batch.tests[i], 0 );
+		}
+		serialTime += Sys_Milliseconds() - start;
+
+		start = Sys_Milliseconds();
+		batch.pass = 1;
+		Sys_RunJobs( CM_TraceTestJob, &batch, CM_TEST_JOBS );
+		parallelTime += Sys_Milliseconds() - start;
+		batch.pass = 0;
+
+		for ( int i = 0; i < batch.count && errors < 10; ++i ) {
+			const cmTraceTest_t* t = &batch.tests[i];
+			if ( memcmp( &t->trace[0], &t->trace[1], sizeof(trace_t) ) || ( t->contents[0] != t->contents[1] ) ) {
+				Com_Printf( "^1trace %i against model %i differs: fraction %g vs %g, contents %X vs %X\n",
+						done + i, t->model, t->trace[0].fraction, t->trace[1].fraction, t->contents[0], t->contents[1] );
+				++errors;
+			}
+		}
+
+		done += batch.count;
+	}
+
+	Z_Free( batch.tests );
+	Sys_SetJobThreads( 0 );
+
+	Com_Printf( "cmtracetest: %i traces, %i errors, %i ms serial, %i ms on %i threads\n",
+			done, errors, serialTime, parallelTime, threads );
+}
+
+
+/*
+===============================================================================
+
+"cmtracebench <file> [passes]" replays the traces saved by "cmtracerecord"
+on the same map, once with the fixed 2048 offset for slanted node planes
+and once with the node reach, and reports the tree work and time per trace
+
+===============================================================================
+*/
+
+static void CM_TreeStats( int* nodes, int* leafs, int* brushTraces )
+{
+	*nodes = *leafs = *brushTraces = 0;
+
+	for ( int i = 0; i < MAX_CM_WORKS; ++i ) {
+		*nodes += cm_works[i].treeNodes;
+		*leafs += cm_works[i].treeLeafs;
+		*brushTraces += cm_works[i].brushTraces;
+	}
+}
+
+
+static void CM_TraceBenchRun( const cmTraceRecord_t* records, int count, int passes, trace_t* results, const char* name )
+{
+	int nodes[2], leafs[2], brushTraces[2];
+
+	CM_TreeStats( &nodes[0], &leafs[0], &brushTraces[0] );
+	const int64_t start = Sys_Microseconds();
+	for ( int p = 0; p < passes; ++p ) {
+		for ( int i = 0; i < count; ++i ) {
+			const cmTraceRecord_t* r = &records[i];
+			if ( r->transformed ) {
+				CM_TransformedBoxTrace( &results[i], r->start, r->end, r->mins, r->maxs,
+						r->model, r->brushmask, r->origin, r->angles, r->capsule );
+			} else {
+				CM_BoxTrace( &results[i], r->start, r->end, r->mins, r->maxs, r->model, r->brushmask, r->capsule );
+			}
+		}
+	}
+	const int64_t time = Sys_Microseconds() - start;
+	CM_TreeStats( &nodes[1], &leafs[1], &brushTraces[1] );
+
+	const double traces = (double)count * passes;
+	Com_Printf( "%s: %.3f us, %.1f nodes, %.1f leafs, %.1f brushes per trace\n", name,
+			(double)time / traces, (nodes[1] - nodes[0]) / traces,
+			(leafs[1] - leafs[0]) / traces, (brushTraces[1] - brushTraces[0]) / traces );
+}
+
+
+void CM_TraceBench_f()
+{
+	if ( Cmd_Argc() < 2 ) {
+		Com_Printf( "usage: cmtracebench <file> [passes]\n" );
+		return;
+	}
+
+	if ( cm_recordHeader ) {
+		Com_Printf( "cmtracebench: stop recording first\n" );
+		return;
+	}
+
+	if ( !cm.numNodes ) {
+		Com_Printf( "cmtracebench: no map loaded\n" );
+		return;
+	}
+
+	void* buf;
+	const int length = FS_ReadFile( Cmd_Argv(1), &buf );
+	if ( length < 0 ) {
+		Com_Printf( "cmtracebench: couldn't read %s\n", Cmd_Argv(1) );
+		return;
+	}
+
+	const cmTraceRecordHeader_t* header = (const cmTraceRecordHeader_t*)buf;
+	const cmTraceRecord_t* records = (const cmTraceRecord_t*)(header + 1);
+	const int numModels = CM_NumInlineModels();
+	if ( length < (int)sizeof(*header) || memcmp( header->id, CM_RECORD_ID, sizeof(header->id) ) ||
+			header->version != CM_RECORD_VERSION || header->count < 0 ||
+			header->count > (length - (int)sizeof(*header)) / (int)sizeof(cmTraceRecord_t) ) {
+		Com_Printf( "cmtracebench: %s isn't a trace recording\n", Cmd_Argv(1) );
+		FS_FreeFile( buf );
+		return;
+	}
+
+	if ( Q_stricmp( header->map, cm.name ) ) {
+		Com_Printf( "cmtracebench: %s was recorded on %s, not %s\n", Cmd_Argv(1), header->map, cm.name );
+		FS_FreeFile( buf );
+		return;
+	}
+
+	const int count = header->count;
+	for ( int i = 0; i < count; ++i ) {
+		if ( records[i].model < 0 || records[i].model >= numModels ) {
+			Com_Printf( "cmtracebench: trace %i is against a model the map doesn't have\n", i );
+			FS_FreeFile( buf );
+			return;
+		}
+	}
+
+	const int passes = (Cmd_Argc() > 2) ? max( atoi( Cmd_Argv(2) ), 1 ) : 10;
+	Com_Printf( "cmtracebench: %i traces from %s, %i passes\n", count, Cmd_Argv(1), passes );
+
+	trace_t* results = (trace_t*)Z_Malloc( 2 * max( count, 1 ) * sizeof(trace_t) );
+
+	cm_fixedNodeOffset = qtrue;
+	CM_TraceBenchRun( records, count, passes, results, "fixed offset" );
+	cm_fixedNodeOffset = qfalse;
+	CM_TraceBenchRun( records, count, passes, results + count, "node reach" );
+
+	int errors = 0;
+	for ( int i = 0; i < count; ++i ) {
+		if ( memcmp( &results[i], &results[count + i], sizeof(trace_t) ) ) {
+			if ( errors < 10 ) {
+				Com_Printf( "^1trace %i differs: fraction %g vs %g, entity %i vs %i\n",
+						i, results[i].fraction, results[count + i].fraction,
+						results[i].entityNum, results[count + i].entityNum );
+			}
+			++errors;
+		}
+	}
+	Com_Printf( "cmtracebench: %i traces differ\n", errors );
+
+	Z_Free( results );
+	FS_FreeFile( buf );
+}
@@ -236,6 +236,10 @@ void QDECL Com_Error( int code, const char *fmt, ... )
 	// make sure we can get at our local stuff
 	FS_PureServerSetLoadedPaks( "", "" );
 
+	// a collision query this jumps out of would never give its work back
+	// errors are only raised on the main thread, so no others are running
+	CM_ReleaseWorks();
+
 	// if we are getting a solid stream of ERR_DROP, do an ERR_FATAL
 	int currentTime = Sys_Milliseconds();
 	if ( currentTime - lastErrorTime < 100 ) {
@@ -632,7 +636,11 @@ int Com_RealTime( qtime_t* qtime )
 There is never any space between memblocks, and there will never be two
 contiguous free memblocks.
 
-The rover can be left pointing at a non-empty block
+Free blocks are also kept in segregated lists by size: below ZONE_SMALL_BLOCK
+each 16-byte size class has its own list, so small allocations get back a
+block of exactly their size class, and above it every power of two is split
+into ZONE_SUB_BINS ranges. An allocation takes the best fit in its own list,
+or else the first block of the next non-empty one, which is always big enough
 
 The zone calls are pretty much only used for small strings and structures,
 all big things are allocated on the hunk.
@@ -642,6 +650,13 @@ all big things are allocated on the hunk.
 #define	ZONEID	0x1d4a11
 #define MINFRAGMENT	64
 
+#define ZONE_SMALL_LOG2		10
+#define ZONE_SMALL_BLOCK	(1 << ZONE_SMALL_LOG2)
+#define ZONE_SMALL_BINS		(ZONE_SMALL_BLOCK / 16)
+#define ZONE_SUB_LOG2		4
+#define ZONE_SUB_BINS		(1 << ZONE_SUB_LOG2)
+#define ZONE_BINS			(ZONE_SMALL_BINS + (31 - ZONE_SMALL_LOG2) * ZONE_SUB_BINS)
+
 typedef struct zonedebug_s {
 	char *label;
 	char *file;
@@ -659,11 +674,18 @@ typedef struct memblock_s {
 #endif
 } memblock_t;
 
+// free blocks keep their size list links where the data would be
+typedef struct memfree_s {
+	memblock_t	b;
+	struct memfree_s	*next, *prev;
+} memfree_t;
+
 typedef struct {
 	int		size;			// total bytes malloced, including header
 	int		used;			// total bytes used
 	memblock_t	blocklist;	// start / end cap for linked list
-	memblock_t	*rover;
+	memfree_t	*bins[ZONE_BINS];
+	unsigned	binMask[(ZONE_BINS + 31) / 32];		// which bins aren't empty
 } memzone_t;
 
 // main zone for all "dynamic" memory allocation
@@ -673,18 +695,93 @@ static memzone_t* mainzone = NULL;
 static memzone_t* smallzone = NULL;
 
 
+static int Z_BinForSize( int size )
+{
+	if ( size < ZONE_SMALL_BLOCK )
+		return size >> 4;
+
+	int log2 = ZONE_SMALL_LOG2;
+	while ( (size >> (log2 + 1)) != 0 )
+		++log2;
+
+	return ZONE_SMALL_BINS + (log2 - ZONE_SMALL_LOG2) * ZONE_SUB_BINS + ((size >> (log2 - ZONE_SUB_LOG2)) & (ZONE_SUB_BINS - 1));
+}
+
+
+static void Z_LinkFree( memzone_t* zone, memblock_t* block )
+{
+	const int bin = Z_BinForSize( block->size );
+	memfree_t* f = (memfree_t*)block;
+
+	f->prev = NULL;
+	f->next = zone->bins[bin];
+	if ( f->next )
+		f->next->prev = f;
+	zone->bins[bin] = f;
+	zone->binMask[bin >> 5] |= 1u << (bin & 31);
+}
+
+
+static void Z_UnlinkFree( memzone_t* zone, memblock_t* block )
+{
+	const int bin = Z_BinForSize( block->size );
+	memfree_t* f = (memfree_t*)block;
+
+	if ( f->next )
+		f->next->prev = f->prev;
+	if ( f->prev )
+		f->prev->next = f->next;
+	else
+		zone->bins[bin] = f->next;
+
+	if ( !zone->bins[bin] )
+		zone->binMask[bin >> 5] &= ~(1u << (bin & 31));
+}
+
+
+static memblock_t* Z_FindFree( const memzone_t* zone, int size )
+{
+	int bin = Z_BinForSize( size );
+
+	// the best fit among the blocks in the same size range
+	const memfree_t* best = NULL;
+	for (const memfree_t* f = zone->bins[bin]; f; f = f->next) {
+		if ( f->b.size >= size && (!best || f->b.size < best->b.size) ) {
+			best = f;
+			if ( f->b.size == size )
+				break;
+		}
+	}
+	if ( best )
+		return (memblock_t*)&best->b;
+
+	// failing that, everything in a bigger range fits
+	for (++bin; bin < ZONE_BINS; bin = (bin & ~31) + 32) {
+		const unsigned bits = zone->binMask[bin >> 5] & (~0u << (bin & 31));
+		if ( bits ) {
+			bin &= ~31;
+			while ( !(bits & (1u << (bin & 31))) )
+				++bin;
+			return &zone->bins[bin]->b;
+		}
+	}
+
+	return NULL;
+}
+
+
 static void Z_ClearZone( memzone_t* zone, int size )
 {
 	memblock_t* block;
 
 	// set the entire zone to one free block
 
+	Com_Memset( zone, 0, sizeof(memzone_t) );
 	zone->blocklist.next = zone->blocklist.prev = block =
 		(memblock_t *)( (byte *)zone + sizeof(memzone_t) );
 	zone->blocklist.tag = 1;	// in use block
 	zone->blocklist.id = 0;
 	zone->blocklist.size = 0;
-	zone->rover = block;
 	zone->size = size;
 	zone->used = 0;
 
@@ -692,6 +789,7 @@ static void Z_ClearZone( memzone_t* zone, int size )
 	block->tag = 0;			// free block
 	block->id = ZONEID;
 	block->size = size - sizeof(memzone_t);
+	Z_LinkFree( zone, block );
 }
 
 
@@ -741,27 +839,23 @@ void Z_Free( void* ptr )
 	memblock_t* other = block->prev;
 	if (!other->tag) {
 		// merge with previous free block
+		Z_UnlinkFree( zone, other );
 		other->size += block->size;
 		other->next = block->next;
 		other->next->prev = other;
-		if (block == zone->rover) {
-			zone->rover = other;
-		}
 		block = other;
 	}
 
-	zone->rover = block;
-
 	other = block->next;
 	if ( !other->tag ) {
 		// merge the next free block onto the end
+		Z_UnlinkFree( zone, other );
 		block->size += other->size;
 		block->next = other->next;
 		block->next->prev = block;
-		if (other == zone->rover) {
-			zone->rover = block;
-		}
 	}
+
+	Z_LinkFree( zone, block );
 }
 
 
@@ -832,7 +926,7 @@ void *Z_TagMallocDebug( int size, int tag, char *label, char *file, int line ) {
 void *Z_TagMalloc( int size, int tag ) {
 #endif
 	int		extra, allocSize;
-	memblock_t	*start, *rover, *base;
+	memblock_t	*base;
 	memzone_t *zone;
 
 	if (!tag) {
@@ -847,39 +941,29 @@ void *Z_TagMalloc( int size, int tag ) {
 	}
 
 	allocSize = size;
-	//
-	// scan through the block list looking for the first free block
-	// of sufficient size
-	//
 	size += sizeof(memblock_t);	// account for size of block header
 	size += 4;					// space for memory trash tester
 	size = PAD(size, sizeof(intptr_t));		// align to 32/64 bit boundary
+	if (size < (int)sizeof(memfree_t)) {
+		size = PAD(sizeof(memfree_t), sizeof(intptr_t));	// room for the free links once it's freed
+	}
 
-	base = rover = zone->rover;
-	start = base->prev;
-
-	do {
-		if (rover == start) {
+	base = Z_FindFree( zone, size );
+	if (!base) {
 #ifdef ZONE_DEBUG
-			Z_LogHeap();
+		Z_LogHeap();
 #endif
-			// scaned all the way around the list
-			Com_Error( ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes from the %s zone",
-								size, zone == smallzone ? "small" : "main");
-			return NULL;
-		}
-		if (rover->tag) {
-			base = rover = rover->next;
-		} else {
-			rover = rover->next;
-		}
-	} while (base->tag || base->size < size);
+		Com_Error( ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes from the %s zone",
+							size, zone == smallzone ? "small" : "main");
+		return NULL;
+	}
+	Z_UnlinkFree( zone, base );
 
 	//
 	// found a block big enough
 	//
 	extra = base->size - size;
-	if (extra > MINFRAGMENT) {
+	if (extra > MINFRAGMENT && extra >= (int)sizeof(memfree_t)) {
 		// there will be a free fragment after the allocated block
 		memblock_t* p = (memblock_t *) ((byte *)base + size );
 		p->size = extra;
@@ -890,12 +974,12 @@ void *Z_TagMalloc( int size, int tag ) {
 		p->next->prev = p;
 		base->next = p;
 		base->size = size;
+		Z_LinkFree( zone, p );
 	}
 
 	base->tag = tag;			// no longer a free block
 
-	zone->rover = base->next;	// next allocation will start looking here
-	zone->used += base->size;	//
+	zone->used += base->size;
 	
 	base->id = ZONEID;
 
@@ -1060,6 +1144,10 @@ typedef struct {
 static	hunkUsed_t	hunk_low = {0}, hunk_high = {0};
 static	hunkUsed_t	*hunk_permanent = &hunk_low, *hunk_temp = &hunk_high;
 
+// bytes at the bottom of the low side that Hunk_Clear leaves alone
+// so that the server can reuse its clip map: see Hunk_BeginRetained
+static	int		hunk_retained = 0;
+
 static	byte	*s_hunkData = NULL;
 static	int		s_hunkTotal = 0;
 
@@ -1081,6 +1169,29 @@ static hunkblock_t* hunkblocks = NULL;
 #endif
 
 
+// with all the free space in one block a zone is 0% fragmented,
+// and the smaller the largest free block gets, the closer it is to 100%
+
+static void Z_PrintFragmentation( const memzone_t* zone, const char* name )
+{
+	int freeBytes = 0;
+	int freeBlocks = 0;
+	int largest = 0;
+
+	for (const memblock_t* block = zone->blocklist.next; block != &zone->blocklist; block = block->next) {
+		if ( !block->tag ) {
+			freeBytes += block->size;
+			freeBlocks++;
+			largest = max( largest, block->size );
+		}
+	}
+
+	Com_Printf( "%8i bytes free in %i %s zone blocks\n", freeBytes, freeBlocks, name );
+	Com_Printf( "   %8i bytes in the largest\n", largest );
+	Com_Printf( "   %8.1f%% fragmented\n", freeBytes ? 100.0f * (freeBytes - largest) / freeBytes : 0.0f );
+}
+
+
 static void Com_Meminfo_f( void )
 {
 	const memblock_t* block;
@@ -1134,6 +1245,9 @@ static void Com_Meminfo_f( void )
 	Com_Printf( "%8i bytes total hunk\n", s_hunkTotal );
 	Com_Printf( "%8i bytes total zone\n", s_zoneTotal );
 	Com_Printf( "\n" );
+	if ( hunk_retained ) {
+		Com_Printf( "%8i low retained\n", hunk_retained );
+	}
 	Com_Printf( "%8i low mark\n", hunk_low.mark );
 	Com_Printf( "%8i low permanent\n", hunk_low.permanent );
 	if ( hunk_low.temp != hunk_low.permanent ) {
@@ -1165,6 +1279,9 @@ static void Com_Meminfo_f( void )
 	Com_Printf( "   %8i bytes in dynamic renderer\n", rendererBytes );
 	Com_Printf( "   %8i bytes in dynamic other\n", zoneBytes - ( botlibBytes + rendererBytes ) );
 	Com_Printf( "   %8i bytes in small Zone memory\n", smallZoneBytes );
+	Com_Printf( "\n" );
+	Z_PrintFragmentation( mainzone, "main" );
+	Z_PrintFragmentation( smallzone, "small" );
 }
 
 
@@ -1395,7 +1512,45 @@ void Hunk_ClearToMark()
 
 qbool Hunk_CheckMark()
 {
-	return ( hunk_low.mark || hunk_high.mark );
+	return ( hunk_low.mark != hunk_retained || hunk_high.mark );
+}
+
+
+// the server calls this before loading a clip map it wants to keep
+// it drops what was retained before and returns qfalse if the new allocations
+// can't start at the bottom of the low side, in which case nothing is dropped
+
+qbool Hunk_BeginRetained()
+{
+	if ( hunk_permanent != &hunk_low || hunk_low.permanent != hunk_retained || hunk_low.temp != hunk_retained )
+		return qfalse;
+
+	hunk_low.mark = 0;
+	hunk_low.permanent = 0;
+	hunk_low.temp = 0;
+	hunk_retained = 0;
+
+	return qtrue;
+}
+
+
+// everything allocated on the low side since Hunk_BeginRetained will survive Hunk_Clear
+// for as long as a server is running, and the size of it is returned
+
+int Hunk_EndRetained()
+{
+	if ( hunk_permanent != &hunk_low || hunk_low.temp != hunk_low.permanent )
+		return 0;
+
+	hunk_retained = hunk_low.permanent;
+
+	return hunk_retained;
+}
+
+
+int Hunk_Retained()
+{
+	return hunk_retained;
 }
 
 
@@ -1418,10 +1573,14 @@ void Hunk_Clear()
 	CIN_CloseAllVideos();
 #endif
 
-	hunk_low.mark = 0;
-	hunk_low.permanent = 0;
-	hunk_low.temp = 0;
-	hunk_low.tempHighwater = 0;
+	// without a server, nobody is going to want the retained memory back
+	if ( !com_sv_running || !com_sv_running->integer )
+		hunk_retained = 0;
+
+	hunk_low.mark = hunk_retained;
+	hunk_low.permanent = hunk_retained;
+	hunk_low.temp = hunk_retained;
+	hunk_low.tempHighwater = hunk_retained;
 
 	hunk_high.mark = 0;
 	hunk_high.permanent = 0;
@@ -1632,12 +1791,162 @@ journaled file
 ===================================================================
 */
 
+// the queues are bounded MPSC rings where every slot has a sequence number:
+// a producer claims a slot by bumping head with a CAS once the slot's sequence
+// says the consumer is done with it, and publishes it by bumping the sequence
+// so a full queue drops the new event rather than an old one, or blocking
+
+typedef struct {
+	volatile int	sequence;	// == its index in the ring when free, +1 when filled
+	sysEvent_t		ev;
+} eventSlot_t;
+
+struct eventQueue_s {
+	const char*		name;
+	eventSlot_t*	slots;
+	byte*			payloads;	// payloadSize bytes for every slot
+	int				numSlots;	// power of 2
+	int				payloadSize;
+	volatile int	head;		// the next slot a producer will claim
+	int				tail;		// the next slot the consumer will read
+	volatile int	pushed;
+	volatile int	overflows;	// dropped because the queue was full
+	volatile int	oversized;	// dropped because ptr didn't fit in a payload slot
+	int				reported;	// overflows + oversized the last time we warned about them
+	int				highwater;
+	eventQueue_t*	next;
+};
+
+static eventQueue_t* eventQueues;
+
+eventQueue_t* com_sysEvents;
+
 // FIXME TTimo blunt upping from 256 to 1024
 // https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=5
 #define MAX_PUSHED_EVENTS	1024
-static sysEvent_t com_pushedEvents[MAX_PUSHED_EVENTS];
-static int com_pushedEventsHead;
-static int com_pushedEventsTail;
+static eventQueue_t* com_pushedEvents;
+
+
+eventQueue_t* EQ_Create( const char* name, int numSlots, int payloadSize )
+{
+	if ( numSlots & (numSlots - 1) )
+		Com_Error( ERR_FATAL, "EQ_Create: %s has %i slots", name, numSlots );
+
+	// this can run before the zone is up
+	eventQueue_t* q = (eventQueue_t*)calloc( 1, sizeof(eventQueue_t) );
+	q->slots = (eventSlot_t*)calloc( numSlots, sizeof(eventSlot_t) );
+	q->payloads = payloadSize ? (byte*)malloc( numSlots * payloadSize ) : NULL;
+	if ( !q->slots || ( payloadSize && !q->payloads ) )
+		Com_Error( ERR_FATAL, "EQ_Create: %s failed to allocate", name );
+
+	q->name = name;
+	q->numSlots = numSlots;
+	q->payloadSize = payloadSize;
+	for (int i = 0; i < numSlots; ++i)
+		q->slots[i].sequence = i;
+
+	q->next = eventQueues;
+	eventQueues = q;
+
+	return q;
+}
+
+
+qbool EQ_Push( eventQueue_t* q, const sysEvent_t* ev )
+{
+	if ( q->payloadSize && ev->evPtrLength > q->payloadSize ) {
+		Sys_AtomicAdd( &q->oversized, 1 );
+		return qfalse;
+	}
+
+	eventSlot_t* slot;
+	int pos = q->head;
+	for (;;) {
+		slot = &q->slots[pos & (q->numSlots - 1)];
+		const int diff = Sys_AtomicAdd( &slot->sequence, 0 ) - pos;
+		if ( diff == 0 ) {
+			if ( Sys_AtomicCompareExchange( &q->head, pos, pos + 1 ) )
+				break;
+		} else if ( diff < 0 ) {
+			// the consumer hasn't gotten to the event that was here one lap ago
+			Sys_AtomicAdd( &q->overflows, 1 );
+			return qfalse;
+		}
+		pos = q->head;
+	}
+
+	slot->ev = *ev;
+	if ( slot->ev.evTime == 0 )
+		slot->ev.evTime = Sys_Milliseconds();
+	if ( q->payloadSize ) {
+		if ( ev->evPtrLength )
+			Com_Memcpy( q->payloads + (pos & (q->numSlots - 1)) * q->payloadSize, ev->evPtr, ev->evPtrLength );
+		slot->ev.evPtr = NULL;
+	}
+
+	Sys_AtomicAdd( &q->pushed, 1 );
+	Sys_AtomicAdd( &slot->sequence, 1 );
+
+	return qtrue;
+}
+
+
+const sysEvent_t* EQ_Front( eventQueue_t* q )
+{
+	// producers can't print, so the consumer complains for them
+	const int dropped = q->overflows + q->oversized;
+	if ( dropped != q->reported ) {
+		Com_Printf( "WARNING: %i events dropped by the %s queue\n", dropped - q->reported, q->name );
+		q->reported = dropped;
+	}
+
+	eventSlot_t* slot = &q->slots[q->tail & (q->numSlots - 1)];
+	if ( Sys_AtomicAdd( &slot->sequence, 0 ) != q->tail + 1 )
+		return NULL;
+
+	q->highwater = max( q->highwater, q->head - q->tail );
+
+	if ( q->payloadSize )
+		slot->ev.evPtr = slot->ev.evPtrLength ? q->payloads + (q->tail & (q->numSlots - 1)) * q->payloadSize : NULL;
+
+	return &slot->ev;
+}
+
+
+void EQ_Pop( eventQueue_t* q )
+{
+	eventSlot_t* slot = &q->slots[q->tail & (q->numSlots - 1)];
+	// hand the slot back to the producers for the next lap
+	Sys_AtomicAdd( &slot->sequence, q->numSlots - 1 );
+	q->tail++;
+}
+
+
+qbool EQ_Get( eventQueue_t* q, sysEvent_t* ev )
+{
+	const sysEvent_t* front = EQ_Front( q );
+	if ( !front )
+		return qfalse;
+
+	*ev = *front;
+	if ( q->payloadSize && ev->evPtrLength ) {
+		ev->evPtr = Z_Malloc( ev->evPtrLength );
+		Com_Memcpy( ev->evPtr, front->evPtr, ev->evPtrLength );
+	}
+
+	EQ_Pop( q );
+	return qtrue;
+}
+
+
+static void EQ_Info_f()
+{
+	Com_Printf( "   slots payload  queued highwater    pushed overflows oversized name\n" );
+	for (const eventQueue_t* q = eventQueues; q; q = q->next) {
+		Com_Printf( "%8i %7i %7i %9i %9i %9i %9i %s\n", q->numSlots, q->payloadSize,
+				q->head - q->tail, q->highwater, q->pushed, q->overflows, q->oversized, q->name );
+	}
+}
 
 
 static void Com_InitJournaling()
@@ -1707,48 +2016,32 @@ static sysEvent_t Com_GetRealEvent()
 }
 
 
+// the pushed events already have their data in the zone,
+// so that queue keeps evPtr instead of copying what it points to
+
 static void Com_PushEvent( const sysEvent_t* event )
 {
-	static qbool printedWarning = qfalse;
-
-	sysEvent_t* ev = &com_pushedEvents[ com_pushedEventsHead & (MAX_PUSHED_EVENTS-1) ];
-
-	if ( com_pushedEventsHead - com_pushedEventsTail >= MAX_PUSHED_EVENTS ) {
-
-		// don't print the warning constantly, or it can give time for more...
-		if ( !printedWarning ) {
-			printedWarning = qtrue;
-			Com_Printf( "WARNING: Com_PushEvent overflow\n" );
-		}
-
-		if ( ev->evPtr ) {
-			Z_Free( ev->evPtr );
-		}
-		com_pushedEventsTail++;
-	} else {
-		printedWarning = qfalse;
+	if ( !EQ_Push( com_pushedEvents, event ) && event->evPtr ) {
+		Z_Free( event->evPtr );
 	}
-
-	*ev = *event;
-	com_pushedEventsHead++;
 }
 
 
 static sysEvent_t Com_GetEvent()
 {
-	if ( com_pushedEventsHead > com_pushedEventsTail ) {
-		com_pushedEventsTail++;
-		return com_pushedEvents[ (com_pushedEventsTail-1) & (MAX_PUSHED_EVENTS-1) ];
+	sysEvent_t ev;
+	if ( EQ_Get( com_pushedEvents, &ev ) ) {
+		return ev;
 	}
 	return Com_GetRealEvent();
 }
 
 
-static void Com_RunAndTimeServerPacket( const netadr_t& from, msg_t* msg )
+static void Com_RunAndTimeServerPacket( const netadr_t& from, msg_t* msg, int time )
 {
 	int t1 = (com_speeds->integer == 3) ? Sys_Milliseconds() : 0;
 
-	SV_PacketEvent( from, msg );
+	SV_PacketEvent( from, msg, time );
 
 	if (com_speeds->integer == 3) {
 		int ms = Sys_Milliseconds() - t1;
@@ -1757,6 +2050,68 @@ static void Com_RunAndTimeServerPacket( const netadr_t& from, msg_t* msg )
 }
 
 
+static void Com_PacketEvent( const netadr_t& from, msg_t* msg, int time )
+{
+	// this cvar allows simulation of connections that
+	// drop a lot of packets.  Note that loopback connections
+	// don't go through here at all.
+	if ( com_dropsim->value > 0 ) {
+		static int seed;
+		if ( Q_random( &seed ) < com_dropsim->value ) {
+			return;		// drop this packet
+		}
+	}
+
+	if ( com_sv_running->integer ) {
+		Com_RunAndTimeServerPacket( from, msg, time );
+	} else {
+		CL_PacketEvent( from, msg );
+	}
+}
+
+
+// packets from the network aren't queued as events: they're handed to
+// the client or server straight from the receive buffers, so they're
+// written to the journal as events here to be played back as such
+
+static void Com_JournalPacket( const netadr_t& from, const msg_t* msg, int time )
+{
+	sysEvent_t ev;
+
+	Com_Memset( &ev, 0, sizeof(ev) );
+	ev.evTime = time;
+	ev.evType = SE_PACKET;
+	ev.evPtrLength = sizeof(from) + msg->cursize;
+
+	if ( FS_Write( &ev, sizeof(ev), com_journalFile ) != sizeof(ev) ||
+		FS_Write( &from, sizeof(from), com_journalFile ) != sizeof(from) ||
+		FS_Write( msg->data, msg->cursize, com_journalFile ) != msg->cursize ) {
+		Com_Error( ERR_FATAL, "Error writing to journal file" );
+	}
+}
+
+
+// packet handlers can run the event loop themselves (the client does while
+// loading a map), and the packet that's being handled further up has to
+// stay where it is until they return, so nested loops copy theirs
+
+static int com_eventLoopDepth;
+
+static qbool Com_GetPacket( netadr_t* from, msg_t* msg, msg_t* buf, int* time )
+{
+	if ( com_journal->integer == 2 ) {
+		return qfalse;	// they're all in the journal
+	}
+
+	if ( com_eventLoopDepth > 1 ) {
+		*msg = *buf;
+		return Sys_CopyPacket( from, msg, time );
+	}
+
+	return Sys_GetPacket( from, msg, time );
+}
+
+
 // returns last event time
 
 int Com_EventLoop()
@@ -1764,16 +2119,30 @@ int Com_EventLoop()
 	sysEvent_t	ev;
 	netadr_t	evFrom;
 	byte		bufData[MAX_MSGLEN];
-	msg_t		buf;
+	msg_t		buf, packet;
+	int			packetTime;
 
 	MSG_Init( &buf, bufData, sizeof( bufData ) );
 
+	++com_eventLoopDepth;
+
 	while ( 1 ) {
 		NET_FlushPacketQueue();
 		ev = Com_GetEvent();
 
 		// if no more events are available
 		if ( ev.evType == SE_NONE ) {
+			// the replies go out together once every packet has been handled
+			NET_BeginPacketBatch();
+			while ( Com_GetPacket( &evFrom, &packet, &buf, &packetTime ) ) {
+				if ( com_journal->integer == 1 ) {
+					Com_JournalPacket( evFrom, &packet, packetTime );
+				}
+				Com_PacketEvent( evFrom, &packet, packetTime );
+				NET_FlushPacketQueue();
+			}
+			NET_FlushPacketBatch();
+
 			// manually send packet events for the loopback channel
 			while ( NET_GetLoopPacket( NS_CLIENT, &evFrom, &buf ) ) {
 				CL_PacketEvent( evFrom, &buf );
@@ -1782,10 +2151,11 @@ int Com_EventLoop()
 			while ( NET_GetLoopPacket( NS_SERVER, &evFrom, &buf ) ) {
 				// if the server just shut down, flush the events
 				if ( com_sv_running->integer ) {
-					Com_RunAndTimeServerPacket( evFrom, &buf );
+					Com_RunAndTimeServerPacket( evFrom, &buf, Sys_Milliseconds() );
 				}
 			}
 
+			--com_eventLoopDepth;
 			return ev.evTime;
 		}
 
@@ -1813,16 +2183,6 @@ int Com_EventLoop()
 			Cbuf_AddText( "\n" );
 			break;
 		case SE_PACKET:
-			// this cvar allows simulation of connections that
-			// drop a lot of packets.  Note that loopback connections
-			// don't go through here at all.
-			if ( com_dropsim->value > 0 ) {
-				static int seed;
-				if ( Q_random( &seed ) < com_dropsim->value ) {
-					break;		// drop this packet
-				}
-			}
-
 			evFrom = *(netadr_t *)ev.evPtr;
 			buf.cursize = ev.evPtrLength - sizeof( evFrom );
 
@@ -1835,11 +2195,7 @@ int Com_EventLoop()
 				continue;
 			}
 			Com_Memcpy( buf.data, (byte *)((netadr_t *)ev.evPtr + 1), buf.cursize );
-			if ( com_sv_running->integer ) {
-				Com_RunAndTimeServerPacket( evFrom, &buf );
-			} else {
-				CL_PacketEvent( evFrom, &buf );
-			}
+			Com_PacketEvent( evFrom, &buf, ev.evTime );
 			break;
 		}
 
@@ -2057,9 +2413,8 @@ void Com_Init( char *commandLine )
 		Sys_Error ("Error during initialization");
 	}
 
-	memset( com_pushedEvents, 0, sizeof(com_pushedEvents) );
-	com_pushedEventsHead = 0;
-	com_pushedEventsTail = 0;
+	com_pushedEvents = EQ_Create( "pushed", MAX_PUSHED_EVENTS, 0 );
+	com_sysEvents = EQ_Create( "system", MAX_SYS_EVENTS, MAX_SYS_EVENT_PAYLOAD );
 
 	Com_InitSmallZoneMemory();
 	Cvar_Init();
@@ -2154,10 +2509,17 @@ void Com_Init( char *commandLine )
 		Cmd_AddCommand( "crash", Com_Crash_f );
 		Cmd_AddCommand( "freeze", Com_Freeze_f );
 		//Cmd_AddCommand( "changeVectors", MSG_ReportChangeVectors_f );
+		Cmd_AddCommand( "msgbench", MSG_Benchmark_f );
+		Cmd_AddCommand( "msgfuzz", MSG_Fuzz_f );
+		Cmd_AddCommand( "msgdeltabench", MSG_DeltaBenchmark_f );
+		Cmd_AddCommand( "cmtracetest", CM_TraceTest_f );
+		Cmd_AddCommand( "cmtracerecord", CM_TraceRecord_f );
+		Cmd_AddCommand( "cmtracebench", CM_TraceBench_f );
 	}
 
 	Cmd_AddCommand( "quit", Com_Quit_f );
 	Cmd_AddCommand( "writeconfig", Com_WriteConfig_f );
+	Cmd_AddCommand( "eventqueues", EQ_Info_f );
 
 	const char* s = Q3_VERSION" "PLATFORM_STRING" "__DATE__;
 	com_version = Cvar_Get( "version", s, CVAR_ROM | CVAR_SERVERINFO );
@@ -2292,6 +2654,8 @@ static int Com_ModifyMsec( int msec )
 void Com_Frame()
 {
 	if ( setjmp(abortframe) ) {
+		com_eventLoopDepth = 0;
+		NET_FlushPacketBatch();
 		return;			// an ERR_DROP was thrown
 	}
 
@@ -2412,13 +2776,16 @@ void Com_Frame()
 	// trace optimization tracking
 	//
 	if ( com_showtrace->integer ) {
-		extern int c_traces, c_brush_traces, c_patch_traces, c_pointcontents;
+		static int lastTraces, lastBrushTraces, lastPatchTraces, lastPointContents;
+		int traces, brushTraces, patchTraces, pointContents;
+		CM_TraceStats( &traces, &brushTraces, &patchTraces, &pointContents );
 		Com_Printf( "%4i traces  (%ib %ip) %4i points\n",
-				c_traces, c_brush_traces, c_patch_traces, c_pointcontents );
-		c_traces = 0;
-		c_brush_traces = 0;
-		c_patch_traces = 0;
-		c_pointcontents = 0;
+				traces - lastTraces, brushTraces - lastBrushTraces,
+				patchTraces - lastPatchTraces, pointContents - lastPointContents );
+		lastTraces = traces;
+		lastBrushTraces = brushTraces;
+		lastPatchTraces = patchTraces;
+		lastPointContents = pointContents;
 	}
 
 	com_frameNumber++;
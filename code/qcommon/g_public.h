@@ -93,6 +93,19 @@ typedef struct {
 	entityShared_t	r;				// shared by both the server system and game
 } sharedEntity_t;
 
+
+// G_TRACEBATCH runs trap_Trace on every one of these and fills in trace
+// mins and maxs are relative and can't be NULL, leave them at 0 for a point
+typedef struct {
+	vec3_t		start;
+	vec3_t		end;
+	vec3_t		mins;
+	vec3_t		maxs;
+	int			passEntityNum;
+	int			contentmask;
+	trace_t		trace;
+} batchTrace_t;
+
 // the actual contents of a gentity_t are the game's business,
 // provided the first two elements EXACTLY MATCH sharedEntity_t
 typedef struct gentity_s gentity_t;
@@ -227,6 +240,11 @@ typedef enum {
 	// 1.32
 	G_FS_SEEK,
 
+	// cnq3 1.44, only engines that have the read-only cvar sv_traceBatch
+	G_TRACEBATCH,	// ( batchTrace_t *traces, int numTraces, int capsule );
+	// the same as a G_TRACE or G_TRACECAPSULE for each one, but much cheaper
+	// for many traces through the same area (shotgun pellets, bot sensing)
+
 	BOTLIB_SETUP = 200,				// ( void );
 	BOTLIB_SHUTDOWN,				// ( void );
 	BOTLIB_LIBVAR_SET,
@@ -418,6 +436,7 @@ void	trap_SetUserinfo( int num, const char *buffer );
 void	trap_GetServerinfo( char *buffer, int bufferSize );
 void	trap_SetBrushModel( gentity_t *ent, const char *name );
 void	trap_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask );
+void	trap_TraceBatch( batchTrace_t *traces, int numTraces, int capsule );
 int		trap_PointContents( const vec3_t point, int passEntityNum );
 qboolean trap_InPVS( const vec3_t p1, const vec3_t p2 );
 qboolean trap_InPVSIgnorePortals( const vec3_t p1, const vec3_t p2 );
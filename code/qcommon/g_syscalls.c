@@ -161,6 +161,10 @@ void trap_TraceCapsule( trace_t *results, const vec3_t start, const vec3_t mins,
 	syscall( G_TRACECAPSULE, results, start, mins, maxs, end, passEntityNum, contentmask );
 }
 
+void trap_TraceBatch( batchTrace_t *traces, int numTraces, int capsule ) {
+	syscall( G_TRACEBATCH, traces, numTraces, capsule );
+}
+
 int trap_PointContents( const vec3_t point, int passEntityNum ) {
 	return syscall( G_POINT_CONTENTS, point, passEntityNum );
 }
@@ -27,41 +27,40 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include "q_shared.h"
 #include "qcommon.h"
 
+// only the adaptive Huff_Compress/Huff_Decompress path still uses this:
+// the offset versions keep their position in the caller's msg_t, so the
+// fixed msgHuff tables can be used by several threads at once
 static int			bloc = 0;
 
 void	Huff_putBit( int bit, byte *fout, int *offset) {
-	bloc = *offset;
-	if ((bloc&7) == 0) {
-		fout[(bloc>>3)] = 0;
+	int b = *offset;
+	if ((b&7) == 0) {
+		fout[(b>>3)] = 0;
 	}
-	fout[(bloc>>3)] |= bit << (bloc&7);
-	bloc++;
-	*offset = bloc;
+	fout[(b>>3)] |= bit << (b&7);
+	*offset = b + 1;
 }
 
 int		Huff_getBit( byte *fin, int *offset) {
-	int t;
-	bloc = *offset;
-	t = (fin[(bloc>>3)] >> (bloc&7)) & 0x1;
-	bloc++;
-	*offset = bloc;
-	return t;
+	int b = *offset;
+	*offset = b + 1;
+	return (fin[(b>>3)] >> (b&7)) & 0x1;
 }
 
 /* Add a bit to the output file (buffered) */
-static void add_bit (char bit, byte *fout) {
-	if ((bloc&7) == 0) {
-		fout[(bloc>>3)] = 0;
+static void add_bit (char bit, byte *fout, int *offset) {
+	if ((*offset&7) == 0) {
+		fout[(*offset>>3)] = 0;
 	}
-	fout[(bloc>>3)] |= bit << (bloc&7);
-	bloc++;
+	fout[(*offset>>3)] |= bit << (*offset&7);
+	(*offset)++;
 }
 
 /* Receive one bit from the input file (buffered) */
-static int get_bit (byte *fin) {
+static int get_bit (byte *fin, int *offset) {
 	int t;
-	t = (fin[(bloc>>3)] >> (bloc&7)) & 0x1;
-	bloc++;
+	t = (fin[(*offset>>3)] >> (*offset&7)) & 0x1;
+	(*offset)++;
 	return t;
 }
 
@@ -255,7 +254,7 @@ void Huff_addRef(huff_t* huff, byte ch) {
 /* Get a symbol */
 int Huff_Receive (node_t *node, int *ch, byte *fin) {
 	while (node && node->symbol == INTERNAL_NODE) {
-		if (get_bit(fin)) {
+		if (get_bit(fin, &bloc)) {
 			node = node->right;
 		} else {
 			node = node->left;
@@ -270,9 +269,9 @@ int Huff_Receive (node_t *node, int *ch, byte *fin) {
 
 /* Get a symbol */
 void Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset) {
-	bloc = *offset;
+	int b = *offset;
 	while (node && node->symbol == INTERNAL_NODE) {
-		if (get_bit(fin)) {
+		if (get_bit(fin, &b)) {
 			node = node->right;
 		} else {
 			node = node->left;
@@ -284,19 +283,19 @@ void Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset) {
 //		Com_Error(ERR_DROP, "Illegal tree!\n");
 	}
 	*ch = node->symbol;
-	*offset = bloc;
+	*offset = b;
 }
 
 /* Send the prefix code for this node */
-static void send(node_t *node, node_t *child, byte *fout) {
+static void send(node_t *node, node_t *child, byte *fout, int *offset) {
 	if (node->parent) {
-		send(node->parent, node, fout);
+		send(node->parent, node, fout, offset);
 	}
 	if (child) {
 		if (node->right == child) {
-			add_bit(1, fout);
+			add_bit(1, fout, offset);
 		} else {
-			add_bit(0, fout);
+			add_bit(0, fout, offset);
 		}
 	}
 }
@@ -308,17 +307,15 @@ void Huff_transmit (huff_t *huff, int ch, byte *fout) {
 		/* node_t hasn't been transmitted, send a NYT, then the symbol */
 		Huff_transmit(huff, NYT, fout);
 		for (i = 7; i >= 0; i--) {
-			add_bit((char)((ch >> i) & 0x1), fout);
+			add_bit((char)((ch >> i) & 0x1), fout, &bloc);
 		}
 	} else {
-		send(huff->loc[ch], NULL, fout);
+		send(huff->loc[ch], NULL, fout, &bloc);
 	}
 }
 
 void Huff_offsetTransmit (huff_t *huff, int ch, byte *fout, int *offset) {
-	bloc = *offset;
-	send(huff->loc[ch], NULL, fout);
-	*offset = bloc;
+	send(huff->loc[ch], NULL, fout, offset);
 }
 
 void Huff_Decompress(msg_t *mbuf, int offset) {
@@ -361,7 +358,7 @@ void Huff_Decompress(msg_t *mbuf, int offset) {
 		if ( ch == NYT ) {								/* We got a NYT, get the symbol associated with it */
 			ch = 0;
 			for ( i = 0; i < 8; i++ ) {
-				ch = (ch<<1) + get_bit(buffer);
+				ch = (ch<<1) + get_bit(buffer, &bloc);
 			}
 		}
 
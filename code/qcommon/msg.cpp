@@ -26,6 +26,20 @@ static huffman_t		msgHuff;
 
 static qbool			msgInit = qfalse;
 
+// msgHuff never changes once it's been seeded, so it's also flattened into
+// tables: each symbol's code in the order its bits go out (first bit in bit 0),
+// and for every possible run of the next HUFF_LOOKUP_BITS bits in the stream,
+// the symbol it starts with and how long its code is
+// every code in the msg_hData tree is 11 bits or less, so the tree itself
+// is only walked if the input is short or the table doesn't cover it
+
+#define HUFF_LOOKUP_BITS	11
+#define HUFF_LOOKUP_SYMBOL	0x1FF	// wide enough for NYT
+
+static unsigned			huffCode[HMAX];
+static byte				huffCodeLength[HMAX];
+static unsigned short	huffLookup[1 << HUFF_LOOKUP_BITS];	// symbol | (code length << 9), 0 if too long
+
 //static int pcount[256];
 
 extern cvar_t* cl_shownet;
@@ -39,11 +53,11 @@ Handles byte ordering and avoids alignment errors
 ==============================================================================
 */
 
-static void MSG_initHuffman();
+static void MSG_initialize();
 
 void MSG_Init( msg_t *buf, byte *data, int length ) {
 	if (!msgInit) {
-		MSG_initHuffman();
+		MSG_initialize();
 	}
 	Com_Memset (buf, 0, sizeof(*buf));
 	buf->data = data;
@@ -52,7 +66,7 @@ void MSG_Init( msg_t *buf, byte *data, int length ) {
 
 void MSG_InitOOB( msg_t *buf, byte *data, int length ) {
 	if (!msgInit) {
-		MSG_initHuffman();
+		MSG_initialize();
 	}
 	Com_Memset (buf, 0, sizeof(*buf));
 	buf->data = data;
@@ -102,6 +116,81 @@ bit functions
 
 //static int overflows;
 
+// reads are done from a 64-bit window onto the stream, and writes go into
+// msg->bitBuffer before being stored a whole word at a time, so a flag bit
+// costs a shift and a store rather than a byte read-modify-write per bit
+// msg->data is still kept complete after every write, because the netchan
+// encoders read the header back and then scramble the message in place
+
+// the next 57 or more bits of the stream starting at bit, first one in bit 0
+// anything past the end of the buffer reads as zeros
+
+static uint64_t MSG_PeekBits( const msg_t* msg, int bit )
+{
+	const int i = bit >> 3;
+	uint64_t bits = 0;
+
+#if defined( Q3_LITTLE_ENDIAN )
+	if (i + 8 <= msg->maxsize) {
+		memcpy( &bits, msg->data + i, 8 );
+		return (bits >> (bit & 7));
+	}
+#endif
+
+	for (int j = 0; j < 8 && i + j < msg->maxsize; ++j) {
+		bits |= (uint64_t)msg->data[i + j] << (j * 8);
+	}
+
+	return (bits >> (bit & 7));
+}
+
+
+static void MSG_StoreBits( msg_t* msg, int ofs, uint64_t bits, int bytes )
+{
+#if defined( Q3_LITTLE_ENDIAN )
+	if (ofs + 8 <= msg->maxsize) {
+		memcpy( msg->data + ofs, &bits, 8 );
+		return;
+	}
+#endif
+
+	for (int i = 0; i < bytes && ofs + i < msg->maxsize; ++i) {
+		msg->data[ofs + i] = (byte)(bits >> (i * 8));
+	}
+}
+
+
+// appends count (< 64) bits that are already Huffman coded where necessary
+
+static void MSG_WriteCodedBits( msg_t* msg, uint64_t bits, int count )
+{
+	int bit = msg->bit;
+
+	// the position was moved by something else, e.g. an OOB write or MSG_Clear
+	if (msg->bitBufferPos != bit) {
+		msg->bitBuffer = (bit & 63) ? MSG_PeekBits( msg, bit & ~63 ) & ((1ull << (bit & 63)) - 1) : 0;
+	}
+
+	const int shift = bit & 63;
+	int ofs = (bit >> 6) << 3;
+	uint64_t word = msg->bitBuffer | (bits << shift);
+
+	if (shift + count >= 64) {
+		MSG_StoreBits( msg, ofs, word, 8 );
+		// shift can't be 0 here, since count is less than 64
+		word = bits >> (64 - shift);
+		ofs += 8;
+	}
+
+	bit += count;
+	MSG_StoreBits( msg, ofs, word, ((bit & 63) + 7) >> 3 );
+
+	msg->bitBuffer = word;
+	msg->bit = bit;
+	msg->bitBufferPos = bit;
+}
+
+
 // negative bit values include signs
 void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 	int	i;
@@ -154,26 +243,24 @@ void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 			Com_Error(ERR_DROP, "can't write %d bits\n", bits);
 		}
 	} else {
-//		fp = fopen("c:\\netchan.bin", "a");
 		value &= (0xffffffff>>(32-bits));
+		// the odd bits go out raw, then each byte is Huffman coded
+		// that's at most 7 + 4 * 11 bits, so it all fits in one go
+		uint64_t coded = 0;
+		int count = 0;
 		if (bits&7) {
-			int nbits;
-			nbits = bits&7;
-			for(i=0;i<nbits;i++) {
-				Huff_putBit((value&1), msg->data, &msg->bit);
-				value = (value>>1);
-			}
-			bits = bits - nbits;
+			count = bits&7;
+			coded = value & ((1 << count) - 1);
+			value = ((unsigned)value >> count);
+			bits = bits - count;
 		}
-		if (bits) {
-			for(i=0;i<bits;i+=8) {
-//				fwrite(bp, 1, 1, fp);
-				Huff_offsetTransmit (&msgHuff.compressor, (value&0xff), msg->data, &msg->bit);
-				value = (value>>8);
-			}
+		for(i=0;i<bits;i+=8) {
+			coded |= (uint64_t)huffCode[value&0xff] << count;
+			count += huffCodeLength[value&0xff];
+			value = (value>>8);
 		}
+		MSG_WriteCodedBits( msg, coded, count );
 		msg->cursize = (msg->bit>>3)+1;
-//		fclose(fp);
 	}
 }
 
@@ -212,23 +299,29 @@ int MSG_ReadBits( msg_t *msg, int bits ) {
 			Com_Error(ERR_DROP, "can't read %d bits\n", bits);
 		}
 	} else {
+		int bit = msg->bit;
+		uint64_t stream = MSG_PeekBits( msg, bit );
 		nbits = 0;
 		if (bits&7) {
 			nbits = bits&7;
-			for(i=0;i<nbits;i++) {
-				value |= (Huff_getBit(msg->data, &msg->bit)<<i);
-			}
+			value = (int)(stream & ((1 << nbits) - 1));
+			stream >>= nbits;
+			bit += nbits;
 			bits = bits - nbits;
 		}
-		if (bits) {
-//			fp = fopen("c:\\netchan.bin", "a");
-			for(i=0;i<bits;i+=8) {
-				Huff_offsetReceive (msgHuff.decompressor.tree, &get, msg->data, &msg->bit);
-//				fwrite(&get, 1, 1, fp);
-				value |= (get<<(i+nbits));
+		for(i=0;i<bits;i+=8) {
+			int entry = huffLookup[stream & ((1 << HUFF_LOOKUP_BITS) - 1)];
+			if (entry) {
+				get = (entry & HUFF_LOOKUP_SYMBOL);
+				stream >>= (entry >> 9);
+				bit += (entry >> 9);
+			} else {
+				Huff_offsetReceive( msgHuff.decompressor.tree, &get, msg->data, &bit );
+				stream = MSG_PeekBits( msg, bit );
 			}
-//			fclose(fp);
+			value |= (get<<(i+nbits));
 		}
+		msg->bit = bit;
 		msg->readcount = (msg->bit>>3)+1;
 	}
 	if ( sgn ) {
@@ -584,6 +677,156 @@ typedef struct {
 } netField_t;
 
 
+/*
+=============================================================================
+
+change vectors
+
+The delta writers compare the whole struct in one pass, 4 or 8 words at a
+time where SSE2 or AVX2 is available, and every group of 4 words that
+changed is turned into the fields it holds, in field list order, with a
+table built at init. The last changed field is then the highest bit set.
+Almost every entity is unchanged from one frame to the next, and that
+comes out without looking at the field list or the tables at all.
+
+=============================================================================
+*/
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MSG_CHANGES_AVX2
+#define MSG_CHANGES_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define MSG_CHANGES_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define MAX_CHANGE_WORDS	128
+#define MAX_CHANGE_FIELDS	64
+
+typedef struct {
+	uint64_t	fields;								// bit i set if field i of the list changed
+	unsigned	words[MAX_CHANGE_WORDS / 32 + 1];	// bit i set if word i of the struct changed
+} changeVector_t;									// +1 so MSG_ChangedWords can always read 2
+
+// for every group of 4 words in the struct and every way they can change,
+// the fields that changed as bits in field list order
+typedef uint64_t changeTable_t[MAX_CHANGE_WORDS / 4][16];
+
+static changeTable_t	esfChangeTable;
+static changeTable_t	psfChangeTable;
+
+
+static void MSG_AddChangeGroup( changeVector_t* cv, const changeTable_t table, int group, unsigned changed )
+{
+	cv->words[group >> 3] |= changed << ((group & 7) * 4);
+	cv->fields |= table[group][changed];
+}
+
+
+static qbool MSG_ChangeVectorScalar( changeVector_t* cv, const int* from, const int* to, int start, int words, const changeTable_t table )
+{
+	qbool any = qfalse;
+
+	for ( int i = start; i < words; ++i ) {
+		if ( from[i] != to[i] ) {
+			MSG_AddChangeGroup( cv, table, i >> 2, 1 << (i & 3) );
+			any = qtrue;
+		}
+	}
+
+	return any;
+}
+
+
+// returns qfalse if the structs are identical, whether or not the words that differ are sent
+
+static qbool MSG_ChangeVector( changeVector_t* cv, const void* fromStruct, const void* toStruct, int words, const changeTable_t table )
+{
+	const int* from = (const int*)fromStruct;
+	const int* to = (const int*)toStruct;
+	unsigned any = 0;
+	int i = 0;
+
+	Com_Memset( cv, 0, sizeof(*cv) );
+
+#if defined(MSG_CHANGES_AVX2)
+	for ( ; i + 8 <= words; i += 8 ) {
+		const __m256i a = _mm256_loadu_si256( (const __m256i*)(from + i) );
+		const __m256i b = _mm256_loadu_si256( (const __m256i*)(to + i) );
+		const unsigned changed = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( a, b ) ) ) ^ 0xFF;
+		if ( changed ) {
+			MSG_AddChangeGroup( cv, table, i >> 2, changed & 0xF );
+			MSG_AddChangeGroup( cv, table, (i >> 2) + 1, changed >> 4 );
+			any |= changed;
+		}
+	}
+#endif
+#if defined(MSG_CHANGES_SSE2)
+	for ( ; i + 4 <= words; i += 4 ) {
+		const __m128i a = _mm_loadu_si128( (const __m128i*)(from + i) );
+		const __m128i b = _mm_loadu_si128( (const __m128i*)(to + i) );
+		const unsigned changed = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( a, b ) ) ) ^ 0xF;
+		if ( changed ) {
+			MSG_AddChangeGroup( cv, table, i >> 2, changed );
+			any |= changed;
+		}
+	}
+#endif
+
+	return (qbool)(MSG_ChangeVectorScalar( cv, from, to, i, words, table ) || any);
+}
+
+
+// the number of fields to send: 1 + the index of the last one that changed
+
+static int MSG_LastChangedField( const changeVector_t* cv )
+{
+	const unsigned high = (unsigned)(cv->fields >> 32);
+	const unsigned low = (unsigned)cv->fields;
+	const unsigned bits = high ? high : low;
+
+	if ( !bits ) {
+		return 0;
+	}
+
+#if defined(__GNUC__)
+	const int top = 31 - __builtin_clz( bits );
+#elif defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse( &index, bits );
+	const int top = (int)index;
+#else
+	int top = 31;
+	while ( !(bits & (1u << top)) ) {
+		--top;
+	}
+#endif
+
+	return (high ? 32 : 0) + top + 1;
+}
+
+
+static qbool MSG_FieldChanged( const changeVector_t* cv, int field )
+{
+	return (qbool)((cv->fields >> field) & 1);
+}
+
+
+// the change bits of count <= 32 consecutive words, starting at byte offset
+
+static int MSG_ChangedWords( const changeVector_t* cv, int offset, int count )
+{
+	const int word = offset >> 2;
+	const uint64_t bits = cv->words[word >> 5] | ((uint64_t)cv->words[(word >> 5) + 1] << 32);
+	return (int)((bits >> (word & 31)) & (0xFFFFFFFF >> (32 - count)));
+}
+
+
 /*
 =============================================================================
 
@@ -593,7 +836,7 @@ entityState_t communication
 */
 
 // using the stringizing operator to save typing...
-#define ESF(x) #x,(int)&((entityState_t*)0)->x
+#define ESF(x) #x,(int)(intptr_t)&((entityState_t*)0)->x
 
 static const netField_t entityStateFields[] =
 {
@@ -664,16 +907,19 @@ If force is not set, then nothing at all will be generated if the entity is
 identical, under the assumption that the in-order delta code will catch it.
 ==================
 */
-void MSG_WriteDeltaEntity( msg_t* msg, const entityState_t* from, entityState_t* to, qbool force )
+void MSG_WriteDeltaEntity( msg_t* msg, const entityState_t* from, const entityState_t* to, qbool force )
 {
 	int			i, lc;
-	int			*fromF, *toF;
+	int			*toF;
+	changeVector_t	changes;
 
 	// all fields should be 32 bits to avoid any compiler packing issues
 	// the "number" field is not part of the field list
 	// if this assert fails, someone added a field to the entityState_t
 	// struct without updating the message fields
 	COMPILE_TIME_ASSERT( numESF + 1 == sizeof(*from) / 4 );
+	COMPILE_TIME_ASSERT( sizeof(*from) / 4 <= MAX_CHANGE_WORDS );
+	COMPILE_TIME_ASSERT( numESF <= MAX_CHANGE_FIELDS );
 
 	// a NULL to is a delta remove message
 	if ( to == NULL ) {
@@ -691,13 +937,8 @@ void MSG_WriteDeltaEntity( msg_t* msg, const entityState_t* from, entityState_t*
 
 	lc = 0;
 	const netField_t* field;
-	// build the change vector as bytes so it is endien independent
-	for ( i = 0, field = entityStateFields ; i < numESF ; i++, field++ ) {
-		fromF = (int *)( (byte *)from + field->offset );
-		toF = (int *)( (byte *)to + field->offset );
-		if ( *fromF != *toF ) {
-			lc = i+1;
-		}
+	if ( MSG_ChangeVector( &changes, from, to, sizeof(*from) / 4, esfChangeTable ) ) {
+		lc = MSG_LastChangedField( &changes );
 	}
 
 	if ( lc == 0 ) {
@@ -719,10 +960,9 @@ void MSG_WriteDeltaEntity( msg_t* msg, const entityState_t* from, entityState_t*
 	MSG_WriteByte( msg, lc );	// # of changes
 
 	for ( i = 0, field = entityStateFields ; i < lc ; i++, field++ ) {
-		fromF = (int *)( (byte *)from + field->offset );
 		toF = (int *)( (byte *)to + field->offset );
 
-		if ( *fromF == *toF ) {
+		if ( !MSG_FieldChanged( &changes, i ) ) {
 			MSG_WriteBits( msg, 0, 1 );	// no change
 			continue;
 		}
@@ -892,7 +1132,8 @@ plyer_state_t communication
 */
 
 // using the stringizing operator to save typing...
-#define PSF(x) #x,(int)&((playerState_t*)0)->x
+#define PSF(x) #x,(int)(intptr_t)&((playerState_t*)0)->x
+#define PSF_OFFSET(x) (int)(intptr_t)&((playerState_t*)0)->x
 
 static const netField_t playerStateFields[] =
 {
@@ -949,13 +1190,17 @@ static const netField_t playerStateFields[] =
 static const int numPSF = sizeof(playerStateFields) / sizeof(playerStateFields[0]);
 
 
-void MSG_WriteDeltaPlayerstate( msg_t* msg, const playerState_t* from, playerState_t* to )
+void MSG_WriteDeltaPlayerstate( msg_t* msg, const playerState_t* from, const playerState_t* to )
 {
 	int				i;
 	playerState_t	dummy;
 	int				c;
-	int				*fromF, *toF;
+	int				*toF;
 	int				lc;
+	changeVector_t	changes;
+
+	COMPILE_TIME_ASSERT( sizeof(*to) / 4 <= MAX_CHANGE_WORDS );
+	COMPILE_TIME_ASSERT( numPSF <= MAX_CHANGE_FIELDS );
 
 	if (!from) {
 		from = &dummy;
@@ -966,21 +1211,17 @@ void MSG_WriteDeltaPlayerstate( msg_t* msg, const playerState_t* from, playerSta
 
 	lc = 0;
 	const netField_t* field;
-	for ( i = 0, field = playerStateFields ; i < numPSF ; i++, field++ ) {
-		fromF = (int *)( (byte *)from + field->offset );
-		toF = (int *)( (byte *)to + field->offset );
-		if ( *fromF != *toF ) {
-			lc = i+1;
-		}
+	const qbool changed = MSG_ChangeVector( &changes, from, to, sizeof(*to) / 4, psfChangeTable );
+	if ( changed ) {
+		lc = MSG_LastChangedField( &changes );
 	}
 
 	MSG_WriteByte( msg, lc );	// # of changes
 
 	for ( i = 0, field = playerStateFields ; i < lc ; i++, field++ ) {
-		fromF = (int *)( (byte *)from + field->offset );
 		toF = (int *)( (byte *)to + field->offset );
 
-		if ( *fromF == *toF ) {
+		if ( !MSG_FieldChanged( &changes, i ) ) {
 			MSG_WriteBits( msg, 0, 1 );	// no change
 			continue;
 		}
@@ -1014,28 +1255,14 @@ void MSG_WriteDeltaPlayerstate( msg_t* msg, const playerState_t* from, playerSta
 	// send the arrays
 	//
 	int statsbits = 0;
-	for (i=0 ; i<MAX_STATS ; i++) {
-		if (to->stats[i] != from->stats[i]) {
-			statsbits |= 1<<i;
-		}
-	}
 	int persistantbits = 0;
-	for (i=0 ; i<MAX_PERSISTANT ; i++) {
-		if (to->persistant[i] != from->persistant[i]) {
-			persistantbits |= 1<<i;
-		}
-	}
 	int ammobits = 0;
-	for (i=0 ; i<MAX_WEAPONS ; i++) {
-		if (to->ammo[i] != from->ammo[i]) {
-			ammobits |= 1<<i;
-		}
-	}
 	int powerupbits = 0;
-	for (i=0 ; i<MAX_POWERUPS ; i++) {
-		if (to->powerups[i] != from->powerups[i]) {
-			powerupbits |= 1<<i;
-		}
+	if ( changed ) {
+		statsbits = MSG_ChangedWords( &changes, PSF_OFFSET(stats), MAX_STATS );
+		persistantbits = MSG_ChangedWords( &changes, PSF_OFFSET(persistant), MAX_PERSISTANT );
+		ammobits = MSG_ChangedWords( &changes, PSF_OFFSET(ammo), MAX_WEAPONS );
+		powerupbits = MSG_ChangedWords( &changes, PSF_OFFSET(powerups), MAX_POWERUPS );
 	}
 
 	if (!statsbits && !persistantbits && !ammobits && !powerupbits) {
@@ -1491,7 +1718,6 @@ static void MSG_initHuffman()
 {
 	int i,j;
 
-	msgInit = qtrue;
 	Huff_Init(&msgHuff);
 	for(i=0;i<256;i++) {
 		for (j=0;j<msg_hData[i];j++) {
@@ -1499,8 +1725,535 @@ static void MSG_initHuffman()
 			Huff_addRef(&msgHuff.decompressor,	(byte)i);			// Do update
 		}
 	}
+
+	for (i = 0; i < HMAX; ++i) {
+		unsigned code = 0;
+		int length = 0;
+		// the bit nearest the root goes out first, so it ends up in bit 0
+		for (const node_t* node = msgHuff.compressor.loc[i]; node->parent; node = node->parent) {
+			code = (code << 1) | (node->parent->right == node);
+			++length;
+		}
+		if (length > 32) {
+			Com_Error( ERR_FATAL, "MSG_initHuffman: code for %i is %i bits long", i, length );
+		}
+		huffCode[i] = code;
+		huffCodeLength[i] = length;
+	}
+
+	for (i = 0; i < (1 << HUFF_LOOKUP_BITS); ++i) {
+		const node_t* node = msgHuff.decompressor.tree;
+		int length = 0;
+		while (node && node->symbol == INTERNAL_NODE && length < HUFF_LOOKUP_BITS) {
+			node = ((i >> length) & 1) ? node->right : node->left;
+			++length;
+		}
+		if (node && node->symbol != INTERNAL_NODE) {
+			huffLookup[i] = node->symbol | (length << 9);
+		} else {
+			huffLookup[i] = 0;
+		}
+	}
+}
+
+
+static void MSG_initChangeTable( changeTable_t table, const netField_t* fields, int numFields )
+{
+	int i, c;
+
+	Com_Memset( table, 0, sizeof(changeTable_t) );
+	for (i = 0; i < numFields; ++i) {
+		const int word = fields[i].offset >> 2;
+		for (c = 0; c < 16; ++c) {
+			if (c & (1 << (word & 3))) {
+				table[word >> 2][c] |= (uint64_t)1 << i;
+			}
+		}
+	}
+}
+
+
+static void MSG_initChangeVectors()
+{
+	MSG_initChangeTable( esfChangeTable, entityStateFields, numESF );
+	MSG_initChangeTable( psfChangeTable, playerStateFields, numPSF );
+}
+
+
+static void MSG_initialize()
+{
+	msgInit = qtrue;
+	MSG_initHuffman();
+	MSG_initChangeVectors();
+}
+
+
+/*
+=============================================================================
+
+developer tests
+
+"msgbench" times the bitstream coder against the original one, which
+walked the Huffman tree and wrote or read a single bit at a time, and
+"msgfuzz" checks that the two produce exactly the same streams
+
+"msgdeltabench" times the delta change vectors against the original
+field by field compare and the scalar version of the struct compare,
+and checks that all 3 agree on every field
+
+=============================================================================
+*/
+
+static void MSG_WriteBitsReference( msg_t *msg, int value, int bits )
+{
+	int i;
+
+	if ( msg->maxsize - msg->cursize < 4 ) {
+		msg->overflowed = qtrue;
+		return;
+	}
+
+	if ( bits < 0 ) {
+		bits = -bits;
+	}
+
+	value &= (0xffffffff>>(32-bits));
+	if (bits&7) {
+		int nbits = bits&7;
+		for(i=0;i<nbits;i++) {
+			Huff_putBit((value&1), msg->data, &msg->bit);
+			value = (value>>1);
+		}
+		bits = bits - nbits;
+	}
+	for(i=0;i<bits;i+=8) {
+		Huff_offsetTransmit( &msgHuff.compressor, (value&0xff), msg->data, &msg->bit );
+		value = (value>>8);
+	}
+	msg->cursize = (msg->bit>>3)+1;
+}
+
+
+static int MSG_ReadBitsReference( msg_t *msg, int bits )
+{
+	int i, get, nbits = 0, value = 0;
+	qbool sgn = (bits < 0);
+
+	if ( bits < 0 ) {
+		bits = -bits;
+	}
+
+	if (bits&7) {
+		nbits = bits&7;
+		for(i=0;i<nbits;i++) {
+			value |= (Huff_getBit(msg->data, &msg->bit)<<i);
+		}
+		bits = bits - nbits;
+	}
+	for(i=0;i<bits;i+=8) {
+		Huff_offsetReceive( msgHuff.decompressor.tree, &get, msg->data, &msg->bit );
+		value |= (get<<(i+nbits));
+	}
+	msg->readcount = (msg->bit>>3)+1;
+
+	if ( sgn ) {
+		if ( value & ( 1 << ( bits - 1 ) ) ) {
+			value |= -1 ^ ( ( 1 << bits ) - 1 );
+		}
+	}
+
+	return value;
+}
+
+
+static unsigned msgTestSeed;
+
+static unsigned MSG_TestRand()
+{
+	msgTestSeed = msgTestSeed * 1664525 + 1013904223;
+	return (msgTestSeed >> 8);
+}
+
+
+typedef void (*msgWriteBits_t)( msg_t* msg, int value, int bits );
+typedef int (*msgReadBits_t)( msg_t* msg, int bits );
+
+// returns the time taken to write and read back every value, in msec
+
+static void MSG_TimeCoder( msgWriteBits_t write, msgReadBits_t read, const int* values, int count, int bits,
+		byte* buf, int size, int rounds, int* writeTime, int* readTime )
+{
+	msg_t msg;
+	int i, r, start;
+
+	MSG_Init( &msg, buf, size );
+
+	start = Sys_Milliseconds();
+	for (r = 0; r < rounds; ++r) {
+		MSG_Clear( &msg );
+		for (i = 0; i < count; ++i) {
+			write( &msg, values[i], bits );
+		}
+	}
+	*writeTime = Sys_Milliseconds() - start;
+
+	start = Sys_Milliseconds();
+	for (r = 0; r < rounds; ++r) {
+		MSG_BeginReading( &msg );
+		for (i = 0; i < count; ++i) {
+			read( &msg, bits );
+		}
+	}
+	*readTime = Sys_Milliseconds() - start;
+}
+
+
+void MSG_Benchmark_f()
+{
+	const int count = 128 * 1024;
+	const int rounds = 16;
+	int i, ch, total;
+
+	if (!msgInit) {
+		MSG_initialize();
+	}
+
+	int* bytes = Z_New<int>( count );
+	int* flags = Z_New<int>( count );
+	byte* refBuf = Z_New<byte>( count * 2 );
+	byte* newBuf = Z_New<byte>( count * 2 );
+
+	// pick the bytes with the same distribution the tree was built from
+	for (total = 0, i = 0; i < 256; ++i) {
+		total += msg_hData[i];
+	}
+	msgTestSeed = 0x1234567;
+	for (i = 0; i < count; ++i) {
+		int pick = MSG_TestRand() % total;
+		for (ch = 0; pick >= msg_hData[ch]; ++ch) {
+			pick -= msg_hData[ch];
+		}
+		bytes[i] = ch;
+		flags[i] = MSG_TestRand() & 1;
+	}
+
+	const float mops = (float)(count * rounds) / (1000 * 1000);
+	int refWrite, refRead, newWrite, newRead;
+
+	MSG_TimeCoder( MSG_WriteBitsReference, MSG_ReadBitsReference, bytes, count, 8, refBuf, count * 2, rounds, &refWrite, &refRead );
+	MSG_TimeCoder( MSG_WriteBits, MSG_ReadBits, bytes, count, 8, newBuf, count * 2, rounds, &newWrite, &newRead );
+	qbool same = !memcmp( refBuf, newBuf, count * 2 );
+	Com_Printf( "bytes  write: %6.1f M/s -> %6.1f M/s   read: %6.1f M/s -> %6.1f M/s\n",
+			mops * 1000 / max( refWrite, 1 ), mops * 1000 / max( newWrite, 1 ),
+			mops * 1000 / max( refRead, 1 ), mops * 1000 / max( newRead, 1 ) );
+
+	MSG_TimeCoder( MSG_WriteBitsReference, MSG_ReadBitsReference, flags, count, 1, refBuf, count * 2, rounds, &refWrite, &refRead );
+	MSG_TimeCoder( MSG_WriteBits, MSG_ReadBits, flags, count, 1, newBuf, count * 2, rounds, &newWrite, &newRead );
+	same = same && !memcmp( refBuf, newBuf, count / 8 );
+	Com_Printf( "flags  write: %6.1f M/s -> %6.1f M/s   read: %6.1f M/s -> %6.1f M/s\n",
+			mops * 1000 / max( refWrite, 1 ), mops * 1000 / max( newWrite, 1 ),
+			mops * 1000 / max( refRead, 1 ), mops * 1000 / max( newRead, 1 ) );
+
+	Com_Printf( "%s\n", same ? "output is identical" : "^1ERROR: output differs" );
+
+	Z_Free( newBuf );
+	Z_Free( refBuf );
+	Z_Free( flags );
+	Z_Free( bytes );
+}
+
+
+// writes random runs of values with both coders into buffers of random sizes,
+// moving the write position around the way the netchan code does, then reads
+// each stream back with both and complains about any difference at all
+
+void MSG_Fuzz_f()
+{
+	enum { MAX_OPS = 1024 };
+	static byte refBuf[MAX_MSGLEN + 16];
+	static byte newBuf[MAX_MSGLEN + 16];
+	static int values[MAX_OPS];
+	static int widths[MAX_OPS];
+	msg_t ref, msg;
+	int i, round, errors = 0, writes = 0, numWritten;
+
+	if (!msgInit) {
+		MSG_initialize();
+	}
+
+	const int rounds = (Cmd_Argc() > 1) ? atoi( Cmd_Argv(1) ) : 10000;
+	msgTestSeed = (Cmd_Argc() > 2) ? atoi( Cmd_Argv(2) ) : Sys_Milliseconds();
+	Com_Printf( "msgfuzz: %i rounds, seed %u\n", rounds, msgTestSeed );
+
+	for (round = 0; round < rounds && errors < 10; ++round) {
+		const int size = 8 + MSG_TestRand() % (MAX_MSGLEN - 8);
+		const int numOps = MSG_TestRand() % MAX_OPS;
+
+		for (i = 0; i < (int)sizeof(refBuf); ++i) {
+			refBuf[i] = newBuf[i] = MSG_TestRand();
+		}
+		MSG_Init( &ref, refBuf, size );
+		MSG_Init( &msg, newBuf, size );
+		numWritten = 0;
+
+		// netchan headers go out of band before the bitstream starts
+		const int numLongs = MSG_TestRand() % 4;
+		ref.oob = msg.oob = qtrue;
+		for (i = 0; i < numLongs; ++i) {
+			values[i] = MSG_TestRand();
+			MSG_WriteLong( &ref, values[i] );
+			MSG_WriteLong( &msg, values[i] );
+		}
+		ref.oob = msg.oob = qfalse;
+
+		for (i = 0; i < numOps; ++i) {
+			switch (MSG_TestRand() % 4) {
+				case 0: widths[i] = 1; break;
+				case 1: widths[i] = 8 << (MSG_TestRand() % 3); break;
+				default: widths[i] = 1 + MSG_TestRand() % 32; break;
+			}
+			if ((widths[i] < 32) && (MSG_TestRand() & 1)) {
+				widths[i] = -widths[i];
+			}
+			values[i] = (MSG_TestRand() << 16) ^ MSG_TestRand();
+
+			MSG_WriteBitsReference( &ref, values[i], widths[i] );
+			MSG_WriteBits( &msg, values[i], widths[i] );
+			++writes;
+			if (!ref.overflowed) {
+				numWritten = i + 1;
+			}
+
+			// the netchan encoders peek at the header mid-message
+			if ((MSG_TestRand() % 64) == 0) {
+				int bit = msg.bit;
+				msg.bit = 0;
+				MSG_ReadBits( &msg, 32 );
+				msg.bit = bit;
+			}
+		}
+
+		// cursize always counts the byte after the last bit, which the old
+		// coder left alone when the stream ended on a byte boundary
+		const int bytes = min( (ref.bit + 7) >> 3, size );
+		if ((ref.cursize != msg.cursize) || (ref.bit != msg.bit) || (ref.overflowed != msg.overflowed) ||
+				memcmp( refBuf, newBuf, bytes )) {
+			Com_Printf( "^1round %i: streams differ after %i writes (%i/%i bytes, %i/%i bits)\n",
+					round, numOps, ref.cursize, msg.cursize, ref.bit, msg.bit );
+			++errors;
+			continue;
+		}
+
+		// the overflow check is loose enough for a write to run up to 2 bytes past the
+		// end of the buffer: the old coder wrote them anyway, the new one drops them
+		if (ref.cursize > size) {
+			continue;
+		}
+
+		MSG_BeginReading( &ref );
+		MSG_BeginReading( &msg );
+		ref.oob = msg.oob = qtrue;
+		for (i = 0; i < numLongs; ++i) {
+			MSG_ReadLong( &ref );
+			MSG_ReadLong( &msg );
+		}
+		ref.oob = msg.oob = qfalse;
+		for (i = 0; i < numWritten; ++i) {
+			const int a = MSG_ReadBitsReference( &ref, widths[i] );
+			const int b = MSG_ReadBits( &msg, widths[i] );
+			if ((a != b) || (ref.bit != msg.bit)) {
+				Com_Printf( "^1round %i: read %i of %i bits differs: %08X vs %08X\n", round, i, widths[i], a, b );
+				++errors;
+				break;
+			}
+		}
+	}
+
+	Com_Printf( "msgfuzz: %i writes in %i rounds, %i errors\n", writes, round, errors );
+}
+
+
+typedef qbool (*msgChangeVector_t)( changeVector_t* cv, const void* from, const void* to, int words, const changeTable_t table );
+
+static qbool MSG_ChangeVectorNoSIMD( changeVector_t* cv, const void* from, const void* to, int words, const changeTable_t table )
+{
+	Com_Memset( cv, 0, sizeof(*cv) );
+	return MSG_ChangeVectorScalar( cv, (const int*)from, (const int*)to, 0, words, table );
+}
+
+
+static int MSG_LastChangedFieldReference( const void* from, const void* to, const netField_t* fields, int numFields )
+{
+	int lc = 0;
+
+	for (int i = 0; i < numFields; ++i) {
+		if (*(const int*)((const byte*)from + fields[i].offset) != *(const int*)((const byte*)to + fields[i].offset)) {
+			lc = i + 1;
+		}
+	}
+
+	return lc;
+}
+
+
+// returns the time taken to find the last changed field of every state in msec,
+// with the original field by field compare if changeVector is NULL
+
+static int MSG_TimeChangeVectors( msgChangeVector_t changeVector, const byte* states, int stateSize, int count,
+		const changeTable_t table, const netField_t* fields, int numFields, int rounds, int* checksum )
+{
+	changeVector_t cv;
+	const int words = stateSize / 4;
+	int lc, sum = 0;
+
+	const int start = Sys_Milliseconds();
+	for (int r = 0; r < rounds; ++r) {
+		for (int i = 0; i < count; ++i) {
+			const byte* from = states + i * stateSize;
+			const byte* to = from + stateSize;
+			if (changeVector) {
+				lc = changeVector( &cv, from, to, words, table ) ? MSG_LastChangedField( &cv ) : 0;
+			} else {
+				lc = MSG_LastChangedFieldReference( from, to, fields, numFields );
+			}
+			sum += lc;
+		}
+	}
+
+	*checksum = sum;
+	return Sys_Milliseconds() - start;
+}
+
+
+// a stream of states that mostly don't change from one to the next,
+// with the rest moving, animating or changing fields at random
+
+static void MSG_MakeDeltaStream( byte* states, int stateSize, int count, const netField_t* fields, int numFields, qbool players )
+{
+	for (int i = 0; i < stateSize / 4; ++i) {
+		((int*)states)[i] = MSG_TestRand() & 0xFF;
+	}
+
+	for (int i = 1; i <= count; ++i) {
+		byte* to = states + i * stateSize;
+		Com_Memcpy( to, to - stateSize, stateSize );
+
+		const int pick = MSG_TestRand() % 100;
+		int changes;
+		if (players) {
+			changes = 4 + MSG_TestRand() % 8;	// time, origin, velocity, angles...
+		} else if (pick < 75) {
+			changes = 0;
+		} else if (pick < 95) {
+			changes = 1 + MSG_TestRand() % 6;
+		} else {
+			changes = MSG_TestRand() % numFields;
+		}
+
+		for (int c = 0; c < changes; ++c) {
+			const int f = (players || pick < 95) ? (MSG_TestRand() % min( numFields, 12 )) : (MSG_TestRand() % numFields);
+			*(int*)(to + fields[f].offset) += 1 + MSG_TestRand() % 64;
+		}
+
+		// stats and words that never go out
+		if (players && (MSG_TestRand() % 8) == 0) {
+			((int*)to)[MSG_TestRand() % (stateSize / 4)] ^= 1 << (MSG_TestRand() % 32);
+		}
+	}
 }
 
+
+static int MSG_VerifyChangeVectors( const byte* states, int stateSize, int count,
+		const changeTable_t table, const netField_t* fields, int numFields )
+{
+	changeVector_t simd, scalar;
+	const int words = stateSize / 4;
+	int errors = 0;
+
+	for (int i = 0; i < count; ++i) {
+		const int* from = (const int*)(states + i * stateSize);
+		const int* to = (const int*)(states + (i + 1) * stateSize);
+		const qbool anySimd = MSG_ChangeVector( &simd, from, to, words, table );
+		const qbool anyScalar = MSG_ChangeVectorNoSIMD( &scalar, from, to, words, table );
+
+		qbool ok = (qbool)((anySimd == anyScalar) && !memcmp( &simd, &scalar, sizeof(simd) ) &&
+				(anySimd == !!memcmp( from, to, stateSize )) &&
+				(MSG_LastChangedField( &simd ) == MSG_LastChangedFieldReference( from, to, fields, numFields )));
+		for (int f = 0; f < numFields; ++f) {
+			const int w = fields[f].offset >> 2;
+			ok = (qbool)(ok && ((from[w] != to[w]) == MSG_FieldChanged( &simd, f )));
+		}
+		for (int w = 0; w + 16 <= words; ++w) {
+			int bits = 0;
+			for (int b = 0; b < 16; ++b) {
+				if (from[w + b] != to[w + b]) {
+					bits |= 1 << b;
+				}
+			}
+			ok = (qbool)(ok && (MSG_ChangedWords( &simd, w * 4, 16 ) == bits));
+		}
+
+		if (!ok) {
+			++errors;
+		}
+	}
+
+	return errors;
+}
+
+
+static int MSG_BenchmarkChangeVectors( const char* name, byte* states, int stateSize, int count,
+		const changeTable_t table, const netField_t* fields, int numFields, qbool players )
+{
+	const int rounds = 64;
+	const float mops = (float)(count * rounds) / (1000 * 1000);
+	int refSum, scalarSum, simdSum;
+
+	MSG_MakeDeltaStream( states, stateSize, count, fields, numFields, players );
+	int errors = MSG_VerifyChangeVectors( states, stateSize, count, table, fields, numFields );
+	const int refTime = MSG_TimeChangeVectors( NULL, states, stateSize, count, table, fields, numFields, rounds, &refSum );
+	const int scalarTime = MSG_TimeChangeVectors( MSG_ChangeVectorNoSIMD, states, stateSize, count, table, fields, numFields, rounds, &scalarSum );
+	const int simdTime = MSG_TimeChangeVectors( MSG_ChangeVector, states, stateSize, count, table, fields, numFields, rounds, &simdSum );
+	errors += (refSum != scalarSum) + (refSum != simdSum);
+
+	Com_Printf( "%-9s %6.1f M/s -> scalar %6.1f M/s, simd %6.1f M/s\n", name,
+			mops * 1000 / max( refTime, 1 ), mops * 1000 / max( scalarTime, 1 ), mops * 1000 / max( simdTime, 1 ) );
+
+	return errors;
+}
+
+
+void MSG_DeltaBenchmark_f()
+{
+	const int count = (Cmd_Argc() > 1) ? max( atoi( Cmd_Argv(1) ), 1 ) : 16 * 1024;
+
+	if (!msgInit) {
+		MSG_initialize();
+	}
+
+#if defined(MSG_CHANGES_AVX2)
+	Com_Printf( "change vectors: AVX2\n" );
+#elif defined(MSG_CHANGES_SSE2)
+	Com_Printf( "change vectors: SSE2\n" );
+#else
+	Com_Printf( "change vectors: no SIMD, the scalar version is used\n" );
+#endif
+
+	msgTestSeed = 0x1234567;
+	byte* states = (byte*)Z_Malloc( (count + 1) * sizeof(playerState_t) );
+	int errors = 0;
+	errors += MSG_BenchmarkChangeVectors( "entities:", states, sizeof(entityState_t), count, esfChangeTable, entityStateFields, numESF, qfalse );
+	errors += MSG_BenchmarkChangeVectors( "players:", states, sizeof(playerState_t), count, psfChangeTable, playerStateFields, numPSF, qtrue );
+	Z_Free( states );
+
+	if (errors) {
+		Com_Printf( "^1ERROR: %i change vectors differ\n", errors );
+	} else {
+		Com_Printf( "change vectors are identical\n" );
+	}
+}
+
+
 /*
 void MSG_NUinitHuffman() {
 	byte	*data;
@@ -377,6 +377,9 @@ qbool NET_CompareBaseAdr( const netadr_t& a, const netadr_t& b )
 	if (a.type == NA_IP)
 		return (a.ip[0] == b.ip[0] && a.ip[1] == b.ip[1] && a.ip[2] == b.ip[2] && a.ip[3] == b.ip[3]);
 
+	if (a.type == NA_IP6)
+		return (!memcmp( a.ip6, b.ip6, sizeof(a.ip6) ) && (a.scope_id == b.scope_id));
+
 	Com_Printf ("NET_CompareBaseAdr: bad address type\n");
 	return qfalse;
 }
@@ -388,6 +391,37 @@ qbool NET_CompareAdr( const netadr_t& a, const netadr_t& b )
 }
 
 
+// RFC 5952 form: lowercase hex groups, with the longest run of 2 or more zero groups as "::"
+
+static void NET_IP6ToString( char* s, int size, const byte* ip6 )
+{
+	int i, zeroStart = -1, zeroLength = 0;
+
+	for (i = 0; i < 8; ) {
+		int length = 0;
+		while (i + length < 8 && !ip6[(i + length) * 2] && !ip6[(i + length) * 2 + 1])
+			++length;
+		if (length > zeroLength && length >= 2) {
+			zeroStart = i;
+			zeroLength = length;
+		}
+		i += length ? length : 1;
+	}
+
+	*s = 0;
+	for (i = 0; i < 8; ++i) {
+		if (i == zeroStart) {
+			Q_strcat( s, size, "::" );
+			i += zeroLength - 1;
+			continue;
+		}
+		if (i && i != zeroStart + zeroLength)
+			Q_strcat( s, size, ":" );
+		Q_strcat( s, size, va( "%x", (ip6[i * 2] << 8) | ip6[i * 2 + 1] ) );
+	}
+}
+
+
 const char* NET_AdrToString( const netadr_t& a )
 {
 	static char s[64];
@@ -400,6 +434,11 @@ const char* NET_AdrToString( const netadr_t& a )
 		Com_sprintf (s, sizeof(s), "%i.%i.%i.%i:%hu",
 			a.ip[0], a.ip[1], a.ip[2], a.ip[3], BigShort(a.port));
 		return s;
+	} else if (a.type == NA_IP6) {
+		char ip6[48];
+		NET_IP6ToString( ip6, sizeof(ip6), a.ip6 );
+		Com_sprintf (s, sizeof(s), "[%s]:%hu", ip6, BigShort(a.port));
+		return s;
 	}
 
 	Com_Printf( "NET_AdrToString: bad address type\n" );
@@ -526,6 +565,21 @@ void NET_FlushPacketQueue()
 }
 
 
+// everything sent in between, including packets NET_FlushPacketQueue
+// releases, goes out in the same order but with as few syscalls as possible
+
+void NET_BeginPacketBatch()
+{
+	Sys_BeginPacketBatch();
+}
+
+
+void NET_FlushPacketBatch()
+{
+	Sys_FlushPacketBatch();
+}
+
+
 void NET_SendPacket( netsrc_t sock, int length, const void* data, const netadr_t& to )
 {
 	// sequenced packets are shown in netchan, so just show OOB
@@ -605,7 +659,7 @@ void QDECL NET_OutOfBandData( netsrc_t sock, const netadr_t& adr, const byte* da
 
 // traps "localhost" for loopback, passes everything else to system
 
-qbool NET_StringToAdr( const char* s, netadr_t* a )
+qbool NET_StringToAdr( const char* s, netadr_t* a, netadrtype_t family )
 {
 	if (!strcmp(s, "localhost")) {
 		Com_Memset( a, 0, sizeof(*a) );
@@ -616,17 +670,32 @@ qbool NET_StringToAdr( const char* s, netadr_t* a )
 	char base[MAX_STRING_CHARS];
 	Q_strncpyz( base, s, sizeof( base ) );
 
-	char* port = strstr( base, ":" );
-	if (port)
-		*port++ = 0;
+	// a bare IPv6 address has no port, one in brackets can have one after them
+	char* host = base;
+	char* port = NULL;
+	if (base[0] == '[') {
+		char* end = strchr( base, ']' );
+		if (!end) {
+			a->type = NA_BAD;
+			return qfalse;
+		}
+		*end++ = 0;
+		host = base + 1;
+		if (*end == ':')
+			port = end + 1;
+	} else if (strchr( base, ':' ) == strrchr( base, ':' )) {
+		port = strchr( base, ':' );
+		if (port)
+			*port++ = 0;
+	}
 
-	if (!Sys_StringToAdr( base, a )) {
+	if (!Sys_StringToAdr( host, a, family )) {
 		a->type = NA_BAD;
 		return qfalse;
 	}
 
 	// inet_addr returns this if out of range
-	if ( a->ip[0] == 255 && a->ip[1] == 255 && a->ip[2] == 255 && a->ip[3] == 255 ) {
+	if ( a->type == NA_IP && a->ip[0] == 255 && a->ip[1] == 255 && a->ip[2] == 255 && a->ip[3] == 255 ) {
 		a->type = NA_BAD;
 		return qfalse;
 	}
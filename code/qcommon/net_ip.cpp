@@ -24,7 +24,8 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include "../qcommon/qcommon.h"
 
 #ifdef _WIN32
-#include <winsock.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
 
 typedef int socklen_t;
 #define EAGAIN			WSAEWOULDBLOCK
@@ -49,6 +50,8 @@ static WSADATA	winsockdata;
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 
 #ifdef MACOS_X
 #include <sys/sockio.h>
@@ -74,6 +77,7 @@ static qboolean usingSocks = qfalse;
 static qboolean networkingEnabled = qfalse;
 
 static cvar_t* net_noudp;
+static cvar_t* net_noipv6;
 static cvar_t* net_socksEnabled;
 static cvar_t* net_socksServer;
 static cvar_t* net_socksPort;
@@ -82,11 +86,14 @@ static cvar_t* net_socksPassword;
 static struct sockaddr socksRelayAddr;
 
 static SOCKET ip_socket = INVALID_SOCKET;
+static SOCKET ip6_socket = INVALID_SOCKET;
 static SOCKET socks_socket = INVALID_SOCKET;
 
 #define MAX_IPS 16
 static int numIP;
 static byte localIP[MAX_IPS][4];
+static int numIP6;
+static byte localIP6[MAX_IPS][16];
 
 
 ///////////////////////////////////////////////////////////////
@@ -151,7 +158,7 @@ static const char* NET_ErrorString()
 }
 
 
-static void NetadrToSockadr( const netadr_t* a, struct sockaddr* s )
+static void NetadrToSockadr( const netadr_t* a, struct sockaddr_storage* s )
 {
 	memset( s, 0, sizeof(*s) );
 
@@ -165,6 +172,12 @@ static void NetadrToSockadr( const netadr_t* a, struct sockaddr* s )
 		((struct sockaddr_in *)s)->sin_addr.s_addr = *(int *)&a->ip;
 		((struct sockaddr_in *)s)->sin_port = a->port;
 	}
+	else if( a->type == NA_IP6 ) {
+		((struct sockaddr_in6 *)s)->sin6_family = AF_INET6;
+		memcpy( &((struct sockaddr_in6 *)s)->sin6_addr, a->ip6, sizeof(a->ip6) );
+		((struct sockaddr_in6 *)s)->sin6_port = a->port;
+		((struct sockaddr_in6 *)s)->sin6_scope_id = a->scope_id;
+	}
 }
 
 
@@ -175,39 +188,72 @@ static void SockadrToNetadr( const struct sockaddr* s, netadr_t* a )
 		*(int *)&a->ip = ((struct sockaddr_in *)s)->sin_addr.s_addr;
 		a->port = ((struct sockaddr_in *)s)->sin_port;
 	}
+	else if (s->sa_family == AF_INET6) {
+		a->type = NA_IP6;
+		memcpy( a->ip6, &((struct sockaddr_in6 *)s)->sin6_addr, sizeof(a->ip6) );
+		a->port = ((struct sockaddr_in6 *)s)->sin6_port;
+		a->scope_id = ((struct sockaddr_in6 *)s)->sin6_scope_id;
+	}
 }
 
 
-static qbool Sys_StringToSockaddr( const char *s, struct sockaddr *sadr )
+static socklen_t SockadrLength( const struct sockaddr_storage* s )
 {
-	memset( sadr, 0, sizeof( *sadr ) );
+	return (s->ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
 
-	((struct sockaddr_in *)sadr)->sin_family = AF_INET;
-	((struct sockaddr_in *)sadr)->sin_port = 0;
 
-	if( s[0] >= '0' && s[0] <= '9' ) {
-		*(int *)&((struct sockaddr_in *)sadr)->sin_addr = inet_addr(s);
-	} else {
-		struct hostent* h;
-		if( ( h = gethostbyname( s ) ) == 0 ) {
-			return 0;
-		}
-		*(int *)&((struct sockaddr_in *)sadr)->sin_addr = *(int *)h->h_addr_list[0];
+// with no family asked for, IPv4 wins unless IPv6 is all we can send on
+
+static qbool Sys_StringToSockaddr( const char *s, struct sockaddr_storage *sadr, netadrtype_t family )
+{
+	struct addrinfo hints;
+	struct addrinfo* res;
+	const struct addrinfo* ai;
+
+	memset( sadr, 0, sizeof( *sadr ) );
+	memset( &hints, 0, sizeof( hints ) );
+	hints.ai_socktype = SOCK_DGRAM;
+	if ( family == NA_IP )
+		hints.ai_family = AF_INET;
+	else if ( family == NA_IP6 )
+		hints.ai_family = AF_INET6;
+	else
+		hints.ai_family = AF_UNSPEC;
+
+	if ( getaddrinfo( s, NULL, &hints, &res ) ) {
+		return qfalse;
 	}
 
-	return qtrue;
+	const int preferred = (ip6_socket != INVALID_SOCKET && ip_socket == INVALID_SOCKET) ? AF_INET6 : AF_INET;
+	const struct addrinfo* found = NULL;
+	for ( ai = res; ai && !found; ai = ai->ai_next ) {
+		if ( ai->ai_family == preferred )
+			found = ai;
+	}
+	for ( ai = res; ai && !found; ai = ai->ai_next ) {
+		if ( ai->ai_family == AF_INET || ai->ai_family == AF_INET6 )
+			found = ai;
+	}
+
+	if ( found )
+		memcpy( sadr, found->ai_addr, found->ai_addrlen );
+
+	freeaddrinfo( res );
+	return (found != NULL);
 }
 
 
-qbool Sys_StringToAdr( const char *s, netadr_t *a )
+qbool Sys_StringToAdr( const char *s, netadr_t *a, netadrtype_t family )
 {
-	struct sockaddr sadr;
+	struct sockaddr_storage sadr;
 
-	if ( !Sys_StringToSockaddr( s, &sadr ) ) {
+	if ( !Sys_StringToSockaddr( s, &sadr, family ) ) {
 		return qfalse;
 	}
 
-	SockadrToNetadr( &sadr, a );
+	memset( a, 0, sizeof(*a) );
+	SockadrToNetadr( (const struct sockaddr*)&sadr, a );
 	return qtrue;
 }
 
@@ -215,75 +261,633 @@ qbool Sys_StringToAdr( const char *s, netadr_t *a )
 ///////////////////////////////////////////////////////////////
 
 
-// never called by the game logic, just the system event queing
+// never called by the game logic, just the event loop
+
+// packets are received up to NET_RECV_BATCH at a time (with a single recvmmsg
+// call on Linux) into buffers big enough for fragment reassembly, and handed
+// out in place: the batch is only refilled once every packet in it has been
+// handed out, so a packet stays valid until the call after that
+
+#define NET_RECV_BATCH	32
+
+static byte		recvData[NET_RECV_BATCH][MAX_MSGLEN];
+static netadr_t	recvFrom[NET_RECV_BATCH];
+static int		recvOffset[NET_RECV_BATCH];	// past the SOCKS header
+static int		recvSize[NET_RECV_BATCH];	// -1 if the packet was dropped
+static int		recvTime[NET_RECV_BATCH];	// Sys_Milliseconds when it came off the socket
+static int		recvCount;
+static int		recvNext;
+
+static qbool NET_ThreadRunning();
+static int NET_ThreadDrain( int first, int last );
+static qbool NET_ThreadCopy( netadr_t* net_from, msg_t* net_message, int* time );
 
 #ifdef _DEBUG
 static int recvfromCount;
 #endif
 
-qbool Sys_GetPacket( netadr_t* net_from, msg_t* net_message )
+
+// fills in where the packet came from and where its payload starts,
+// returns qfalse if it should be dropped
+// the network thread can't print, so it passes report qfalse and counts them
+
+static qbool NET_AcceptPacket( struct sockaddr_storage* from, socklen_t fromlen, const byte* data, int size, int maxsize, netadr_t* net_from, int* offset, qbool report = qtrue )
 {
-	if (ip_socket == INVALID_SOCKET)
+	if ( from->ss_family == AF_INET ) {
+		memset( ((struct sockaddr_in *)from)->sin_zero, 0, 8 );
+	}
+
+	if ( usingSocks && from->ss_family == AF_INET && memcmp( from, &socksRelayAddr, sizeof(socksRelayAddr) ) == 0 ) {
+		if ( size < 10 || data[0] != 0 || data[1] != 0 || data[2] != 0 || data[3] != 1 ) {
+			return qfalse;
+		}
+		net_from->type = NA_IP;
+		net_from->ip[0] = data[4];
+		net_from->ip[1] = data[5];
+		net_from->ip[2] = data[6];
+		net_from->ip[3] = data[7];
+		net_from->port = *(const short *)&data[8];
+		*offset = 10;
+	}
+	else {
+		SockadrToNetadr( (const struct sockaddr*)from, net_from );
+		*offset = 0;
+	}
+
+	if( size == maxsize ) {
+		if ( report )
+			Com_Printf( "Oversize packet from %s\n", NET_AdrToString (*net_from) );
 		return qfalse;
+	}
+
+	return qtrue;
+}
+
+
+static qbool NET_RecvError()
+{
+	int err = socketError;
+	if (err != EAGAIN && err != ECONNRESET)
+		Com_Printf( "NET_GetPacket: %s\n", NET_ErrorString() );
+	return qfalse;
+}
+
+
+// reads what's waiting on one socket into batch slots [first, last),
+// returns the first slot left unfilled
+
+static int NET_RecvSocket( SOCKET sock, int first, int last )
+{
+	struct sockaddr_storage from[NET_RECV_BATCH];
+	int i;
+
+	if (sock == INVALID_SOCKET || first >= last)
+		return first;
+
+#if defined(__linux__)
+	struct mmsghdr msgs[NET_RECV_BATCH];
+	struct iovec iov[NET_RECV_BATCH];
+	const int max = last - first;
+	memset( msgs, 0, sizeof(msgs[0]) * max );
+	for (i = 0; i < max; ++i) {
+		iov[i].iov_base = recvData[first + i];
+		iov[i].iov_len = MAX_MSGLEN;
+		msgs[i].msg_hdr.msg_name = &from[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	const int count = recvmmsg( sock, msgs, max, 0, NULL );
+	if (count == SOCKET_ERROR) {
+		NET_RecvError();
+		return first;
+	}
+
+	const int now = Sys_Milliseconds();
+	for (i = 0; i < count; ++i) {
+		const int n = first + i;
+		recvTime[n] = now;
+		recvSize[n] = msgs[i].msg_len;
+		if ( !NET_AcceptPacket( &from[i], msgs[i].msg_hdr.msg_namelen, recvData[n], recvSize[n], MAX_MSGLEN, &recvFrom[n], &recvOffset[n] ) ) {
+			recvSize[n] = -1;
+		}
+	}
+	return first + count;
+#else
+	for (i = first; i < last; ++i) {
+		socklen_t fromlen = sizeof(from[i]);
+		recvSize[i] = recvfrom( sock, (char*)recvData[i], MAX_MSGLEN, 0, (struct sockaddr*)&from[i], &fromlen );
+		if (recvSize[i] == SOCKET_ERROR) {
+			NET_RecvError();
+			break;
+		}
+		recvTime[i] = Sys_Milliseconds();
+		if ( !NET_AcceptPacket( &from[i], fromlen, recvData[i], recvSize[i], MAX_MSGLEN, &recvFrom[i], &recvOffset[i] ) ) {
+			recvSize[i] = -1;
+		}
+	}
+	return i;
+#endif
+}
+
+
+static void NET_RecvBatch()
+{
+	recvCount = 0;
+	recvNext = 0;
+
+	if (ip_socket == INVALID_SOCKET && ip6_socket == INVALID_SOCKET)
+		return;
 
 #ifdef _DEBUG
 	++recvfromCount;
 #endif
 
-	struct sockaddr from;
+	// the network thread has already taken them off the sockets
+	if (NET_ThreadRunning()) {
+		recvCount = NET_ThreadDrain( 0, NET_RECV_BATCH );
+		return;
+	}
+
+	// a flood on one socket mustn't starve the other one,
+	// so IPv4 only gets the whole batch if IPv6 leaves it
+	const int half = (ip6_socket != INVALID_SOCKET) ? NET_RECV_BATCH / 2 : NET_RECV_BATCH;
+	const int ip4Count = NET_RecvSocket( ip_socket, 0, half );
+	recvCount = NET_RecvSocket( ip6_socket, ip4Count, NET_RECV_BATCH );
+	if (ip4Count == half)
+		recvCount = NET_RecvSocket( ip_socket, recvCount, NET_RECV_BATCH );
+}
+
+
+qbool Sys_GetPacket( netadr_t* net_from, msg_t* net_message, int* time )
+{
+	if (recvNext >= recvCount)
+		NET_RecvBatch();
+
+	while (recvNext < recvCount) {
+		const int i = recvNext++;
+		if (recvSize[i] < 0)
+			continue;
+		MSG_Init( net_message, recvData[i] + recvOffset[i], MAX_MSGLEN - recvOffset[i] );
+		net_message->cursize = recvSize[i] - recvOffset[i];
+		*net_from = recvFrom[i];
+		*time = recvTime[i];
+		return qtrue;
+	}
+
+	return qfalse;
+}
+
+
+static qbool NET_CopyFromSocket( SOCKET sock, netadr_t* net_from, msg_t* net_message )
+{
+	if (sock == INVALID_SOCKET)
+		return qfalse;
+
+	struct sockaddr_storage from;
 	socklen_t fromlen = sizeof(from);
-	int ret = recvfrom( ip_socket, (char*)net_message->data, net_message->maxsize, 0, (struct sockaddr *)&from, &fromlen );
-	if (ret == SOCKET_ERROR) {
-		int err = socketError;
-		if (err == EAGAIN || err == ECONNRESET)
-			return qfalse;
-		Com_Printf( "NET_GetPacket: %s\n", NET_ErrorString() );
+	int offset;
+	int ret = recvfrom( sock, (char*)net_message->data, net_message->maxsize, 0, (struct sockaddr*)&from, &fromlen );
+	if (ret == SOCKET_ERROR)
+		return NET_RecvError();
+
+	if ( !NET_AcceptPacket( &from, fromlen, net_message->data, ret, net_message->maxsize, net_from, &offset ) )
 		return qfalse;
+
+	memmove( net_message->data, net_message->data + offset, ret - offset );
+	net_message->cursize = ret - offset;
+	net_message->readcount = 0;
+	return qtrue;
+}
+
+
+qbool Sys_CopyPacket( netadr_t* net_from, msg_t* net_message, int* time )
+{
+	while (recvNext < recvCount) {
+		const int i = recvNext++;
+		if (recvSize[i] < 0)
+			continue;
+		net_message->cursize = recvSize[i] - recvOffset[i];
+		net_message->readcount = 0;
+		Com_Memcpy( net_message->data, recvData[i] + recvOffset[i], net_message->cursize );
+		*net_from = recvFrom[i];
+		*time = recvTime[i];
+		return qtrue;
 	}
 
-	memset( ((struct sockaddr_in *)&from)->sin_zero, 0, 8 );
+	if (NET_ThreadRunning())
+		return NET_ThreadCopy( net_from, net_message, time );
 
-	if ( usingSocks && memcmp( &from, &socksRelayAddr, fromlen ) == 0 ) {
-		if ( ret < 10 || net_message->data[0] != 0 || net_message->data[1] != 0 || net_message->data[2] != 0 || net_message->data[3] != 1 ) {
-			return qfalse;
+	*time = Sys_Milliseconds();
+	return NET_CopyFromSocket( ip_socket, net_from, net_message ) ||
+		NET_CopyFromSocket( ip6_socket, net_from, net_message );
+}
+
+
+/*
+=============================================================================
+
+NETWORK THREAD
+
+with net_thread 1, a thread blocks on the sockets and queues every packet
+the moment it arrives, stamped with the time it did: a long frame no longer
+leaves them sitting in the socket buffers, and pings no longer include
+however long the frame took to get around to reading them
+
+the packets go through an event queue (see EQ_Create) as SE_PACKET events
+laid out the way the journal has them: a netadr_t followed by the data
+the sockets are only closed once the thread has been stopped
+
+=============================================================================
+*/
+
+#define NET_THREAD_QUEUE	256
+
+static cvar_t* net_thread;
+
+static eventQueue_t* netThreadQueue;
+static volatile int netThreadQuit;
+static volatile int netThreadDropped;	// oversize and bad SOCKS packets
+static volatile int netThreadErrors;	// recvfrom failures
+static int netThreadReported;
+
+#ifdef _WIN32
+static HANDLE netThread;
+static HANDLE netThreadWake;		// auto-reset, set whenever packets were queued
+#else
+static pthread_t netThread;
+static qbool netThreadStarted;
+static pthread_mutex_t netThreadMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t netThreadWake = PTHREAD_COND_INITIALIZER;
+static qbool netThreadSignaled;
+#endif
+
+
+static qbool NET_ThreadRunning()
+{
+#ifdef _WIN32
+	return ( netThread != NULL );
+#else
+	return netThreadStarted;
+#endif
+}
+
+
+// queues everything that's waiting on the socket, returns how many were queued
+
+static int NET_ThreadRecv( SOCKET sock )
+{
+	// the data goes right after the room for the address, so that
+	// the address can be written just before the payload without a copy
+	static byte buf[sizeof(netadr_t) + MAX_MSGLEN];
+	byte* const data = buf + sizeof(netadr_t);
+	int count = 0;
+
+	for (;;) {
+		struct sockaddr_storage from;
+		socklen_t fromlen = sizeof(from);
+		const int size = recvfrom( sock, (char*)data, MAX_MSGLEN, 0, (struct sockaddr*)&from, &fromlen );
+		if (size == SOCKET_ERROR) {
+			const int err = socketError;
+			if (err != EAGAIN && err != ECONNRESET)
+				Sys_AtomicAdd( &netThreadErrors, 1 );
+			return count;
 		}
-		net_from->type = NA_IP;
-		net_from->ip[0] = net_message->data[4];
-		net_from->ip[1] = net_message->data[5];
-		net_from->ip[2] = net_message->data[6];
-		net_from->ip[3] = net_message->data[7];
-		net_from->port = *(short *)&net_message->data[8];
-		net_message->readcount = 10;
+
+		const int now = Sys_Milliseconds();
+		netadr_t adr;
+		int offset;
+		if ( !NET_AcceptPacket( &from, fromlen, data, size, MAX_MSGLEN, &adr, &offset, qfalse ) ) {
+			Sys_AtomicAdd( &netThreadDropped, 1 );
+			continue;
+		}
+
+		byte* const event = data + offset - sizeof(netadr_t);
+		Com_Memcpy( event, &adr, sizeof(adr) );
+
+		sysEvent_t ev;
+		Com_Memset( &ev, 0, sizeof(ev) );
+		ev.evTime = now;
+		ev.evType = SE_PACKET;
+		ev.evPtrLength = sizeof(netadr_t) + size - offset;
+		ev.evPtr = event;
+		if ( EQ_Push( netThreadQueue, &ev ) )
+			++count;
 	}
-	else {
-		SockadrToNetadr( &from, net_from );
-		net_message->readcount = 0;
+}
+
+
+static void NET_ThreadLoop()
+{
+	while (!netThreadQuit) {
+		// the timeout is only there to notice netThreadQuit
+		struct timeval timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 100 * 1000;
+
+		fd_set fdset;
+		FD_ZERO( &fdset );
+		SOCKET highest = 0;
+		if (ip_socket != INVALID_SOCKET) {
+			FD_SET( ip_socket, &fdset );
+			highest = ip_socket;
+		}
+		if (ip6_socket != INVALID_SOCKET) {
+			FD_SET( ip6_socket, &fdset );
+			if (ip6_socket > highest)
+				highest = ip6_socket;
+		}
+
+		if (select( highest + 1, &fdset, NULL, NULL, &timeout ) <= 0)
+			continue;
+
+		int count = 0;
+		if (ip_socket != INVALID_SOCKET && FD_ISSET( ip_socket, &fdset ))
+			count += NET_ThreadRecv( ip_socket );
+		if (ip6_socket != INVALID_SOCKET && FD_ISSET( ip6_socket, &fdset ))
+			count += NET_ThreadRecv( ip6_socket );
+
+		if (!count)
+			continue;
+
+#ifdef _WIN32
+		SetEvent( netThreadWake );
+#else
+		pthread_mutex_lock( &netThreadMutex );
+		netThreadSignaled = qtrue;
+		pthread_cond_signal( &netThreadWake );
+		pthread_mutex_unlock( &netThreadMutex );
+#endif
+	}
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI NET_Thread( LPVOID )
+{
+	NET_ThreadLoop();
+	return 0;
+}
+#else
+static void* NET_Thread( void* )
+{
+	NET_ThreadLoop();
+	return NULL;
+}
+#endif
+
+
+static void NET_StartThread()
+{
+	if (NET_ThreadRunning() || !net_thread->integer)
+		return;
+
+	if (ip_socket == INVALID_SOCKET && ip6_socket == INVALID_SOCKET)
+		return;
+
+	if (!netThreadQueue)
+		netThreadQueue = EQ_Create( "network", NET_THREAD_QUEUE, sizeof(netadr_t) + MAX_MSGLEN );
+
+	netThreadQuit = 0;
+#ifdef _WIN32
+	if (!netThreadWake)
+		netThreadWake = CreateEvent( NULL, FALSE, FALSE, NULL );
+	netThread = CreateThread( NULL, 0, NET_Thread, NULL, 0, NULL );
+	if (!netThread) {
+#else
+	netThreadStarted = !pthread_create( &netThread, NULL, NET_Thread, NULL );
+	if (!netThreadStarted) {
+#endif
+		Com_Printf( "WARNING: the network thread couldn't be started\n" );
+		return;
+	}
+
+	Com_Printf( "Network thread started\n" );
+}
+
+
+static void NET_StopThread()
+{
+	if (!NET_ThreadRunning())
+		return;
+
+	netThreadQuit = 1;
+#ifdef _WIN32
+	WaitForSingleObject( netThread, INFINITE );
+	CloseHandle( netThread );
+	netThread = NULL;
+#else
+	pthread_join( netThread, NULL );
+	netThreadStarted = qfalse;
+#endif
+
+	// the sockets are about to go, and so is whatever came from them
+	while (EQ_Front( netThreadQueue ))
+		EQ_Pop( netThreadQueue );
+}
+
+
+static void NET_ThreadReport()
+{
+	const int problems = netThreadDropped + netThreadErrors;
+	if (problems == netThreadReported)
+		return;
+
+	Com_Printf( "WARNING: the network thread dropped %i packets and had %i receive errors so far\n", netThreadDropped, netThreadErrors );
+	netThreadReported = problems;
+}
+
+
+// moves packets from the queue into batch slots [first, last),
+// returns the first slot left unfilled
+
+static int NET_ThreadDrain( int first, int last )
+{
+	NET_ThreadReport();
+
+	int i;
+	for (i = first; i < last; ++i) {
+		const sysEvent_t* ev = EQ_Front( netThreadQueue );
+		if (!ev)
+			break;
+		recvFrom[i] = *(const netadr_t*)ev->evPtr;
+		recvOffset[i] = 0;
+		recvSize[i] = ev->evPtrLength - sizeof(netadr_t);
+		recvTime[i] = ev->evTime;
+		Com_Memcpy( recvData[i], (const netadr_t*)ev->evPtr + 1, recvSize[i] );
+		EQ_Pop( netThreadQueue );
 	}
 
-	if( ret == net_message->maxsize ) {
-		Com_Printf( "Oversize packet from %s\n", NET_AdrToString (*net_from) );
+	return i;
+}
+
+
+static qbool NET_ThreadCopy( netadr_t* net_from, msg_t* net_message, int* time )
+{
+	const sysEvent_t* ev = EQ_Front( netThreadQueue );
+	if (!ev)
+		return qfalse;
+
+	const int size = ev->evPtrLength - sizeof(netadr_t);
+	if (size > net_message->maxsize) {
+		EQ_Pop( netThreadQueue );
 		return qfalse;
 	}
 
-	net_message->cursize = ret;
+	*net_from = *(const netadr_t*)ev->evPtr;
+	*time = ev->evTime;
+	net_message->cursize = size;
+	net_message->readcount = 0;
+	Com_Memcpy( net_message->data, (const netadr_t*)ev->evPtr + 1, size );
+	EQ_Pop( netThreadQueue );
+
 	return qtrue;
 }
 
 
+// returns qtrue if packets came in before msec was up
+
+static qbool NET_ThreadSleep( int msec )
+{
+	if (EQ_Front( netThreadQueue ))
+		return qtrue;
+
+#ifdef _WIN32
+	return ( WaitForSingleObject( netThreadWake, msec ) == WAIT_OBJECT_0 );
+#else
+	struct timespec ts;
+	clock_gettime( CLOCK_REALTIME, &ts );
+	ts.tv_sec += msec / 1000;
+	ts.tv_nsec += (msec % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock( &netThreadMutex );
+	while (!netThreadSignaled) {
+		if (pthread_cond_timedwait( &netThreadWake, &netThreadMutex, &ts ))
+			break;
+	}
+	const qbool woken = netThreadSignaled;
+	netThreadSignaled = qfalse;
+	pthread_mutex_unlock( &netThreadMutex );
+
+	return woken;
+#endif
+}
+
+
+// while a batch is open, packets are only copied out along with their
+// address, and they all go out in order when it's flushed: with a single
+// sendmmsg call on Linux, so a server frame's worth of snapshots and
+// fragments costs one syscall instead of one per datagram
+
+#define NET_SEND_BATCH		256
+#define NET_SEND_BATCH_DATA	(256 * 1024)
+
+static struct sockaddr_storage	sendAddr[NET_SEND_BATCH];
+static SOCKET			sendSocket[NET_SEND_BATCH];
+static netadrtype_t		sendType[NET_SEND_BATCH];
+static int				sendOffset[NET_SEND_BATCH];
+static int				sendLength[NET_SEND_BATCH];
+static byte				sendData[NET_SEND_BATCH_DATA];
+static int				sendCount;
+static int				sendDataUsed;
+static qbool			sendBatching;
+
+
+static void NET_SendError( netadrtype_t type )
+{
+	int err = socketError;
+
+	// wouldblock is silent
+	if( err == EAGAIN ) {
+		return;
+	}
+
+	// some PPP links do not allow broadcasts and return an error
+	if( ( err == EADDRNOTAVAIL ) && ( ( type == NA_BROADCAST ) ) ) {
+		return;
+	}
+
+	Com_Printf( "NET_SendPacket: %s\n", NET_ErrorString() );
+}
+
+
+static void NET_SendBatch()
+{
+	int i;
+
+#if defined(__linux__)
+	struct mmsghdr msgs[NET_SEND_BATCH];
+	struct iovec iov[NET_SEND_BATCH];
+	memset( msgs, 0, sizeof(msgs[0]) * sendCount );
+	for (i = 0; i < sendCount; ++i) {
+		iov[i].iov_base = sendData + sendOffset[i];
+		iov[i].iov_len = sendLength[i];
+		msgs[i].msg_hdr.msg_name = &sendAddr[i];
+		msgs[i].msg_hdr.msg_namelen = SockadrLength( &sendAddr[i] );
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	// one call per run of packets going out on the same socket
+	// it stops at the first packet that fails, so report that one and carry on after it
+	for (i = 0; i < sendCount; ) {
+		int run = 1;
+		while (i + run < sendCount && sendSocket[i + run] == sendSocket[i])
+			++run;
+		const int sent = sendmmsg( sendSocket[i], msgs + i, run, 0 );
+		if (sent == SOCKET_ERROR) {
+			NET_SendError( sendType[i] );
+			++i;
+		} else {
+			i += sent;
+		}
+	}
+#else
+	for (i = 0; i < sendCount; ++i) {
+		if (sendto( sendSocket[i], (const char*)sendData + sendOffset[i], sendLength[i], 0, (const struct sockaddr*)&sendAddr[i], SockadrLength( &sendAddr[i] ) ) == SOCKET_ERROR) {
+			NET_SendError( sendType[i] );
+		}
+	}
+#endif
+
+	sendCount = 0;
+	sendDataUsed = 0;
+}
+
+
+void Sys_BeginPacketBatch()
+{
+	sendBatching = qtrue;
+}
+
+
+void Sys_FlushPacketBatch()
+{
+	sendBatching = qfalse;
+	if (sendCount)
+		NET_SendBatch();
+}
+
+
 void Sys_SendPacket( int length, const void* data, netadr_t to )
 {
-	static char socksBuf[4096];
-	int ret;
+	static char socksBuf[MAX_MSGLEN + 10];
 
-	if( to.type != NA_BROADCAST && to.type != NA_IP ) {
+	if( to.type != NA_BROADCAST && to.type != NA_IP && to.type != NA_IP6 ) {
 		Com_Error( ERR_FATAL, "Sys_SendPacket: bad address type" );
 		return;
 	}
 
-	if (ip_socket == INVALID_SOCKET)
+	const SOCKET sock = (to.type == NA_IP6) ? ip6_socket : ip_socket;
+	if (sock == INVALID_SOCKET)
 		return;
 
-	struct sockaddr addr;
+	struct sockaddr_storage addr;
 	NetadrToSockadr( &to, &addr );
 
 	if( usingSocks && to.type == NA_IP ) {
@@ -294,27 +898,29 @@ void Sys_SendPacket( int length, const void* data, netadr_t to )
 		*(int *)&socksBuf[4] = ((struct sockaddr_in *)&addr)->sin_addr.s_addr;
 		*(short *)&socksBuf[8] = ((struct sockaddr_in *)&addr)->sin_port;
 		memcpy( &socksBuf[10], data, length );
-		ret = sendto( ip_socket, socksBuf, length+10, 0, &socksRelayAddr, sizeof(socksRelayAddr) );
-	}
-	else {
-		ret = sendto( ip_socket, (const char*)data, length, 0, &addr, sizeof(addr) );
+		data = socksBuf;
+		length += 10;
+		memset( &addr, 0, sizeof(addr) );
+		memcpy( &addr, &socksRelayAddr, sizeof(socksRelayAddr) );
 	}
 
-	if (ret == SOCKET_ERROR) {
-		int err = socketError;
-
-		// wouldblock is silent
-		if( err == EAGAIN ) {
-			return;
-		}
-
-		// some PPP links do not allow broadcasts and return an error
-		if( ( err == EADDRNOTAVAIL ) && ( ( to.type == NA_BROADCAST ) ) ) {
-			return;
-		}
-
-		Com_Printf( "NET_SendPacket: %s\n", NET_ErrorString() );
+	if (!sendBatching) {
+		if (sendto( sock, (const char*)data, length, 0, (const struct sockaddr*)&addr, SockadrLength( &addr ) ) == SOCKET_ERROR)
+			NET_SendError( to.type );
+		return;
 	}
+
+	if (sendCount == NET_SEND_BATCH || sendDataUsed + length > NET_SEND_BATCH_DATA)
+		NET_SendBatch();
+
+	sendAddr[sendCount] = addr;
+	sendSocket[sendCount] = sock;
+	sendType[sendCount] = to.type;
+	sendOffset[sendCount] = sendDataUsed;
+	sendLength[sendCount] = length;
+	memcpy( sendData + sendDataUsed, data, length );
+	sendDataUsed += length;
+	++sendCount;
 }
 
 
@@ -330,6 +936,26 @@ qbool Sys_IsLANAddress( const netadr_t& adr )
 	if (adr.type == NA_LOOPBACK)
 		return qtrue;
 
+	if (adr.type == NA_IP6) {
+		static const byte loopback6[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+		if (!memcmp( adr.ip6, loopback6, sizeof(loopback6) ))
+			return qtrue;
+
+		// RFC4291 link-local (fe80::/10) and RFC4193 unique local (fc00::/7)
+		if (adr.ip6[0] == 0xfe && (adr.ip6[1] & 0xc0) == 0x80)
+			return qtrue;
+		if ((adr.ip6[0] & 0xfe) == 0xfc)
+			return qtrue;
+
+		// anything else has to be on the same /64 as one of our own addresses
+		for ( i = 0 ; i < numIP6 ; i++ ) {
+			if (!memcmp( adr.ip6, localIP6[i], 8 ))
+				return qtrue;
+		}
+
+		return qfalse;
+	}
+
 	if (adr.type != NA_IP)
 		return qfalse;
 
@@ -383,11 +1009,29 @@ qbool Sys_IsLANAddress( const netadr_t& adr )
 }
 
 
+static const char* NET_IP6String( const byte* ip6 )
+{
+	static char s[NI_MAXHOST];
+	struct sockaddr_in6 sadr;
+
+	memset( &sadr, 0, sizeof(sadr) );
+	sadr.sin6_family = AF_INET6;
+	memcpy( &sadr.sin6_addr, ip6, 16 );
+	if (getnameinfo( (const struct sockaddr*)&sadr, sizeof(sadr), s, sizeof(s), NULL, 0, NI_NUMERICHOST ))
+		return "?";
+
+	return s;
+}
+
+
 void Sys_ShowIP()
 {
 	for (int i = 0; i < numIP; ++i) {
 		Com_Printf( "IP: %i.%i.%i.%i\n", localIP[i][0], localIP[i][1], localIP[i][2], localIP[i][3] );
 	}
+	for (int i = 0; i < numIP6; ++i) {
+		Com_Printf( "IP6: %s\n", NET_IP6String( localIP6[i] ) );
+	}
 }
 
 
@@ -426,7 +1070,9 @@ static SOCKET NET_IPSocket( const char* net_interface, int port )
 		address.sin_addr.s_addr = INADDR_ANY;
 	}
 	else {
-		Sys_StringToSockaddr( net_interface, (struct sockaddr *)&address );
+		struct sockaddr_storage sadr;
+		Sys_StringToSockaddr( net_interface, &sadr, NA_IP );
+		address.sin_addr = ((struct sockaddr_in *)&sadr)->sin_addr;
 	}
 
 	address.sin_port = (port == PORT_ANY) ? 0 : htons( (unsigned short)port );
@@ -442,6 +1088,57 @@ static SOCKET NET_IPSocket( const char* net_interface, int port )
 }
 
 
+// IPv6 only: the IPv4 socket already has the v4 traffic, and
+// taking v4-mapped addresses too would stop both binding to a port
+
+static SOCKET NET_IP6Socket( const char* net_interface, int port )
+{
+	SOCKET newsocket;
+	struct sockaddr_storage address;
+
+	Com_Printf( "Opening IP6 socket: [%s]:%i\n", net_interface, port );
+
+	if( ( newsocket = socket( AF_INET6, SOCK_DGRAM, IPPROTO_UDP ) ) == INVALID_SOCKET ) {
+		int err = socketError;
+		if (err != EAFNOSUPPORT) {
+			Com_Printf( "WARNING: NET_IP6Socket: socket: %s\n", NET_ErrorString() );
+		}
+		return INVALID_SOCKET;
+	}
+
+	// make it non-blocking
+	qboolean uglyapi = qtrue;
+	if( ioctlsocket( newsocket, FIONBIO, (u_long*)&uglyapi ) == SOCKET_ERROR ) {
+		Com_Printf( "WARNING: NET_IP6Socket: ioctl FIONBIO: %s\n", NET_ErrorString() );
+		closesocket( newsocket );
+		return INVALID_SOCKET;
+	}
+
+#ifdef IPV6_V6ONLY
+	int v6only = 1;
+	if( setsockopt( newsocket, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&v6only, sizeof(v6only) ) == SOCKET_ERROR ) {
+		Com_Printf( "WARNING: NET_IP6Socket: setsockopt IPV6_V6ONLY: %s\n", NET_ErrorString() );
+	}
+#endif
+
+	if( !net_interface[0] || !Sys_StringToSockaddr( net_interface, &address, NA_IP6 ) ) {
+		memset( &address, 0, sizeof(address) );
+		((struct sockaddr_in6 *)&address)->sin6_addr = in6addr_any;
+	}
+
+	((struct sockaddr_in6 *)&address)->sin6_family = AF_INET6;
+	((struct sockaddr_in6 *)&address)->sin6_port = (port == PORT_ANY) ? 0 : htons( (unsigned short)port );
+
+	if( bind( newsocket, (const sockaddr*)&address, sizeof(struct sockaddr_in6) ) == SOCKET_ERROR ) {
+		Com_Printf( "WARNING: NET_IP6Socket: bind: %s\n", NET_ErrorString() );
+		closesocket( newsocket );
+		return INVALID_SOCKET;
+	}
+
+	return newsocket;
+}
+
+
 static void NET_OpenSocks( int port )
 {
 	const int SOCKS_VERSION = 5;
@@ -765,15 +1462,48 @@ static void NET_GetLocalAddress()
 #endif
 
 
+// the interface list above is IPv4 only everywhere,
+// so the global IPv6 addresses come from the hostname instead
+
+static void NET_GetLocalAddress6()
+{
+	struct addrinfo hints;
+	struct addrinfo* res;
+
+	numIP6 = 0;
+
+	char hostname[256];
+	if (gethostname( hostname, sizeof(hostname) ) == SOCKET_ERROR)
+		return;
+
+	memset( &hints, 0, sizeof(hints) );
+	hints.ai_family = AF_INET6;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo( hostname, NULL, &hints, &res ))
+		return;
+
+	for (const struct addrinfo* ai = res; ai && (numIP6 < MAX_IPS); ai = ai->ai_next) {
+		if (ai->ai_family != AF_INET6)
+			continue;
+		memcpy( localIP6[numIP6], &((const struct sockaddr_in6 *)ai->ai_addr)->sin6_addr, 16 );
+		Com_Printf( "IP6: %s\n", NET_IP6String( localIP6[numIP6] ) );
+		++numIP6;
+	}
+
+	freeaddrinfo( res );
+}
+
+
 static void NET_OpenIP()
 {
 	const cvar_t* ip = Cvar_Get( "net_ip", "localhost", CVAR_LATCH );
 	int port = Cvar_Get( "net_port", va( "%i", PORT_SERVER ), CVAR_LATCH )->integer;
+	int i;
 
 	// automatically scan for a valid port, so multiple
 	// dedicated servers can be started without requiring
 	// a different net_port for each one
-	for (int i = 0; i < 10; ++i) {
+	for (i = 0; i < 10; ++i) {
 		ip_socket = NET_IPSocket( ip->string, port + i );
 		if (ip_socket != INVALID_SOCKET) {
 			Cvar_SetValue( "net_port", port + i );
@@ -781,11 +1511,29 @@ static void NET_OpenIP()
 				NET_OpenSocks( port + i );
 			}
 			NET_GetLocalAddress();
+			break;
+		}
+	}
+
+	if (ip_socket == INVALID_SOCKET)
+		Com_Printf( "WARNING: Couldn't allocate IP port\n");
+
+	if (net_noipv6->integer)
+		return;
+
+	const cvar_t* ip6 = Cvar_Get( "net_ip6", "::", CVAR_LATCH );
+	int port6 = Cvar_Get( "net_port6", va( "%i", PORT_SERVER ), CVAR_LATCH )->integer;
+
+	for (i = 0; i < 10; ++i) {
+		ip6_socket = NET_IP6Socket( ip6->string, port6 + i );
+		if (ip6_socket != INVALID_SOCKET) {
+			Cvar_SetValue( "net_port6", port6 + i );
+			NET_GetLocalAddress6();
 			return;
 		}
 	}
 
-	Com_Printf( "WARNING: Couldn't allocate IP port\n");
+	Com_Printf( "WARNING: Couldn't allocate IP6 port\n");
 }
 
 
@@ -800,6 +1548,14 @@ static qboolean NET_GetCvars()
 		modified = qtrue;
 	net_noudp = Cvar_Get( "net_noudp", "0", CVAR_LATCH | CVAR_ARCHIVE );
 
+	if (net_noipv6 && net_noipv6->modified)
+		modified = qtrue;
+	net_noipv6 = Cvar_Get( "net_noipv6", "0", CVAR_LATCH | CVAR_ARCHIVE );
+
+	if (net_thread && net_thread->modified)
+		modified = qtrue;
+	net_thread = Cvar_Get( "net_thread", "0", CVAR_LATCH | CVAR_ARCHIVE );
+
 	if (net_socksEnabled && net_socksEnabled->modified)
 		modified = qtrue;
 	net_socksEnabled = Cvar_Get( "net_socksEnabled", "0", CVAR_LATCH | CVAR_ARCHIVE );
@@ -848,11 +1604,23 @@ static void NET_Config( qboolean enableNetworking )
 	}
 
 	if (stop) {
+		NET_StopThread();
+
 		if (ip_socket != INVALID_SOCKET) {
 			closesocket( ip_socket );
 			ip_socket = INVALID_SOCKET;
 		}
 
+		if (ip6_socket != INVALID_SOCKET) {
+			closesocket( ip6_socket );
+			ip6_socket = INVALID_SOCKET;
+		}
+
+		recvCount = 0;
+		recvNext = 0;
+		sendCount = 0;
+		sendDataUsed = 0;
+
 		if (socks_socket != INVALID_SOCKET) {
 			closesocket( socks_socket );
 			socks_socket = INVALID_SOCKET;
@@ -861,6 +1629,7 @@ static void NET_Config( qboolean enableNetworking )
 
 	if (enableNetworking && !net_noudp->integer) {
 		NET_OpenIP();
+		NET_StartThread();
 	}
 }
 
@@ -868,7 +1637,7 @@ static void NET_Config( qboolean enableNetworking )
 void NET_Init()
 {
 #ifdef _WIN32
-	int r = WSAStartup( MAKEWORD( 1, 1 ), &winsockdata );
+	int r = WSAStartup( MAKEWORD( 2, 2 ), &winsockdata );
 	if (r) {
 		Com_Printf( "WARNING: Winsock initialization failed, returned %d\n", r );
 		return;
@@ -906,17 +1675,31 @@ void NET_Sleep( int msec )
 	if (!com_dedicated->integer)
 		return; // we're not a server, just run full speed
 
-	if (ip_socket == INVALID_SOCKET)
+	if (ip_socket == INVALID_SOCKET && ip6_socket == INVALID_SOCKET)
 		return;
 
 	if (msec < 0)
 		return;
 
+	if (NET_ThreadRunning()) {
+		NET_ThreadSleep( msec );
+		return;
+	}
+
+	SOCKET highest = 0;
 	FD_ZERO(&fdset);
-	FD_SET(ip_socket, &fdset);
+	if (ip_socket != INVALID_SOCKET) {
+		FD_SET(ip_socket, &fdset);
+		highest = ip_socket;
+	}
+	if (ip6_socket != INVALID_SOCKET) {
+		FD_SET(ip6_socket, &fdset);
+		if (ip6_socket > highest)
+			highest = ip6_socket;
+	}
 	timeout.tv_sec = msec/1000;
 	timeout.tv_usec = (msec%1000)*1000;
-	select(ip_socket+1, &fdset, NULL, NULL, &timeout);
+	select(highest+1, &fdset, NULL, NULL, &timeout);
 }
 
 
@@ -40,6 +40,8 @@ typedef struct {
 	int		cursize;
 	int		readcount;
 	int		bit;				// for bitwise reads and writes
+	uint64_t	bitBuffer;		// what's already been written to the 64-bit word bit is in
+	int		bitBufferPos;		// the bit position bitBuffer is up to date for
 } msg_t;
 
 void MSG_Init (msg_t *buf, byte *data, int length);
@@ -79,14 +81,17 @@ void	MSG_ReadData (msg_t *sb, void *buffer, int size);
 void MSG_WriteDeltaUsercmdKey( msg_t* msg, int key, const usercmd_t* from, usercmd_t* to );
 void MSG_ReadDeltaUsercmdKey( msg_t* msg, int key, const usercmd_t* from, usercmd_t* to );
 
-void MSG_WriteDeltaEntity( msg_t* msg, const entityState_t* from, entityState_t* to, qbool force );
+void MSG_WriteDeltaEntity( msg_t* msg, const entityState_t* from, const entityState_t* to, qbool force );
 void MSG_ReadDeltaEntity( msg_t* msg, const entityState_t* from, entityState_t* to, int number );
 
-void MSG_WriteDeltaPlayerstate( msg_t* msg, const playerState_t* from, playerState_t* to );
+void MSG_WriteDeltaPlayerstate( msg_t* msg, const playerState_t* from, const playerState_t* to );
 void MSG_ReadDeltaPlayerstate( msg_t* msg, const playerState_t* from, playerState_t* to );
 
 
 // void MSG_ReportChangeVectors_f( void );
+void MSG_Benchmark_f();
+void MSG_Fuzz_f();
+void MSG_DeltaBenchmark_f();
 
 //============================================================================
 
@@ -114,6 +119,8 @@ typedef enum {
 	NA_LOOPBACK,
 	NA_BROADCAST,
 	NA_IP,
+	NA_IP6,
+	NA_UNSPEC		// only for lookups: either IPv4 or IPv6 will do
 } netadrtype_t;
 
 typedef enum {
@@ -124,6 +131,8 @@ typedef enum {
 typedef struct {
 	netadrtype_t type;
 	byte ip[4];
+	byte ip6[16];
+	unsigned scope_id;	// the interface a link-local IPv6 address is on
 	unsigned short port;
 } netadr_t;
 
@@ -131,6 +140,8 @@ void NET_Init();
 void NET_Shutdown();
 void NET_Restart();
 void NET_FlushPacketQueue();
+void NET_BeginPacketBatch();
+void NET_FlushPacketBatch();
 void NET_SendPacket( netsrc_t sock, int length, const void* data, const netadr_t& to );
 void QDECL NET_OutOfBandPrint( netsrc_t sock, const netadr_t& adr, const char* format, ... );
 void QDECL NET_OutOfBandData( netsrc_t sock, const netadr_t& adr, const byte* data, int len );
@@ -139,7 +150,9 @@ qbool NET_CompareAdr( const netadr_t& a, const netadr_t& b );
 qbool NET_CompareBaseAdr( const netadr_t& a, const netadr_t& b );
 qbool NET_IsLocalAddress( const netadr_t& a );
 const char* NET_AdrToString( const netadr_t& a );
-qbool NET_StringToAdr( const char* s, netadr_t* a );
+// "host", "host:port", "a.b.c.d[:port]", "[v6addr][:port]" or a bare "v6addr"
+// family NA_IP or NA_IP6 restricts the lookup, NA_UNSPEC takes IPv4 if it can
+qbool NET_StringToAdr( const char* s, netadr_t* a, netadrtype_t family = NA_UNSPEC );
 qbool NET_GetLoopPacket( netsrc_t sock, netadr_t *net_from, msg_t *net_message );
 void NET_Sleep( int msec );
 
@@ -278,8 +291,36 @@ typedef enum {
 	TRAP_TESTPRINTFLOAT
 } sharedTraps_t;
 
+// system calls that only work on their arguments, which the vm runs itself
+// rather than going through the module's systemCalls: the interpreter and
+// compiled code call them directly, and the compiler inlines the simple ones
+// the modules still handle them too, for dlls and calls through pointers
+typedef enum {
+	VM_LEAF_MEMSET,
+	VM_LEAF_MEMCPY,
+	VM_LEAF_STRNCPY,
+	VM_LEAF_SIN,
+	VM_LEAF_COS,
+	VM_LEAF_ATAN2,
+	VM_LEAF_SQRT,
+	VM_LEAF_FLOOR,
+	VM_LEAF_CEIL,
+	VM_LEAF_ACOS,
+	VM_LEAF_MATRIXMULTIPLY,
+	VM_LEAF_ANGLEVECTORS,
+	VM_LEAF_PERPENDICULARVECTOR,
+	VM_LEAF_COUNT
+} vmLeafTrap_t;
+
+// the numbers differ between modules, so each one registers its own
+typedef struct {
+	int				trap;
+	vmLeafTrap_t	leaf;
+} vmLeafTrapDef_t;
+
 void	VM_Init();
-vm_t	*VM_Create( const char *module, intptr_t (*systemCalls)(intptr_t *), vmInterpret_t interpret );
+vm_t	*VM_Create( const char *module, intptr_t (*systemCalls)(intptr_t *),
+				const vmLeafTrapDef_t* leafTraps, int numLeafTraps, vmInterpret_t interpret );
 // module should be bare: "cgame", not "cgame.dll" or "vm/cgame.qvm"
 
 void	VM_Free( vm_t *vm );
@@ -288,6 +329,9 @@ vm_t	*VM_Restart( vm_t *vm );
 
 intptr_t	QDECL VM_Call( vm_t *vm, int callNum, ... );
 
+// how many of the count elements of size bytes at a VMA pointer are in the vm's memory
+int		VM_ArgCount( intptr_t intValue, int count, int size );
+
 void	VM_Debug( int level );
 
 
@@ -771,6 +815,9 @@ void Hunk_Clear();
 void Hunk_ClearToMark();
 void Hunk_SetMark();
 qbool Hunk_CheckMark();
+qbool Hunk_BeginRetained();
+int Hunk_EndRetained();
+int Hunk_Retained();
 void Hunk_ClearTempMemory();
 void* Hunk_AllocateTempMemory( int size );
 void Hunk_FreeTempMemory( void* buf );
@@ -855,7 +902,7 @@ void S_ClearSoundBuffer( void );
 void SV_Init();
 void SV_Shutdown( const char* finalmsg );
 void SV_Frame( int msec );
-void SV_PacketEvent( const netadr_t& from, msg_t* msg );
+void SV_PacketEvent( const netadr_t& from, msg_t* msg, int time );	// time is when it was received
 qbool SV_GameCommand();
 
 
@@ -890,7 +937,7 @@ typedef enum {
 	SE_MOUSE,	// evValue and evValue2 are reletive signed x / y moves
 	SE_JOYSTICK_AXIS,	// evValue is an axis number and evValue2 is the current state (-127 to 127)
 	SE_CONSOLE,	// evPtr is a char*
-	SE_PACKET	// evPtr is a netadr_t followed by data bytes to evPtrLength
+	SE_PACKET	// evPtr is a netadr_t followed by data bytes to evPtrLength (journal playback only)
 } sysEventType_t;
 
 typedef struct {
@@ -903,6 +950,23 @@ typedef struct {
 
 sysEvent_t Sys_GetEvent();
 
+// bounded lock-free queues of events that any thread can add to,
+// but that only the main thread takes from
+// producers never allocate: evPtr's data is copied into room set aside in the slot
+// (unless payloadSize is 0, in which case evPtr itself is kept)
+// and a full queue drops the new event and counts it, see "eventqueues"
+typedef struct eventQueue_s eventQueue_t;
+eventQueue_t* EQ_Create( const char* name, int numSlots, int payloadSize );	// numSlots must be a power of 2
+qbool EQ_Push( eventQueue_t* q, const sysEvent_t* ev );	// an evTime of 0 will get the current time
+const sysEvent_t* EQ_Front( eventQueue_t* q );	// NULL if it's empty, evPtr is valid until EQ_Pop
+void EQ_Pop( eventQueue_t* q );
+qbool EQ_Get( eventQueue_t* q, sysEvent_t* ev );	// EQ_Front + EQ_Pop, but evPtr is copied to the zone
+
+// what Sys_QueEvent adds to and Sys_GetEvent returns before looking for new input
+#define MAX_SYS_EVENTS			512
+#define MAX_SYS_EVENT_PAYLOAD	1024
+extern eventQueue_t* com_sysEvents;
+
 void Sys_Init();
 void Sys_Quit();
 
@@ -919,6 +983,7 @@ void	Sys_Print( const char *msg );
 // Sys_Milliseconds should only be used for profiling purposes,
 // any game related timing information should come from event timestamps
 int		Sys_Milliseconds();
+int64_t	Sys_Microseconds();		// for timing short things, from an arbitrary origin
 
 // the system console is shown when a dedicated server is running
 void	Sys_DisplaySystemConsole( qbool show );
@@ -933,10 +998,18 @@ void	Sys_StreamSeek( fileHandle_t f, int offset, int origin );
 void	Sys_ShowConsole( int level, qbool quitOnClose );
 void	Sys_SetErrorText( const char *text );
 
-qbool	Sys_GetPacket( netadr_t* net_from, msg_t* net_message );
+// received packets are handed out in place, and net_message->data stays valid
+// until the next Sys_GetPacket call that has to go back to the socket
+// Sys_CopyPacket copies into net_message's own buffer and leaves them all valid
+// time is the Sys_Milliseconds when the packet came off the socket
+qbool	Sys_GetPacket( netadr_t* net_from, msg_t* net_message, int* time );
+qbool	Sys_CopyPacket( netadr_t* net_from, msg_t* net_message, int* time );
 void	Sys_SendPacket( int length, const void *data, netadr_t to );
+// between these, Sys_SendPacket only queues packets, and they're sent together in order
+void	Sys_BeginPacketBatch();
+void	Sys_FlushPacketBatch();
 
-qbool	Sys_StringToAdr( const char *s, netadr_t *a );
+qbool	Sys_StringToAdr( const char *s, netadr_t *a, netadrtype_t family );
 //Does NOT parse port numbers, only base addresses.
 
 qbool	Sys_IsLANAddress( const netadr_t& adr );
@@ -956,6 +1029,19 @@ void	Sys_EndProfiling( void );
 qbool Sys_LowPhysicalMemory( void );
 unsigned int Sys_ProcessorCount( void );
 
+// a pool of worker threads for splitting up work the main thread would otherwise
+// do serially: Sys_RunJobs calls job( data, i ) once for every i in [0, count)
+// and doesn't return until they've all finished
+// jobs mustn't print, touch cvars or the filesystem, allocate, or Com_Error
+#define MAX_JOB_THREADS 16
+typedef void (*sysJob_t)( void* data, int index );
+void	Sys_SetJobThreads( int count );	// 0 runs every job on the calling thread
+void	Sys_RunJobs( sysJob_t job, void* data, int count );
+
+// both are full memory barriers
+int		Sys_AtomicAdd( volatile int* p, int value );	// returns the new value
+qbool	Sys_AtomicCompareExchange( volatile int* p, int expected, int desired );	// qtrue if it was expected
+
 qbool Sys_DetectAltivec( void );
 
 /* This is based on the Adaptive Huffman algorithm described in Sayood's Data
@@ -36,14 +36,14 @@ and one exported function: Perform
 
 int vm_debugLevel;
 vm_t* currentVM = NULL;
-static vm_t* lastVM; // only used by profiling, which is useless anyway
+
+static cvar_t* vm_cache;
 
 #define	MAX_VM		3
 static vm_t vmTable[MAX_VM];
 
 
 static void VM_VmInfo_f( void );
-static void VM_VmProfile_f( void );
 
 
 void VM_Init()
@@ -51,9 +51,10 @@ void VM_Init()
 	Cvar_Get( "vm_cgame", "2", CVAR_ARCHIVE );	// !@# SHIP WITH SET TO 2
 	Cvar_Get( "vm_game", "2", CVAR_ARCHIVE );	// !@# SHIP WITH SET TO 2
 	Cvar_Get( "vm_ui", "2", CVAR_ARCHIVE );		// !@# SHIP WITH SET TO 2
+	vm_cache = Cvar_Get( "vm_cache", "1", CVAR_ARCHIVE );
 
-	Cmd_AddCommand ("vmprofile", VM_VmProfile_f );
 	Cmd_AddCommand ("vminfo", VM_VmInfo_f );
+	VM_ProfileInit();
 
 	Com_Memset( vmTable, 0, sizeof( vmTable ) );
 }
@@ -297,6 +298,11 @@ vmHeader_t *VM_LoadQVM( vm_t *vm, qbool alloc ) {
 		return NULL;
 	}
 
+	if ( alloc ) {
+		vm->imageLength = length;
+		vm->imageChecksum = Com_BlockChecksum( header, length );
+	}
+
 	if( LittleLong( header->vmMagic ) == VM_MAGIC_VER2 ) {
 		Com_Printf( "...which has vmMagic VM_MAGIC_VER2\n" );
 
@@ -396,13 +402,17 @@ vm_t *VM_Restart( vm_t *vm ) {
 	if ( vm->dllHandle ) {
 		char	name[MAX_QPATH];
 		intptr_t	(*systemCall)( intptr_t *parms );
+		const vmLeafTrapDef_t*	leafTraps;
+		int		numLeafTraps;
 
 		systemCall = vm->systemCall;
+		leafTraps = vm->leafTraps;
+		numLeafTraps = vm->numLeafTraps;
 		Q_strncpyz( name, vm->name, sizeof( name ) );
 
 		VM_Free( vm );
 
-		vm = VM_Create( name, systemCall, VMI_NATIVE );
+		vm = VM_Create( name, systemCall, leafTraps, numLeafTraps, VMI_NATIVE );
 		return vm;
 	}
 
@@ -420,6 +430,212 @@ vm_t *VM_Restart( vm_t *vm ) {
 	return vm;
 }
 
+///////////////////////////////////////////////////////////////
+
+
+/*
+vmcache/<name>-<checksum>.<arch> holds the compiled code of a qvm, so that
+everything sharing a homepath only compiles each version of it once
+
+the file is only used if the qvm, the compiler and the cpu features all
+match, and it's checksummed so that a half-written one simply gets replaced
+
+only the game qvm is cached: anyone can edit the file and fix up the checksums,
+and the server's own code is the only one that doesn't have to be trusted to
+match what the pure checks vouched for
+*/
+
+#if !defined(NO_VM_COMPILED)
+
+#if defined(VM_CODE_CACHE)
+
+#define VM_CACHE_MAGIC	0x434D5651	// "QVMC"
+
+typedef struct {
+	int			magic;
+	char		key[64];		// VM_CodeCacheKey
+	int			imageLength;
+	unsigned	imageChecksum;
+	int			instructionCount;
+	int			codeLength;
+	unsigned	tableChecksum;	// of the instruction pointers that follow
+	unsigned	codeChecksum;	// of the code after them
+} vmCacheHeader_t;
+
+
+static qbool VM_UseCache( const vm_t* vm )
+{
+	return ( vm_cache->integer && !Q_stricmp( vm->name, "qagame" ) );
+}
+
+
+static const char* VM_CachePath( const vm_t* vm )
+{
+	return va( "vmcache/%s-%08x.%s", vm->name, vm->imageChecksum, ARCH_STRING );
+}
+
+
+static qbool VM_ReadCachedCode( vm_t* vm, const vmHeader_t* header, fileHandle_t f, int fileLength )
+{
+	vmCacheHeader_t h;
+
+	if ( fileLength < (int)sizeof(h) || FS_Read( &h, sizeof(h), f ) != sizeof(h) ) {
+		return qfalse;
+	}
+
+	h.key[sizeof(h.key) - 1] = '\0';
+	if ( h.magic != VM_CACHE_MAGIC ||
+		strcmp( h.key, VM_CodeCacheKey() ) ||
+		h.imageLength != vm->imageLength ||
+		h.imageChecksum != vm->imageChecksum ||
+		h.instructionCount != header->instructionCount ||
+		h.codeLength <= 0 ||
+		fileLength != (int)sizeof(h) + vm->instructionPointersLength + h.codeLength ) {
+		return qfalse;
+	}
+
+	if ( FS_Read( vm->instructionPointers, vm->instructionPointersLength, f ) != vm->instructionPointersLength ||
+		Com_BlockChecksum( vm->instructionPointers, vm->instructionPointersLength ) != h.tableChecksum ) {
+		return qfalse;
+	}
+
+	for ( int i = 0; i < h.instructionCount; ++i ) {
+		if ( (unsigned)vm->instructionPointers[i] >= (unsigned)h.codeLength ) {
+			return qfalse;
+		}
+	}
+
+	byte* code = (byte*)Hunk_AllocateTempMemory( h.codeLength );
+	const qbool valid = ( FS_Read( code, h.codeLength, f ) == h.codeLength &&
+		Com_BlockChecksum( code, h.codeLength ) == h.codeChecksum );
+	if ( valid ) {
+		VM_LoadCompiledCode( vm, code, h.codeLength );
+	}
+	Hunk_FreeTempMemory( code );
+
+	return valid;
+}
+
+
+static qbool VM_LoadCachedCode( vm_t* vm, const vmHeader_t* header )
+{
+	if ( !VM_UseCache( vm ) ) {
+		return qfalse;
+	}
+
+	fileHandle_t f;
+	const int fileLength = FS_SV_FOpenFileRead( VM_CachePath( vm ), &f );
+	if ( !f ) {
+		return qfalse;
+	}
+
+	vm->cachedCode = VM_ReadCachedCode( vm, header, f, fileLength );
+	FS_FCloseFile( f );
+
+	if ( vm->cachedCode ) {
+		Com_Printf( "VM file %s loaded from %s\n", vm->name, VM_CachePath( vm ) );
+	}
+
+	return vm->cachedCode;
+}
+
+
+static void VM_SaveCachedCode( const vm_t* vm, const vmHeader_t* header )
+{
+	if ( !VM_UseCache( vm ) ) {
+		return;
+	}
+
+	vmCacheHeader_t h;
+	Com_Memset( &h, 0, sizeof(h) );
+	h.magic = VM_CACHE_MAGIC;
+	Q_strncpyz( h.key, VM_CodeCacheKey(), sizeof(h.key) );
+	h.imageLength = vm->imageLength;
+	h.imageChecksum = vm->imageChecksum;
+	h.instructionCount = header->instructionCount;
+	h.codeLength = vm->codeLength;
+	h.tableChecksum = Com_BlockChecksum( vm->instructionPointers, vm->instructionPointersLength );
+	h.codeChecksum = Com_BlockChecksum( vm->codeBase, vm->codeLength );
+
+	fileHandle_t f = FS_SV_FOpenFileWrite( VM_CachePath( vm ) );
+	if ( !f ) {
+		Com_Printf( S_COLOR_YELLOW "Warning: can't write %s\n", VM_CachePath( vm ) );
+		return;
+	}
+
+	FS_Write( &h, sizeof(h), f );
+	FS_Write( vm->instructionPointers, vm->instructionPointersLength, f );
+	FS_Write( vm->codeBase, vm->codeLength, f );
+	FS_FCloseFile( f );
+}
+
+#else
+
+static qbool VM_LoadCachedCode( vm_t* vm, const vmHeader_t* header ) { return qfalse; }
+static void VM_SaveCachedCode( const vm_t* vm, const vmHeader_t* header ) {}
+
+#endif
+
+#endif
+
+
+// every OP_ENTER and the size of its frame, for walking the qvm stack
+
+static void VM_FindFunctions( vm_t* vm, const vmHeader_t* header )
+{
+	const byte* code = (const byte*)header + header->codeOffset;
+	int pass, i, pc, count = 0;
+
+	for ( pass = 0; pass < 2; pass++ ) {
+		if ( pass ) {
+			vm->functions = (vmFunction_t*)Hunk_Alloc( max( count, 1 ) * sizeof( vmFunction_t ), h_high );
+			vm->numFunctions = count;
+		}
+
+		count = 0;
+		pc = 0;
+		for ( i = 0; i < header->instructionCount && pc < header->codeLength; i++ ) {
+			const int op = code[pc++];
+			switch ( op ) {
+			case OP_ENTER:
+				if ( pass ) {
+					vm->functions[count].start = i;
+					vm->functions[count].frameSize = LittleLong( *(const int*)&code[pc] );
+				}
+				count++;
+				pc += 4;
+				break;
+			case OP_LEAVE:
+			case OP_CONST:
+			case OP_LOCAL:
+			case OP_BLOCK_COPY:
+				pc += 4;
+				break;
+			case OP_ARG:
+				pc++;
+				break;
+			default:
+				if ( op >= OP_EQ && op <= OP_GEF ) {
+					pc += 4;
+				}
+				break;
+			}
+		}
+	}
+}
+
+
+vm_t* VM_Find( const char* name )
+{
+	for (int i = 0; i < MAX_VM; ++i) {
+		if ( vmTable[i].name[0] && !Q_stricmp( vmTable[i].name, name ) ) {
+			return &vmTable[i];
+		}
+	}
+	return NULL;
+}
+
+
 /*
 ================
 VM_Create
@@ -431,7 +647,8 @@ it will attempt to load as a system dll
 
 #define	STACK_SIZE	0x20000
 
-vm_t* VM_Create( const char *module, intptr_t (*systemCalls)(intptr_t *), vmInterpret_t interpret )
+vm_t* VM_Create( const char *module, intptr_t (*systemCalls)(intptr_t *),
+				const vmLeafTrapDef_t* leafTraps, int numLeafTraps, vmInterpret_t interpret )
 {
 	vm_t		*vm;
 	vmHeader_t	*header;
@@ -444,11 +661,9 @@ vm_t* VM_Create( const char *module, intptr_t (*systemCalls)(intptr_t *), vmInte
 	remaining = Hunk_MemoryRemaining();
 
 	// see if we already have the VM
-	for ( i = 0 ; i < MAX_VM ; i++ ) {
-		if (!Q_stricmp(vmTable[i].name, module)) {
-			vm = &vmTable[i];
-			return vm;
-		}
+	vm = VM_Find( module );
+	if ( vm ) {
+		return vm;
 	}
 
 	// find a free vm
@@ -466,6 +681,8 @@ vm_t* VM_Create( const char *module, intptr_t (*systemCalls)(intptr_t *), vmInte
 
 	Q_strncpyz( vm->name, module, sizeof( vm->name ) );
 	vm->systemCall = systemCalls;
+	vm->leafTraps = leafTraps;
+	vm->numLeafTraps = numLeafTraps;
 
 	if ( interpret == VMI_NATIVE ) {
 		// try to load as a system dll
@@ -495,12 +712,19 @@ vm_t* VM_Create( const char *module, intptr_t (*systemCalls)(intptr_t *), vmInte
 	VM_PrepareInterpreter( vm, header );
 #else
 	vm->compiled = qtrue;
-	VM_Compile( vm, header );
-	// VM_Compile will have reset vm->compiled if compilation failed
-	if (!vm->compiled)
-		Com_Error( ERR_FATAL, "ERROR: QVM compilation failed\n" );
+	const int compileStart = Sys_Milliseconds();
+	if ( !VM_LoadCachedCode( vm, header ) ) {
+		VM_Compile( vm, header );
+		// VM_Compile will have reset vm->compiled if compilation failed
+		if (!vm->compiled)
+			Com_Error( ERR_FATAL, "ERROR: QVM compilation failed\n" );
+		VM_SaveCachedCode( vm, header );
+	}
+	vm->compileTime = Sys_Milliseconds() - compileStart;
 #endif
 
+	VM_FindFunctions( vm, header );
+
 	// free the original file
 	FS_FreeFile( header );
 
@@ -523,6 +747,8 @@ VM_Free
 */
 void VM_Free( vm_t *vm ) {
 
+	VM_ProfileStop( vm );
+
 	if(vm->destroy)
 		vm->destroy(vm);
 
@@ -544,19 +770,18 @@ void VM_Free( vm_t *vm ) {
 	Com_Memset( vm, 0, sizeof( *vm ) );
 
 	currentVM = NULL;
-	lastVM = NULL;
 }
 
 void VM_Clear(void) {
 	int i;
 	for (i=0;i<MAX_VM; i++) {
+		VM_ProfileStop( &vmTable[i] );
 		if ( vmTable[i].dllHandle ) {
 			Sys_UnloadDll( vmTable[i].dllHandle );
 		}
 		Com_Memset( &vmTable[i], 0, sizeof( vm_t ) );
 	}
 	currentVM = NULL;
-	lastVM = NULL;
 }
 
 
@@ -592,6 +817,145 @@ intptr_t VM_ExplicitArgPtr( const vm_t* vm, intptr_t intValue )
 }
 
 
+int VM_ArgCount( intptr_t intValue, int count, int size )
+{
+	if (!intValue || !currentVM || count <= 0)
+		return 0;
+
+	if ( currentVM->entryPoint )
+		return count;
+
+	const int room = (currentVM->dataMask + 1 - (intValue & currentVM->dataMask)) / size;
+	return (count < room) ? count : room;
+}
+
+
+///////////////////////////////////////////////////////////////
+
+
+// the leaf traps are always called from qvm code, which is currentVM
+// pointers are masked the same way VMA does, including NULL staying NULL,
+// and lengths are clipped to the end of the vm's memory
+
+static ID_INLINE void* VM_LeafPointer( int p )
+{
+	return p ? currentVM->dataBase + (p & currentVM->dataMask) : NULL;
+}
+
+static int VM_LeafLength( int p, int length )
+{
+	const int room = currentVM->dataMask + 1 - (p & currentVM->dataMask);
+	return (length < room) ? length : room;
+}
+
+
+static int VM_Leaf_Memset( const int* args )
+{
+	if ( args[2] > 0 )
+		Com_Memset( VM_LeafPointer( args[0] ), args[1], VM_LeafLength( args[0], args[2] ) );
+	return 0;
+}
+
+static int VM_Leaf_Memcpy( const int* args )
+{
+	if ( args[2] > 0 ) {
+		const int length = VM_LeafLength( args[1], VM_LeafLength( args[0], args[2] ) );
+		Com_Memcpy( VM_LeafPointer( args[0] ), VM_LeafPointer( args[1] ), length );
+	}
+	return 0;
+}
+
+static int VM_Leaf_Strncpy( const int* args )
+{
+	if ( args[2] > 0 ) {
+		const int length = VM_LeafLength( args[1], VM_LeafLength( args[0], args[2] ) );
+		strncpy( (char*)VM_LeafPointer( args[0] ), (const char*)VM_LeafPointer( args[1] ), length );
+	}
+	return args[0];
+}
+
+static int VM_Leaf_Sin( const int* args )
+{
+	return PASSFLOAT( sin( _vmf( args[0] ) ) );
+}
+
+static int VM_Leaf_Cos( const int* args )
+{
+	return PASSFLOAT( cos( _vmf( args[0] ) ) );
+}
+
+static int VM_Leaf_Atan2( const int* args )
+{
+	return PASSFLOAT( atan2( _vmf( args[0] ), _vmf( args[1] ) ) );
+}
+
+static int VM_Leaf_Sqrt( const int* args )
+{
+	return PASSFLOAT( sqrt( _vmf( args[0] ) ) );
+}
+
+static int VM_Leaf_Floor( const int* args )
+{
+	return PASSFLOAT( floor( _vmf( args[0] ) ) );
+}
+
+static int VM_Leaf_Ceil( const int* args )
+{
+	return PASSFLOAT( ceil( _vmf( args[0] ) ) );
+}
+
+static int VM_Leaf_Acos( const int* args )
+{
+	return PASSFLOAT( Q_acos( _vmf( args[0] ) ) );
+}
+
+static int VM_Leaf_MatrixMultiply( const int* args )
+{
+	MatrixMultiply( (float(*)[3])VM_LeafPointer( args[0] ), (float(*)[3])VM_LeafPointer( args[1] ), (float(*)[3])VM_LeafPointer( args[2] ) );
+	return 0;
+}
+
+static int VM_Leaf_AngleVectors( const int* args )
+{
+	AngleVectors( (const float*)VM_LeafPointer( args[0] ), (float*)VM_LeafPointer( args[1] ),
+		(float*)VM_LeafPointer( args[2] ), (float*)VM_LeafPointer( args[3] ) );
+	return 0;
+}
+
+static int VM_Leaf_PerpendicularVector( const int* args )
+{
+	PerpendicularVector( (float*)VM_LeafPointer( args[0] ), (const float*)VM_LeafPointer( args[1] ) );
+	return 0;
+}
+
+
+const vmLeafFunc_t vm_leafFuncs[VM_LEAF_COUNT] = {
+	VM_Leaf_Memset,
+	VM_Leaf_Memcpy,
+	VM_Leaf_Strncpy,
+	VM_Leaf_Sin,
+	VM_Leaf_Cos,
+	VM_Leaf_Atan2,
+	VM_Leaf_Sqrt,
+	VM_Leaf_Floor,
+	VM_Leaf_Ceil,
+	VM_Leaf_Acos,
+	VM_Leaf_MatrixMultiply,
+	VM_Leaf_AngleVectors,
+	VM_Leaf_PerpendicularVector
+};
+
+
+int VM_FindLeafTrap( const vm_t* vm, int trap )
+{
+	for (int i = 0; i < vm->numLeafTraps; ++i) {
+		if ( vm->leafTraps[i].trap == trap )
+			return vm->leafTraps[i].leaf;
+	}
+	return -1;
+}
+
+
 /*
 ==============
 VM_Call
@@ -629,7 +993,6 @@ intptr_t	QDECL VM_Call( vm_t *vm, int callnum, ... ) {
 
 	oldVM = currentVM;
 	currentVM = vm;
-	lastVM = vm;
 
 	if ( vm_debugLevel ) {
 		Com_Printf( "VM_Call( %ld )\n", callnum );
@@ -686,64 +1049,6 @@ intptr_t	QDECL VM_Call( vm_t *vm, int callnum, ... ) {
 ///////////////////////////////////////////////////////////////
 
 
-static int QDECL VM_ProfileSort( const void *a, const void *b )
-{
-	const vmSymbol_t *sa, *sb;
-
-	sa = *(vmSymbol_t **)a;
-	sb = *(vmSymbol_t **)b;
-
-	if ( sa->profileCount < sb->profileCount ) {
-		return -1;
-	}
-	if ( sa->profileCount > sb->profileCount ) {
-		return 1;
-	}
-	return 0;
-}
-
-
-static void VM_VmProfile_f( void )
-{
-	vmSymbol_t	**sorted, *sym;
-	int			i;
-	double		total;
-
-	if ( !lastVM ) {
-		return;
-	}
-
-	const vm_t* vm = lastVM;
-	if ( !vm->numSymbols ) {
-		return;
-	}
-
-	sorted = (vmSymbol_t**)Z_Malloc( vm->numSymbols * sizeof( *sorted ) );
-	sorted[0] = vm->symbols;
-	total = sorted[0]->profileCount;
-	for ( i = 1 ; i < vm->numSymbols ; i++ ) {
-		sorted[i] = sorted[i-1]->next;
-		total += sorted[i]->profileCount;
-	}
-
-	qsort( sorted, vm->numSymbols, sizeof( *sorted ), VM_ProfileSort );
-
-	for ( i = 0 ; i < vm->numSymbols ; i++ ) {
-		int		perc;
-
-		sym = sorted[i];
-
-		perc = 100 * (float) sym->profileCount / total;
-		Com_Printf( "%2i%% %9i %s\n", perc, sym->profileCount, sym->symName );
-		sym->profileCount = 0;
-	}
-
-	Com_Printf("    %9.0f total\n", total );
-
-	Z_Free( sorted );
-}
-
-
 static void VM_VmInfo_f( void )
 {
 	Com_Printf( "Registered virtual machines:\n" );
@@ -760,7 +1065,9 @@ static void VM_VmInfo_f( void )
 			continue;
 		}
 
-		if ( vm->compiled ) {
+		if ( vm->cachedCode ) {
+			Com_Printf( "compiled, loaded from the vmcache\n" );
+		} else if ( vm->compiled ) {
 			Com_Printf( "compiled on load\n" );
 		} else {
 			Com_Printf( "interpreted\n" );
@@ -769,6 +1076,9 @@ static void VM_VmInfo_f( void )
 		Com_Printf( "    code length : %7i\n", vm->codeLength );
 		Com_Printf( "    table length: %7i\n", vm->instructionPointersLength );
 		Com_Printf( "    data length : %7i\n", vm->dataMask + 1 );
+		if ( vm->compiled ) {
+			Com_Printf( "    compile time: %7i msec\n", vm->compileTime );
+		}
 	}
 }
 
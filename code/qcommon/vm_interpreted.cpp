@@ -170,36 +170,86 @@ void VM_StackTrace( vm_t *vm, int programCounter, int programStack ) {
 }
 
 
+/*
+VM_PrepareInterpreter decodes the qvm into one vmInstruction_t per
+instruction: every operand is a full int, the program counter is an
+instruction number and branches already hold the number of their target
+
+with gcc, each instruction also holds the address of its handler and
+the handlers jump straight to the next one (direct threading) instead of
+going back through the switch, which is still used by other compilers
+
+a few common pairs of instructions get a handler that does the work of
+both and skips the second one, which is still decoded on its own in case
+something jumps to it
+*/
+
+#if defined(__GNUC__) && !defined(DEBUG_VM)
+#define VM_THREADED_CODE
+#endif
+
+typedef enum {
+	OP_LOCAL_LOAD4 = OP_CVFI + 1,
+	OP_CONST_LOAD4,
+	OP_CONST_ADD,
+	OP_CONST_EQ,
+	OP_CONST_NE,
+	OP_CONST_JUMP,
+	OP_CONST_CALL,
+	OP_CONST_LEAF,				// arg is the vmLeafTrap_t instead
+	OP_MAX_INTERPRETED
+} superOpcode_t;
+
+#define VM_OPCODES(X) \
+	X(OP_UNDEF) X(OP_IGNORE) X(OP_BREAK) X(OP_ENTER) X(OP_LEAVE) X(OP_CALL) \
+	X(OP_PUSH) X(OP_POP) X(OP_CONST) X(OP_LOCAL) X(OP_JUMP) \
+	X(OP_EQ) X(OP_NE) X(OP_LTI) X(OP_LEI) X(OP_GTI) X(OP_GEI) \
+	X(OP_LTU) X(OP_LEU) X(OP_GTU) X(OP_GEU) \
+	X(OP_EQF) X(OP_NEF) X(OP_LTF) X(OP_LEF) X(OP_GTF) X(OP_GEF) \
+	X(OP_LOAD1) X(OP_LOAD2) X(OP_LOAD4) X(OP_STORE1) X(OP_STORE2) X(OP_STORE4) \
+	X(OP_ARG) X(OP_BLOCK_COPY) X(OP_SEX8) X(OP_SEX16) \
+	X(OP_NEGI) X(OP_ADD) X(OP_SUB) X(OP_DIVI) X(OP_DIVU) X(OP_MODI) X(OP_MODU) \
+	X(OP_MULI) X(OP_MULU) X(OP_BAND) X(OP_BOR) X(OP_BXOR) X(OP_BCOM) \
+	X(OP_LSH) X(OP_RSHI) X(OP_RSHU) \
+	X(OP_NEGF) X(OP_ADDF) X(OP_SUBF) X(OP_DIVF) X(OP_MULF) X(OP_CVIF) X(OP_CVFI) \
+	X(OP_LOCAL_LOAD4) X(OP_CONST_LOAD4) X(OP_CONST_ADD) \
+	X(OP_CONST_EQ) X(OP_CONST_NE) X(OP_CONST_JUMP) X(OP_CONST_CALL) \
+	X(OP_CONST_LEAF)
+
+typedef struct {
+#if defined(VM_THREADED_CODE)
+	const void*	handler;
+#endif
+	int		op;
+	int		arg;		// the operand, or the target instruction of a branch
+} vmInstruction_t;
+
+
+static int VM_Run( vm_t* vm, int programStack, const void* const** handlers );
+
+
 void VM_PrepareInterpreter( vm_t* vm, const vmHeader_t* header )
 {
-	int		op;
-	int		pc;
-	byte	*code;
-	int		instruction;
-	int		*codeBase;
-
-	vm->codeBase = (byte*)Hunk_Alloc( vm->codeLength*4, h_high );			// we're now int aligned
-//	memcpy( vm->codeBase, (byte *)header + header->codeOffset, vm->codeLength );
-
-	// we don't need to translate the instructions, but we still need
-	// to find each instructions starting point for jumps
-	pc = 0;
-	instruction = 0;
-	code = (byte *)header + header->codeOffset;
-	codeBase = (int *)vm->codeBase;
-
-	while ( instruction < header->instructionCount ) {
-		vm->instructionPointers[ instruction ] = pc;
-		instruction++;
-
-		op = code[ pc ];
-		codeBase[pc] = op;
-		if ( pc > header->codeLength ) {
+	const int instructionCount = header->instructionCount;
+	const byte* code = (const byte*)header + header->codeOffset;
+	int pc = 0;
+
+	vmInstruction_t* codeBase = (vmInstruction_t*)Hunk_Alloc( instructionCount * sizeof(vmInstruction_t), h_high );
+
+	for (int i = 0; i < instructionCount; ++i) {
+		if ( pc >= header->codeLength ) {
 			Com_Error( ERR_FATAL, "VM_PrepareInterpreter: pc > header->codeLength" );
 		}
 
+		// symbols and return addresses are instruction numbers too
+		vm->instructionPointers[i] = i;
+
+		const int op = code[ pc ];
 		pc++;
 
+		codeBase[i].op = op;
+		codeBase[i].arg = 0;
+
 		// these are the only opcodes that aren't a single byte
 		switch ( op ) {
 		case OP_ENTER:
@@ -223,81 +273,81 @@ void VM_PrepareInterpreter( vm_t* vm, const vmHeader_t* header )
 		case OP_GTF:
 		case OP_GEF:
 		case OP_BLOCK_COPY:
-			codeBase[pc+0] = loadWord(&code[pc]);
+			codeBase[i].arg = loadWord( (void*)&code[pc] );
 			pc += 4;
 			break;
 		case OP_ARG:
-			codeBase[pc+0] = code[pc];
+			codeBase[i].arg = code[pc];
 			pc += 1;
 			break;
 		default:
+			if ( op > OP_CVFI ) {
+				Com_Error( ERR_FATAL, "VM_PrepareInterpreter: bad opcode %i at offset %i", op, pc - 1 );
+			}
 			break;
 		}
 
+		if ( op >= OP_EQ && op <= OP_GEF && (unsigned)codeBase[i].arg >= (unsigned)instructionCount ) {
+			Com_Error( ERR_FATAL, "VM_PrepareInterpreter: jump target %i out of range at offset %i", codeBase[i].arg, pc - 5 );
+		}
 	}
-	pc = 0;
-	instruction = 0;
-	code = (byte *)header + header->codeOffset;
-	codeBase = (int *)vm->codeBase;
-
-	while ( instruction < header->instructionCount ) {
-		op = code[ pc ];
-		instruction++;
-		pc++;
-		switch ( op ) {
-		case OP_ENTER:
-		case OP_CONST:
+
+	for (int i = 0; i < instructionCount - 1; ++i) {
+		vmInstruction_t* in = &codeBase[i];
+		const qbool validTarget = ( (unsigned)in->arg < (unsigned)instructionCount );
+
+		switch ( in->op ) {
 		case OP_LOCAL:
-		case OP_LEAVE:
-		case OP_EQ:
-		case OP_NE:
-		case OP_LTI:
-		case OP_LEI:
-		case OP_GTI:
-		case OP_GEI:
-		case OP_LTU:
-		case OP_LEU:
-		case OP_GTU:
-		case OP_GEU:
-		case OP_EQF:
-		case OP_NEF:
-		case OP_LTF:
-		case OP_LEF:
-		case OP_GTF:
-		case OP_GEF:
-		case OP_BLOCK_COPY:
-			switch(op) {
-				case OP_EQ:
-				case OP_NE:
-				case OP_LTI:
-				case OP_LEI:
-				case OP_GTI:
-				case OP_GEI:
-				case OP_LTU:
-				case OP_LEU:
-				case OP_GTU:
-				case OP_GEU:
-				case OP_EQF:
-				case OP_NEF:
-				case OP_LTF:
-				case OP_LEF:
-				case OP_GTF:
-				case OP_GEF:
-				codeBase[pc] = vm->instructionPointers[codeBase[pc]];
+			if ( in[1].op == OP_LOAD4 ) {
+				in->op = OP_LOCAL_LOAD4;
+			}
+			break;
+		case OP_CONST:
+			switch ( in[1].op ) {
+			case OP_LOAD4:
+				in->op = OP_CONST_LOAD4;
 				break;
-			default:
+			case OP_ADD:
+				in->op = OP_CONST_ADD;
+				break;
+			case OP_EQ:
+				in->op = OP_CONST_EQ;
+				break;
+			case OP_NE:
+				in->op = OP_CONST_NE;
+				break;
+			case OP_JUMP:
+				if ( validTarget ) {
+					in->op = OP_CONST_JUMP;
+				}
+				break;
+			case OP_CALL:
+				// other system calls still go through OP_CALL
+				if ( validTarget ) {
+					in->op = OP_CONST_CALL;
+				} else if ( in->arg < 0 ) {
+					const int leaf = VM_FindLeafTrap( vm, -1 - in->arg );
+					if ( leaf >= 0 ) {
+						in->op = OP_CONST_LEAF;
+						in->arg = leaf;
+					}
+				}
 				break;
 			}
-			pc += 4;
-			break;
-		case OP_ARG:
-			pc += 1;
-			break;
-		default:
 			break;
 		}
+	}
 
+#if defined(VM_THREADED_CODE)
+	const void* const* handlers;
+	VM_Run( NULL, 0, &handlers );
+	for (int i = 0; i < instructionCount; ++i) {
+		codeBase[i].handler = handlers[ codeBase[i].op ];
 	}
+#endif
+
+	vm->codeBase = (byte*)codeBase;
+	vm->codeLength = instructionCount * sizeof(vmInstruction_t);
 }
 
 /*
@@ -329,41 +379,17 @@ locals from sp
 #define	DEBUGSTR va("%s%i", VM_Indent(vm), opStack-stack )
 
 int	VM_CallInterpreted( vm_t *vm, int *args ) {
-	int		stack[MAX_STACK];
-	int		*opStack;
-	int		programCounter;
 	int		programStack;
 	int		stackOnEntry;
 	byte	*image;
-	int		*codeImage;
-	int		v1;
-	int		dataMask;
-#ifdef DEBUG_VM
-	vmSymbol_t	*profileSymbol;
-#endif
-
-	// interpret the code
-	vm->currentlyInterpreting = qtrue;
+	int		r;
 
 	// we might be called recursively, so this might not be the very top
 	programStack = stackOnEntry = vm->programStack;
 
-#ifdef DEBUG_VM
-	profileSymbol = VM_ValueToFunctionSymbol( vm, 0 );
-	// uncomment this for debugging breakpoints
-	vm->breakFunction = 0;
-#endif
 	// set up the stack frame 
 
 	image = vm->dataBase;
-	codeImage = (int *)vm->codeBase;
-	dataMask = vm->dataMask;
-	
-	// leave a free spot at start of stack so
-	// that as long as opStack is valid, opStack-1 will
-	// not corrupt anything
-	opStack = stack;
-	programCounter = 0;
 
 	programStack -= 48;
 
@@ -384,538 +410,517 @@ int	VM_CallInterpreted( vm_t *vm, int *args ) {
 	
 	VM_Debug(0);
 
-//	vm_debugLevel=2;
-	// main interpreter loop, will exit when a LEAVE instruction
-	// grabs the -1 program counter
-
-#define r2 codeImage[programCounter]
+	r = VM_Run( vm, programStack, NULL );
 
-	while ( 1 ) {
-		int		opcode,	r0, r1;
-//		unsigned int	r2;
-
-nextInstruction:
-		r0 = ((int *)opStack)[0];
-		r1 = ((int *)opStack)[-1];
-nextInstruction2:
-		opcode = codeImage[ programCounter++ ];
-#ifdef DEBUG_VM
-		if ( (unsigned)programCounter > vm->codeLength ) {
-			Com_Error( ERR_DROP, "VM pc out of range" );
-		}
-
-		if ( opStack < stack ) {
-			Com_Error( ERR_DROP, "VM opStack underflow" );
-		}
-		if ( opStack >= stack+MAX_STACK ) {
-			Com_Error( ERR_DROP, "VM opStack overflow" );
-		}
-
-		if ( programStack <= vm->stackBottom ) {
-			Com_Error( ERR_DROP, "VM stack overflow" );
-		}
+	vm->programStack = stackOnEntry;
 
-		if ( programStack & 3 ) {
-			Com_Error( ERR_DROP, "VM program stack misaligned" );
-		}
+	return r;
+}
 
-		if ( vm_debugLevel > 1 ) {
-			Com_Printf( "%s %s\n", DEBUGSTR, opnames[opcode] );
-		}
-		profileSymbol->profileCount++;
-#endif
 
-		switch ( opcode ) {
-#ifdef DEBUG_VM
-		default:
-			Com_Error( ERR_DROP, "Bad VM instruction" );  // this should be scanned on load!
+#if defined(VM_THREADED_CODE)
+#define VM_OP(x)	op_##x
+#define DISPATCH()	goto *ip->handler
+#else
+#define VM_OP(x)	case x
+#define DISPATCH()	goto nextInstruction
 #endif
-		case OP_BREAK:
-			vm->breakCount++;
-			goto nextInstruction2;
-		case OP_CONST:
-			opStack++;
-			r1 = r0;
-			r0 = *opStack = r2;
-			
-			programCounter += 4;
-			goto nextInstruction2;
-		case OP_LOCAL:
-			opStack++;
-			r1 = r0;
-			r0 = *opStack = r2+programStack;
 
-			programCounter += 4;
-			goto nextInstruction2;
+#define NEXT()		ip++; DISPATCH()
 
-		case OP_LOAD4:
-#ifdef DEBUG_VM
-			if ( *opStack & 3 ) {
-				Com_Error( ERR_DROP, "OP_LOAD4 misaligned" );
-			}
-#endif
-			r0 = *opStack = *(int *)&image[ r0&dataMask ];
-			goto nextInstruction2;
-		case OP_LOAD2:
-			r0 = *opStack = *(unsigned short *)&image[ r0&dataMask ];
-			goto nextInstruction2;
-		case OP_LOAD1:
-			r0 = *opStack = image[ r0&dataMask ];
-			goto nextInstruction2;
-
-		case OP_STORE4:
-			*(int *)&image[ r1&(dataMask & ~3) ] = r0;
-			opStack -= 2;
-			goto nextInstruction;
-		case OP_STORE2:
-			*(short *)&image[ r1&(dataMask & ~1) ] = r0;
-			opStack -= 2;
-			goto nextInstruction;
-		case OP_STORE1:
-			image[ r1&dataMask ] = r0;
-			opStack -= 2;
-			goto nextInstruction;
+#define BRANCH_IF( cond ) \
+	if ( cond ) { \
+		opStack -= 2; \
+		ip = codeBase + ip->arg; \
+		DISPATCH(); \
+	} \
+	opStack -= 2; \
+	NEXT()
 
-		case OP_ARG:
-			// single byte offset from programStack
-			*(int *)&image[ codeImage[programCounter] + programStack ] = r0;
-			opStack--;
-			programCounter += 1;
-			goto nextInstruction;
+#define	F(i)		((float *)opStack)[i]
 
-		case OP_BLOCK_COPY:
-			{
-				int		*src, *dest;
-				int		i, count, srci, desti;
-
-				count = r2;
-				// MrE: copy range check
-				srci = r0 & dataMask;
-				desti = r1 & dataMask;
-				count = ((srci + count) & dataMask) - srci;
-				count = ((desti + count) & dataMask) - desti;
-
-				src = (int *)&image[ r0&dataMask ];
-				dest = (int *)&image[ r1&dataMask ];
-				if ( ( (intptr_t)src | (intptr_t)dest | count ) & 3 ) {
-					// happens in westernq3
-					Com_Printf( S_COLOR_YELLOW "Warning: OP_BLOCK_COPY not dword aligned\n");
-				}
-				count >>= 2;
-				for ( i = count-1 ; i>= 0 ; i-- ) {
-					dest[i] = src[i];
-				}
-				programCounter += 4;
-				opStack -= 2;
-			}
-			goto nextInstruction;
-
-		case OP_CALL:
-			// save current program counter
-			*(int *)&image[ programStack ] = programCounter;
-			
-			// jump to the location on the stack
-			programCounter = r0;
-			opStack--;
-			if ( programCounter < 0 ) {
-				// system call
-				int		r;
-				int		temp;
-#ifdef DEBUG_VM
-				int		stomped;
 
-				if ( vm_debugLevel ) {
-					Com_Printf( "%s---> systemcall(%i)\n", DEBUGSTR, -1 - programCounter );
-				}
-#endif
-				// save the stack to allow recursive VM entry
-				temp = vm->callLevel;
-				vm->programStack = programStack - 4;
-#ifdef DEBUG_VM
-				stomped = *(int *)&image[ programStack + 4 ];
-#endif
-				*(int *)&image[ programStack + 4 ] = -1 - programCounter;
+// main interpreter loop, will exit when a LEAVE instruction
+// grabs the -1 program counter
+// called without a vm, it only hands out the handler addresses
 
-//VM_LogSyscalls( (int *)&image[ programStack + 4 ] );
-				{
-					intptr_t* argptr = (intptr_t *)&image[ programStack + 4 ];
-				#if __WORDSIZE == 64
-				// the vm has ints on the stack, we expect
-				// longs so we have to convert it
-					intptr_t argarr[16];
-					int i;
-					for (i = 0; i < 16; ++i) {
-						argarr[i] = *(int*)&image[ programStack + 4 + 4*i ];
-					}
-					argptr = argarr;
-				#endif
-					r = vm->systemCall( argptr );
-				}
-
-#ifdef DEBUG_VM
-				// this is just our stack frame pointer, only needed
-				// for debugging
-				*(int *)&image[ programStack + 4 ] = stomped;
+static int VM_Run( vm_t* vm, int programStack, const void* const** handlers )
+{
+#if defined(VM_THREADED_CODE)
+	static const void* handlerTable[OP_MAX_INTERPRETED];
+
+	if ( !vm ) {
+#define VM_HANDLER(x) handlerTable[x] = &&op_##x;
+		VM_OPCODES(VM_HANDLER)
+#undef VM_HANDLER
+		*handlers = handlerTable;
+		return 0;
+	}
 #endif
 
-				// save return value
-				opStack++;
-				*opStack = r;
-				programCounter = *(int *)&image[ programStack ];
-				vm->callLevel = temp;
+	int		stack[MAX_STACK];
+	int		*opStack;
+	const vmInstruction_t	*ip;
+	const vmInstruction_t	*codeBase;
+	const unsigned	instructionCount = vm->instructionPointersLength >> 2;
+	byte	*image;
+	int		dataMask;
+	int		v1;
 #ifdef DEBUG_VM
-				if ( vm_debugLevel ) {
-					Com_Printf( "%s<--- %s\n", DEBUGSTR, VM_ValueToSymbol( vm, programCounter ) );
-				}
+	const vmSymbol_t	*profileSymbol;
 #endif
-			} else {
-				programCounter = vm->instructionPointers[ programCounter ];
-			}
-			goto nextInstruction;
 
-		// push and pop are only needed for discarded or bad function return values
-		case OP_PUSH:
-			opStack++;
-			goto nextInstruction;
-		case OP_POP:
-			opStack--;
-			goto nextInstruction;
+	image = vm->dataBase;
+	codeBase = (const vmInstruction_t *)vm->codeBase;
+	dataMask = vm->dataMask;
 
-		case OP_ENTER:
-#ifdef DEBUG_VM
-			profileSymbol = VM_ValueToFunctionSymbol( vm, programCounter );
-#endif
-			// get size of stack frame
-			v1 = r2;
+	// leave a free spot at start of stack so
+	// that as long as opStack is valid, opStack-1 will
+	// not corrupt anything
+	opStack = stack;
+	ip = codeBase;
 
-			programCounter += 4;
-			programStack -= v1;
 #ifdef DEBUG_VM
-			// save old stack frame for debugging traces
-			*(int *)&image[programStack+4] = programStack + v1;
-			if ( vm_debugLevel ) {
-				Com_Printf( "%s---> %s\n", DEBUGSTR, VM_ValueToSymbol( vm, programCounter - 5 ) );
-				if ( vm->breakFunction && programCounter - 5 == vm->breakFunction ) {
-					// this is to allow setting breakpoints here in the debugger
-					vm->breakCount++;
-//					vm_debugLevel = 2;
-//					VM_StackTrace( vm, programCounter, programStack );
-				}
-				vm->callLevel++;
-			}
+	profileSymbol = VM_ValueToFunctionSymbol( vm, 0 );
+	// uncomment this for debugging breakpoints
+	vm->breakFunction = 0;
 #endif
-			goto nextInstruction;
-		case OP_LEAVE:
-			// remove our stack frame
-			v1 = r2;
 
-			programStack += v1;
-
-			// grab the saved program counter
-			programCounter = *(int *)&image[ programStack ];
+#if defined(VM_THREADED_CODE)
+	DISPATCH();
+	{
+#else
+nextInstruction:
 #ifdef DEBUG_VM
-			profileSymbol = VM_ValueToFunctionSymbol( vm, programCounter );
-			if ( vm_debugLevel ) {
-				vm->callLevel--;
-				Com_Printf( "%s<--- %s\n", DEBUGSTR, VM_ValueToSymbol( vm, programCounter ) );
-			}
-#endif
-			// check for leaving the VM
-			if ( programCounter == -1 ) {
-				goto done;
-			}
-			goto nextInstruction;
-
-		/*
-		===================================================================
-		BRANCHES
-		===================================================================
-		*/
-
-		case OP_JUMP:
-			programCounter = r0;
-			programCounter = vm->instructionPointers[ programCounter ];
-			opStack--;
-			goto nextInstruction;
-
-		case OP_EQ:
-			opStack -= 2;
-			if ( r1 == r0 ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				goto nextInstruction;
-			}
-
-		case OP_NE:
-			opStack -= 2;
-			if ( r1 != r0 ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				goto nextInstruction;
-			}
+	if ( (unsigned)(ip - codeBase) >= instructionCount ) {
+		Com_Error( ERR_DROP, "VM pc out of range" );
+	}
 
-		case OP_LTI:
-			opStack -= 2;
-			if ( r1 < r0 ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				goto nextInstruction;
-			}
+	if ( opStack < stack ) {
+		Com_Error( ERR_DROP, "VM opStack underflow" );
+	}
+	if ( opStack >= stack+MAX_STACK ) {
+		Com_Error( ERR_DROP, "VM opStack overflow" );
+	}
 
-		case OP_LEI:
-			opStack -= 2;
-			if ( r1 <= r0 ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				goto nextInstruction;
-			}
+	if ( programStack <= vm->stackBottom ) {
+		Com_Error( ERR_DROP, "VM stack overflow" );
+	}
 
-		case OP_GTI:
-			opStack -= 2;
-			if ( r1 > r0 ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				goto nextInstruction;
-			}
+	if ( programStack & 3 ) {
+		Com_Error( ERR_DROP, "VM program stack misaligned" );
+	}
 
-		case OP_GEI:
-			opStack -= 2;
-			if ( r1 >= r0 ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				goto nextInstruction;
-			}
+	if ( vm_debugLevel > 1 ) {
+		Com_Printf( "%s %s\n", DEBUGSTR, ip->op <= OP_CVFI ? opnames[ip->op] : "OP_CONST (paired)" );
+	}
+	((vmSymbol_t *)profileSymbol)->profileCount++;
+#endif
 
-		case OP_LTU:
-			opStack -= 2;
-			if ( ((unsigned)r1) < ((unsigned)r0) ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				goto nextInstruction;
-			}
+	switch ( ip->op ) {
+	default:
+		Com_Error( ERR_DROP, "Bad VM instruction" );
+#endif
 
-		case OP_LEU:
-			opStack -= 2;
-			if ( ((unsigned)r1) <= ((unsigned)r0) ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				goto nextInstruction;
+	VM_OP(OP_UNDEF):
+	VM_OP(OP_IGNORE):
+		NEXT();
+	VM_OP(OP_BREAK):
+		vm->breakCount++;
+		NEXT();
+	VM_OP(OP_CONST):
+		*++opStack = ip->arg;
+		NEXT();
+	VM_OP(OP_LOCAL):
+		*++opStack = ip->arg + programStack;
+		NEXT();
+
+	VM_OP(OP_LOAD4):
+#ifdef DEBUG_VM
+		if ( *opStack & 3 ) {
+			Com_Error( ERR_DROP, "OP_LOAD4 misaligned" );
+		}
+#endif
+		*opStack = *(int *)&image[ *opStack & dataMask ];
+		NEXT();
+	VM_OP(OP_LOAD2):
+		*opStack = *(unsigned short *)&image[ *opStack & dataMask ];
+		NEXT();
+	VM_OP(OP_LOAD1):
+		*opStack = image[ *opStack & dataMask ];
+		NEXT();
+
+	VM_OP(OP_STORE4):
+		*(int *)&image[ opStack[-1] & (dataMask & ~3) ] = opStack[0];
+		opStack -= 2;
+		NEXT();
+	VM_OP(OP_STORE2):
+		*(short *)&image[ opStack[-1] & (dataMask & ~1) ] = opStack[0];
+		opStack -= 2;
+		NEXT();
+	VM_OP(OP_STORE1):
+		image[ opStack[-1] & dataMask ] = opStack[0];
+		opStack -= 2;
+		NEXT();
+
+	VM_OP(OP_ARG):
+		// single byte offset from programStack
+		*(int *)&image[ (ip->arg + programStack) & (dataMask & ~3) ] = *opStack;
+		opStack--;
+		NEXT();
+
+	VM_OP(OP_BLOCK_COPY):
+		{
+			int		*src, *dest;
+			int		i, count, srci, desti;
+
+			count = ip->arg;
+			// MrE: copy range check
+			srci = opStack[0] & dataMask;
+			desti = opStack[-1] & dataMask;
+			count = ((srci + count) & dataMask) - srci;
+			count = ((desti + count) & dataMask) - desti;
+
+			src = (int *)&image[ srci ];
+			dest = (int *)&image[ desti ];
+			if ( ( (intptr_t)src | (intptr_t)dest | count ) & 3 ) {
+				// happens in westernq3
+				Com_Printf( S_COLOR_YELLOW "Warning: OP_BLOCK_COPY not dword aligned\n");
 			}
-
-		case OP_GTU:
-			opStack -= 2;
-			if ( ((unsigned)r1) > ((unsigned)r0) ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				goto nextInstruction;
+			count >>= 2;
+			for ( i = count-1 ; i>= 0 ; i-- ) {
+				dest[i] = src[i];
 			}
-
-		case OP_GEU:
 			opStack -= 2;
-			if ( ((unsigned)r1) >= ((unsigned)r0) ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				goto nextInstruction;
-			}
-
-		case OP_EQF:
-			if ( ((float *)opStack)[-1] == *(float *)opStack ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				opStack -= 2;
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				opStack -= 2;
-				goto nextInstruction;
-			}
+		}
+		NEXT();
+
+	VM_OP(OP_CALL):
+		// save the return address
+		*(int *)&image[ programStack ] = ip - codeBase + 1;
+
+		// jump to the location on the stack
+		v1 = *opStack;
+		opStack--;
+		if ( v1 < 0 ) {
+			// system call
+			int		r;
+			int		temp;
+#ifdef DEBUG_VM
+			int		stomped;
 
-		case OP_NEF:
-			if ( ((float *)opStack)[-1] != *(float *)opStack ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				opStack -= 2;
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				opStack -= 2;
-				goto nextInstruction;
+			if ( vm_debugLevel ) {
+				Com_Printf( "%s---> systemcall(%i)\n", DEBUGSTR, -1 - v1 );
 			}
+#endif
+			// save the stack to allow recursive VM entry
+			temp = vm->callLevel;
+			vm->programStack = programStack - 4;
+#ifdef DEBUG_VM
+			stomped = *(int *)&image[ programStack + 4 ];
+#endif
+			*(int *)&image[ programStack + 4 ] = -1 - v1;
 
-		case OP_LTF:
-			if ( ((float *)opStack)[-1] < *(float *)opStack ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				opStack -= 2;
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				opStack -= 2;
-				goto nextInstruction;
+//VM_LogSyscalls( (int *)&image[ programStack + 4 ] );
+			{
+				intptr_t* argptr = (intptr_t *)&image[ programStack + 4 ];
+			#if __WORDSIZE == 64
+			// the vm has ints on the stack, we expect
+			// longs so we have to convert it
+				intptr_t argarr[16];
+				int i;
+				for (i = 0; i < 16; ++i) {
+					argarr[i] = *(int*)&image[ programStack + 4 + 4*i ];
+				}
+				argptr = argarr;
+			#endif
+				r = vm->systemCall( argptr );
 			}
 
-		case OP_LEF:
-			if ( ((float *)opStack)[-1] <= *(float *)opStack ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				opStack -= 2;
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				opStack -= 2;
-				goto nextInstruction;
-			}
+#ifdef DEBUG_VM
+			// this is just our stack frame pointer, only needed
+			// for debugging
+			*(int *)&image[ programStack + 4 ] = stomped;
+#endif
 
-		case OP_GTF:
-			if ( ((float *)opStack)[-1] > *(float *)opStack ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				opStack -= 2;
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				opStack -= 2;
-				goto nextInstruction;
+			// save return value
+			opStack++;
+			*opStack = r;
+			vm->callLevel = temp;
+#ifdef DEBUG_VM
+			if ( vm_debugLevel ) {
+				Com_Printf( "%s<--- %s\n", DEBUGSTR, VM_ValueToSymbol( vm, ip - codeBase + 1 ) );
 			}
+#endif
+			NEXT();
+		}
+		if ( (unsigned)v1 >= instructionCount ) {
+			Com_Error( ERR_DROP, "VM %s: call to bad instruction %i", vm->name, v1 );
+		}
+		ip = codeBase + v1;
+		DISPATCH();
+
+	// push and pop are only needed for discarded or bad function return values
+	VM_OP(OP_PUSH):
+		opStack++;
+		NEXT();
+	VM_OP(OP_POP):
+		opStack--;
+		NEXT();
+
+	VM_OP(OP_ENTER):
+#ifdef DEBUG_VM
+		profileSymbol = VM_ValueToFunctionSymbol( vm, ip - codeBase );
+#endif
+		// get size of stack frame
+		v1 = ip->arg;
 
-		case OP_GEF:
-			if ( ((float *)opStack)[-1] >= *(float *)opStack ) {
-				programCounter = r2;	//vm->instructionPointers[r2];
-				opStack -= 2;
-				goto nextInstruction;
-			} else {
-				programCounter += 4;
-				opStack -= 2;
-				goto nextInstruction;
+		programStack -= v1;
+#ifdef DEBUG_VM
+		// save old stack frame for debugging traces
+		*(int *)&image[programStack+4] = programStack + v1;
+		if ( vm_debugLevel ) {
+			Com_Printf( "%s---> %s\n", DEBUGSTR, VM_ValueToSymbol( vm, ip - codeBase ) );
+			if ( vm->breakFunction && ip - codeBase == vm->breakFunction ) {
+				// this is to allow setting breakpoints here in the debugger
+				vm->breakCount++;
+//				vm_debugLevel = 2;
+//				VM_StackTrace( vm, ip - codeBase, programStack );
 			}
+			vm->callLevel++;
+		}
+#endif
+		if ( vm_profileTick ) {
+			VM_ProfileSample( vm, ip - codeBase, programStack );
+		}
+		NEXT();
+	VM_OP(OP_LEAVE):
+		// remove our stack frame
+		programStack += ip->arg;
 
-
-		//===================================================================
-
-		case OP_NEGI:
-			*opStack = -r0;
-			goto nextInstruction;
-		case OP_ADD:
-			opStack[-1] = r1 + r0;
-			opStack--;
-			goto nextInstruction;
-		case OP_SUB:
-			opStack[-1] = r1 - r0;
-			opStack--;
-			goto nextInstruction;
-		case OP_DIVI:
-			opStack[-1] = r1 / r0;
-			opStack--;
-			goto nextInstruction;
-		case OP_DIVU:
-			opStack[-1] = ((unsigned)r1) / ((unsigned)r0);
-			opStack--;
-			goto nextInstruction;
-		case OP_MODI:
-			opStack[-1] = r1 % r0;
-			opStack--;
-			goto nextInstruction;
-		case OP_MODU:
-			opStack[-1] = ((unsigned)r1) % (unsigned)r0;
-			opStack--;
-			goto nextInstruction;
-		case OP_MULI:
-			opStack[-1] = r1 * r0;
-			opStack--;
-			goto nextInstruction;
-		case OP_MULU:
-			opStack[-1] = ((unsigned)r1) * ((unsigned)r0);
-			opStack--;
-			goto nextInstruction;
-
-		case OP_BAND:
-			opStack[-1] = ((unsigned)r1) & ((unsigned)r0);
-			opStack--;
-			goto nextInstruction;
-		case OP_BOR:
-			opStack[-1] = ((unsigned)r1) | ((unsigned)r0);
-			opStack--;
-			goto nextInstruction;
-		case OP_BXOR:
-			opStack[-1] = ((unsigned)r1) ^ ((unsigned)r0);
-			opStack--;
-			goto nextInstruction;
-		case OP_BCOM:
-			opStack[-1] = ~ ((unsigned)r0);
-			goto nextInstruction;
-
-		case OP_LSH:
-			opStack[-1] = r1 << r0;
-			opStack--;
-			goto nextInstruction;
-		case OP_RSHI:
-			opStack[-1] = r1 >> r0;
-			opStack--;
-			goto nextInstruction;
-		case OP_RSHU:
-			opStack[-1] = ((unsigned)r1) >> r0;
-			opStack--;
-			goto nextInstruction;
-
-		case OP_NEGF:
-			*(float *)opStack =  -*(float *)opStack;
-			goto nextInstruction;
-		case OP_ADDF:
-			*(float *)(opStack-1) = *(float *)(opStack-1) + *(float *)opStack;
-			opStack--;
-			goto nextInstruction;
-		case OP_SUBF:
-			*(float *)(opStack-1) = *(float *)(opStack-1) - *(float *)opStack;
-			opStack--;
-			goto nextInstruction;
-		case OP_DIVF:
-			*(float *)(opStack-1) = *(float *)(opStack-1) / *(float *)opStack;
-			opStack--;
-			goto nextInstruction;
-		case OP_MULF:
-			*(float *)(opStack-1) = *(float *)(opStack-1) * *(float *)opStack;
-			opStack--;
-			goto nextInstruction;
-
-		case OP_CVIF:
-			*(float *)opStack =  (float)*opStack;
-			goto nextInstruction;
-		case OP_CVFI:
-			*opStack = (int) *(float *)opStack;
-			goto nextInstruction;
-		case OP_SEX8:
-			*opStack = (signed char)*opStack;
-			goto nextInstruction;
-		case OP_SEX16:
-			*opStack = (short)*opStack;
-			goto nextInstruction;
+		// grab the saved program counter
+		v1 = *(int *)&image[ programStack ];
+#ifdef DEBUG_VM
+		profileSymbol = VM_ValueToFunctionSymbol( vm, v1 );
+		if ( vm_debugLevel ) {
+			vm->callLevel--;
+			Com_Printf( "%s<--- %s\n", DEBUGSTR, VM_ValueToSymbol( vm, v1 ) );
+		}
+#endif
+		// check for leaving the VM
+		if ( v1 == -1 ) {
+			goto done;
 		}
+		if ( (unsigned)v1 >= instructionCount ) {
+			Com_Error( ERR_DROP, "VM %s: return to bad instruction %i", vm->name, v1 );
+		}
+		ip = codeBase + v1;
+		DISPATCH();
+
+	/*
+	===================================================================
+	BRANCHES
+	===================================================================
+	*/
+
+	VM_OP(OP_JUMP):
+		v1 = *opStack;
+		opStack--;
+		if ( (unsigned)v1 >= instructionCount ) {
+			Com_Error( ERR_DROP, "VM %s: jump to bad instruction %i", vm->name, v1 );
+		}
+		ip = codeBase + v1;
+		DISPATCH();
+
+	VM_OP(OP_EQ):
+		BRANCH_IF( opStack[-1] == opStack[0] );
+	VM_OP(OP_NE):
+		BRANCH_IF( opStack[-1] != opStack[0] );
+	VM_OP(OP_LTI):
+		BRANCH_IF( opStack[-1] < opStack[0] );
+	VM_OP(OP_LEI):
+		BRANCH_IF( opStack[-1] <= opStack[0] );
+	VM_OP(OP_GTI):
+		BRANCH_IF( opStack[-1] > opStack[0] );
+	VM_OP(OP_GEI):
+		BRANCH_IF( opStack[-1] >= opStack[0] );
+	VM_OP(OP_LTU):
+		BRANCH_IF( (unsigned)opStack[-1] < (unsigned)opStack[0] );
+	VM_OP(OP_LEU):
+		BRANCH_IF( (unsigned)opStack[-1] <= (unsigned)opStack[0] );
+	VM_OP(OP_GTU):
+		BRANCH_IF( (unsigned)opStack[-1] > (unsigned)opStack[0] );
+	VM_OP(OP_GEU):
+		BRANCH_IF( (unsigned)opStack[-1] >= (unsigned)opStack[0] );
+
+	VM_OP(OP_EQF):
+		BRANCH_IF( F(-1) == F(0) );
+	VM_OP(OP_NEF):
+		BRANCH_IF( F(-1) != F(0) );
+	VM_OP(OP_LTF):
+		BRANCH_IF( F(-1) < F(0) );
+	VM_OP(OP_LEF):
+		BRANCH_IF( F(-1) <= F(0) );
+	VM_OP(OP_GTF):
+		BRANCH_IF( F(-1) > F(0) );
+	VM_OP(OP_GEF):
+		BRANCH_IF( F(-1) >= F(0) );
+
+	//===================================================================
+
+	VM_OP(OP_NEGI):
+		*opStack = -*opStack;
+		NEXT();
+	VM_OP(OP_ADD):
+		opStack[-1] = opStack[-1] + opStack[0];
+		opStack--;
+		NEXT();
+	VM_OP(OP_SUB):
+		opStack[-1] = opStack[-1] - opStack[0];
+		opStack--;
+		NEXT();
+	VM_OP(OP_DIVI):
+		opStack[-1] = opStack[-1] / opStack[0];
+		opStack--;
+		NEXT();
+	VM_OP(OP_DIVU):
+		opStack[-1] = ((unsigned)opStack[-1]) / ((unsigned)opStack[0]);
+		opStack--;
+		NEXT();
+	VM_OP(OP_MODI):
+		opStack[-1] = opStack[-1] % opStack[0];
+		opStack--;
+		NEXT();
+	VM_OP(OP_MODU):
+		opStack[-1] = ((unsigned)opStack[-1]) % ((unsigned)opStack[0]);
+		opStack--;
+		NEXT();
+	VM_OP(OP_MULI):
+		opStack[-1] = opStack[-1] * opStack[0];
+		opStack--;
+		NEXT();
+	VM_OP(OP_MULU):
+		opStack[-1] = ((unsigned)opStack[-1]) * ((unsigned)opStack[0]);
+		opStack--;
+		NEXT();
+
+	VM_OP(OP_BAND):
+		opStack[-1] = ((unsigned)opStack[-1]) & ((unsigned)opStack[0]);
+		opStack--;
+		NEXT();
+	VM_OP(OP_BOR):
+		opStack[-1] = ((unsigned)opStack[-1]) | ((unsigned)opStack[0]);
+		opStack--;
+		NEXT();
+	VM_OP(OP_BXOR):
+		opStack[-1] = ((unsigned)opStack[-1]) ^ ((unsigned)opStack[0]);
+		opStack--;
+		NEXT();
+	VM_OP(OP_BCOM):
+		*opStack = ~((unsigned)*opStack);
+		NEXT();
+
+	VM_OP(OP_LSH):
+		opStack[-1] = opStack[-1] << opStack[0];
+		opStack--;
+		NEXT();
+	VM_OP(OP_RSHI):
+		opStack[-1] = opStack[-1] >> opStack[0];
+		opStack--;
+		NEXT();
+	VM_OP(OP_RSHU):
+		opStack[-1] = ((unsigned)opStack[-1]) >> opStack[0];
+		opStack--;
+		NEXT();
+
+	VM_OP(OP_NEGF):
+		F(0) = -F(0);
+		NEXT();
+	VM_OP(OP_ADDF):
+		F(-1) = F(-1) + F(0);
+		opStack--;
+		NEXT();
+	VM_OP(OP_SUBF):
+		F(-1) = F(-1) - F(0);
+		opStack--;
+		NEXT();
+	VM_OP(OP_DIVF):
+		F(-1) = F(-1) / F(0);
+		opStack--;
+		NEXT();
+	VM_OP(OP_MULF):
+		F(-1) = F(-1) * F(0);
+		opStack--;
+		NEXT();
+
+	VM_OP(OP_CVIF):
+		F(0) = (float)*opStack;
+		NEXT();
+	VM_OP(OP_CVFI):
+		*opStack = (int)F(0);
+		NEXT();
+	VM_OP(OP_SEX8):
+		*opStack = (signed char)*opStack;
+		NEXT();
+	VM_OP(OP_SEX16):
+		*opStack = (short)*opStack;
+		NEXT();
+
+	/*
+	===================================================================
+	PAIRS
+
+	each of these does the work of the instruction after it too
+	===================================================================
+	*/
+
+	VM_OP(OP_LOCAL_LOAD4):
+		*++opStack = *(int *)&image[ (ip->arg + programStack) & dataMask ];
+		ip += 2;
+		DISPATCH();
+	VM_OP(OP_CONST_LOAD4):
+		*++opStack = *(int *)&image[ ip->arg & dataMask ];
+		ip += 2;
+		DISPATCH();
+	VM_OP(OP_CONST_ADD):
+		*opStack += ip->arg;
+		ip += 2;
+		DISPATCH();
+	VM_OP(OP_CONST_EQ):
+		opStack--;
+		if ( opStack[1] == ip->arg ) {
+			ip = codeBase + ip[1].arg;
+			DISPATCH();
+		}
+		ip += 2;
+		DISPATCH();
+	VM_OP(OP_CONST_NE):
+		opStack--;
+		if ( opStack[1] != ip->arg ) {
+			ip = codeBase + ip[1].arg;
+			DISPATCH();
+		}
+		ip += 2;
+		DISPATCH();
+	VM_OP(OP_CONST_JUMP):
+		ip = codeBase + ip->arg;
+		DISPATCH();
+	VM_OP(OP_CONST_CALL):
+		*(int *)&image[ programStack ] = ip - codeBase + 2;
+		ip = codeBase + ip->arg;
+		DISPATCH();
+	VM_OP(OP_CONST_LEAF):
+		opStack++;
+		*opStack = vm_leafFuncs[ ip->arg ]( (const int *)&image[ programStack + 8 ] );
+		ip += 2;
+		DISPATCH();
 	}
 
 done:
-	vm->currentlyInterpreting = qfalse;
-
 	if ( opStack != &stack[1] ) {
 		Com_Error( ERR_DROP, "Interpreter error: opStack = %i", opStack - stack );
 	}
 
-	vm->programStack = stackOnEntry;
-
 	// return the result
 	return *opStack;
 }
@@ -118,6 +118,12 @@ typedef struct vmSymbol_s {
 	char	symName[1];		// variable sized
 } vmSymbol_t;
 
+// every OP_ENTER, so that the profiler can walk the qvm stack without symbols
+typedef struct {
+	int		start;				// instruction number
+	int		frameSize;
+} vmFunction_t;
+
 #define	VM_OFFSET_PROGRAM_STACK		0
 #define	VM_OFFSET_SYSTEM_CALL		4
 
@@ -131,6 +137,9 @@ struct vm_s {
 
 	char		name[MAX_QPATH];
 
+	const vmLeafTrapDef_t	*leafTraps;
+	int			numLeafTraps;
+
 	// for dynamic linked modules
 	void		*dllHandle;
 	intptr_t	(QDECL *entryPoint)( int callNum, ... );
@@ -139,6 +148,8 @@ struct vm_s {
 	qbool	compiled;
 	byte		*codeBase;
 	int			codeLength;
+	int			compileTime;		// msec spent in VM_Compile or loading the cached code
+	qbool		cachedCode;			// the compiled code came from the vmcache
 
 	int			*instructionPointers;
 	int			instructionPointersLength;
@@ -146,9 +157,15 @@ struct vm_s {
 	byte		*dataBase;
 	int			dataMask;
 
+	int			imageLength;		// of the .qvm file
+	unsigned	imageChecksum;
+
 	int			numSymbols;
 	vmSymbol_t	*symbols;
 
+	int			numFunctions;
+	vmFunction_t	*functions;		// sorted by start
+
 	int			stackBottom;		// if programStack < stackBottom, error
 #if defined(NO_VM_COMPILED)
 	int			callLevel;			// for debug indenting
@@ -188,15 +205,38 @@ extern	int		vm_debugLevel;
 void VM_Compile( vm_t* vm, const vmHeader_t* header );
 int VM_CallCompiled( vm_t* vm, int* args );
 
+// compilers whose code doesn't depend on where it or the engine is loaded
+// can have it written to and loaded back from the vmcache
+#if !defined(NO_VM_COMPILED) && defined(__x86_64__)
+#define VM_CODE_CACHE
+const char* VM_CodeCacheKey();
+void VM_LoadCompiledCode( vm_t* vm, const byte* code, int codeLength );
+#endif
+
 #if defined(NO_VM_COMPILED)
 void VM_PrepareInterpreter( vm_t* vm, const vmHeader_t* header );
 int VM_CallInterpreted( vm_t *vm, int *args );
 #endif
 
+vm_t* VM_Find( const char* name );
+
+// args points at the first argument on the qvm's stack,
+// and the result is returned the way the system call would
+typedef int (*vmLeafFunc_t)( const int* args );
+extern const vmLeafFunc_t vm_leafFuncs[VM_LEAF_COUNT];
+int VM_FindLeafTrap( const vm_t* vm, int trap );	// -1 if it's not one
+
 const char* VM_ValueToSymbol( const vm_t* vm, int value );
 const vmSymbol_t* VM_ValueToFunctionSymbol( const vm_t* vm, int value );
 void VM_LogSyscalls( int *args );
 
+// all the backends store the instruction a call returns to at
+// the caller's programStack, which is how the profiler walks the stack
+extern volatile int vm_profileTick;		// a sample is due at the next check
+void VM_ProfileInit();
+void VM_ProfileSample( const vm_t* vm, int instruction, int programStack );
+void VM_ProfileStop( const vm_t* vm );	// NULL keeps the samples, VM_Free passes the vm to drop them
+
 intptr_t VM_ArgPtr( intptr_t intValue );
 intptr_t VM_ExplicitArgPtr( const vm_t* vm, intptr_t intValue );
 
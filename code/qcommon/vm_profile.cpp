@@ -0,0 +1,628 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+// vm_profile.cpp -- sampling profiler for qvm code and system calls
+
+#include "vm_local.h"
+
+#if !defined(_WIN32)
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+// on x86-64 linux, the signal handler can map the interrupted pc
+// of compiled code straight to an instruction
+#if defined(__linux__) && defined(__x86_64__) && !defined(NO_VM_COMPILED)
+#include <ucontext.h>
+#include <pthread.h>
+#define VM_PROFILE_NATIVE_PC
+#endif
+
+
+/*
+
+every qvm backend writes the number of the instruction a call returns to
+into the caller's frame at programStack, the way the interpreter always has,
+and OP_ENTER tells how big each frame is. so given an instruction and the
+program stack, the whole qvm call stack can be walked without any help
+from the generated code or the symbols
+
+samples are taken on a timer: by the signal handler itself for compiled
+code on x86-64 linux, otherwise at the next system call or (interpreted)
+function entry after the timer went off. every system call the profiled
+vm makes is also timed while the profiler runs
+
+*/
+
+#define MAX_PROFILE_FRAMES		32
+#define MAX_PROFILE_SYSCALLS	1024
+#define PROFILE_BUFFER_SIZE		(512 * 1024)	// ints
+
+typedef struct {
+	vm_t*		vm;
+	intptr_t	(*systemCall)( intptr_t* parms );	// the vm's own, which the profiler wraps
+	qbool		native;		// the signal handler takes the samples itself
+	int			hz;
+	int			startTime;
+	int			stopTime;
+
+	// one record per sample: frame count, system call or -1, then
+	// the function of every frame, starting with the innermost one
+	int*		buffer;
+	int			used;
+	int			samples;
+	int			dropped;
+
+	// the system call the vm is in, if any
+	volatile int	syscall;
+	volatile int	syscallStack;
+
+	int64_t		syscallTime[MAX_PROFILE_SYSCALLS];	// usec, including nested vm calls
+	int			syscallCount[MAX_PROFILE_SYSCALLS];
+
+#if defined(VM_PROFILE_NATIVE_PC)
+	pthread_t	thread;
+#endif
+} vmProfile_t;
+
+static vmProfile_t prof;
+
+volatile int vm_profileTick;
+
+#if defined(_WIN32)
+static int64_t nextTick;
+#endif
+
+
+static const vmFunction_t* VM_FunctionAt( const vm_t* vm, int instruction )
+{
+	int low = 0;
+	int high = vm->numFunctions - 1;
+
+	if ( high < 0 || instruction < vm->functions[0].start ) {
+		return NULL;
+	}
+
+	while ( low < high ) {
+		const int mid = ( low + high + 1 ) / 2;
+		if ( vm->functions[mid].start <= instruction ) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+
+	return &vm->functions[low];
+}
+
+
+// fills frames with the function of every frame, innermost first
+
+static int VM_ProfileStack( const vm_t* vm, int instruction, int programStack, int* frames )
+{
+	const int instructionCount = vm->instructionPointersLength >> 2;
+	int count = 0;
+
+	while ( count < MAX_PROFILE_FRAMES ) {
+		const vmFunction_t* function = VM_FunctionAt( vm, instruction );
+		if ( !function ) {
+			break;
+		}
+		frames[count++] = function->start;
+
+		// the caller's frame, and where it continues: -1 ends the chain
+		programStack += function->frameSize;
+		instruction = *(const int*)( vm->dataBase + ( programStack & vm->dataMask & ~3 ) );
+		if ( (unsigned)instruction >= (unsigned)instructionCount ) {
+			break;
+		}
+	}
+
+	return count;
+}
+
+
+static void VM_ProfileRecord( const vm_t* vm, int instruction, int programStack, int syscall )
+{
+	int frames[MAX_PROFILE_FRAMES];
+	const int count = VM_ProfileStack( vm, instruction, programStack, frames );
+	if ( !count ) {
+		return;
+	}
+
+	if ( prof.used + 2 + count > PROFILE_BUFFER_SIZE ) {
+		prof.dropped++;
+		return;
+	}
+
+	int* record = prof.buffer + prof.used;
+	record[0] = count;
+	record[1] = syscall;
+	for (int i = 0; i < count; ++i)
+		record[2 + i] = frames[i];
+
+	prof.used += 2 + count;
+	prof.samples++;
+}
+
+
+// the instruction a call made at this program stack will return to
+
+static int VM_ReturnInstruction( const vm_t* vm, int programStack )
+{
+	return *(const int*)( vm->dataBase + ( programStack & vm->dataMask & ~3 ) );
+}
+
+
+// for the interpreter: the timer went off, and the vm is at this instruction
+
+void VM_ProfileSample( const vm_t* vm, int instruction, int programStack )
+{
+	vm_profileTick = 0;
+	if ( vm == prof.vm ) {
+		VM_ProfileRecord( vm, instruction, programStack, -1 );
+	}
+}
+
+
+#if defined(VM_PROFILE_NATIVE_PC)
+
+static int VM_InstructionAt( const vm_t* vm, int offset )
+{
+	const int* instructionPointers = vm->instructionPointers;
+	int low = 0;
+	int high = ( vm->instructionPointersLength >> 2 ) - 1;
+
+	while ( low < high ) {
+		const int mid = ( low + high + 1 ) / 2;
+		if ( instructionPointers[mid] <= offset ) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+
+	return low;
+}
+
+
+static void VM_ProfileNativeSample( const ucontext_t* context )
+{
+	const vm_t* vm = prof.vm;
+	const byte* pc = (const byte*)context->uc_mcontext.gregs[REG_RIP];
+	const int programStack = (int)context->uc_mcontext.gregs[REG_R13];
+	const intptr_t offset = pc - vm->codeBase;
+
+	if ( offset >= vm->instructionPointers[0] && offset < vm->codeLength ) {
+		if ( *pc == 0xC3 ) {
+			// the ret of an OP_LEAVE: the frame is already gone
+			VM_ProfileRecord( vm, VM_ReturnInstruction( vm, programStack ), programStack, -1 );
+			return;
+		}
+
+		const int instruction = VM_InstructionAt( vm, (int)offset );
+		const vmFunction_t* function = VM_FunctionAt( vm, instruction );
+		if ( function && function->start == instruction ) {
+			// the OP_ENTER itself hasn't made the frame yet
+			VM_ProfileRecord( vm, instruction, programStack - function->frameSize, -1 );
+		} else {
+			VM_ProfileRecord( vm, instruction, programStack, -1 );
+		}
+		return;
+	}
+
+	const int syscall = prof.syscall;
+	if ( syscall >= 0 ) {
+		const int stack = prof.syscallStack;
+		VM_ProfileRecord( vm, VM_ReturnInstruction( vm, stack ), stack, syscall );
+	}
+}
+
+#endif
+
+
+#if !defined(_WIN32)
+
+static void VM_ProfileSignal( int sig, siginfo_t* info, void* context )
+{
+#if defined(VM_PROFILE_NATIVE_PC)
+	if ( prof.native ) {
+		// the timer counts the cpu time of every thread, but only the
+		// main one ever runs qvm code
+		if ( pthread_equal( pthread_self(), prof.thread ) ) {
+			VM_ProfileNativeSample( (const ucontext_t*)context );
+		}
+		return;
+	}
+#endif
+	vm_profileTick = 1;
+}
+
+
+static void VM_ProfileTimer( int hz )
+{
+	struct sigaction action;
+	Com_Memset( &action, 0, sizeof( action ) );
+	if ( hz ) {
+		action.sa_sigaction = VM_ProfileSignal;
+		action.sa_flags = SA_SIGINFO | SA_RESTART;
+	} else {
+		action.sa_handler = SIG_IGN;
+	}
+	sigemptyset( &action.sa_mask );
+
+	struct itimerval timer;
+	Com_Memset( &timer, 0, sizeof( timer ) );
+	if ( hz ) {
+		timer.it_interval.tv_usec = 1000000 / hz;
+		timer.it_value = timer.it_interval;
+	}
+
+	// install the handler before arming the timer, and disarm it before removing the handler
+	if ( hz ) {
+		sigaction( SIGPROF, &action, NULL );
+		setitimer( ITIMER_PROF, &timer, NULL );
+	} else {
+		setitimer( ITIMER_PROF, &timer, NULL );
+		sigaction( SIGPROF, &action, NULL );
+	}
+}
+
+#else
+
+// no profiling timer here: the system calls check the time instead
+
+static void VM_ProfileTimer( int hz )
+{
+	nextTick = Sys_Microseconds();
+}
+
+#endif
+
+
+static intptr_t VM_ProfileSystemCall( intptr_t* args )
+{
+	// the backends leave the caller's program stack just below the arguments
+	const vm_t* vm = prof.vm;
+	const int programStack = vm->programStack + 4;
+	const int syscall = (int)args[0];
+
+	const int savedSyscall = prof.syscall;
+	const int savedStack = prof.syscallStack;
+
+	int64_t start = Sys_Microseconds();
+
+#if defined(_WIN32)
+	if ( start >= nextTick ) {
+		nextTick = start + 1000000 / prof.hz;
+		vm_profileTick = 1;
+	}
+#endif
+
+	// the timer went off while the vm was running its own code
+	if ( vm_profileTick ) {
+		vm_profileTick = 0;
+		VM_ProfileRecord( vm, VM_ReturnInstruction( vm, programStack ), programStack, -1 );
+	}
+
+	prof.syscallStack = programStack;
+	prof.syscall = syscall;
+
+	const intptr_t result = prof.systemCall( args );
+
+	prof.syscall = savedSyscall;
+	prof.syscallStack = savedStack;
+
+	const int slot = ( (unsigned)syscall < MAX_PROFILE_SYSCALLS ) ? syscall : MAX_PROFILE_SYSCALLS - 1;
+	prof.syscallTime[slot] += Sys_Microseconds() - start;
+	prof.syscallCount[slot]++;
+
+	// the timer went off during the system call
+	if ( vm_profileTick ) {
+		vm_profileTick = 0;
+		VM_ProfileRecord( vm, VM_ReturnInstruction( vm, programStack ), programStack, syscall );
+	}
+
+	return result;
+}
+
+
+static qbool VM_ProfileRunning()
+{
+	return ( prof.vm && prof.hz );
+}
+
+
+static void VM_ProfileStart( vm_t* vm, int hz )
+{
+	if ( prof.buffer ) {
+		Z_Free( prof.buffer );
+	}
+	Com_Memset( &prof, 0, sizeof( prof ) );
+
+	prof.buffer = (int*)Z_Malloc( PROFILE_BUFFER_SIZE * sizeof(int) );
+	prof.vm = vm;
+	prof.hz = hz;
+	prof.syscall = -1;
+	prof.startTime = Sys_Milliseconds();
+
+#if defined(VM_PROFILE_NATIVE_PC)
+	prof.native = vm->compiled;
+	prof.thread = pthread_self();
+#endif
+
+	prof.systemCall = vm->systemCall;
+	vm->systemCall = VM_ProfileSystemCall;
+
+	vm_profileTick = 0;
+	VM_ProfileTimer( hz );
+
+	Com_Printf( "Profiling %s at %d Hz%s\n", vm->name, hz, prof.native ? "" : " (sampled at system calls)" );
+}
+
+
+// the samples are kept for the report until the vm itself goes away
+
+void VM_ProfileStop( const vm_t* vm )
+{
+	if ( !prof.vm || ( vm && vm != prof.vm ) ) {
+		return;
+	}
+
+	if ( VM_ProfileRunning() ) {
+		VM_ProfileTimer( 0 );
+		vm_profileTick = 0;
+
+		prof.vm->systemCall = prof.systemCall;
+		prof.stopTime = Sys_Milliseconds();
+		prof.hz = 0;
+
+		Com_Printf( "Stopped profiling %s: %d samples\n", prof.vm->name, prof.samples );
+	}
+
+	// the report needs the vm's functions and symbols
+	if ( vm ) {
+		Z_Free( prof.buffer );
+		Com_Memset( &prof, 0, sizeof( prof ) );
+	}
+}
+
+
+static const char* VM_ProfileFunctionName( const vm_t* vm, int start )
+{
+	if ( vm->numSymbols ) {
+		return VM_ValueToFunctionSymbol( vm, vm->instructionPointers[start] )->symName;
+	}
+	return va( "func_%d", start );
+}
+
+
+static const int* sortBuffer;
+
+static int QDECL VM_ProfileSortRecords( const void* a, const void* b )
+{
+	const int* ra = sortBuffer + *(const int*)a;
+	const int* rb = sortBuffer + *(const int*)b;
+
+	// compare the outermost frames first, so that the file reads like a tree
+	const int count = min( ra[0], rb[0] );
+	for (int i = 1; i <= count; ++i) {
+		if ( ra[1 + ra[0] - i] != rb[1 + rb[0] - i] ) {
+			return ra[1 + ra[0] - i] - rb[1 + rb[0] - i];
+		}
+	}
+	if ( ra[0] != rb[0] ) {
+		return ra[0] - rb[0];
+	}
+	return ra[1] - rb[1];
+}
+
+
+// offsets of all the records so far, the profiler might still be adding more
+
+static int* VM_ProfileRecords( int* count )
+{
+	const int used = prof.used;
+	int* records = (int*)Z_Malloc( max( prof.samples, 1 ) * sizeof(int) );
+	*count = 0;
+	for (int i = 0; i < used; i += 2 + prof.buffer[i]) {
+		records[(*count)++] = i;
+	}
+	return records;
+}
+
+
+static void VM_ProfileReport()
+{
+	const vm_t* vm = prof.vm;
+	const int msec = ( VM_ProfileRunning() ? Sys_Milliseconds() : prof.stopTime ) - prof.startTime;
+	int i;
+
+	int samples;
+	int* records = VM_ProfileRecords( &samples );
+
+	Com_Printf( "%s: %d samples in %.1f seconds, %d dropped\n", vm->name, samples, msec / 1000.0f, prof.dropped );
+	if ( !samples ) {
+		Z_Free( records );
+		return;
+	}
+
+	int* self = (int*)Z_Malloc( vm->numFunctions * sizeof(int) );
+	int* total = (int*)Z_Malloc( vm->numFunctions * sizeof(int) );
+	int* seen = (int*)Z_Malloc( vm->numFunctions * sizeof(int) );
+	int* syscallSamples = (int*)Z_Malloc( MAX_PROFILE_SYSCALLS * sizeof(int) );
+	byte* printed = (byte*)Z_Malloc( MAX_PROFILE_SYSCALLS );
+
+	for (int sample = 0; sample < samples; ++sample) {
+		const int* record = prof.buffer + records[sample];
+		for (int f = 0; f < record[0]; ++f) {
+			const int index = VM_FunctionAt( vm, record[2 + f] ) - vm->functions;
+			// recursive functions only count once per sample
+			if ( seen[index] != sample + 1 ) {
+				seen[index] = sample + 1;
+				total[index]++;
+			}
+		}
+		if ( record[1] >= 0 ) {
+			syscallSamples[ min( record[1], MAX_PROFILE_SYSCALLS - 1 ) ]++;
+		} else {
+			self[ VM_FunctionAt( vm, record[2] ) - vm->functions ]++;
+		}
+	}
+
+	Com_Printf( "  self%%  total%%  function\n" );
+	for (int n = 0; n < 20; ++n) {
+		int best = -1;
+		for (i = 0; i < vm->numFunctions; ++i) {
+			if ( total[i] && ( best < 0 || self[i] > self[best] || ( self[i] == self[best] && total[i] > total[best] ) ) ) {
+				best = i;
+			}
+		}
+		if ( best < 0 ) {
+			break;
+		}
+		Com_Printf( "%6.1f %7.1f  %s\n", 100.0f * self[best] / samples, 100.0f * total[best] / samples,
+			VM_ProfileFunctionName( vm, vm->functions[best].start ) );
+		self[best] = total[best] = 0;
+	}
+
+	Com_Printf( "syscall    calls      msec  usec/call  samples%%\n" );
+	for (int n = 0; n < 20; ++n) {
+		int best = -1;
+		for (i = 0; i < MAX_PROFILE_SYSCALLS; ++i) {
+			if ( prof.syscallCount[i] && !printed[i] && ( best < 0 || prof.syscallTime[i] > prof.syscallTime[best] ) ) {
+				best = i;
+			}
+		}
+		if ( best < 0 ) {
+			break;
+		}
+		Com_Printf( "%7d %8d %9.1f %10.2f %8.1f\n", best, prof.syscallCount[best],
+			prof.syscallTime[best] / 1000.0, (double)prof.syscallTime[best] / prof.syscallCount[best],
+			100.0f * syscallSamples[best] / samples );
+		printed[best] = 1;
+	}
+
+	Z_Free( printed );
+	Z_Free( syscallSamples );
+	Z_Free( seen );
+	Z_Free( total );
+	Z_Free( self );
+	Z_Free( records );
+}
+
+
+// one line per distinct stack, outermost function first, and how many
+// samples had it: what flamegraph.pl and most other viewers read
+
+static void VM_ProfileWrite( const char* name )
+{
+	char filename[MAX_QPATH];
+	Q_strncpyz( filename, name, sizeof( filename ) - 8 );
+	COM_DefaultExtension( filename, sizeof( filename ), ".folded" );
+
+	fileHandle_t f = FS_FOpenFileWrite( filename );
+	if ( !f ) {
+		Com_Printf( "ERROR: couldn't open %s\n", filename );
+		return;
+	}
+
+	const vm_t* vm = prof.vm;
+	int samples;
+	int* records = VM_ProfileRecords( &samples );
+	sortBuffer = prof.buffer;
+	qsort( records, samples, sizeof(int), VM_ProfileSortRecords );
+
+	int lines = 0;
+	for (int i = 0; i < samples; ) {
+		const int* record = prof.buffer + records[i];
+		int count = 1;
+		while ( i + count < samples && !VM_ProfileSortRecords( &records[i], &records[i + count] ) ) {
+			++count;
+		}
+		i += count;
+
+		FS_Printf( f, "%s", vm->name );
+		for (int frame = record[0] - 1; frame >= 0; --frame) {
+			FS_Printf( f, ";%s", VM_ProfileFunctionName( vm, record[2 + frame] ) );
+		}
+		if ( record[1] >= 0 ) {
+			FS_Printf( f, ";syscall_%d", record[1] );
+		}
+		FS_Printf( f, " %d\n", count );
+		++lines;
+	}
+
+	Z_Free( records );
+	FS_FCloseFile( f );
+
+	Com_Printf( "Wrote %d stacks from %d samples to %s\n", lines, samples, filename );
+}
+
+
+static void VM_VmProfile_f( void )
+{
+	const char* cmd = Cmd_Argv( 1 );
+
+	if ( !Q_stricmp( cmd, "start" ) ) {
+		const char* name = ( Cmd_Argc() > 2 ) ? Cmd_Argv( 2 ) : "qagame";
+		vm_t* vm = VM_Find( name );
+		if ( !vm ) {
+			Com_Printf( "vmprofile: no vm named %s\n", name );
+			return;
+		}
+		if ( vm->dllHandle ) {
+			Com_Printf( "vmprofile: %s is a native dll\n", name );
+			return;
+		}
+		VM_ProfileStop( NULL );
+		VM_ProfileStart( vm, ( Cmd_Argc() > 3 ) ? (int)Com_Clamp( 10, 10000, atoi( Cmd_Argv( 3 ) ) ) : 1000 );
+		return;
+	}
+
+	if ( !Q_stricmp( cmd, "stop" ) ) {
+		VM_ProfileStop( NULL );
+		return;
+	}
+
+	if ( !prof.vm ) {
+		Com_Printf( "usage: vmprofile start [vm] [hz] | stop | report | write <filename>\n" );
+		return;
+	}
+
+	if ( !Q_stricmp( cmd, "write" ) && Cmd_Argc() == 3 ) {
+		VM_ProfileWrite( Cmd_Argv( 2 ) );
+		return;
+	}
+
+	if ( !cmd[0] || !Q_stricmp( cmd, "report" ) ) {
+		VM_ProfileReport();
+		return;
+	}
+
+	Com_Printf( "usage: vmprofile start [vm] [hz] | stop | report | write <filename>\n" );
+}
+
+
+void VM_ProfileInit()
+{
+	Cmd_AddCommand( "vmprofile", VM_VmProfile_f );
+}
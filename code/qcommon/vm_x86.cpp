@@ -687,7 +687,7 @@ void VM_Compile( vm_t* vm, const vmHeader_t* header )
 		case OP_CALL:
 			EmitString( "C7 86" );		// mov dword ptr [esi+database],0x12345678
 			Emit4( (int)vm->dataBase );
-			Emit4( pc );
+			Emit4( instruction );		// the return address, as an instruction number
 			EmitString( "FF 15" );		// call asmCallPtr
 			Emit4( (int)&asmCallPtr );
 			break;
@@ -20,940 +20,1192 @@ along with Quake III Arena source code; if not, write to the Free Software
 Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 ===========================================================================
 */
-// vm_x86_64.c -- load time compiler and execution environment for x86-64
+// vm_x86_64.cpp -- load time compiler and execution environment for x86-64
 
 #include "vm_local.h"
 
 #include <sys/mman.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <fcntl.h>
-#include <errno.h>
-#include <unistd.h>
-
-#ifdef DEBUG_VM
-#define Dfprintf(fd, args...) fprintf(fd, ##args)
-static FILE* qdasmout;
-#else
-#define Dfprintf(args...)
-#endif
-
-static void VM_Destroy_Compiled(vm_t* self);
+#include <cpuid.h>
+
 
 /*
 
   eax	scratch
-  ebx	scratch
   ecx	scratch (required for shifts)
   edx	scratch (required for divisions)
-  rsi	stack pointer
-  rdi	program frame pointer
-  r8    pointer to begin of real stack memory
-  r9    return address to real program
-  r10   start of generated code
+  rbx	opstack
+  rbp	saved rsp around calls back into C
+  r12	dataBase
+  r13	program stack
+  r14	instructionPointers
+  r15	codeBase
+
+  everything the generated code needs to keep lives in callee-saved
+  registers, so calls back into the engine don't have to spill anything
+
+  the top of the opstack is kept in eax between instructions that don't
+  need it in memory, and constants are folded into the instructions that
+  consume them, both only within the run of code between two jump targets
+
+  the code is assembled directly into memory in two passes: the first one
+  only measures, so every instruction has a fixed size and all the jump
+  targets are known by the time the second one writes the real thing
+
+  the only absolute addresses the code needs are those of the C helpers,
+  and it reads them from a table just in front of codeBase, so the code
+  itself can be written to the cache and loaded back by another process
+
 */
 
+static	byte	*buf = NULL;
+static	int		compiledOfs = 0;
+static	const byte	*code = NULL;
+static	int		pc = 0;
 
-static long callAsmCall(long callProgramStack, long callSyscallNum)
-{
-	vm_t *savedVM;
-	long ret = 0x77;
-	long args[11];
-//	int iargs[11];
-	int i;
+static	int		codeLength = 0;
+
+static	int		*instructionPointers = NULL;
+static	int		instruction, instructionCount;
+
+// instructions that can be reached other than by falling into them
+static	byte	*jused = NULL;
+
+// whether eax holds the top of the opstack, and whether [rbx] is stale
+static	qbool	topInEAX, topDirty;
+
+// offsets of the helper stubs at the start of the code
+static	int		callStubOfs, badJumpStubOfs;
+
+typedef enum {
+	HELPER_SYSTEMCALL,
+	HELPER_BLOCKCOPY,
+	HELPER_BADJUMP,
+	HELPER_LEAF,		// one for each vmLeafTrap_t
+	HELPER_COUNT = HELPER_LEAF + VM_LEAF_COUNT
+} vmHelper_t;
+
+// keeps codeBase 16-byte aligned and every entry within a disp8 of r15
+#define HELPER_TABLE_SIZE	128
+
+// it's full already: any more helpers would overwrite the start of the code,
+// and EmitCallC's displacement would wrap around
+// (COMPILE_TIME_ASSERT is only there in debug builds and can't be at file scope)
+static_assert( HELPER_COUNT * 8 <= HELPER_TABLE_SIZE, "the vm helpers don't fit in HELPER_TABLE_SIZE" );
+
+
+// what the entry stub loads the registers from,
+// and where it leaves them once the vm returns
+
+typedef struct {
+	int*		opStack;				// rbx
+	byte*		dataBase;				// r12
+	const int*	instructionPointers;	// r14
+	byte*		codeBase;				// r15
+	int			programStack;			// r13
+} vmEntryFrame_t;
+
+typedef void (*vmEntryPoint_t)( vmEntryFrame_t* frame );
 
-//	Dfprintf(stderr, "callAsmCall(%ld, %ld)\n", callProgramStack, callSyscallNum);
-//	Com_Printf("-> callAsmCall %s, level %d, num %ld\n", currentVM->name, currentVM->callLevel, callSyscallNum);
+#define OPSTACK_SIZE	1024
 
-	savedVM = currentVM;
+
+// the generated code calls this with the negative call target the qvm pushed
+
+static int VM_SystemCall( int callTarget, int programStack )
+{
+	vm_t* savedVM = currentVM;
 
 	// save the stack to allow recursive VM entry
-	currentVM->programStack = callProgramStack - 4;
-
-	args[0] = callSyscallNum;
-//	iargs[0] = callSyscallNum;
-	for(i = 0; i < 10; ++i)
-	{
-//		iargs[i+1] = *(int *)((byte *)currentVM->dataBase + callProgramStack + 8 + 4*i);
-		args[i+1] = *(int *)((byte *)currentVM->dataBase + callProgramStack + 8 + 4*i);
+	currentVM->programStack = programStack - 4;
+
+	// the vm has ints on the stack, the system calls want intptr_t
+	int* data = (int*)(currentVM->dataBase + programStack + 4);
+	data[0] = -1 - callTarget;
+
+	intptr_t args[16];
+	for (int i = 0; i < 16; ++i)
+		args[i] = data[i];
+
+	int r = currentVM->systemCall( args );
+
+	currentVM = savedVM;
+
+	return r;
+}
+
+
+// same range check and copy order as the interpreter
+
+static void VM_BlockCopy( int dest, int src, int count )
+{
+	const int dataMask = currentVM->dataMask;
+
+	src &= dataMask;
+	dest &= dataMask;
+	count = ((src + count) & dataMask) - src;
+	count = ((dest + count) & dataMask) - dest;
+
+	if ( (src | dest | count) & 3 ) {
+		Com_Printf( S_COLOR_YELLOW "Warning: OP_BLOCK_COPY not dword aligned\n" );
+	}
+
+	const int* s = (const int*)(currentVM->dataBase + src);
+	int* d = (int*)(currentVM->dataBase + dest);
+	for (int i = (count >> 2) - 1; i >= 0; --i)
+		d[i] = s[i];
+}
+
+
+static void VM_BadJump( int target )
+{
+	Com_Error( ERR_DROP, "VM %s: jump to bad instruction %i", currentVM->name, target );
+}
+
+
+static void VM_Destroy_Compiled( vm_t* self )
+{
+	munmap( self->codeBase - HELPER_TABLE_SIZE, self->codeLength + HELPER_TABLE_SIZE );
+}
+
+
+static byte* VM_AllocCode( int length )
+{
+	byte* p = (byte*)mmap( NULL, length + HELPER_TABLE_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 );
+	if ( p == (byte*)MAP_FAILED ) {
+		Com_Error( ERR_DROP, "VM_CompileX86_64: can't mmap memory" );
 	}
-	ret = currentVM->systemCall(args);
+	return p + HELPER_TABLE_SIZE;
+}
 
- 	currentVM = savedVM;
-//	Com_Printf("<- callAsmCall %s, level %d, num %ld\n", currentVM->name, currentVM->callLevel, callSyscallNum);
 
-	return ret;
+static void VM_InstallCode( vm_t* vm, byte* codeBase, int length )
+{
+	const void** helpers = (const void**)(codeBase - HELPER_TABLE_SIZE);
+	helpers[HELPER_SYSTEMCALL] = (const void*)VM_SystemCall;
+	helpers[HELPER_BLOCKCOPY] = (const void*)VM_BlockCopy;
+	helpers[HELPER_BADJUMP] = (const void*)VM_BadJump;
+	for (int i = 0; i < VM_LEAF_COUNT; ++i)
+		helpers[HELPER_LEAF + i] = (const void*)vm_leafFuncs[i];
+
+	if ( mprotect( codeBase - HELPER_TABLE_SIZE, length + HELPER_TABLE_SIZE, PROT_READ|PROT_EXEC ) ) {
+		Com_Error( ERR_DROP, "VM_CompileX86_64: mprotect failed" );
+	}
+
+	vm->codeBase = codeBase;
+	vm->codeLength = length;
+	vm->destroy = VM_Destroy_Compiled;
 }
 
-#ifdef DEBUG_VM // bk001204
-static char	*opnames[256] = {
-	"OP_UNDEF", 
 
-	"OP_IGNORE", 
+static int Constant4()
+{
+	int v = code[pc] | (code[pc+1]<<8) | (code[pc+2]<<16) | (code[pc+3]<<24);
+	pc += 4;
+	return v;
+}
+
+static int Constant1()
+{
+	int v = code[pc];
+	pc += 1;
+	return v;
+}
 
-	"OP_BREAK",
-
-	"OP_ENTER",
-	"OP_LEAVE",
-	"OP_CALL",
-	"OP_PUSH",
-	"OP_POP",
-
-	"OP_CONST",
-
-	"OP_LOCAL",
-
-	"OP_JUMP",
-
-	//-------------------
-
-	"OP_EQ",
-	"OP_NE",
-
-	"OP_LTI",
-	"OP_LEI",
-	"OP_GTI",
-	"OP_GEI",
-
-	"OP_LTU",
-	"OP_LEU",
-	"OP_GTU",
-	"OP_GEU",
-
-	"OP_EQF",
-	"OP_NEF",
-
-	"OP_LTF",
-	"OP_LEF",
-	"OP_GTF",
-	"OP_GEF",
-
-	//-------------------
-
-	"OP_LOAD1",
-	"OP_LOAD2",
-	"OP_LOAD4",
-	"OP_STORE1",
-	"OP_STORE2",
-	"OP_STORE4",
-	"OP_ARG",
-
-	"OP_BLOCK_COPY",
-
-	//-------------------
-
-	"OP_SEX8",
-	"OP_SEX16",
-
-	"OP_NEGI",
-	"OP_ADD",
-	"OP_SUB",
-	"OP_DIVI",
-	"OP_DIVU",
-	"OP_MODI",
-	"OP_MODU",
-	"OP_MULI",
-	"OP_MULU",
-
-	"OP_BAND",
-	"OP_BOR",
-	"OP_BXOR",
-	"OP_BCOM",
-
-	"OP_LSH",
-	"OP_RSHI",
-	"OP_RSHU",
-
-	"OP_NEGF",
-	"OP_ADDF",
-	"OP_SUBF",
-	"OP_DIVF",
-	"OP_MULF",
-
-	"OP_CVIF",
-	"OP_CVFI"
-};
-#endif // DEBUG_VM
-
-static unsigned char op_argsize[256] = 
-{
-	[OP_ENTER]      = 4,
-	[OP_LEAVE]      = 4,
-	[OP_CONST]      = 4,
-	[OP_LOCAL]      = 4,
-	[OP_EQ]         = 4,
-	[OP_NE]         = 4,
-	[OP_LTI]        = 4,
-	[OP_LEI]        = 4,
-	[OP_GTI]        = 4,
-	[OP_GEI]        = 4,
-	[OP_LTU]        = 4,
-	[OP_LEU]        = 4,
-	[OP_GTU]        = 4,
-	[OP_GEU]        = 4,
-	[OP_EQF]        = 4,
-	[OP_NEF]        = 4,
-	[OP_LTF]        = 4,
-	[OP_LEF]        = 4,
-	[OP_GTF]        = 4,
-	[OP_GEF]        = 4,
-	[OP_ARG]        = 1,
-	[OP_BLOCK_COPY] = 4,
-};
-
-#define emit(x...) \
-	do { fprintf(fh_s, ##x); fputc('\n', fh_s); } while(0)
- 
-// integer compare and jump
-#define IJ(op) \
-	emit("subq $8, %%rsi"); \
-	emit("movl 4(%%rsi), %%eax"); \
-	emit("cmpl 8(%%rsi), %%eax"); \
-	emit(op " i_%08x", instruction+1); \
-	emit("jmp i_%08x", iarg);
-
-#ifdef USE_X87
-#define FJ(bits, op) \
-	emit("subq $8, %%rsi");\
-	emit("flds 4(%%rsi)");\
-	emit("fcomps 8(%%rsi)");\
-	emit("fnstsw %%ax");\
-	emit("testb $" #bits ", %%ah");\
-	emit(op " i_%08x", instruction+1);\
-	emit("jmp i_%08x", iarg);
-#define XJ(x)
-#else
-#define FJ(x, y)
-#define XJ(op) \
-	emit("subq $8, %%rsi");\
-	emit("movss 4(%%rsi), %%xmm0");\
-	emit("ucomiss 8(%%rsi), %%xmm0");\
-	emit("jp i_%08x", instruction+1);\
-	emit(op " i_%08x", instruction+1);\
-	emit("jmp i_%08x", iarg);
-#endif
-
-#define SIMPLE(op) \
-	emit("subq $4, %%rsi"); \
-	emit("movl 4(%%rsi), %%eax"); \
-	emit(op " %%eax, 0(%%rsi)");
-
-#ifdef USE_X87
-#define FSIMPLE(op) \
-	emit("subq $4, %%rsi"); \
-	emit("flds 0(%%rsi)"); \
-	emit(op " 4(%%rsi)"); \
-	emit("fstps 0(%%rsi)");
-#define XSIMPLE(op)
-#else
-#define FSIMPLE(op)
-#define XSIMPLE(op) \
-	emit("subq $4, %%rsi"); \
-	emit("movss 0(%%rsi), %%xmm0"); \
-	emit(op " 4(%%rsi), %%xmm0"); \
-	emit("movss %%xmm0, 0(%%rsi)");
-#endif
-
-#define SHIFT(op) \
-	emit("subq $4, %%rsi"); \
-	emit("movl 4(%%rsi), %%ecx"); \
-	emit("movl 0(%%rsi), %%eax"); \
-	emit(op " %%cl, %%eax"); \
-	emit("movl %%eax, 0(%%rsi)");
-
-#if 1
-#define RANGECHECK(reg) \
-	emit("andl $0x%x, %%" #reg, vm->dataMask);
-#else
-#define RANGECHECK(reg)
-#endif
-
-#ifdef DEBUG_VM
-#define NOTIMPL(x) \
-	do { Com_Error(ERR_DROP, "instruction not implemented: %s\n", opnames[x]); } while(0)
-#else
-#define NOTIMPL(x) \
-	do { Com_Printf(S_COLOR_RED "instruction not implemented: %x\n", x); vm->compiled = qfalse; return; } while(0)
-#endif
-
-static void* getentrypoint(vm_t* vm)
-{
-       return vm->codeBase+64; // skip ELF header
-}
-
-char* mmapfile(const char* fn, size_t* size)
-{
-	int fd = -1;
-	char* mem = NULL;
-	struct stat stb;
-
-	fd = open(fn, O_RDONLY);
-	if(fd == -1)
-		goto out;
-
-	if(fstat(fd, &stb) == -1)
-		goto out;
-
-	*size = stb.st_size;
-
-	mem = mmap(NULL, stb.st_size, PROT_READ|PROT_EXEC, MAP_SHARED, fd, 0);
-	if(mem == (void*)-1)
-		mem = NULL;
-
-out:
-	if(fd != -1)
-		close(fd);
-
-	return mem;
-}
-
-static int doas(char* in, char* out, unsigned char** compiledcode)
-{
-	unsigned char* mem;
-	size_t size = -1;
-	pid_t pid;
-
-	Com_Printf("running assembler < %s > %s\n", in, out);
-	pid = fork();
-	if(pid == -1)
-	{
-		Com_Printf(S_COLOR_RED "can't fork\n");
-		return -1;
+static void Emit1( int v )
+{
+	if ( buf ) {
+		buf[ compiledOfs ] = v;
 	}
+	compiledOfs++;
+}
+
+static void Emit4( int v )
+{
+	Emit1( v & 255 );
+	Emit1( ( v >> 8 ) & 255 );
+	Emit1( ( v >> 16 ) & 255 );
+	Emit1( ( v >> 24 ) & 255 );
+}
 
-	if(!pid)
-	{
-		char* const argv[] = {
-			"as",
-			"-o",
-			out,
-			in,
-			NULL
-		};
-
-		execvp(argv[0], argv);
-		_exit(-1);
+static int Hex( int c ) {
+	if ( c >= 'a' && c <= 'f' ) {
+		return 10 + c - 'a';
+	}
+	if ( c >= 'A' && c <= 'F' ) {
+		return 10 + c - 'A';
+	}
+	if ( c >= '0' && c <= '9' ) {
+		return c - '0';
 	}
-	else
-	{
-		int status;
-		if(waitpid(pid, &status, 0) == -1)
-		{
-			Com_Printf(S_COLOR_RED "can't wait for as: %s\n", strerror(errno));
-			return -1;
-		}
 
-		if(!WIFEXITED(status))
-		{
-			Com_Printf(S_COLOR_RED "as died\n");
-			return -1;
-		}
-		if(WEXITSTATUS(status))
-		{
-			Com_Printf(S_COLOR_RED "as failed with status %d\n", WEXITSTATUS(status));
-			return -1;
+	Com_Error( ERR_DROP, "Hex: bad char '%c'", c );
+
+	return 0;
+}
+
+static void EmitString( const char *string ) {
+	int		c1, c2;
+	int		v;
+
+	while ( 1 ) {
+		c1 = string[0];
+		c2 = string[1];
+
+		v = ( Hex( c1 ) << 4 ) | Hex( c2 );
+		Emit1( v );
+
+		if ( !string[2] ) {
+			break;
 		}
+		string += 3;
+	}
+}
+
+
+// rel32 operand of the jump or call just emitted
+
+static void EmitRel32( int target )
+{
+	Emit4( target - (compiledOfs + 4) );
+}
+
+
+static void EmitJumpToInstruction( const char* jcc, int target )
+{
+	if ( (unsigned)target >= (unsigned)instructionCount ) {
+		Com_Error( ERR_DROP, "VM_CompileX86_64: jump target %i out of range at offset %i", target, pc );
+	}
+	EmitString( jcc );
+	EmitRel32( instructionPointers[ target ] );
+}
+
+
+// calls into C have to realign rsp, since the qvm's own calls
+// leave it at whatever call depth the qvm happens to be at
+
+static void EmitCallC( vmHelper_t helper )
+{
+	EmitString( "48 89 E5" );		// mov rbp, rsp
+	EmitString( "48 83 E4 F0" );	// and rsp, -16
+	EmitString( "41 FF 57" );		// call qword ptr [r15 - 0x12]
+	Emit1( helper * 8 - HELPER_TABLE_SIZE );
+	EmitString( "48 89 EC" );		// mov rsp, rbp
+}
+
+
+// eax = instruction number, leaves its address in rax
+
+static void EmitInstructionAddress()
+{
+	EmitString( "3D" );				// cmp eax, instructionCount
+	Emit4( instructionCount );
+	EmitString( "0F 83" );			// jae badJumpStub
+	EmitRel32( badJumpStubOfs );
+	EmitString( "49 63 04 86" );	// movsxd rax, dword ptr [r14 + rax*4]
+	EmitString( "4C 01 F8" );		// add rax, r15
+}
+
+
+static void EmitStubs()
+{
+	// entry point: VM_CallCompiled passes a vmEntryFrame_t in rdi
+	EmitString( "53" );				// push rbx
+	EmitString( "55" );				// push rbp
+	EmitString( "41 54" );			// push r12
+	EmitString( "41 55" );			// push r13
+	EmitString( "41 56" );			// push r14
+	EmitString( "41 57" );			// push r15
+	EmitString( "57" );				// push rdi
+	EmitString( "48 8B 1F" );		// mov rbx, [rdi]
+	EmitString( "4C 8B 67 08" );	// mov r12, [rdi+8]
+	EmitString( "4C 8B 77 10" );	// mov r14, [rdi+16]
+	EmitString( "4C 8B 7F 18" );	// mov r15, [rdi+24]
+	EmitString( "44 8B 6F 20" );	// mov r13d, [rdi+32]
+	EmitString( "49 63 06" );		// movsxd rax, dword ptr [r14]
+	EmitString( "4C 01 F8" );		// add rax, r15
+	EmitString( "FF D0" );			// call rax
+	EmitString( "5F" );				// pop rdi
+	EmitString( "48 89 1F" );		// mov [rdi], rbx
+	EmitString( "44 89 6F 20" );	// mov [rdi+32], r13d
+	EmitString( "41 5F" );			// pop r15
+	EmitString( "41 5E" );			// pop r14
+	EmitString( "41 5D" );			// pop r13
+	EmitString( "41 5C" );			// pop r12
+	EmitString( "5D" );				// pop rbp
+	EmitString( "5B" );				// pop rbx
+	EmitString( "C3" );				// ret
+
+	// eax = the bad instruction number, never returns
+	badJumpStubOfs = compiledOfs;
+	EmitString( "89 C7" );			// mov edi, eax
+	EmitCallC( HELPER_BADJUMP );
+
+	// OP_CALL with eax = the popped call target: the return address
+	// the caller pushed is the one the callee's OP_LEAVE returns to
+	callStubOfs = compiledOfs;
+	EmitString( "85 C0" );			// test eax, eax
+	EmitString( "0F 8C" );			// jl systemCall
+	Emit4( 0 );
+	const int systemCallFixup = compiledOfs;
+	EmitInstructionAddress();
+	EmitString( "FF E0" );			// jmp rax
+
+	// systemCall:
+	if ( buf ) {
+		*(int*)&buf[ systemCallFixup - 4 ] = compiledOfs - systemCallFixup;
+	}
+	EmitString( "89 C7" );			// mov edi, eax
+	EmitString( "44 89 EE" );		// mov esi, r13d
+	EmitCallC( HELPER_SYSTEMCALL );
+	EmitString( "48 83 C3 04" );	// add rbx, 4
+	EmitString( "89 03" );			// mov [rbx], eax
+	EmitString( "C3" );				// ret
+}
+
+
+// the top of the opstack lives in eax as long as nothing else needs it:
+// rbx still counts every entry, but the slot it points at is only
+// written back when topDirty is set and something has to see memory
+
+static void EmitFlush()
+{
+	if ( topDirty ) {
+		EmitString( "89 03" );		// mov [rbx], eax
+		topDirty = qfalse;
 	}
+}
+
+
+// jump targets and calls out of the code expect the whole stack in memory
+
+static void EmitSync()
+{
+	EmitFlush();
+	topInEAX = qfalse;
+}
+
+
+static void EmitLoadTop()
+{
+	if ( !topInEAX ) {
+		EmitString( "8B 03" );		// mov eax, [rbx]
+		topInEAX = qtrue;
+	}
+}
+
+
+// the caller leaves the new top in eax
+
+static void EmitPush()
+{
+	EmitFlush();
+	EmitString( "48 83 C3 04" );	// add rbx, 4
+	topInEAX = qtrue;
+	topDirty = qtrue;
+}
+
+
+// drops entries that have already been consumed from eax:
+// everything below the top is always up to date in memory
+
+static void EmitDrop( int count )
+{
+	EmitString( "48 83 EB" );		// sub rbx, count * 4
+	Emit1( count * 4 );
+	topInEAX = qfalse;
+	topDirty = qfalse;
+}
+
+
+// the result of an operation on the top replaces it in eax
+
+static void SetTop()
+{
+	topInEAX = qtrue;
+	topDirty = qtrue;
+}
+
+
+// second operand in eax, first one in [rbx] once this returns
+
+static void EmitPopOperand()
+{
+	EmitLoadTop();
+	EmitString( "48 83 EB 04" );	// sub rbx, 4
+}
+
+
+// same, but with the operands in eax and ecx the way sub, div and shifts want them
+
+static void EmitPopOperands()
+{
+	EmitPopOperand();
+	EmitString( "89 C1" );			// mov ecx, eax
+	EmitString( "8B 03" );			// mov eax, [rbx]
+}
+
+
+// like the interpreter, calls leave the number of the instruction they return to
+// in the caller's frame, where VM_StackTrace and the profiler can find it
+
+static void EmitReturnAddress()
+{
+	EmitString( "43 C7 04 2C" );	// mov dword ptr [r12 + r13], 0x12345678
+	Emit4( instruction );
+}
+
 
-	Com_Printf("done\n");
+// the next instruction, if it can be folded into the current one
 
-	mem = (unsigned char*)mmapfile(out, &size);
-	if(!mem)
-	{
-		Com_Printf(S_COLOR_RED "can't mmap object file %s: %s\n", out, strerror(errno));
+static int NextOp()
+{
+	if ( instruction >= instructionCount || pc >= codeLength || jused[ instruction ] ) {
 		return -1;
 	}
+	return code[ pc ];
+}
+
+
+static void SkipOp()
+{
+	instructionPointers[ instruction ] = compiledOfs;
+	instruction++;
+	pc++;
+}
 
-	*compiledcode = mem;
 
-	return size;
+static void EmitStore( const char* op, int mask )
+{
+	EmitPopOperand();
+	EmitString( "8B 0B" );			// mov ecx, [rbx]
+	EmitString( "81 E1" );			// and ecx, mask
+	Emit4( mask );
+	EmitString( op );
+	EmitDrop( 1 );
 }
 
-static void block_copy_vm(unsigned dest, unsigned src, unsigned count)
+
+static void EmitCompareInt( const char* jcc, int target )
 {
-	unsigned dataMask = currentVM->dataMask;
+	EmitLoadTop();
+	EmitDrop( 2 );
+	EmitString( "39 43 04" );		// cmp [rbx+4], eax
+	EmitJumpToInstruction( jcc, target );
+}
+
+
+// ucomiss sets CF both for "below" and for unordered, so < and <= swap
+// the operands and test "above" instead, which is false for NaNs
 
-	if ((dest & dataMask) != dest
-	|| (src & dataMask) != src
-	|| ((dest+count) & dataMask) != dest + count
-	|| ((src+count) & dataMask) != src + count)
-	{
-		Com_Error(ERR_DROP, "OP_BLOCK_COPY out of range!\n");
+static void EmitCompareFloat( qbool swap )
+{
+	EmitLoadTop();
+	EmitDrop( 2 );
+	EmitString( "66 0F 6E C8" );		// movd xmm1, eax
+	EmitString( "F3 0F 10 43 04" );		// movss xmm0, [rbx+4]
+	if ( swap ) {
+		EmitString( "0F 2E C8" );		// ucomiss xmm1, xmm0
+	} else {
+		EmitString( "0F 2E C1" );		// ucomiss xmm0, xmm1
 	}
+}
 
-	memcpy(currentVM->dataBase+dest, currentVM->dataBase+src, count);
+
+static void EmitBinaryFloat( const char* op )
+{
+	EmitPopOperand();
+	EmitString( "66 0F 6E C8" );	// movd xmm1, eax
+	EmitString( "F3 0F 10 03" );	// movss xmm0, [rbx]
+	EmitString( op );				// op xmm0, xmm1
+	EmitString( "66 0F 7E C0" );	// movd eax, xmm0
+	SetTop();
 }
 
-/*
-=================
-VM_Compile
-=================
-*/
-void VM_Compile( vm_t *vm, vmHeader_t *header ) {
-	unsigned char op;
-	int pc;
-	unsigned instruction;
-	char* code;
-	unsigned iarg = 0;
-	unsigned char barg = 0;
-	void* entryPoint;
-
-	char fn_s[2*MAX_QPATH]; // output file for assembler code
-	char fn_o[2*MAX_QPATH]; // file written by as
-#ifdef DEBUG_VM
-	char fn_d[MAX_QPATH]; // disassembled
-#endif
-	FILE* fh_s;
-	int fd_s, fd_o;
-	byte* compiledcode;
-	int   compiledsize;
-
-	Com_Printf("compiling %s\n", vm->name);
-
-	snprintf(fn_s, sizeof(fn_s), "/tmp/%.63s.s_XXXXXX", vm->name);
-	snprintf(fn_o, sizeof(fn_o), "/tmp/%.63s.o_XXXXXX", vm->name);
-	fd_s = mkstemp(fn_s);
-	fd_o = mkstemp(fn_o);
-	if(fd_s == -1 || fd_o == -1)
-	{
-		if(fd_s != -1) close(fd_s);
-		if(fd_o != -1) close(fd_o);
-		unlink(fn_s);
-		unlink(fn_o);
-
-		Com_Printf(S_COLOR_RED "can't create temporary files for vm\n", fn_s);
-		vm->compiled = qfalse;
-		return;
+
+static void EmitDivide( qbool isSigned, qbool remainder )
+{
+	EmitPopOperands();
+	if ( isSigned ) {
+		EmitString( "99" );			// cdq
+		EmitString( "F7 F9" );		// idiv ecx
+	} else {
+		EmitString( "31 D2" );		// xor edx, edx
+		EmitString( "F7 F1" );		// div ecx
 	}
+	if ( remainder ) {
+		EmitString( "89 D0" );		// mov eax, edx
+	}
+	SetTop();
+}
+
+
+static void EmitShift( const char* op )
+{
+	EmitPopOperands();
+	EmitString( op );				// op eax, cl
+	SetTop();
+}
 
-#ifdef DEBUG_VM
-	strcpy(fn_d,vm->name);
-	strcat(fn_d, ".qdasm");
 
-	qdasmout = fopen(fn_d, "w");
-#endif
+// op eax, [rbx] for the commutative integer ops
 
-	fh_s = fdopen(fd_s, "wb");
-	if(!fh_s)
-	{
-		Com_Printf(S_COLOR_RED "can't write %s\n", fn_s);
-		vm->compiled = qfalse;
-		return;
+static void EmitBinary( const char* op )
+{
+	EmitPopOperand();
+	EmitString( op );
+	SetTop();
+}
+
+
+// op eax, imm32 with the constant that was about to be pushed
+
+static void EmitBinaryConst( const char* op, int v )
+{
+	SkipOp();
+	EmitLoadTop();
+	EmitString( op );
+	Emit4( v );
+	SetTop();
+}
+
+
+static void EmitShiftConst( const char* op, int v )
+{
+	SkipOp();
+	EmitLoadTop();
+	EmitString( op );				// op eax, imm8
+	Emit1( v & 31 );
+	SetTop();
+}
+
+
+static void EmitCompareConst( const char* jcc, int v )
+{
+	SkipOp();
+	const int target = Constant4();
+	EmitLoadTop();
+	EmitDrop( 1 );
+	EmitString( "3D" );				// cmp eax, 0x12345678
+	Emit4( v );
+	EmitJumpToInstruction( jcc, target );
+}
+
+
+// the address is the top of the stack, the value the constant
+
+static void EmitStoreConst( const char* op, int mask, int v, int size )
+{
+	SkipOp();
+	EmitLoadTop();
+	EmitString( "25" );				// and eax, mask
+	Emit4( mask );
+	EmitString( op );				// mov [r12 + rax], imm
+	if ( size == 4 ) {
+		Emit4( v );
+	} else if ( size == 2 ) {
+		Emit1( v & 255 );
+		Emit1( ( v >> 8 ) & 255 );
+	} else {
+		Emit1( v & 255 );
 	}
+	EmitDrop( 1 );
+}
 
-	// translate all instructions
-	pc = 0;
-	code = (char *)header + header->codeOffset;
 
-	emit("start:");
-	emit("or %%r8, %%r8"); // check whether to set up instruction pointers
-	emit("jnz main");
-	emit("jmp setupinstructionpointers");
-	emit("exit:");
-	emit("jmp *%%r9");
+// a system call with a constant number goes straight to the system call,
+// without going through callStub, and the leaf traps don't even need that
 
-	emit("main:");
+static void EmitSystemCall( const vm_t* vm, int v )
+{
+	const int leaf = VM_FindLeafTrap( vm, -1 - v );
 
-	for ( instruction = 0; instruction < header->instructionCount; ++instruction )
-	{
-		op = code[ pc ];
-		++pc;
+	if ( leaf == VM_LEAF_SQRT ) {
+		// sqrtss rounds the same as the double sqrt does
+		EmitString( "F3 43 0F 51 44 2C 08" );	// sqrtss xmm0, [r12 + r13 + 8]
+		EmitPush();
+		EmitString( "66 0F 7E C0" );	// movd eax, xmm0
+		return;
+	}
 
-		vm->instructionPointers[instruction] = pc;
+	if ( leaf >= 0 ) {
+		// a plain C call that reads the arguments where the qvm left them
+		EmitString( "4B 8D 7C 2C 08" );	// lea rdi, [r12 + r13 + 8]
+		EmitCallC( (vmHelper_t)(HELPER_LEAF + leaf) );
+		EmitPush();
+		return;
+	}
 
-#if 0
-		emit("nop");
-		emit("movq $%d, %%r15", instruction);
-		emit("nop");
-#endif
+	EmitString( "BF" );				// mov edi, 0x12345678
+	Emit4( v );
+	EmitString( "44 89 EE" );		// mov esi, r13d
+	EmitCallC( HELPER_SYSTEMCALL );
+	EmitPush();
+}
 
-		if(op_argsize[op] == 4)
-		{
-			iarg = *(int*)(code+pc);
-			pc += 4;
-			Dfprintf(qdasmout, "%s %8u\n", opnames[op], iarg);
-		}
-		else if(op_argsize[op] == 1)
-		{
-			barg = code[pc++];
-			Dfprintf(qdasmout, "%s %8hhu\n", opnames[op], barg);
+
+// lcc emits most loads, stores, arithmetic, branches and calls with a
+// constant operand, so OP_CONST looks at what consumes the constant and
+// uses an immediate operand or a direct call or jump instead of pushing it
+
+static void EmitConst( const vm_t* vm, int v )
+{
+	switch ( NextOp() ) {
+	case OP_LOAD1:
+	case OP_LOAD2:
+	case OP_LOAD4:
+		// the masking would be a no-op on an address that's already in range
+		if ( (unsigned)v > (unsigned)vm->dataMask ) {
+			break;
 		}
-		else
-		{
-			Dfprintf(qdasmout, "%s\n", opnames[op]);
+		switch ( code[ pc ] ) {
+		case OP_LOAD1:
+			EmitPush();
+			EmitString( "41 0F B6 84 24" );	// movzx eax, byte ptr [r12 + 0x12345678]
+			break;
+		case OP_LOAD2:
+			EmitPush();
+			EmitString( "41 0F B7 84 24" );	// movzx eax, word ptr [r12 + 0x12345678]
+			break;
+		default:
+			EmitPush();
+			EmitString( "41 8B 84 24" );	// mov eax, [r12 + 0x12345678]
+			break;
 		}
-		emit("i_%08x:", instruction);
-		switch ( op )
-		{
-			case OP_UNDEF:
-				NOTIMPL(op);
-				break;
-			case OP_IGNORE:
-				emit("nop");
-				break;
-			case OP_BREAK:
-				emit("int3");
-				break;
-			case OP_ENTER:
-				emit("subl $%d, %%edi", iarg);
-				RANGECHECK(edi);
-				break;
-			case OP_LEAVE:
-				emit("addl $%d, %%edi", iarg);          // get rid of stack frame
-				RANGECHECK(edi);
-				emit("movl 0(%%r8, %%rdi, 1), %%eax");  // get return address
-				emit("movq $%lu, %%rbx", (unsigned long)vm->instructionPointers);
-				emit("cmp $-1, %%eax");
-				emit("je jumptoexit%d", instruction);
-				emit("movl (%%rbx, %%rax, 4), %%eax"); // load new relative jump address
-				emit("addq %%r10, %%rax");
-				emit("jmp *%%rax");
-				emit("jumptoexit%d:", instruction);
-				emit("jmp exit");
-				break;
-			case OP_CALL:
-				emit("movl 0(%%rsi), %%eax");  // get instr from stack
-				emit("subq $4, %%rsi");
-				emit("movl $%d, 0(%%r8, %%rdi, 1)", instruction+1);  // save next instruction
-				emit("orl %%eax, %%eax");
-				emit("jl callSyscall%d", instruction);
-				emit("movq $%lu, %%rbx", (unsigned long)vm->instructionPointers);
-				emit("movl (%%rbx, %%rax, 4), %%eax"); // load new relative jump address
-				emit("addq %%r10, %%rax");
-				emit("jmp *%%rax");
-				emit("callSyscall%d:", instruction);
-//				emit("fnsave 4(%%rsi)");
-				emit("push %%rsi");
-				emit("push %%rdi");
-				emit("push %%r8");
-				emit("push %%r9");
-				emit("push %%r10");
-				emit("push %%r10"); // align!
-				emit("negl %%eax");        // convert to actual number
-				emit("decl %%eax");
-				                           // first argument already in rdi
-				emit("movq %%rax, %%rsi"); // second argument in rsi
-				emit("movq $%lu, %%rax", (unsigned long)callAsmCall);
-				emit("callq *%%rax");
-				emit("pop %%r10");
-				emit("pop %%r10");
-				emit("pop %%r9");
-				emit("pop %%r8");
-				emit("pop %%rdi");
-				emit("pop %%rsi");
-//				emit("frstor 4(%%rsi)");
-				emit("addq $4, %%rsi");
-				emit("movl %%eax, (%%rsi)");
-				break;
-			case OP_PUSH:
-				emit("addq $4, %%rsi");
-				break;
-			case OP_POP:
-				emit("subq $4, %%rsi");
-				break;
-			case OP_CONST:
-				emit("addq $4, %%rsi");
-				emit("movl $%d, 0(%%rsi)", iarg);
-				break;
-			case OP_LOCAL:
-				emit("movl %%edi, %%ebx");
-				emit("addl $%d,%%ebx", iarg);
-				emit("addq $4, %%rsi");
-				emit("movl %%ebx, 0(%%rsi)");
-				break;
-			case OP_JUMP:
-				emit("movl 0(%%rsi), %%eax"); // get instr from stack
-				emit("subq $4, %%rsi");
-				emit("movq $%lu, %%rbx", (unsigned long)vm->instructionPointers);
-				emit("movl (%%rbx, %%rax, 4), %%eax"); // load new relative jump address
-				emit("addq %%r10, %%rax");
-				emit("jmp *%%rax");
-				break;
-			case OP_EQ:
-				IJ("jne");
-				break;
-			case OP_NE:
-				IJ("je");
-				break;
-			case OP_LTI:
-				IJ("jnl");
-				break;
-			case OP_LEI:
-				IJ("jnle");
-				break;
-			case OP_GTI:
-				IJ("jng");
-				break;
-			case OP_GEI:
-				IJ("jnge");
-				break;
-			case OP_LTU:
-				IJ("jnb");
-				break;
-			case OP_LEU:
-				IJ("jnbe");
-				break;
-			case OP_GTU:
-				IJ("jna");
-				break;
-			case OP_GEU:
-				IJ("jnae");
-				break;
-			case OP_EQF:
-				FJ(0x40, "jz");
-				XJ("jnz");
-				break;
-			case OP_NEF:
-				FJ(0x40, "jnz");
-#ifndef USE_X87
-				emit("subq $8, %%rsi");
-				emit("movss 4(%%rsi), %%xmm0");
-				emit("ucomiss 8(%%rsi), %%xmm0");
-				emit("jp dojump_i_%08x", instruction);
-				emit("jz i_%08x", instruction+1);
-				emit("dojump_i_%08x:", instruction);
-				emit("jmp i_%08x", iarg);
-#endif
-				break;
-			case OP_LTF:
-				FJ(0x01, "jz");
-				XJ("jnc");
-				break;
-			case OP_LEF:
-				FJ(0x41, "jz");
-				XJ("ja");
-				break;
-			case OP_GTF:
-				FJ(0x41, "jnz");
-				XJ("jbe");
-				break;
-			case OP_GEF:
-				FJ(0x01, "jnz");
-				XJ("jb");
-				break;
-			case OP_LOAD1:
-				emit("movl 0(%%rsi), %%eax"); // get pointer from stack
-				RANGECHECK(eax);
-				emit("movb 0(%%r8, %%rax, 1), %%al"); // deref into eax
-				emit("andq $255, %%rax");
-				emit("movl %%eax, 0(%%rsi)"); // store on stack
-				break;
-			case OP_LOAD2:
-				emit("movl 0(%%rsi), %%eax"); // get pointer from stack
-				RANGECHECK(eax);
-				emit("movw 0(%%r8, %%rax, 1), %%rax"); // deref into eax
-				emit("movl %%eax, 0(%%rsi)"); // store on stack
-				break;
-			case OP_LOAD4:
-				emit("movl 0(%%rsi), %%eax"); // get pointer from stack
-				RANGECHECK(eax);
-				emit("movl 0(%%r8, %%rax, 1), %%eax"); // deref into eax
-				emit("movl %%eax, 0(%%rsi)"); // store on stack
-				break;
-			case OP_STORE1:
-				emit("movl 0(%%rsi), %%eax"); // get value from stack
-				emit("andq $255, %%rax");
-				emit("movl -4(%%rsi), %%ebx"); // get pointer from stack
-				RANGECHECK(ebx);
-				emit("movb %%al, 0(%%r8, %%rbx, 1)"); // store in memory
-				emit("subq $8, %%rsi");
-				break;
-			case OP_STORE2:
-				emit("movl 0(%%rsi), %%eax"); // get value from stack
-				emit("movl -4(%%rsi), %%ebx"); // get pointer from stack
-				RANGECHECK(ebx);
-				emit("movw %%rax, 0(%%r8, %%rbx, 1)"); // store in memory
-				emit("subq $8, %%rsi");
-				break;
-			case OP_STORE4:
-				emit("movl -4(%%rsi), %%ebx"); // get pointer from stack
-				RANGECHECK(ebx);
-				emit("movl 0(%%rsi), %%ecx"); // get value from stack
-				emit("movl %%ecx, 0(%%r8, %%rbx, 1)"); // store in memory
-				emit("subq $8, %%rsi");
-				break;
-			case OP_ARG:
-				emit("subq $4, %%rsi");
-				emit("movl 4(%%rsi), %%eax"); // get value from stack
-				emit("movl $0x%hhx, %%ebx", barg);
-				emit("addl %%edi, %%ebx");
-				RANGECHECK(ebx);
-				emit("movl %%eax, 0(%%r8,%%rbx, 1)"); // store in args space
-				break;
-			case OP_BLOCK_COPY:
-
-				emit("subq $8, %%rsi");
-				emit("push %%rsi");
-				emit("push %%rdi");
-				emit("push %%r8");
-				emit("push %%r9");
-				emit("push %%r10");
-				emit("movl 4(%%rsi), %%edi");  // 1st argument dest
-				emit("movl 8(%%rsi), %%esi");  // 2nd argument src
-				emit("movl $%d, %%edx", iarg); // 3rd argument count
-				emit("movq $%lu, %%rax", (unsigned long)block_copy_vm);
-				emit("callq *%%rax");
-				emit("pop %%r10");
-				emit("pop %%r9");
-				emit("pop %%r8");
-				emit("pop %%rdi");
-				emit("pop %%rsi");
-
-				break;
-			case OP_SEX8:
-				emit("movw 0(%%rsi), %%rax");
-				emit("andq $255, %%rax");
-				emit("cbw");
-				emit("cwde");
-				emit("movl %%eax, 0(%%rsi)");
-				break;
-			case OP_SEX16:
-				emit("movw 0(%%rsi), %%rax");
-				emit("cwde");
-				emit("movl %%eax, 0(%%rsi)");
-				break;
-			case OP_NEGI:
-				emit("negl 0(%%rsi)");
-				break;
-			case OP_ADD:
-				SIMPLE("addl");
-				break;
-			case OP_SUB:
-				SIMPLE("subl");
-				break;
-			case OP_DIVI:
-				emit("subq $4, %%rsi");
-				emit("movl 0(%%rsi), %%eax");
-				emit("cdq");
-				emit("idivl 4(%%rsi)");
-				emit("movl %%eax, 0(%%rsi)");
-				break;
-			case OP_DIVU:
-				emit("subq $4, %%rsi");
-				emit("movl 0(%%rsi), %%eax");
-				emit("xorq %%rdx, %%rdx");
-				emit("divl 4(%%rsi)");
-				emit("movl %%eax, 0(%%rsi)");
-				break;
-			case OP_MODI:
-				emit("subq $4, %%rsi");
-				emit("movl 0(%%rsi), %%eax");
-				emit("xorl %%edx, %%edx");
-				emit("divl 4(%%rsi)");
-				emit("movl %%edx, 0(%%rsi)");
-				break;
-			case OP_MODU:
-				emit("subq $4, %%rsi");
-				emit("movl 0(%%rsi), %%eax");
-				emit("xorl %%edx, %%edx");
-				emit("idivl 4(%%rsi)");
-				emit("movl %%edx, 0(%%rsi)");
-				break;
-			case OP_MULI:
-				emit("subq $4, %%rsi");
-				emit("movl 0(%%rsi), %%eax");
-				emit("imull 4(%%rsi)");
-				emit("movl %%eax, 0(%%rsi)");
-				break;
-			case OP_MULU:
-				emit("subq $4, %%rsi");
-				emit("movl 0(%%rsi), %%eax");
-				emit("mull 4(%%rsi)");
-				emit("movl %%eax, 0(%%rsi)");
-				break;
-			case OP_BAND:
-				SIMPLE("andl");
-				break;
-			case OP_BOR:
-				SIMPLE("orl");
-				break;
-			case OP_BXOR:
-				SIMPLE("xorl");
-				break;
-			case OP_BCOM:
-				emit("notl 0(%%rsi)");
-				break;
-			case OP_LSH:
-				SHIFT("shl");
-				break;
-			case OP_RSHI:
-				SHIFT("sarl");
-				break;
-			case OP_RSHU:
-				SHIFT("shrl");
-				break;
-			case OP_NEGF:
-#ifdef USE_X87
-				emit("flds 0(%%rsi)");
-				emit("fchs");
-				emit("fstps 0(%%rsi)");
-#else
-				emit("movl $0x80000000, %%eax");
-				emit("xorl %%eax, 0(%%rsi)");
-#endif
-				break;
-			case OP_ADDF:
-				FSIMPLE("fadds");
-				XSIMPLE("addss");
-				break;
-			case OP_SUBF:
-				FSIMPLE("fsubs");
-				XSIMPLE("subss");
-				break;
-			case OP_DIVF:
-				FSIMPLE("fdivs");
-				XSIMPLE("divss");
-				break;
-			case OP_MULF:
-				FSIMPLE("fmuls");
-				XSIMPLE("mulss");
-				break;
-			case OP_CVIF:
-#ifdef USE_X87
-				emit("filds 0(%%rsi)");
-				emit("fstps 0(%%rsi)");
-#else
-				emit("movl 0(%%rsi), %%eax");
-				emit("cvtsi2ss %%eax, %%xmm0");
-				emit("movss %%xmm0, 0(%%rsi)");
-#endif
-				break;
-			case OP_CVFI:
-#ifdef USE_X87
-				emit("flds 0(%%rsi)");
-				emit("fnstcw 4(%%rsi)");
-				emit("movw $0x0F7F, 8(%%rsi)"); // round toward zero
-				emit("fldcw 8(%%rsi)");
-				emit("fistpl 0(%%rsi)");
-				emit("fldcw 4(%%rsi)");
-#else
-				emit("movss 0(%%rsi), %%xmm0");
-				emit("cvttss2si %%xmm0, %%eax");
-				emit("movl %%eax, 0(%%rsi)");
-#endif
-				break;
-			default:
-				NOTIMPL(op);
-				break;
+		Emit4( v );
+		SkipOp();
+		return;
+
+	case OP_STORE1:
+		EmitStoreConst( "41 C6 04 04", vm->dataMask, v, 1 );			// mov byte ptr [r12 + rax], imm8
+		return;
+	case OP_STORE2:
+		EmitStoreConst( "66 41 C7 04 04", vm->dataMask & ~1, v, 2 );	// mov word ptr [r12 + rax], imm16
+		return;
+	case OP_STORE4:
+		EmitStoreConst( "41 C7 04 04", vm->dataMask & ~3, v, 4 );		// mov dword ptr [r12 + rax], imm32
+		return;
+
+	case OP_ADD:
+		EmitBinaryConst( "05", v );		// add eax, 0x12345678
+		return;
+	case OP_SUB:
+		EmitBinaryConst( "2D", v );		// sub eax, 0x12345678
+		return;
+	case OP_MULI:
+	case OP_MULU:
+		EmitBinaryConst( "69 C0", v );	// imul eax, eax, 0x12345678
+		return;
+	case OP_BAND:
+		EmitBinaryConst( "25", v );		// and eax, 0x12345678
+		return;
+	case OP_BOR:
+		EmitBinaryConst( "0D", v );		// or eax, 0x12345678
+		return;
+	case OP_BXOR:
+		EmitBinaryConst( "35", v );		// xor eax, 0x12345678
+		return;
+	case OP_LSH:
+		EmitShiftConst( "C1 E0", v );	// shl eax, imm8
+		return;
+	case OP_RSHI:
+		EmitShiftConst( "C1 F8", v );	// sar eax, imm8
+		return;
+	case OP_RSHU:
+		EmitShiftConst( "C1 E8", v );	// shr eax, imm8
+		return;
+
+	case OP_EQ:
+		EmitCompareConst( "0F 84", v );	// je
+		return;
+	case OP_NE:
+		EmitCompareConst( "0F 85", v );	// jne
+		return;
+	case OP_LTI:
+		EmitCompareConst( "0F 8C", v );	// jl
+		return;
+	case OP_LEI:
+		EmitCompareConst( "0F 8E", v );	// jle
+		return;
+	case OP_GTI:
+		EmitCompareConst( "0F 8F", v );	// jg
+		return;
+	case OP_GEI:
+		EmitCompareConst( "0F 8D", v );	// jge
+		return;
+	case OP_LTU:
+		EmitCompareConst( "0F 82", v );	// jb
+		return;
+	case OP_LEU:
+		EmitCompareConst( "0F 86", v );	// jbe
+		return;
+	case OP_GTU:
+		EmitCompareConst( "0F 87", v );	// ja
+		return;
+	case OP_GEU:
+		EmitCompareConst( "0F 83", v );	// jae
+		return;
+
+	case OP_CALL:
+		SkipOp();
+		EmitSync();
+		EmitReturnAddress();
+		if ( v < 0 ) {
+			EmitSystemCall( vm, v );
+		} else {
+			EmitJumpToInstruction( "E8", v );	// call
 		}
+		return;
+
+	case OP_JUMP:
+		SkipOp();
+		EmitSync();
+		EmitJumpToInstruction( "E9", v );	// jmp
+		return;
 	}
 
+	EmitPush();
+	EmitString( "B8" );				// mov eax, 0x12345678
+	Emit4( v );
+}
+
+
+// anything that can be reached other than by falling into it has to start
+// with the whole stack in memory: branch targets, switch tables, functions
+// and the targets of constant jumps. without the jump table list of a
+// VM_MAGIC_VER2 qvm, a computed jump could land anywhere
 
-	emit("setupinstructionpointers:");
-	emit("movq $%lu, %%rax", (unsigned long)vm->instructionPointers);
-	for ( instruction = 0; instruction < header->instructionCount; ++instruction )
-	{
-		emit("movl $i_%08x-start, %d(%%rax)", instruction, instruction*4);
+static void VM_FindJumpTargets( const vm_t* vm )
+{
+	Com_Memset( jused, 0, instructionCount );
+
+	const int* jumpTableTargets = (const int*)vm->jumpTableTargets;
+	for ( int i = 0; i < vm->numJumpTableTargets; i++ ) {
+		if ( (unsigned)jumpTableTargets[i] < (unsigned)instructionCount ) {
+			jused[ jumpTableTargets[i] ] = 1;
+		}
 	}
-	emit("jmp exit");
-
-	emit("debugger:");
-	if(1);
-	{
-		int i = 6;
-		while(i--)
-		{
-			emit("nop");
-			emit("int3");
+
+	qbool computedJumps = qfalse;
+	int lastOp = OP_UNDEF, v = 0;
+
+	pc = 0;
+	for ( int i = 0; i < instructionCount && pc < codeLength; i++ ) {
+		const int op = code[ pc ];
+		pc++;
+
+		switch ( op ) {
+		case OP_ENTER:
+			jused[i] = 1;
+			v = Constant4();
+			break;
+		case OP_LEAVE:
+		case OP_CONST:
+		case OP_LOCAL:
+		case OP_BLOCK_COPY:
+			v = Constant4();
+			break;
+		case OP_ARG:
+			pc++;
+			break;
+		case OP_JUMP:
+			if ( lastOp == OP_CONST ) {
+				if ( (unsigned)v < (unsigned)instructionCount ) {
+					jused[v] = 1;
+				}
+			} else if ( !vm->numJumpTableTargets ) {
+				computedJumps = qtrue;
+			}
+			break;
+		default:
+			if ( op >= OP_EQ && op <= OP_GEF ) {
+				v = Constant4();
+				if ( (unsigned)v < (unsigned)instructionCount ) {
+					jused[v] = 1;
+				}
+			}
+			break;
 		}
+
+		lastOp = op;
 	}
 
-	fflush(fh_s);
-	fclose(fh_s);
+	if ( computedJumps ) {
+		Com_Memset( jused, 1, instructionCount );
+	}
+	jused[0] = 1;
+}
 
-	compiledsize = doas(fn_s, fn_o, &compiledcode);
-	if(compiledsize == -1)
-	{
-		vm->compiled = qfalse;
-		goto out;
+
+static void VM_CompileInstructions( const vm_t* vm )
+{
+	int op, v;
+
+	pc = 0;
+	instruction = 0;
+	compiledOfs = 0;
+	topInEAX = qfalse;
+	topDirty = qfalse;
+
+	EmitStubs();
+
+	while ( instruction < instructionCount ) {
+		if ( jused[ instruction ] ) {
+			EmitSync();
+		}
+		instructionPointers[ instruction ] = compiledOfs;
+		instruction++;
+
+		if ( pc >= codeLength ) {
+			Com_Error( ERR_DROP, "VM_CompileX86_64: pc > header->codeLength" );
+		}
+
+		op = code[ pc ];
+		pc++;
+		switch ( op ) {
+		case OP_UNDEF:
+		case OP_IGNORE:
+			break;
+		case OP_BREAK:
+			EmitString( "CC" );				// int 3
+			break;
+		case OP_ENTER:
+			EmitString( "41 81 ED" );		// sub r13d, 0x12345678
+			Emit4( Constant4() );
+			break;
+		case OP_LEAVE:
+			EmitSync();
+			EmitString( "41 81 C5" );		// add r13d, 0x12345678
+			Emit4( Constant4() );
+			EmitString( "C3" );				// ret
+			break;
+		case OP_CALL:
+			EmitLoadTop();
+			EmitDrop( 1 );
+			EmitReturnAddress();
+			EmitString( "E8" );				// call callStub
+			EmitRel32( callStubOfs );
+			break;
+		case OP_PUSH:
+			EmitFlush();
+			EmitString( "48 83 C3 04" );	// add rbx, 4
+			topInEAX = qfalse;
+			break;
+		case OP_POP:
+			EmitDrop( 1 );
+			break;
+
+		case OP_CONST:
+			EmitConst( vm, Constant4() );
+			break;
+		case OP_LOCAL:
+			v = Constant4();
+			EmitPush();
+			EmitString( "41 8D 85" );		// lea eax, [r13 + 0x12345678]
+			Emit4( v );
+			break;
+
+		case OP_JUMP:
+			EmitLoadTop();
+			EmitDrop( 1 );
+			EmitInstructionAddress();
+			EmitString( "FF E0" );			// jmp rax
+			break;
+
+		case OP_EQ:
+			EmitCompareInt( "0F 84", Constant4() );	// je
+			break;
+		case OP_NE:
+			EmitCompareInt( "0F 85", Constant4() );	// jne
+			break;
+		case OP_LTI:
+			EmitCompareInt( "0F 8C", Constant4() );	// jl
+			break;
+		case OP_LEI:
+			EmitCompareInt( "0F 8E", Constant4() );	// jle
+			break;
+		case OP_GTI:
+			EmitCompareInt( "0F 8F", Constant4() );	// jg
+			break;
+		case OP_GEI:
+			EmitCompareInt( "0F 8D", Constant4() );	// jge
+			break;
+		case OP_LTU:
+			EmitCompareInt( "0F 82", Constant4() );	// jb
+			break;
+		case OP_LEU:
+			EmitCompareInt( "0F 86", Constant4() );	// jbe
+			break;
+		case OP_GTU:
+			EmitCompareInt( "0F 87", Constant4() );	// ja
+			break;
+		case OP_GEU:
+			EmitCompareInt( "0F 83", Constant4() );	// jae
+			break;
+
+		case OP_EQF:
+			v = Constant4();
+			EmitCompareFloat( qfalse );
+			EmitString( "7A 06" );				// jp over the je
+			EmitJumpToInstruction( "0F 84", v );	// je
+			break;
+		case OP_NEF:
+			v = Constant4();
+			EmitCompareFloat( qfalse );
+			EmitJumpToInstruction( "0F 8A", v );	// jp
+			EmitJumpToInstruction( "0F 85", v );	// jne
+			break;
+		case OP_LTF:
+			v = Constant4();
+			EmitCompareFloat( qtrue );
+			EmitJumpToInstruction( "0F 87", v );	// ja
+			break;
+		case OP_LEF:
+			v = Constant4();
+			EmitCompareFloat( qtrue );
+			EmitJumpToInstruction( "0F 83", v );	// jae
+			break;
+		case OP_GTF:
+			v = Constant4();
+			EmitCompareFloat( qfalse );
+			EmitJumpToInstruction( "0F 87", v );	// ja
+			break;
+		case OP_GEF:
+			v = Constant4();
+			EmitCompareFloat( qfalse );
+			EmitJumpToInstruction( "0F 83", v );	// jae
+			break;
+
+		case OP_LOAD1:
+			EmitLoadTop();
+			EmitString( "25" );				// and eax, dataMask
+			Emit4( vm->dataMask );
+			EmitString( "41 0F B6 04 04" );	// movzx eax, byte ptr [r12 + rax]
+			SetTop();
+			break;
+		case OP_LOAD2:
+			EmitLoadTop();
+			EmitString( "25" );				// and eax, dataMask
+			Emit4( vm->dataMask );
+			EmitString( "41 0F B7 04 04" );	// movzx eax, word ptr [r12 + rax]
+			SetTop();
+			break;
+		case OP_LOAD4:
+			EmitLoadTop();
+			EmitString( "25" );				// and eax, dataMask
+			Emit4( vm->dataMask );
+			EmitString( "41 8B 04 04" );	// mov eax, [r12 + rax]
+			SetTop();
+			break;
+		case OP_STORE1:
+			EmitStore( "41 88 04 0C", vm->dataMask );			// mov [r12 + rcx], al
+			break;
+		case OP_STORE2:
+			EmitStore( "66 41 89 04 0C", vm->dataMask & ~1 );	// mov [r12 + rcx], ax
+			break;
+		case OP_STORE4:
+			EmitStore( "41 89 04 0C", vm->dataMask & ~3 );		// mov [r12 + rcx], eax
+			break;
+		case OP_ARG:
+			EmitLoadTop();
+			EmitString( "41 8D 8D" );		// lea ecx, [r13 + 0x12345678]
+			Emit4( Constant1() );
+			EmitString( "81 E1" );			// and ecx, dataMask
+			Emit4( vm->dataMask & ~3 );
+			EmitString( "41 89 04 0C" );	// mov [r12 + rcx], eax
+			EmitDrop( 1 );
+			break;
+
+		case OP_BLOCK_COPY:
+			EmitSync();
+			EmitString( "8B 7B FC" );		// mov edi, [rbx-4]
+			EmitString( "8B 33" );			// mov esi, [rbx]
+			EmitString( "BA" );				// mov edx, 0x12345678
+			Emit4( Constant4() );
+			EmitDrop( 2 );
+			EmitCallC( HELPER_BLOCKCOPY );
+			break;
+
+		case OP_SEX8:
+			EmitLoadTop();
+			EmitString( "0F BE C0" );		// movsx eax, al
+			SetTop();
+			break;
+		case OP_SEX16:
+			EmitLoadTop();
+			EmitString( "0F BF C0" );		// movsx eax, ax
+			SetTop();
+			break;
+
+		case OP_NEGI:
+			EmitLoadTop();
+			EmitString( "F7 D8" );			// neg eax
+			SetTop();
+			break;
+		case OP_ADD:
+			EmitBinary( "03 03" );			// add eax, [rbx]
+			break;
+		case OP_SUB:
+			EmitPopOperands();
+			EmitString( "29 C8" );			// sub eax, ecx
+			SetTop();
+			break;
+		case OP_DIVI:
+			EmitDivide( qtrue, qfalse );
+			break;
+		case OP_DIVU:
+			EmitDivide( qfalse, qfalse );
+			break;
+		case OP_MODI:
+			EmitDivide( qtrue, qtrue );
+			break;
+		case OP_MODU:
+			EmitDivide( qfalse, qtrue );
+			break;
+		case OP_MULI:
+		case OP_MULU:
+			EmitBinary( "0F AF 03" );		// imul eax, [rbx]
+			break;
+
+		case OP_BAND:
+			EmitBinary( "23 03" );			// and eax, [rbx]
+			break;
+		case OP_BOR:
+			EmitBinary( "0B 03" );			// or eax, [rbx]
+			break;
+		case OP_BXOR:
+			EmitBinary( "33 03" );			// xor eax, [rbx]
+			break;
+		case OP_BCOM:
+			EmitLoadTop();
+			EmitString( "F7 D0" );			// not eax
+			SetTop();
+			break;
+
+		case OP_LSH:
+			EmitShift( "D3 E0" );			// shl eax, cl
+			break;
+		case OP_RSHI:
+			EmitShift( "D3 F8" );			// sar eax, cl
+			break;
+		case OP_RSHU:
+			EmitShift( "D3 E8" );			// shr eax, cl
+			break;
+
+		case OP_NEGF:
+			EmitLoadTop();
+			EmitString( "35 00 00 00 80" );	// xor eax, 0x80000000
+			SetTop();
+			break;
+		case OP_ADDF:
+			EmitBinaryFloat( "F3 0F 58 C1" );	// addss xmm0, xmm1
+			break;
+		case OP_SUBF:
+			EmitBinaryFloat( "F3 0F 5C C1" );	// subss xmm0, xmm1
+			break;
+		case OP_DIVF:
+			EmitBinaryFloat( "F3 0F 5E C1" );	// divss xmm0, xmm1
+			break;
+		case OP_MULF:
+			EmitBinaryFloat( "F3 0F 59 C1" );	// mulss xmm0, xmm1
+			break;
+
+		case OP_CVIF:
+			EmitLoadTop();
+			EmitString( "F3 0F 2A C0" );	// cvtsi2ss xmm0, eax
+			EmitString( "66 0F 7E C0" );	// movd eax, xmm0
+			SetTop();
+			break;
+		case OP_CVFI:
+			EmitLoadTop();
+			EmitString( "66 0F 6E C0" );	// movd xmm0, eax
+			EmitString( "F3 0F 2C C0" );	// cvttss2si eax, xmm0
+			SetTop();
+			break;
+
+		default:
+			Com_Error( ERR_DROP, "VM_CompileX86_64: bad opcode %i at offset %i", op, pc );
+		}
 	}
+}
 
-	vm->codeBase   = compiledcode; // remember to skip ELF header!
-	vm->codeLength = compiledsize;
 
-	vm->destroy = VM_Destroy_Compiled;
-	
-	entryPoint = getentrypoint(vm);
-
-//	__asm__ __volatile__ ("int3");
-	Com_Printf("computing jump table\n");
-
-	// call code with r8 set to zero to set up instruction pointers
-	__asm__ __volatile__ (
-		"	xorq %%r8,%%r8		\r\n" \
-		"	movq $doneinit,%%r9	\r\n" \
-		"	movq %0,%%r10		\r\n" \
-		"	jmp *%%r10		\r\n" \
-		"doneinit:			\r\n" \
-		:
-		: "m" (entryPoint)
-		: "%r8", "%r9", "%r10", "%rax"
-	);
-
-#ifdef DEBUG_VM
-	fflush(qdasmout);
-#endif
-
-	Com_Printf( "VM file %s compiled to %i bytes of code (0x%lx - 0x%lx)\n", vm->name, vm->codeLength, vm->codeBase, vm->codeBase+vm->codeLength );
-
-out:
-	close(fd_o);
-	if(!com_developer->integer)
-	{
-		unlink(fn_o);
-		unlink(fn_s);
+void VM_Compile( vm_t* vm, const vmHeader_t* header )
+{
+	code = (const byte*)header + header->codeOffset;
+	codeLength = header->codeLength;
+	instructionCount = header->instructionCount;
+	instructionPointers = vm->instructionPointers;
+
+	jused = (byte*)Z_Malloc( instructionCount );
+	VM_FindJumpTargets( vm );
+
+	// measure, then assemble straight into the final buffer
+	buf = NULL;
+	VM_CompileInstructions( vm );
+
+	const int length = compiledOfs;
+	byte* codeBase = VM_AllocCode( length );
+
+	buf = codeBase;
+	VM_CompileInstructions( vm );
+	buf = NULL;
+
+	Z_Free( jused );
+	jused = NULL;
+
+	if ( compiledOfs != length ) {
+		Com_Error( ERR_FATAL, "VM_CompileX86_64: code size changed between passes" );
 	}
+
+	VM_InstallCode( vm, codeBase, length );
+
+	// unlike on x86, the instruction pointers stay offsets from codeBase:
+	// the generated code adds r15 to them when it jumps through the table
+
+	Com_Printf( "VM file %s compiled to %i bytes of code\n", vm->name, length );
 }
 
 
-void VM_Destroy_Compiled(vm_t* self)
+// the cache is only valid for the exact same compiler, which __DATE__ and
+// __TIME__ of this file stand for, and the same cpu features
+
+const char* VM_CodeCacheKey()
 {
-	munmap(self->codeBase, self->codeLength);
+	static char key[64];
+
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+	__get_cpuid( 1, &eax, &ebx, &ecx, &edx );
+	Com_sprintf( key, sizeof(key), "%s %s %s %s %08x%08x", Q3_VERSION, ARCH_STRING, __DATE__, __TIME__, ecx, edx );
+
+	return key;
 }
 
-/*
-==============
-VM_CallCompiled
 
-This function is called directly by the generated code
-==============
-*/
+// the instruction pointers have already been filled in from the cache
 
-#ifdef DEBUG_VM
-static char* memData;
-#endif
+void VM_LoadCompiledCode( vm_t* vm, const byte* code, int codeLength )
+{
+	byte* codeBase = VM_AllocCode( codeLength );
+	Com_Memcpy( codeBase, code, codeLength );
+	VM_InstallCode( vm, codeBase, codeLength );
+}
 
-int	VM_CallCompiled( vm_t *vm, int *args ) {
-	int		programCounter;
+
+int VM_CallCompiled( vm_t* vm, int* args )
+{
+	int		stack[OPSTACK_SIZE];
 	int		programStack;
 	int		stackOnEntry;
 	byte	*image;
-	void	*entryPoint;
-	void	*opStack;
-	int stack[1024] = { 0xDEADBEEF };
 
 	currentVM = vm;
 
-	++vm->callLevel;
-//	Com_Printf("entering %s level %d, call %d, arg1 = 0x%x\n", vm->name, vm->callLevel, args[0], args[1]);
-
-	// interpret the code
-	vm->currentlyInterpreting = qtrue;
-
-//	callMask = vm->dataMask;
-
 	// we might be called recursively, so this might not be the very top
 	programStack = vm->programStack;
 	stackOnEntry = programStack;
 
-	// set up the stack frame 
+	// set up the stack frame
 	image = vm->dataBase;
-#ifdef DEBUG_VM
-	memData = (char*)image;
-#endif
-
-	programCounter = 0;
 
 	programStack -= 48;
 
@@ -967,38 +1219,27 @@ int	VM_CallCompiled( vm_t *vm, int *args ) {
 	*(int *)&image[ programStack + 16] = args[2];
 	*(int *)&image[ programStack + 12] = args[1];
 	*(int *)&image[ programStack + 8 ] = args[0];
-	*(int *)&image[ programStack + 4 ] = 0x77777777;	// return stack
+	*(int *)&image[ programStack + 4 ] = 0;	// return stack
 	*(int *)&image[ programStack ] = -1;	// will terminate the loop on return
 
 	// off we go into generated code...
-	entryPoint = getentrypoint(vm);
-	opStack = &stack;
-
-	__asm__ __volatile__ (
-		"	movq %5,%%rsi		\r\n" \
-		"	movl %4,%%edi		\r\n" \
-		"	movq $done,%%r9		\r\n" \
-		"	movq %2,%%r10		\r\n" \
-		"	movq %3,%%r8		\r\n" \
-		"	jmp *%%r10		\r\n" \
-		"done:				\r\n" \
-		"	movl %%edi, %0		\r\n" \
-		"	movq %%rsi, %1		\r\n" \
-		: "=m" (programStack), "=m" (opStack)
-		: "m" (entryPoint), "m" (vm->dataBase), "m" (programStack), "m" (opStack)
-		: "%rsi", "%rdi", "%rax", "%rbx", "%rcx", "%rdx", "%r8", "%r9", "%r10", "%r15", "%xmm0"
-	);
-
-	if ( opStack != &stack[1] ) {
-		Com_Error( ERR_DROP, "opStack corrupted in compiled code (offset %d)\n", (void*)&stack[1] - opStack);
+	vmEntryFrame_t frame;
+	frame.opStack = stack;
+	frame.dataBase = image;
+	frame.instructionPointers = vm->instructionPointers;
+	frame.codeBase = vm->codeBase;
+	frame.programStack = programStack;
+
+	((vmEntryPoint_t)(void*)vm->codeBase)( &frame );
+
+	if ( frame.opStack != &stack[1] ) {
+		Com_Error( ERR_DROP, "opStack corrupted in compiled code" );
 	}
-	if ( programStack != stackOnEntry - 48 ) {
-		Com_Error( ERR_DROP, "programStack corrupted in compiled code\n" );
+	if ( frame.programStack != stackOnEntry - 48 ) {
+		Com_Error( ERR_DROP, "programStack corrupted in compiled code" );
 	}
 
-//	Com_Printf("exiting %s level %d\n", vm->name, vm->callLevel);
-	--vm->callLevel;
 	vm->programStack = stackOnEntry;
 
-	return *(int *)opStack;
+	return stack[1];
 }
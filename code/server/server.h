@@ -33,15 +33,13 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #define	MAX_ENT_CLUSTERS	16
 
 typedef struct svEntity_s {
-	struct worldSector_s *worldSector;
-	struct svEntity_s *nextEntityInWorldSector;
+	int			worldNode;			// leaf in the entity tree, 0 if not linked
 	
 	entityState_t	baseline;		// for delta compression of initial sighting
 	int			numClusters;		// if -1, use headnode instead
 	int			clusternums[MAX_ENT_CLUSTERS];
 	int			lastCluster;		// if all the clusters don't fit in clusternums
 	int			areanum, areanum2;
-	int			snapshotCounter;	// used to prevent double adding from portal views
 } svEntity_t;
 
 typedef enum {
@@ -59,7 +57,7 @@ typedef struct {
 	// https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=475
 	// the serverId associated with the current checksumFeed (always <= serverId)
 	int				checksumFeedServerId;
-	int				snapshotCounter;	// incremented for each snapshot built
+	qbool			snapshotIndexValid;	// cleared by SV_LinkEntity and at the start of each send
 	int				timeResidual;		// <= 1000 / sv_frame->value
 	int				nextFrameTime;		// when time > nextFrameTime, process world
 	struct cmodel_s	*models[MAX_MODELS];
@@ -86,11 +84,12 @@ typedef struct {
 	byte			areabits[MAX_MAP_AREA_BYTES];		// portalarea visibility bits
 	playerState_t	ps;
 	int				num_entities;
-	int				first_entity;		// into the circular sv_packet_entities[]
+	unsigned		first_entity;		// into the circular svs.snapshotEntities[]
 										// the entities MUST be in increasing state number
 										// order, otherwise the delta compression will fail
-	int				messageSent;		// time the message was transmitted
-	int				messageAcked;		// time the message was acked
+	unsigned		first_state;		// the first of the shared svs.snapshotStates[] this frame uses
+	int				messageSent;		// Sys_Milliseconds when the message was transmitted
+	int				messageAcked;		// Sys_Milliseconds when the ack was received
 	int				messageSize;		// used to rate drop packets
 } clientSnapshot_t;
 
@@ -181,6 +180,10 @@ typedef struct client_s {
 
 #define	AUTHORIZE_TIMEOUT	5000
 
+// both must be powers of two
+#define	CLIENT_HASH_SIZE	(MAX_CLIENTS * 2)
+#define	CHALLENGE_HASH_SIZE	(MAX_CHALLENGES * 2)
+
 typedef struct {
 	netadr_t	adr;
 	int			challenge;
@@ -203,11 +206,37 @@ typedef struct {
 	int			snapFlagServerBit;			// ^= SNAPFLAG_SERVERCOUNT every SV_SpawnServer()
 
 	client_t	*clients;					// [sv_maxclients->integer];
-	int			numSnapshotEntities;		// sv_maxclients->integer*PACKET_BACKUP*MAX_PACKET_ENTITIES
-	int			nextSnapshotEntities;		// next snapshotEntities to use
-	entityState_t	*snapshotEntities;		// [numSnapshotEntities]
+
+	// every client frame is a sorted list of indices into a pool of entity states,
+	// and each entity's state is only copied into that pool once per server frame
+	// both are rings whose sizes are powers of two, so the counters can wrap freely
+	int			numSnapshotEntities;		// sv_maxclients->integer*PACKET_BACKUP*64, rounded up
+	unsigned	nextSnapshotEntities;		// next snapshotEntities to use
+	unsigned	*snapshotEntities;			// [numSnapshotEntities] into snapshotStates
+	int			numSnapshotStates;
+	unsigned	nextSnapshotStates;			// next snapshotStates to use
+	entityState_t	*snapshotStates;		// [numSnapshotStates]
+
+	int			snapshotFrameNum;			// bumped each time a new set of states is started
+	unsigned	snapshotFrameFirstState;	// the first snapshotStates of the current frame
+	int			snapshotStateFrame[MAX_GENTITIES];	// the snapshotFrameNum each entity was last copied in
+	unsigned	snapshotStateNum[MAX_GENTITIES];	// and where it went
+
 	int			nextHeartbeatTime;
 	challenge_t	challenges[MAX_CHALLENGES];	// to prevent invalid IPs from connecting
+	int			nextChallenge;				// the oldest one, replaced by the next new challenge
+
+	// clients are hashed on base address + qport and challenges on address + port,
+	// so finding one costs the same however many slots there are
+	// the chains hold index + 1, so 0 ends them and a cleared svs has empty tables
+	unsigned	hashSeed;					// keeps remote hosts from aiming at one bucket
+	int			clientHash[CLIENT_HASH_SIZE];
+	int			clientHashNext[MAX_CLIENTS];
+	int			clientHashBucket[MAX_CLIENTS];		// bucket + 1, 0 if not in the table
+	int			challengeHash[CHALLENGE_HASH_SIZE];
+	int			challengeHashNext[MAX_CHALLENGES];
+	int			challengeHashBucket[MAX_CHALLENGES];	// bucket + 1, 0 if not in the table
+
 	netadr_t	redirectAddress;			// for rcon return messages
 
 	netadr_t	authorizeAddress;			// for rcon return messages
@@ -248,6 +277,8 @@ extern	cvar_t	*sv_pure;
 extern	cvar_t	*sv_floodProtect;
 extern	cvar_t	*sv_lanForceRate;
 extern	cvar_t	*sv_strictAuth;
+extern	cvar_t	*sv_snapshotIndex;
+extern	cvar_t	*sv_snapshotThreads;
 
 //===========================================================
 
@@ -291,11 +322,16 @@ void SV_DirectConnect( netadr_t from );
 
 void SV_AuthorizeIpPacket( netadr_t from );
 
-void SV_ExecuteClientMessage( client_t *cl, msg_t *msg );
+void SV_ExecuteClientMessage( client_t *cl, msg_t *msg, int time );
 
 void SV_ClientEnterWorld( client_t* cl, const usercmd_t* cmd );
 void SV_DropClient( client_t *drop, const char *reason );
 
+client_t* SV_ClientByAddress( const netadr_t& from, int qport );
+void SV_LinkClientAddress( client_t* cl );
+void SV_UnlinkClientAddress( client_t* cl );
+void SV_RebuildClientAddresses();
+
 void SV_ExecuteClientCommand( client_t *cl, const char *s, qbool clientOK );
 void SV_ClientThink( client_t* cl, const usercmd_t* cmd );
 
@@ -315,6 +351,9 @@ void SV_WriteFrameToClient (client_t *client, msg_t *msg);
 void SV_SendMessageToClient( msg_t *msg, client_t *client );
 void SV_SendClientMessages( void );
 void SV_SendClientSnapshot( client_t *client );
+void SV_InitSnapshotIndex();
+void SV_BeginSnapshotFrame();
+const entityState_t* SV_SnapshotEntity( const clientSnapshot_t* frame, int i );
 
 //
 // sv_game.c
@@ -369,6 +408,7 @@ clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent );
 
 
 void SV_SectorList_f( void );
+void SV_SectorBench_f();
 
 
 int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount );
@@ -396,6 +436,9 @@ void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const ve
 // passEntityNum is explicitly excluded from clipping checks (normally ENTITYNUM_NONE)
 
 
+void SV_TraceBatch( batchTrace_t *traces, int count, int capsule );
+// the same as SV_Trace on each of the traces, with the world traces on the job threads
+
 void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int entityNum, int contentmask, int capsule );
 // clip to a specific entity
 
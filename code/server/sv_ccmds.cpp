@@ -380,18 +380,21 @@ static void SV_Ban_f( void ) {
 		return;
 	}
 
+	if( cl->netchan.remoteAddress.type == NA_IP6 ) {
+		Com_Printf( "The authorize server can't ban IPv6 clients\n" );
+		return;
+	}
+
 	// look up the authorize server's IP
 	if ( !svs.authorizeAddress.ip[0] && svs.authorizeAddress.type != NA_BAD ) {
 		Com_Printf( "Resolving %s\n", AUTHORIZE_SERVER_NAME );
-		if ( !NET_StringToAdr( AUTHORIZE_SERVER_NAME, &svs.authorizeAddress ) ) {
+		if ( !NET_StringToAdr( AUTHORIZE_SERVER_NAME, &svs.authorizeAddress, NA_IP ) ) {
 			Com_Printf( "Couldn't resolve address\n" );
 			return;
 		}
 		svs.authorizeAddress.port = BigShort( PORT_AUTHORIZE );
-		Com_Printf( "%s resolved to %i.%i.%i.%i:%i\n", AUTHORIZE_SERVER_NAME,
-			svs.authorizeAddress.ip[0], svs.authorizeAddress.ip[1],
-			svs.authorizeAddress.ip[2], svs.authorizeAddress.ip[3],
-			BigShort( svs.authorizeAddress.port ) );
+		Com_Printf( "%s resolved to %s\n", AUTHORIZE_SERVER_NAME,
+			NET_AdrToString( svs.authorizeAddress ) );
 	}
 
 	// otherwise send their ip to the authorize server
@@ -434,18 +437,21 @@ static void SV_BanNum_f( void ) {
 		return;
 	}
 
+	if( cl->netchan.remoteAddress.type == NA_IP6 ) {
+		Com_Printf( "The authorize server can't ban IPv6 clients\n" );
+		return;
+	}
+
 	// look up the authorize server's IP
 	if ( !svs.authorizeAddress.ip[0] && svs.authorizeAddress.type != NA_BAD ) {
 		Com_Printf( "Resolving %s\n", AUTHORIZE_SERVER_NAME );
-		if ( !NET_StringToAdr( AUTHORIZE_SERVER_NAME, &svs.authorizeAddress ) ) {
+		if ( !NET_StringToAdr( AUTHORIZE_SERVER_NAME, &svs.authorizeAddress, NA_IP ) ) {
 			Com_Printf( "Couldn't resolve address\n" );
 			return;
 		}
 		svs.authorizeAddress.port = BigShort( PORT_AUTHORIZE );
-		Com_Printf( "%s resolved to %i.%i.%i.%i:%i\n", AUTHORIZE_SERVER_NAME,
-			svs.authorizeAddress.ip[0], svs.authorizeAddress.ip[1],
-			svs.authorizeAddress.ip[2], svs.authorizeAddress.ip[3],
-			BigShort( svs.authorizeAddress.port ) );
+		Com_Printf( "%s resolved to %s\n", AUTHORIZE_SERVER_NAME,
+			NET_AdrToString( svs.authorizeAddress ) );
 	}
 
 	// otherwise send their ip to the authorize server
@@ -691,6 +697,7 @@ void SV_AddOperatorCommands()
 	Cmd_AddCommand ("dumpuser", SV_DumpUser_f);
 	Cmd_AddCommand ("map_restart", SV_MapRestart_f);
 	Cmd_AddCommand ("sectorlist", SV_SectorList_f);
+	Cmd_AddCommand ("sectorbench", SV_SectorBench_f);
 	Cmd_AddCommand ("map", SV_Map_f);
 	Cmd_AddCommand ("devmap", SV_DevMap_f);
 	Cmd_AddCommand ("killserver", SV_KillServer_f);
@@ -714,6 +721,7 @@ void SV_RemoveOperatorCommands()
 	Cmd_RemoveCommand ("dumpuser");
 	Cmd_RemoveCommand ("map_restart");
 	Cmd_RemoveCommand ("sectorlist");
+	Cmd_RemoveCommand ("sectorbench");
 	Cmd_RemoveCommand ("say");
 #endif
 }
@@ -89,6 +89,132 @@ static void SV_UserinfoChanged( client_t *cl )
 }
 
 
+///////////////////////////////////////////////////////////////
+
+
+// FNV-1a over the fields NET_CompareBaseAdr looks at, plus a port or qport
+
+static unsigned SV_HashAdr( const netadr_t& adr, int port )
+{
+	unsigned hash = 2166136261u ^ svs.hashSeed;
+	const byte* p = NULL;
+	int i, n = 0;
+
+	if (adr.type == NA_IP) {
+		p = adr.ip;
+		n = 4;
+	} else if (adr.type == NA_IP6) {
+		p = adr.ip6;
+		n = 16;
+		hash = (hash ^ adr.scope_id) * 16777619u;
+	}
+
+	for (i = 0; i < n; ++i)
+		hash = (hash ^ p[i]) * 16777619u;
+
+	hash = (hash ^ (unsigned)adr.type) * 16777619u;
+	hash = (hash ^ (port & 0xFF)) * 16777619u;
+	hash = (hash ^ ((port >> 8) & 0xFF)) * 16777619u;
+
+	return hash ^ (hash >> 16);
+}
+
+
+static void SV_HashUnlink( int* heads, int* next, int* bucket, int index )
+{
+	if (!bucket[index])
+		return;
+
+	int* link = &heads[bucket[index] - 1];
+	while (*link != index + 1)
+		link = &next[*link - 1];
+	*link = next[index];
+
+	next[index] = 0;
+	bucket[index] = 0;
+}
+
+
+static void SV_HashLink( int* heads, int* next, int* bucket, int index, unsigned hash, int size )
+{
+	SV_HashUnlink( heads, next, bucket, index );
+
+	const int b = hash & (size - 1);
+	next[index] = heads[b];
+	heads[b] = index + 1;
+	bucket[index] = b + 1;
+}
+
+
+client_t* SV_ClientByAddress( const netadr_t& from, int qport )
+{
+	const unsigned hash = SV_HashAdr( from, qport );
+
+	for (int n = svs.clientHash[hash & (CLIENT_HASH_SIZE - 1)]; n; n = svs.clientHashNext[n - 1]) {
+		client_t* cl = &svs.clients[n - 1];
+		// the links aren't dropped along with every client, so check it's still the same one
+		if (cl->state != CS_FREE && cl->netchan.qport == qport && NET_CompareBaseAdr( from, cl->netchan.remoteAddress ))
+			return cl;
+	}
+
+	return NULL;
+}
+
+
+void SV_LinkClientAddress( client_t* cl )
+{
+	if (cl->netchan.remoteAddress.type == NA_BOT)
+		return;
+
+	SV_HashLink( svs.clientHash, svs.clientHashNext, svs.clientHashBucket, cl - svs.clients,
+		SV_HashAdr( cl->netchan.remoteAddress, cl->netchan.qport ), CLIENT_HASH_SIZE );
+}
+
+
+void SV_UnlinkClientAddress( client_t* cl )
+{
+	SV_HashUnlink( svs.clientHash, svs.clientHashNext, svs.clientHashBucket, cl - svs.clients );
+}
+
+
+// for when svs.clients has been reallocated
+
+void SV_RebuildClientAddresses()
+{
+	Com_Memset( svs.clientHash, 0, sizeof(svs.clientHash) );
+	Com_Memset( svs.clientHashNext, 0, sizeof(svs.clientHashNext) );
+	Com_Memset( svs.clientHashBucket, 0, sizeof(svs.clientHashBucket) );
+
+	for (int i = 0; i < sv_maxclients->integer; ++i) {
+		if (svs.clients[i].state != CS_FREE)
+			SV_LinkClientAddress( &svs.clients[i] );
+	}
+}
+
+
+static int SV_FirstChallenge( const netadr_t& adr )
+{
+	return svs.challengeHash[SV_HashAdr( adr, adr.port ) & (CHALLENGE_HASH_SIZE - 1)];
+}
+
+
+static void SV_LinkChallenge( int i )
+{
+	SV_HashLink( svs.challengeHash, svs.challengeHashNext, svs.challengeHashBucket, i,
+		SV_HashAdr( svs.challenges[i].adr, svs.challenges[i].adr.port ), CHALLENGE_HASH_SIZE );
+}
+
+
+static void SV_ClearChallenge( int i )
+{
+	SV_HashUnlink( svs.challengeHash, svs.challengeHashNext, svs.challengeHashBucket, i );
+	Com_Memset( &svs.challenges[i], 0, sizeof( svs.challenges[i] ) );
+}
+
+
+///////////////////////////////////////////////////////////////
+
+
 /*
 =================
 SV_GetChallenge
@@ -109,43 +235,40 @@ sent to that ip.
 */
 void SV_GetChallenge( netadr_t from ) {
 	int		i;
-	int		oldest;
-	int		oldestTime;
 	challenge_t	*challenge;
 
 	// ignore if we are in single player
 	if (Cvar_VariableValue("sv_singlePlayer"))
 		return;
 
-	oldest = 0;
-	oldestTime = 0x7fffffff;
-
 	// see if we already have a challenge for this ip
-	challenge = &svs.challenges[0];
-	for (i = 0 ; i < MAX_CHALLENGES ; i++, challenge++) {
-		if ( !challenge->connected && NET_CompareAdr( from, challenge->adr ) ) {
+	challenge = NULL;
+	for (int n = SV_FirstChallenge( from ); n; n = svs.challengeHashNext[n - 1]) {
+		if ( !svs.challenges[n - 1].connected && NET_CompareAdr( from, svs.challenges[n - 1].adr ) ) {
+			i = n - 1;
+			challenge = &svs.challenges[i];
 			break;
 		}
-		if ( challenge->time < oldestTime ) {
-			oldestTime = challenge->time;
-			oldest = i;
-		}
 	}
 
-	if (i == MAX_CHALLENGES) {
+	if (!challenge) {
 		// this is the first time this client has asked for a challenge
-		challenge = &svs.challenges[oldest];
+		// challenges are only ever created here, in order, so the oldest one is always next
+		i = svs.nextChallenge;
+		svs.nextChallenge = (svs.nextChallenge + 1) % MAX_CHALLENGES;
+		challenge = &svs.challenges[i];
 
 		challenge->challenge = ( (rand() << 16) ^ rand() ) ^ svs.time;
 		challenge->adr = from;
 		challenge->firstTime = svs.time;
 		challenge->time = svs.time;
 		challenge->connected = qfalse;
-		i = oldest;
+		SV_LinkChallenge( i );
 	}
 
 	// if they are on a lan address, send the challengeResponse immediately
-	if ( Sys_IsLANAddress( from ) ) {
+	// the authorize server only knows about IPv4, so IPv6 clients don't wait on it either
+	if ( Sys_IsLANAddress( from ) || from.type == NA_IP6 ) {
 		challenge->pingTime = svs.time;
 		NET_OutOfBandPrint( NS_SERVER, from, "challengeResponse %i", challenge->challenge );
 		return;
@@ -154,15 +277,13 @@ void SV_GetChallenge( netadr_t from ) {
 	// look up the authorize server's IP
 	if ( !svs.authorizeAddress.ip[0] && svs.authorizeAddress.type != NA_BAD ) {
 		Com_Printf( "Resolving %s\n", AUTHORIZE_SERVER_NAME );
-		if ( !NET_StringToAdr( AUTHORIZE_SERVER_NAME, &svs.authorizeAddress ) ) {
+		if ( !NET_StringToAdr( AUTHORIZE_SERVER_NAME, &svs.authorizeAddress, NA_IP ) ) {
 			Com_Printf( "Couldn't resolve address\n" );
 			return;
 		}
 		svs.authorizeAddress.port = BigShort( PORT_AUTHORIZE );
-		Com_Printf( "%s resolved to %i.%i.%i.%i:%i\n", AUTHORIZE_SERVER_NAME,
-			svs.authorizeAddress.ip[0], svs.authorizeAddress.ip[1],
-			svs.authorizeAddress.ip[2], svs.authorizeAddress.ip[3],
-			BigShort( svs.authorizeAddress.port ) );
+		Com_Printf( "%s resolved to %s\n", AUTHORIZE_SERVER_NAME,
+			NET_AdrToString( svs.authorizeAddress ) );
 	}
 
 	// if they have been challenging for a long time and we
@@ -242,7 +363,7 @@ void SV_AuthorizeIpPacket( netadr_t from )
 			NET_OutOfBandPrint( NS_SERVER, svs.challenges[i].adr, "print\n%s\n", r );
 		}
 		// clear the challenge record so it won't timeout and let them through
-		Com_Memset( &svs.challenges[i], 0, sizeof( svs.challenges[i] ) );
+		SV_ClearChallenge( i );
 		return;
 	}
 
@@ -254,7 +375,7 @@ void SV_AuthorizeIpPacket( netadr_t from )
 	}
 
 	// clear the challenge record so it won't timeout and let them through
-	Com_Memset( &svs.challenges[i], 0, sizeof( svs.challenges[i] ) );
+	SV_ClearChallenge( i );
 }
 
 /*
@@ -314,20 +435,22 @@ void SV_DirectConnect( netadr_t from )
 	if ( !NET_IsLocalAddress (from) ) {
 		int		ping;
 
-		for (i=0 ; i<MAX_CHALLENGES ; i++) {
-			if (NET_CompareAdr(from, svs.challenges[i].adr)) {
-				if ( challenge == svs.challenges[i].challenge ) {
+		int n;
+		for (n = SV_FirstChallenge( from ); n; n = svs.challengeHashNext[n - 1]) {
+			if (NET_CompareAdr(from, svs.challenges[n - 1].adr)) {
+				if ( challenge == svs.challenges[n - 1].challenge ) {
 					break;		// good
 				}
 			}
 		}
-		if (i == MAX_CHALLENGES) {
+		if (!n) {
 			NET_OutOfBandPrint( NS_SERVER, from, "print\nNo or bad challenge for address.\n" );
 			return;
 		}
 		// force the IP key/value pair so the game can filter based on ip
 		Info_SetValueForKey( userinfo, "ip", NET_AdrToString( from ) );
 
+		i = n - 1;
 		ping = svs.time - svs.challenges[i].pingTime;
 		Com_Printf( "Client %i connecting with %i challenge ping\n", i, ping );
 		svs.challenges[i].connected = qtrue;
@@ -341,6 +464,7 @@ void SV_DirectConnect( netadr_t from )
 				// reset the address otherwise their ping will keep increasing
 				// with each connect message and they'd eventually be able to connect
 				svs.challenges[i].adr.port = 0;
+				SV_LinkChallenge( i );
 				return;
 			}
 			if ( sv_maxPing->value && ping > sv_maxPing->value ) {
@@ -449,6 +573,7 @@ gotnewcl:
 
 	// save the address
 	Netchan_Setup (NS_SERVER, &newcl->netchan , from, qport);
+	SV_LinkClientAddress( newcl );
 	// init the netchan queue
 	newcl->netchan_end_queue = &newcl->netchan_start_queue;
 
@@ -507,7 +632,6 @@ or crashing -- SV_FinalMessage() will handle that
 */
 void SV_DropClient( client_t *drop, const char *reason ) {
 	int		i;
-	challenge_t	*challenge;
 
 	if ( drop->state == CS_ZOMBIE ) {
 		return;		// already dropped
@@ -515,11 +639,9 @@ void SV_DropClient( client_t *drop, const char *reason ) {
 
 	if (drop->netchan.remoteAddress.type != NA_BOT) {
 		// see if we already have a challenge for this ip
-		challenge = &svs.challenges[0];
-
-		for (i = 0 ; i < MAX_CHALLENGES ; i++, challenge++) {
-			if ( NET_CompareAdr( drop->netchan.remoteAddress, challenge->adr ) ) {
-				challenge->connected = qfalse;
+		for (int n = SV_FirstChallenge( drop->netchan.remoteAddress ); n; n = svs.challengeHashNext[n - 1]) {
+			if ( NET_CompareAdr( drop->netchan.remoteAddress, svs.challenges[n - 1].adr ) ) {
+				svs.challenges[n - 1].connected = qfalse;
 				break;
 			}
 		}
@@ -543,6 +665,11 @@ void SV_DropClient( client_t *drop, const char *reason ) {
 	// this will remove the body, among other things
 	VM_Call( gvm, GAME_CLIENT_DISCONNECT, drop - svs.clients );
 
+	// the game may have changed any entity, so the rest of this
+	// frame's snapshots can't reuse anything captured before the drop
+	sv.snapshotIndexValid = qfalse;
+	SV_BeginSnapshotFrame();
+
 	// add the disconnect command
 	SV_SendServerCommand( drop, "disconnect \"%s\"", reason);
 
@@ -1253,9 +1380,12 @@ in dropped packets can be recovered.
 
 On very fast clients, there may be multiple usercmd packed into
 each of the backup packets.
+
+time is when the packet came off the socket, which is what the
+ack time for the ping has to be, not when this frame got to it
 ==================
 */
-static void SV_UserMove( client_t *cl, msg_t *msg, qbool delta ) {
+static void SV_UserMove( client_t *cl, msg_t *msg, qbool delta, int time ) {
 	int			i, key;
 	int			cmdCount;
 	usercmd_t	nullcmd;
@@ -1297,7 +1427,7 @@ static void SV_UserMove( client_t *cl, msg_t *msg, qbool delta ) {
 
 	// save time for ping calculation if this is the first ack of a given snap
 	if ( cl->frames[ cl->messageAcknowledge & PACKET_MASK ].messageAcked <= 0 )
-		cl->frames[ cl->messageAcknowledge & PACKET_MASK ].messageAcked = svs.time;
+		cl->frames[ cl->messageAcknowledge & PACKET_MASK ].messageAcked = max( time, 1 );
 
 	// catch the no-cp-yet situation before SV_ClientEnterWorld
 	// if CS_ACTIVE, then it's time to trigger a new gamestate emission
@@ -1367,7 +1497,7 @@ SV_ExecuteClientMessage
 Parse a client packet
 ===================
 */
-void SV_ExecuteClientMessage( client_t *cl, msg_t *msg ) {
+void SV_ExecuteClientMessage( client_t *cl, msg_t *msg, int time ) {
 	int			c;
 	int			serverId;
 
@@ -1452,9 +1582,9 @@ void SV_ExecuteClientMessage( client_t *cl, msg_t *msg ) {
 
 	// read the usercmd_t
 	if ( c == clc_move ) {
-		SV_UserMove( cl, msg, qtrue );
+		SV_UserMove( cl, msg, qtrue, time );
 	} else if ( c == clc_moveNoDelta ) {
-		SV_UserMove( cl, msg, qfalse );
+		SV_UserMove( cl, msg, qfalse, time );
 	} else if ( c != clc_EOF ) {
 		Com_Printf( "WARNING: bad command byte for client %i\n", cl - svs.clients );
 	}
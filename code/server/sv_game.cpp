@@ -314,6 +314,9 @@ static intptr_t SV_GameSystemCalls( intptr_t* args )
 	case G_TRACECAPSULE:
 		SV_Trace( VMA(1), VMA(2), VMA(3), VMA(4), VMA(5), args[6], args[7], /*int capsule*/ qtrue );
 		return 0;
+	case G_TRACEBATCH:
+		SV_TraceBatch( VMA(1), VM_ArgCount( args[1], args[2], sizeof(batchTrace_t) ), args[3] );
+		return 0;
 	case G_POINT_CONTENTS:
 		return SV_PointContents( VMA(1), args[2] );
 	case G_SET_BRUSH_MODEL:
@@ -782,6 +785,24 @@ static intptr_t SV_GameSystemCalls( intptr_t* args )
 }
 
 
+// the traps above that the vm can run by itself
+
+static const vmLeafTrapDef_t sv_gameLeafTraps[] = {
+	{ TRAP_MEMSET, VM_LEAF_MEMSET },
+	{ TRAP_MEMCPY, VM_LEAF_MEMCPY },
+	{ TRAP_STRNCPY, VM_LEAF_STRNCPY },
+	{ TRAP_SIN, VM_LEAF_SIN },
+	{ TRAP_COS, VM_LEAF_COS },
+	{ TRAP_ATAN2, VM_LEAF_ATAN2 },
+	{ TRAP_SQRT, VM_LEAF_SQRT },
+	{ TRAP_MATRIXMULTIPLY, VM_LEAF_MATRIXMULTIPLY },
+	{ TRAP_ANGLEVECTORS, VM_LEAF_ANGLEVECTORS },
+	{ TRAP_PERPENDICULARVECTOR, VM_LEAF_PERPENDICULARVECTOR },
+	{ TRAP_FLOOR, VM_LEAF_FLOOR },
+	{ TRAP_CEIL, VM_LEAF_CEIL }
+};
+
+
 ///////////////////////////////////////////////////////////////
 
 
@@ -845,7 +866,8 @@ void SV_InitGameProgs()
 	bot_enable = (var && var->integer);
 
 	// load the dll or bytecode
-	gvm = VM_Create( "qagame", SV_GameSystemCalls, (vmInterpret_t)Cvar_VariableIntegerValue( "vm_game" ) );
+	gvm = VM_Create( "qagame", SV_GameSystemCalls, sv_gameLeafTraps, sizeof(sv_gameLeafTraps) / sizeof(sv_gameLeafTraps[0]),
+			(vmInterpret_t)Cvar_VariableIntegerValue( "vm_game" ) );
 
 	SV_InitGameVM( qfalse );
 }
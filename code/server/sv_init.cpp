@@ -196,6 +196,33 @@ void SV_BoundMaxClients( int minimum ) {
 }
 
 
+// sizes the snapshot rings: one frame must always fit, and they have to be
+// powers of two so that their counters can wrap without any special casing
+
+static void SV_SetSnapshotEntityCounts()
+{
+	int count;
+
+	if ( com_dedicated->integer ) {
+		count = sv_maxclients->integer * PACKET_BACKUP * 64;
+	} else {
+		// we don't need nearly as many when playing locally
+		count = sv_maxclients->integer * 4 * 64;
+	}
+
+	svs.numSnapshotEntities = 2 * MAX_GENTITIES;
+	while ( svs.numSnapshotEntities < count )
+		svs.numSnapshotEntities <<= 1;
+
+	// the states are shared between clients, so even a full server
+	// only needs room for a couple of backups' worth of every entity
+	count = min( count, 2 * PACKET_BACKUP * MAX_GENTITIES );
+	svs.numSnapshotStates = 2 * MAX_GENTITIES;
+	while ( svs.numSnapshotStates < count )
+		svs.numSnapshotStates <<= 1;
+}
+
+
 /*
 ===============
 SV_Startup
@@ -214,12 +241,8 @@ void SV_Startup( void )
 	SV_BoundMaxClients( 1 );
 
 	svs.clients = Z_New<client_t>( sv_maxclients->integer );
-	if ( com_dedicated->integer ) {
-		svs.numSnapshotEntities = sv_maxclients->integer * PACKET_BACKUP * 64;
-	} else {
-		// we don't need nearly as many when playing locally
-		svs.numSnapshotEntities = sv_maxclients->integer * 4 * 64;
-	}
+	SV_SetSnapshotEntityCounts();
+	svs.hashSeed = ((unsigned)rand() << 16) ^ (unsigned)rand() ^ (unsigned)Sys_Milliseconds();
 	svs.initialized = qtrue;
 
 	Cvar_Set( "sv_running", "1" );
@@ -281,14 +304,12 @@ void SV_ChangeMaxClients( void ) {
 
 	// free the old clients on the hunk
 	Hunk_FreeTempMemory( oldClients );
+
+	// zombies weren't copied over
+	SV_RebuildClientAddresses();
 	
 	// allocate new snapshot entities
-	if ( com_dedicated->integer ) {
-		svs.numSnapshotEntities = sv_maxclients->integer * PACKET_BACKUP * 64;
-	} else {
-		// we don't need nearly as many when playing locally
-		svs.numSnapshotEntities = sv_maxclients->integer * 4 * 64;
-	}
+	SV_SetSnapshotEntityCounts();
 }
 
 
@@ -344,7 +365,7 @@ void SV_SpawnServer( const char* mapname )
 	// clear collision map data
 	CM_ClearMap();
 
-	// init client structures and svs.numSnapshotEntities 
+	// init client structures and svs.numSnapshotEntities / numSnapshotStates
 	if ( !Cvar_VariableValue("sv_running") ) {
 		SV_Startup();
 	} else {
@@ -357,10 +378,6 @@ void SV_SpawnServer( const char* mapname )
 	// clear pak references
 	FS_ClearPakReferences(0);
 
-	// allocate the snapshot entities on the hunk
-	svs.snapshotEntities = (entityState_t*)Hunk_Alloc( sizeof(entityState_t)*svs.numSnapshotEntities, h_high );
-	svs.nextSnapshotEntities = 0;
-
 	// toggle the server bit so clients can detect that a
 	// server has changed
 	svs.snapFlagServerBit ^= SNAPFLAG_SERVERCOUNT;
@@ -391,8 +408,18 @@ void SV_SpawnServer( const char* mapname )
 	sv.checksumFeed = ( ((int) rand() << 16) ^ rand() ) ^ Com_Milliseconds();
 	FS_Restart( sv.checksumFeed );
 
+	// the clip map has to be the first thing on the hunk for CM_LoadMap to keep it
 	CM_LoadMap( va("maps/%s.bsp", mapname), qfalse, &checksum );
 
+	// allocate the snapshot entities on the hunk
+	svs.snapshotEntities = H_New<unsigned>( svs.numSnapshotEntities, h_high );
+	svs.nextSnapshotEntities = 0;
+	svs.snapshotStates = H_New<entityState_t>( svs.numSnapshotStates, h_high );
+	svs.nextSnapshotStates = 0;
+
+	// size the cluster -> entity index used by the snapshot code
+	SV_InitSnapshotIndex();
+
 	// set serverinfo visible name
 	Cvar_Set( "mapname", mapname );
 
@@ -572,6 +599,10 @@ void SV_Init()
 	sv_mapChecksum = Cvar_Get ("sv_mapChecksum", "", CVAR_ROM);
 	sv_lanForceRate = Cvar_Get ("sv_lanForceRate", "1", CVAR_ARCHIVE );
 	sv_strictAuth = Cvar_Get ("sv_strictAuth", "1", CVAR_ARCHIVE );
+	sv_snapshotIndex = Cvar_Get ("sv_snapshotIndex", "1", 0 );
+	sv_snapshotThreads = Cvar_Get ("sv_snapshotThreads", "0", CVAR_ARCHIVE );
+	// lets mods know that they can use G_TRACEBATCH
+	Cvar_Get ("sv_traceBatch", "1", CVAR_ROM );
 
 	sv_master[0] = Cvar_Get ("sv_master1", MASTER_SERVER_NAME, 0 );
 	for (int i = 1; i < MAX_MASTER_SERVERS; ++i)
@@ -635,6 +666,7 @@ void SV_Shutdown( const char* finalmsg )
 	SV_RemoveOperatorCommands();
 	SV_MasterShutdown();
 	SV_ShutdownGameProgs();
+	Sys_SetJobThreads( 0 );
 
 	// free current level
 	SV_ClearServer();
@@ -53,6 +53,8 @@ cvar_t	*sv_pure;
 cvar_t	*sv_floodProtect;
 cvar_t	*sv_lanForceRate; // dedicated 1 (LAN) server forces local client rates to 99999 (bug #491)
 cvar_t	*sv_strictAuth;
+cvar_t	*sv_snapshotIndex;		// use the per-frame cluster index to find visible entities
+cvar_t	*sv_snapshotThreads;	// extra threads to build and encode client snapshots on
 
 /*
 =============================================================================
@@ -222,9 +224,20 @@ but not on every player enter or exit.
 */
 #define	HEARTBEAT_MSEC	300*1000
 #define	HEARTBEAT_GAME	"QuakeArena-1"
+
+// "host:port" and "[v6addr]:port" have one, a bare "v6addr" doesn't
+static qbool SV_MasterHasPort( const char* s )
+{
+	if ( s[0] == '[' )
+		return ( strstr( s, "]:" ) != NULL );
+
+	const char* colon = strchr( s, ':' );
+	return ( colon && colon == strrchr( s, ':' ) );
+}
+
 void SV_MasterHeartbeat( void ) {
-	static netadr_t	adr[MAX_MASTER_SERVERS];
-	int			i;
+	static netadr_t	adr[MAX_MASTER_SERVERS][2];	// IPv4 and IPv6
+	int			i, j;
 
 	// "dedicated 1" is for lan play, "dedicated 2" is for inet public play
 	if ( !com_dedicated || com_dedicated->integer != 2 ) {
@@ -251,7 +264,9 @@ void SV_MasterHeartbeat( void ) {
 			sv_master[i]->modified = qfalse;
 	
 			Com_Printf( "Resolving %s\n", sv_master[i]->string );
-			if ( !NET_StringToAdr( sv_master[i]->string, &adr[i] ) ) {
+			const qbool resolved4 = NET_StringToAdr( sv_master[i]->string, &adr[i][0], NA_IP );
+			const qbool resolved6 = NET_StringToAdr( sv_master[i]->string, &adr[i][1], NA_IP6 );
+			if ( !resolved4 && !resolved6 ) {
 				// if the address failed to resolve, clear it
 				// so we don't take repeated dns hits
 				Com_Printf( "Couldn't resolve address: %s\n", sv_master[i]->string );
@@ -259,19 +274,26 @@ void SV_MasterHeartbeat( void ) {
 				sv_master[i]->modified = qfalse;
 				continue;
 			}
-			if ( !strchr( sv_master[i]->string, ':' ) ) {
-				adr[i].port = BigShort( PORT_MASTER );
+			for ( j = 0 ; j < 2 ; j++ ) {
+				if ( adr[i][j].type == NA_BAD ) {
+					continue;
+				}
+				if ( !SV_MasterHasPort( sv_master[i]->string ) ) {
+					adr[i][j].port = BigShort( PORT_MASTER );
+				}
+				Com_Printf( "%s resolved to %s\n", sv_master[i]->string, NET_AdrToString( adr[i][j] ) );
 			}
-			Com_Printf( "%s resolved to %i.%i.%i.%i:%i\n", sv_master[i]->string,
-				adr[i].ip[0], adr[i].ip[1], adr[i].ip[2], adr[i].ip[3],
-				BigShort( adr[i].port ) );
 		}
 
 
 		Com_Printf ("Sending heartbeat to %s\n", sv_master[i]->string );
 		// this command should be changed if the server info / status format
 		// ever incompatably changes
-		NET_OutOfBandPrint( NS_SERVER, adr[i], "heartbeat %s\n", HEARTBEAT_GAME );
+		for ( j = 0 ; j < 2 ; j++ ) {
+			if ( adr[i][j].type != NA_BAD ) {
+				NET_OutOfBandPrint( NS_SERVER, adr[i][j], "heartbeat %s\n", HEARTBEAT_GAME );
+			}
+		}
 	}
 }
 
@@ -532,7 +554,7 @@ static void SV_ConnectionlessPacket( const netadr_t from, msg_t* msg )
 //============================================================================
 
 
-void SV_PacketEvent( const netadr_t& from, msg_t* msg )
+void SV_PacketEvent( const netadr_t& from, msg_t* msg, int time )
 {
 	// check for connectionless packet (0xffffffff) first
 	if ( msg->cursize >= 4 && *(int *)msg->data == -1) {
@@ -546,43 +568,33 @@ void SV_PacketEvent( const netadr_t& from, msg_t* msg )
 	int qport = MSG_ReadShort( msg ) & 0xffff;
 
 	// find which client the message is from
-	client_t* cl = svs.clients;
-	for (int i = 0; i < sv_maxclients->integer; ++i, ++cl) {
-		if (cl->state == CS_FREE) {
-			continue;
-		}
-		if ( !NET_CompareBaseAdr( from, cl->netchan.remoteAddress ) ) {
-			continue;
-		}
-		// it is possible to have multiple clients from a single IP
-		// address, so they are differentiated by the qport variable
-		if (cl->netchan.qport != qport) {
-			continue;
-		}
+	// it is possible to have multiple clients from a single IP
+	// address, so they are differentiated by the qport variable
+	client_t* cl = SV_ClientByAddress( from, qport );
+	if (!cl) {
+		// if we received a sequenced packet from an address we don't recognize,
+		// send an out of band disconnect packet to it
+		NET_OutOfBandPrint( NS_SERVER, from, "disconnect" );
+		return;
+	}
 
-		// the IP port can't be used to differentiate them,
-		// because some NATs periodically change UDP port assignments
-		if (cl->netchan.remoteAddress.port != from.port) {
-			Com_Printf( "SV_PacketEvent: fixing up a translated port\n" );
-			cl->netchan.remoteAddress.port = from.port;
-		}
+	// the IP port can't be used to differentiate them,
+	// because some NATs periodically change UDP port assignments
+	if (cl->netchan.remoteAddress.port != from.port) {
+		Com_Printf( "SV_PacketEvent: fixing up a translated port\n" );
+		cl->netchan.remoteAddress.port = from.port;
+	}
 
-		// make sure it is a valid, in sequence packet
-		if (SV_Netchan_Process(cl, msg)) {
-			// zombie clients still need to do the Netchan_Process
-			// to make sure they don't need to retransmit the final
-			// reliable message, but they don't do any other processing
-			if (cl->state != CS_ZOMBIE) {
-				cl->lastPacketTime = svs.time;	// don't timeout
-				SV_ExecuteClientMessage( cl, msg );
-			}
+	// make sure it is a valid, in sequence packet
+	if (SV_Netchan_Process(cl, msg)) {
+		// zombie clients still need to do the Netchan_Process
+		// to make sure they don't need to retransmit the final
+		// reliable message, but they don't do any other processing
+		if (cl->state != CS_ZOMBIE) {
+			cl->lastPacketTime = svs.time;	// don't timeout
+			SV_ExecuteClientMessage( cl, msg, time );
 		}
-		return;
 	}
-
-	// if we received a sequenced packet from an address we don't recognize,
-	// send an out of band disconnect packet to it
-	NET_OutOfBandPrint( NS_SERVER, from, "disconnect" );
 }
 
 
@@ -673,6 +685,7 @@ void SV_CheckTimeouts( void ) {
 			// using the client id cause the cl->name is empty at this point
 			Com_DPrintf( "Going from CS_ZOMBIE to CS_FREE for client %d\n", i );
 			cl->state = CS_FREE;	// can now be reused
+			SV_UnlinkClientAddress( cl );
 			continue;
 		}
 		if ( cl->state >= CS_CONNECTED && cl->lastPacketTime < droppoint) {
@@ -681,6 +694,7 @@ void SV_CheckTimeouts( void ) {
 			if ( ++cl->timeoutCount > 5 ) {
 				SV_DropClient (cl, "timed out"); 
 				cl->state = CS_FREE;	// don't bother with zombie state
+				SV_UnlinkClientAddress( cl );
 			}
 		} else {
 			cl->timeoutCount = 0;
@@ -777,12 +791,6 @@ void SV_Frame( int msec ) {
 		Cbuf_AddText( va( "map %s\n", Cvar_VariableString( "mapname" ) ) );
 		return;
 	}
-	// this can happen considerably earlier when lots of clients play and the map doesn't change
-	if ( svs.nextSnapshotEntities >= 0x7FFFFFFE - svs.numSnapshotEntities ) {
-		SV_Shutdown( "Restarting server due to numSnapshotEntities wrapping" );
-		Cbuf_AddText( va( "map %s\n", Cvar_VariableString( "mapname" ) ) );
-		return;
-	}
 
 	if( sv.restartTime && sv.time >= sv.restartTime ) {
 		sv.restartTime = 0;
@@ -811,6 +819,9 @@ void SV_Frame( int msec ) {
 
 	if (com_dedicated->integer) SV_BotFrame (sv.time);
 
+	// everything the frame sends goes out in one batch at the end
+	NET_BeginPacketBatch();
+
 	// run the game simulation in chunks
 	while ( sv.timeResidual >= frameMsec ) {
 		sv.timeResidual -= frameMsec;
@@ -833,6 +844,8 @@ void SV_Frame( int msec ) {
 
 	// send a heartbeat to the master if needed
 	SV_MasterHeartbeat();
+
+	NET_FlushPacketBatch();
 }
 
 //============================================================================
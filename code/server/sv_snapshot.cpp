@@ -46,11 +46,20 @@ A normal server packet will look like:
 */
 
 
+// the entity states of every client frame live in the shared svs.snapshotStates pool
+
+const entityState_t* SV_SnapshotEntity( const clientSnapshot_t* frame, int i )
+{
+	unsigned state = svs.snapshotEntities[(frame->first_entity + i) & (svs.numSnapshotEntities - 1)];
+	return &svs.snapshotStates[state & (svs.numSnapshotStates - 1)];
+}
+
+
 // write a delta update of an entityState_t list to the message
 
-static void SV_EmitPacketEntities( const clientSnapshot_t* from, clientSnapshot_t* to, msg_t* msg )
+static void SV_EmitPacketEntities( const clientSnapshot_t* from, const clientSnapshot_t* to, msg_t* msg )
 {
-	entityState_t* newent = NULL;
+	const entityState_t* newent = NULL;
 	const entityState_t* oldent = NULL;
 	int newindex = 0, oldindex = 0;
 	int newnum, oldnum;
@@ -60,14 +69,14 @@ static void SV_EmitPacketEntities( const clientSnapshot_t* from, clientSnapshot_
 		if ( newindex >= to->num_entities ) {
 			newnum = 9999;
 		} else {
-			newent = &svs.snapshotEntities[(to->first_entity+newindex) % svs.numSnapshotEntities];
+			newent = SV_SnapshotEntity( to, newindex );
 			newnum = newent->number;
 		}
 
 		if ( oldindex >= from_num_entities ) {
 			oldnum = 9999;
 		} else {
-			oldent = &svs.snapshotEntities[(from->first_entity+oldindex) % svs.numSnapshotEntities];
+			oldent = SV_SnapshotEntity( from, oldindex );
 			oldnum = oldent->number;
 		}
 
@@ -99,44 +108,56 @@ static void SV_EmitPacketEntities( const clientSnapshot_t* from, clientSnapshot_
 }
 
 
-/*
-==================
-SV_WriteSnapshotToClient
-==================
-*/
-static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
-	clientSnapshot_t	*frame, *oldframe;
-	int					lastframe;
-	int					i;
-	int					snapFlags;
+// picks the previous frame to delta compress the snapshot being created from, if any:
+// this has to be done once no other snapshot will be committed before this one is
+// encoded, because whether the old frame's entities are still around depends on how
+// many other snapshots came after it
 
-	// this is the snapshot we are creating
-	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+static const clientSnapshot_t* SV_SnapshotDeltaFrame( const client_t* client, int* lastframe )
+{
+	const clientSnapshot_t* oldframe;
 
-	// try to use a previous frame as the source for delta compressing the snapshot
 	if ( client->deltaMessage <= 0 || client->state != CS_ACTIVE ) {
 		// client is asking for a retransmit
 		oldframe = NULL;
-		lastframe = 0;
+		*lastframe = 0;
 	} else if ( client->netchan.outgoingSequence - client->deltaMessage 
 		>= (PACKET_BACKUP - 3) ) {
 		// client hasn't gotten a good message through in a long time
 		Com_DPrintf ("%s: Delta request from out of date packet.\n", client->name);
 		oldframe = NULL;
-		lastframe = 0;
+		*lastframe = 0;
 	} else {
 		// we have a valid snapshot to delta from
 		oldframe = &client->frames[ client->deltaMessage & PACKET_MASK ];
-		lastframe = client->netchan.outgoingSequence - client->deltaMessage;
+		*lastframe = client->netchan.outgoingSequence - client->deltaMessage;
 
-		// the snapshot's entities may still have rolled off the buffer, though
-		if ( oldframe->first_entity <= svs.nextSnapshotEntities - svs.numSnapshotEntities ) {
+		// the snapshot's entities may still have rolled off the buffers, though
+		if ( (svs.nextSnapshotEntities - oldframe->first_entity >= (unsigned)svs.numSnapshotEntities) ||
+				(svs.nextSnapshotStates - oldframe->first_state >= (unsigned)svs.numSnapshotStates) ) {
 			Com_DPrintf ("%s: Delta request from out of date entities.\n", client->name);
 			oldframe = NULL;
-			lastframe = 0;
+			*lastframe = 0;
 		}
 	}
 
+	return oldframe;
+}
+
+
+/*
+==================
+SV_WriteSnapshotToClient
+==================
+*/
+static void SV_WriteSnapshotToClient( const client_t* client, msg_t* msg, const clientSnapshot_t* oldframe, int lastframe )
+{
+	int					i;
+	int					snapFlags;
+
+	// this is the snapshot we are creating
+	const clientSnapshot_t* frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
 	MSG_WriteByte (msg, svc_snapshot);
 
 	// NOTE, MRE: now sent at the start of every message from server to client
@@ -224,33 +245,43 @@ Build a client snapshot structure
 typedef struct {
 	int		numSnapshotEntities;
 	int		snapshotEntities[MAX_SNAPSHOT_ENTITIES];
+	unsigned	added[MAX_GENTITIES / 32];	// prevents double adding from portal views
+	qbool	bypassIndex;	// set while sv_snapshotIndex 2 is cross-checking a snapshot
+	const char*	error;		// snapshots can be built on job threads, so the caller raises it
 } snapshotEntityNumbers_t;
 
 
+// duplicates are checked for by the caller once the list is sorted,
+// since this can run on a job thread and can't raise the error itself
+
 static int QDECL SV_QsortEntityNumbers( const void *a, const void *b )
 {
 	const int *ea = (const int *)a;
 	const int *eb = (const int *)b;
 
-	if ( *ea == *eb ) {
-		Com_Error( ERR_DROP, "SV_QsortEntityStates: duplicated entity" );
-	}
-
 	if ( *ea < *eb ) {
 		return -1;
 	}
 
-	return 1;
+	return ( *ea > *eb );
+}
+
+
+static qbool SV_EntityAdded( const snapshotEntityNumbers_t* eNums, int e )
+{
+	return ( (eNums->added[e >> 5] & (1u << (e & 31))) != 0 );
 }
 
 
-static void SV_AddEntToSnapshot( svEntity_t *svEnt, const sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums )
+static void SV_AddEntToSnapshot( const sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums )
 {
+	int e = gEnt->s.number;
+
 	// if we have already added this entity to this snapshot, don't add again
-	if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
+	if ( SV_EntityAdded( eNums, e ) ) {
 		return;
 	}
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	eNums->added[e >> 5] |= (1u << (e & 31));
 
 	// if we are full, silently discard entities
 	if ( eNums->numSnapshotEntities == MAX_SNAPSHOT_ENTITIES ) {
@@ -262,133 +293,360 @@ static void SV_AddEntToSnapshot( svEntity_t *svEnt, const sharedEntity_t *gEnt,
 }
 
 
-static void SV_AddEntitiesVisibleFromPoint( const vec3_t origin,
-		clientSnapshot_t *frame, snapshotEntityNumbers_t *eNums )
+/*
+=============================================================================
+
+Per-frame cluster -> entity index
+
+Rather than have every client walk every entity in the level, the linked
+entities are bucketed by the PVS clusters they touch once per frame, and
+each view only looks at the buckets of the clusters it can actually see.
+Broadcast entities and ones whose cluster list overflowed can't be
+bucketed and are checked for every view.
+
+=============================================================================
+*/
+
+typedef struct {
+	int		numClusters;
+	int*	clusterFirst;	// [numClusters+1], offsets into entities[]
+	int		entities[MAX_GENTITIES * MAX_ENT_CLUSTERS];
+	int		numAlways;
+	int		always[MAX_GENTITIES];
+} snapshotIndex_t;
+
+static snapshotIndex_t snapIndex;
+
+
+// called after the clip map is loaded, before any entities are linked
+
+void SV_InitSnapshotIndex()
 {
-	int i, l;
+	snapIndex.numClusters = CM_NumClusters();
+	snapIndex.clusterFirst = H_New<int>( snapIndex.numClusters + 1, h_high );
+	snapIndex.numAlways = 0;
+	sv.snapshotIndexValid = qfalse;
+}
 
-	// during an error shutdown message we may need to transmit
-	// the shutdown message after the server has shutdown, so
-	// specfically check for it
-	if ( !sv.state ) {
-		return;
-	}
 
-	int leafnum = CM_PointLeafnum( origin );
-	int clientarea = CM_LeafArea( leafnum );
-	int clientcluster = CM_LeafCluster( leafnum );
-	const byte* clientpvs = CM_ClusterPVS( clientcluster );
+static void SV_BuildSnapshotIndex()
+{
+	int* first = snapIndex.clusterFirst;
+	int i, e;
 
-	// calculate the visible areas
-	frame->areabytes = CM_WriteAreaBits( frame->areabits, clientarea );
+	Com_Memset( first, 0, (snapIndex.numClusters + 1) * sizeof(int) );
+	snapIndex.numAlways = 0;
 
-	for (int e = 0; e < sv.num_entities; ++e) {
+	// count the entities in each cluster, offset by one so the
+	// running total below leaves each cluster's start in place
+	for (e = 0; e < sv.num_entities; ++e) {
 		const sharedEntity_t* ent = SV_GentityNum(e);
-
-		// never send entities that aren't linked in
-		if ( !ent->r.linked ) {
+		if ( !ent->r.linked || (ent->r.svFlags & SVF_NOCLIENT) ) {
 			continue;
 		}
-
-		// entities can be flagged to explicitly not be sent to the client
-		if ( ent->r.svFlags & SVF_NOCLIENT ) {
+		const svEntity_t* svEnt = SV_SvEntityForGentity( ent );
+		if ( (ent->r.svFlags & SVF_BROADCAST) || svEnt->lastCluster ) {
+			snapIndex.always[snapIndex.numAlways++] = e;
 			continue;
 		}
+		for (i = 0; i < svEnt->numClusters; ++i) {
+			first[svEnt->clusternums[i] + 1]++;
+		}
+	}
 
-		// entities can be flagged to be sent to only one client
-		if ( ent->r.svFlags & SVF_SINGLECLIENT ) {
-			if ( ent->r.singleClient != frame->ps.clientNum ) {
-				continue;
-			}
+	for (i = 0; i < snapIndex.numClusters; ++i) {
+		first[i + 1] += first[i];
+	}
+
+	// fill the buckets, which leaves each entry pointing at the NEXT cluster's start
+	for (e = 0; e < sv.num_entities; ++e) {
+		const sharedEntity_t* ent = SV_GentityNum(e);
+		if ( !ent->r.linked || (ent->r.svFlags & SVF_NOCLIENT) ) {
+			continue;
 		}
-		// entities can be flagged to be sent to everyone but one client
-		if ( ent->r.svFlags & SVF_NOTSINGLECLIENT ) {
-			if ( ent->r.singleClient == frame->ps.clientNum ) {
-				continue;
-			}
+		const svEntity_t* svEnt = SV_SvEntityForGentity( ent );
+		if ( (ent->r.svFlags & SVF_BROADCAST) || svEnt->lastCluster ) {
+			continue;
 		}
-		// entities can be flagged to be sent to a given mask of clients
-		if ( ent->r.svFlags & SVF_CLIENTMASK ) {
-			if (frame->ps.clientNum >= 32)
-				Com_Error( ERR_DROP, "SVF_CLIENTMASK: clientNum >= 32\n" );
-			if (~ent->r.singleClient & (1 << frame->ps.clientNum))
-				continue;
+		for (i = 0; i < svEnt->numClusters; ++i) {
+			snapIndex.entities[first[svEnt->clusternums[i]]++] = e;
 		}
+	}
 
-		svEntity_t* svEnt = SV_SvEntityForGentity( ent );
+	for (i = snapIndex.numClusters; i > 0; --i) {
+		first[i] = first[i - 1];
+	}
+	first[0] = 0;
+
+	sv.snapshotIndexValid = qtrue;
+}
+
+
+// sets a bit for every entity that could possibly be visible from a given pvs
+
+static void SV_MarkIndexedEntities( const byte* pvs, unsigned* marks )
+{
+	int i;
+
+	Com_Memset( marks, 0, MAX_GENTITIES / 8 );
+
+	for (i = 0; i < snapIndex.numAlways; ++i) {
+		int e = snapIndex.always[i];
+		marks[e >> 5] |= (1u << (e & 31));
+	}
 
-		// don't double add an entity through portals
-		if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
+	for (int c = 0; c < snapIndex.numClusters; ++c) {
+		if ( !pvs[c >> 3] ) {
+			c |= 7;
 			continue;
 		}
-
-		// broadcast entities are always sent
-		if ( ent->r.svFlags & SVF_BROADCAST ) {
-			SV_AddEntToSnapshot( svEnt, ent, eNums );
+		if ( !(pvs[c >> 3] & (1 << (c & 7))) ) {
 			continue;
 		}
+		for (i = snapIndex.clusterFirst[c]; i < snapIndex.clusterFirst[c + 1]; ++i) {
+			int e = snapIndex.entities[i];
+			marks[e >> 5] |= (1u << (e & 31));
+		}
+	}
+}
 
-		// ignore if not touching a PV leaf
-		// check area
-		if ( !CM_AreasConnected( clientarea, svEnt->areanum ) ) {
-			// doors can legally straddle two areas, so
-			// we may need to check another one
-			if ( !CM_AreasConnected( clientarea, svEnt->areanum2 ) ) {
-				continue;		// blocked by a door
-			}
+
+static void SV_AddEntitiesVisibleFromPoint( const vec3_t origin, clientSnapshot_t *frame, snapshotEntityNumbers_t *eNums );
+
+static void SV_AddEntityIfVisible( int e, const vec3_t origin, clientSnapshot_t *frame, snapshotEntityNumbers_t *eNums,
+		int clientarea, const byte* clientpvs )
+{
+	int i, l;
+
+	const sharedEntity_t* ent = SV_GentityNum(e);
+
+	// never send entities that aren't linked in
+	if ( !ent->r.linked ) {
+		return;
+	}
+
+	// entities can be flagged to explicitly not be sent to the client
+	if ( ent->r.svFlags & SVF_NOCLIENT ) {
+		return;
+	}
+
+	// entities can be flagged to be sent to only one client
+	if ( ent->r.svFlags & SVF_SINGLECLIENT ) {
+		if ( ent->r.singleClient != frame->ps.clientNum ) {
+			return;
+		}
+	}
+	// entities can be flagged to be sent to everyone but one client
+	if ( ent->r.svFlags & SVF_NOTSINGLECLIENT ) {
+		if ( ent->r.singleClient == frame->ps.clientNum ) {
+			return;
+		}
+	}
+	// entities can be flagged to be sent to a given mask of clients
+	if ( ent->r.svFlags & SVF_CLIENTMASK ) {
+		if (frame->ps.clientNum >= 32) {
+			eNums->error = "SVF_CLIENTMASK: clientNum >= 32\n";
+			return;
 		}
+		if (~ent->r.singleClient & (1 << frame->ps.clientNum))
+			return;
+	}
 
-		// check individual leafs
-		if ( !svEnt->numClusters ) {
-			continue;
+	// don't double add an entity through portals
+	if ( SV_EntityAdded( eNums, e ) ) {
+		return;
+	}
+
+	const svEntity_t* svEnt = SV_SvEntityForGentity( ent );
+
+	// broadcast entities are always sent
+	if ( ent->r.svFlags & SVF_BROADCAST ) {
+		SV_AddEntToSnapshot( ent, eNums );
+		return;
+	}
+
+	// ignore if not touching a PV leaf
+	// check area
+	if ( !CM_AreasConnected( clientarea, svEnt->areanum ) ) {
+		// doors can legally straddle two areas, so
+		// we may need to check another one
+		if ( !CM_AreasConnected( clientarea, svEnt->areanum2 ) ) {
+			return;		// blocked by a door
 		}
-		l = 0;
-		for ( i=0 ; i < svEnt->numClusters ; i++ ) {
-			l = svEnt->clusternums[i];
-			if ( clientpvs[l >> 3] & (1 << (l&7) ) ) {
-				break;
-			}
+	}
+
+	// check individual leafs
+	if ( !svEnt->numClusters ) {
+		return;
+	}
+	l = 0;
+	for ( i=0 ; i < svEnt->numClusters ; i++ ) {
+		l = svEnt->clusternums[i];
+		if ( clientpvs[l >> 3] & (1 << (l&7) ) ) {
+			break;
 		}
+	}
 
-		// if we haven't found it to be visible,
-		// check overflow clusters that couldn't be stored
-		if ( i == svEnt->numClusters ) {
-			if ( svEnt->lastCluster ) {
-				for ( ; l <= svEnt->lastCluster ; l++ ) {
-					if ( clientpvs[l >> 3] & (1 << (l&7) ) ) {
-						break;
-					}
-				}
-				if ( l == svEnt->lastCluster ) {
-					continue;	// not visible
+	// if we haven't found it to be visible,
+	// check overflow clusters that couldn't be stored
+	if ( i == svEnt->numClusters ) {
+		if ( svEnt->lastCluster ) {
+			for ( ; l <= svEnt->lastCluster ; l++ ) {
+				if ( clientpvs[l >> 3] & (1 << (l&7) ) ) {
+					break;
 				}
-			} else {
-				continue;
+			}
+			if ( l == svEnt->lastCluster ) {
+				return;	// not visible
+			}
+		} else {
+			return;
+		}
+	}
+
+	// add it
+	SV_AddEntToSnapshot( ent, eNums );
+
+	// if its a portal entity, add everything visible from its camera position
+	if ( ent->r.svFlags & SVF_PORTAL ) {
+		if ( ent->s.generic1 ) {
+			vec3_t dir;
+			VectorSubtract(ent->s.origin, origin, dir);
+			if ( VectorLengthSquared(dir) > (float) ent->s.generic1 * ent->s.generic1 ) {
+				return;
 			}
 		}
+		SV_AddEntitiesVisibleFromPoint( ent->s.origin2, frame, eNums );
+	}
+}
 
-		// add it
-		SV_AddEntToSnapshot( svEnt, ent, eNums );
 
-		// if its a portal entity, add everything visible from its camera position
-		if ( ent->r.svFlags & SVF_PORTAL ) {
-			if ( ent->s.generic1 ) {
-				vec3_t dir;
-				VectorSubtract(ent->s.origin, origin, dir);
-				if ( VectorLengthSquared(dir) > (float) ent->s.generic1 * ent->s.generic1 ) {
-					continue;
-				}
+static void SV_AddEntitiesVisibleFromPoint( const vec3_t origin,
+		clientSnapshot_t *frame, snapshotEntityNumbers_t *eNums )
+{
+	// during an error shutdown message we may need to transmit
+	// the shutdown message after the server has shutdown, so
+	// specfically check for it
+	if ( !sv.state ) {
+		return;
+	}
+
+	int leafnum = CM_PointLeafnum( origin );
+	int clientarea = CM_LeafArea( leafnum );
+	int clientcluster = CM_LeafCluster( leafnum );
+	const byte* clientpvs = CM_ClusterPVS( clientcluster );
+
+	// calculate the visible areas
+	frame->areabytes = CM_WriteAreaBits( frame->areabits, clientarea );
+
+	if ( !sv_snapshotIndex->integer || !snapIndex.clusterFirst || eNums->bypassIndex ) {
+		for (int e = 0; e < sv.num_entities; ++e) {
+			SV_AddEntityIfVisible( e, origin, frame, eNums, clientarea, clientpvs );
+		}
+		return;
+	}
+
+	if ( !sv.snapshotIndexValid ) {
+		SV_BuildSnapshotIndex();
+	}
+
+	// the candidates still have to be visited in entity order, because
+	// both portal recursion and the MAX_SNAPSHOT_ENTITIES cap depend on it
+	unsigned marks[MAX_GENTITIES / 32];
+	SV_MarkIndexedEntities( clientpvs, marks );
+
+	for (int w = 0; w < MAX_GENTITIES / 32; ++w) {
+		if ( !marks[w] ) {
+			continue;
+		}
+		for (int b = 0; b < 32; ++b) {
+			if ( marks[w] & (1u << b) ) {
+				SV_AddEntityIfVisible( (w << 5) | b, origin, frame, eNums, clientarea, clientpvs );
 			}
-			SV_AddEntitiesVisibleFromPoint( ent->s.origin2, frame, eNums );
 		}
+	}
+}
+
+
+// sv_snapshotIndex 2 also builds every snapshot the old way, and complains
+// if the index didn't pick exactly the same entities in exactly the same order
+// returns the number of entities the old way found if they differ, -1 if they're the same
+
+static int SV_VerifySnapshotIndex( const vec3_t org, const clientSnapshot_t* frame, const snapshotEntityNumbers_t* eNums )
+{
+	clientSnapshot_t check;
+	snapshotEntityNumbers_t checkNums;
+
+	check.ps.clientNum = frame->ps.clientNum;
+	Com_Memset( check.areabits, 0, sizeof( check.areabits ) );
+	checkNums.numSnapshotEntities = 0;
+	Com_Memset( checkNums.added, 0, sizeof( checkNums.added ) );
+	checkNums.added[ frame->ps.clientNum >> 5 ] = 1u << (frame->ps.clientNum & 31);
+	checkNums.bypassIndex = qtrue;
+	checkNums.error = NULL;
+
+	SV_AddEntitiesVisibleFromPoint( org, &check, &checkNums );
+
+	if ( (checkNums.numSnapshotEntities != eNums->numSnapshotEntities) ||
+			memcmp( checkNums.snapshotEntities, eNums->snapshotEntities, eNums->numSnapshotEntities * sizeof(int) ) ||
+			(check.areabytes != frame->areabytes) || memcmp( check.areabits, frame->areabits, sizeof( check.areabits ) ) ) {
+		return checkNums.numSnapshotEntities;
+	}
+
+	return -1;
+}
+
+
+static qbool snapFrameShared;	// set while SV_SendClientMessages is building everyone's snapshots
+
+
+// starts a new set of shared entity states: no snapshot built after this
+// will reuse a state that was copied before it
+
+void SV_BeginSnapshotFrame()
+{
+	svs.snapshotFrameNum++;
+	svs.snapshotFrameFirstState = svs.nextSnapshotStates;
+}
+
+
+// returns the index of the entity's state in the pool,
+// copying it in if it isn't already there for this frame
 
+static unsigned SV_SnapshotStateForEntity( int entityNum )
+{
+	if ( svs.snapshotStateFrame[entityNum] == svs.snapshotFrameNum ) {
+		return svs.snapshotStateNum[entityNum];
 	}
+
+	unsigned state = svs.nextSnapshotStates++;
+	svs.snapshotStates[state & (svs.numSnapshotStates - 1)] = SV_GentityNum(entityNum)->s;
+	svs.snapshotStateFrame[entityNum] = svs.snapshotFrameNum;
+	svs.snapshotStateNum[entityNum] = state;
+
+	return state;
 }
 
 
+// everything needed to build and encode one client's snapshot, so that
+// several of them can be worked on at once by job threads
+
+typedef struct {
+	client_t*				client;
+	qbool					fragment;		// only send the next fragment of the last message
+	snapshotEntityNumbers_t	entityNumbers;
+	int						indexMismatch;	// -1, or how many entities sv_snapshotIndex 2 expected
+	qbool					send;			// the snapshot is encoded and sent this frame
+	const clientSnapshot_t*	oldframe;
+	int						lastframe;
+	msg_t					msg;
+	byte					msg_buf[MAX_MSGLEN];
+} snapshotJob_t;
+
+
 /*
 =============
-SV_BuildClientSnapshot
+SV_GatherClientSnapshot
 
 Decides which entities are going to be visible to the client, and
 copies off the playerstate and areabits.
@@ -397,28 +655,30 @@ This properly handles multiple recursive portals, but the render
 currently doesn't.
 
 For viewing through other player's eyes, clent can be something other than client->gentity
+
+This only writes to the client's own frame, so it's safe to run on a job thread:
+anything that has to touch shared state is left for SV_CommitClientSnapshot
 =============
 */
-static void SV_BuildClientSnapshot( client_t *client ) {
+static void SV_GatherClientSnapshot( snapshotJob_t* job ) {
 	vec3_t						org;
 	clientSnapshot_t			*frame;
-	snapshotEntityNumbers_t		entityNumbers;
+	snapshotEntityNumbers_t		*entityNumbers = &job->entityNumbers;
 	int							i;
-	sharedEntity_t				*ent;
-	entityState_t				*state;
-	svEntity_t					*svEnt;
-	sharedEntity_t				*clent;
+	const sharedEntity_t		*clent;
 	int							clientNum;
-	playerState_t				*ps;
-
-	// bump the counter used to prevent double adding
-	sv.snapshotCounter++;
+	const playerState_t			*ps;
+	client_t					*client = job->client;
 
 	// this is the frame we are creating
 	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
 
 	// clear everything in this snapshot
-	entityNumbers.numSnapshotEntities = 0;
+	entityNumbers->numSnapshotEntities = 0;
+	Com_Memset( entityNumbers->added, 0, sizeof( entityNumbers->added ) );
+	entityNumbers->bypassIndex = qfalse;
+	entityNumbers->error = NULL;
+	job->indexMismatch = -1;
 	Com_Memset( frame->areabits, 0, sizeof( frame->areabits ) );
 	frame->num_entities = 0;
 
@@ -435,11 +695,10 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	// be regenerated from the playerstate
 	clientNum = frame->ps.clientNum;
 	if ( clientNum < 0 || clientNum >= MAX_GENTITIES ) {
-		Com_Error( ERR_DROP, "SV_SvEntityForGentity: bad gEnt" );
+		entityNumbers->error = "SV_SvEntityForGentity: bad gEnt";
+		return;
 	}
-	svEnt = &sv.svEntities[ clientNum ];
-
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	entityNumbers->added[clientNum >> 5] |= (1u << (clientNum & 31));
 
 	// find the client's viewpoint
 	VectorCopy( ps->origin, org );
@@ -447,38 +706,107 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 
 	// add all the entities directly visible to the eye,
 	// which may include portal entities that merge other viewpoints
-	SV_AddEntitiesVisibleFromPoint( org, frame, &entityNumbers );
+	SV_AddEntitiesVisibleFromPoint( org, frame, entityNumbers );
+	if ( entityNumbers->error ) {
+		return;
+	}
+
+	if ( sv_snapshotIndex->integer > 1 ) {
+		job->indexMismatch = SV_VerifySnapshotIndex( org, frame, entityNumbers );
+	}
 
 	// if there were portals visible, there may be out of order entities
 	// in the list which will need to be resorted for the delta compression
-	// to work correctly.  This also catches the error condition
-	// of an entity being included twice.
-	qsort( entityNumbers.snapshotEntities, entityNumbers.numSnapshotEntities, 
-		sizeof( entityNumbers.snapshotEntities[0] ), SV_QsortEntityNumbers );
+	// to work correctly.
+	qsort( entityNumbers->snapshotEntities, entityNumbers->numSnapshotEntities, 
+		sizeof( entityNumbers->snapshotEntities[0] ), SV_QsortEntityNumbers );
+
+	for ( i = 1 ; i < entityNumbers->numSnapshotEntities ; i++ ) {
+		if ( entityNumbers->snapshotEntities[i] == entityNumbers->snapshotEntities[i - 1] ) {
+			entityNumbers->error = "SV_QsortEntityStates: duplicated entity";
+			return;
+		}
+	}
 
 	// now that all viewpoint's areabits have been OR'd together, invert
 	// all of them to make it a mask vector, which is what the renderer wants
 	for ( i = 0 ; i < MAX_MAP_AREA_BYTES/4 ; i++ ) {
 		((int *)frame->areabits)[i] = ((int *)frame->areabits)[i] ^ -1;
 	}
+}
+
+
+// points the client's frame at the shared entity states, copying any that no
+// other client has needed yet this frame
+// this has to be done on the main thread, in client order
+
+static void SV_CommitClientSnapshot( snapshotJob_t* job )
+{
+	client_t* client = job->client;
+	const snapshotEntityNumbers_t* entityNumbers = &job->entityNumbers;
+	clientSnapshot_t* frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+	int i;
+
+	if ( entityNumbers->error ) {
+		Com_Error( ERR_DROP, "%s", entityNumbers->error );
+	}
+
+	if ( job->indexMismatch >= 0 ) {
+		Com_Printf( "WARNING: sv_snapshotIndex mismatch for client %i (%i vs %i entities)\n",
+				frame->ps.clientNum, entityNumbers->numSnapshotEntities, job->indexMismatch );
+	}
+
+	// snapshots sent outside of the normal frame can't assume that
+	// nothing has changed since the last time states were copied
+	if ( !snapFrameShared ) {
+		SV_BeginSnapshotFrame();
+	}
 
-	// copy the entity states out
 	frame->num_entities = 0;
 	frame->first_entity = svs.nextSnapshotEntities;
-	for ( i = 0 ; i < entityNumbers.numSnapshotEntities ; i++ ) {
-		ent = SV_GentityNum(entityNumbers.snapshotEntities[i]);
-		state = &svs.snapshotEntities[svs.nextSnapshotEntities % svs.numSnapshotEntities];
-		*state = ent->s;
+	frame->first_state = svs.snapshotFrameFirstState;
+	for ( i = 0 ; i < entityNumbers->numSnapshotEntities ; i++ ) {
+		unsigned state = SV_SnapshotStateForEntity( entityNumbers->snapshotEntities[i] );
+		svs.snapshotEntities[svs.nextSnapshotEntities & (svs.numSnapshotEntities - 1)] = state;
 		svs.nextSnapshotEntities++;
-		// this should never hit, map should always be restarted first in SV_Frame
-		if ( svs.nextSnapshotEntities >= 0x7FFFFFFE ) {
-			Com_Error(ERR_FATAL, "svs.nextSnapshotEntities wrapped");
-		}
 		frame->num_entities++;
 	}
 }
 
 
+// picks the frame to delta from and sets up the message, once every snapshot
+// of the frame has been committed and nothing else will be added to the buffers
+// before it's encoded: returns qfalse if the snapshot isn't going to be sent
+
+static qbool SV_PrepareClientSnapshot( snapshotJob_t* job )
+{
+	const client_t* client = job->client;
+	const clientSnapshot_t* frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
+	job->send = qfalse;
+
+	// bots need to have their snapshots built, but
+	// then query them directly without needing to be sent
+	if ( client->gentity && client->gentity->r.svFlags & SVF_BOT ) {
+		return qfalse;
+	}
+
+	// the snapshots committed after this one can wrap around onto its own entities
+	if ( svs.nextSnapshotEntities - frame->first_entity > (unsigned)svs.numSnapshotEntities ) {
+		Com_DPrintf( "%s: Snapshot entities overwritten, skipping it.\n", client->name );
+		return qfalse;
+	}
+
+	job->oldframe = SV_SnapshotDeltaFrame( client, &job->lastframe );
+
+	MSG_Init( &job->msg, job->msg_buf, sizeof(job->msg_buf) );
+	job->msg.allowoverflow = qtrue;
+	job->send = qtrue;
+
+	return qtrue;
+}
+
+
 /*
 ====================
 SV_RateMsec
@@ -526,7 +854,7 @@ void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 
 	// record information about the message
 	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSize = msg->cursize;
-	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSent = svs.time;
+	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSent = Sys_Milliseconds();
 	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageAcked = -1;
 
 	// send the datagram
@@ -567,51 +895,41 @@ void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 }
 
 
-/*
-=======================
-SV_SendClientSnapshot
-
-Also called by SV_FinalMessage
-
-=======================
-*/
-void SV_SendClientSnapshot( client_t *client ) {
-	byte		msg_buf[MAX_MSGLEN];
-	msg_t		msg;
-
-	// build the snapshot
-	SV_BuildClientSnapshot( client );
-
-	// bots need to have their snapshots built, but
-	// then query them directly without needing to be sent
-	if ( client->gentity && client->gentity->r.svFlags & SVF_BOT ) {
-		return;
-	}
+// writes the snapshot into the job's message: safe to run on a job thread
 
-	MSG_Init (&msg, msg_buf, sizeof(msg_buf));
-	msg.allowoverflow = qtrue;
+static void SV_EncodeClientSnapshot( snapshotJob_t* job )
+{
+	client_t* client = job->client;
+	msg_t* msg = &job->msg;
 
 	// NOTE, MRE: all server->client messages now acknowledge
 	// let the client know which reliable clientCommands we have received
-	MSG_WriteLong( &msg, client->lastClientCommand );
+	MSG_WriteLong( msg, client->lastClientCommand );
 
 	// (re)send any reliable server commands
-	SV_UpdateServerCommandsToClient( client, &msg );
+	SV_UpdateServerCommandsToClient( client, msg );
 
 	// send over all the relevant entityState_t
 	// and the playerState_t
-	SV_WriteSnapshotToClient( client, &msg );
+	SV_WriteSnapshotToClient( client, msg, job->oldframe, job->lastframe );
+}
+
+
+static void SV_FinishClientSnapshot( snapshotJob_t* job )
+{
+	client_t* client = job->client;
+	msg_t* msg = &job->msg;
 
 	// Add any download data if the client is downloading
-	SV_WriteDownloadToClient( client, &msg );
+	SV_WriteDownloadToClient( client, msg );
 
 	// check for overflow
-	if ( msg.overflowed ) {
+	if ( msg->overflowed ) {
 		Com_Printf ("WARNING: msg overflowed for %s\n", client->name);
-		MSG_Clear (&msg);
+		MSG_Clear (msg);
 	}
 
-	SV_SendMessageToClient( &msg, client );
+	SV_SendMessageToClient( msg, client );
 
 /* this works fine on lan (160K/s dl, yay) and SEEMS okay over the net, but needs more testing
 #define UNSUCK_DOWNLOADS
@@ -629,6 +947,113 @@ void SV_SendClientSnapshot( client_t *client ) {
 }
 
 
+/*
+=======================
+SV_SendClientSnapshot
+
+Also called by SV_FinalMessage
+
+=======================
+*/
+void SV_SendClientSnapshot( client_t *client ) {
+	snapshotJob_t job;
+
+	job.client = client;
+
+	// build the snapshot
+	SV_GatherClientSnapshot( &job );
+	SV_CommitClientSnapshot( &job );
+
+	if ( !SV_PrepareClientSnapshot( &job ) ) {
+		return;
+	}
+
+	SV_EncodeClientSnapshot( &job );
+	SV_FinishClientSnapshot( &job );
+}
+
+
+/*
+=============================================================================
+
+sv_snapshotThreads N spreads the snapshot building and delta encoding over
+N job threads as well as the main thread:
+
+1. visibility is worked out for every client at once
+2. the main thread then copies the entity states, in client order, so the
+   buffers end up exactly as they would have if everything had been done
+   on the main thread, and once they're all in picks the delta frames
+3. every message is delta encoded at once, into its own buffer
+4. the main thread adds the downloads and sends them all, in client order
+
+=============================================================================
+*/
+
+static snapshotJob_t snapJobs[MAX_CLIENTS];
+
+
+static void SV_GatherJob( void* data, int index )
+{
+	snapshotJob_t* job = ((snapshotJob_t**)data)[index];
+	SV_GatherClientSnapshot( job );
+}
+
+
+static void SV_EncodeJob( void* data, int index )
+{
+	snapshotJob_t* job = ((snapshotJob_t**)data)[index];
+	SV_EncodeClientSnapshot( job );
+}
+
+
+static void SV_SendThreadedClientMessages( snapshotJob_t** jobs, int numJobs )
+{
+	snapshotJob_t* build[MAX_CLIENTS];
+	snapshotJob_t* encode[MAX_CLIENTS];
+	int numBuild = 0, numEncode = 0;
+	int i;
+
+	for (i = 0; i < numJobs; ++i) {
+		if ( !jobs[i]->fragment ) {
+			build[numBuild++] = jobs[i];
+		}
+	}
+
+	// the index is shared by every job, so it has to be up to date before they start
+	if ( sv.state && sv_snapshotIndex->integer && snapIndex.clusterFirst && !sv.snapshotIndexValid ) {
+		SV_BuildSnapshotIndex();
+	}
+
+	Sys_RunJobs( SV_GatherJob, build, numBuild );
+
+	for (i = 0; i < numBuild; ++i) {
+		SV_CommitClientSnapshot( build[i] );
+	}
+
+	// the later commits keep filling the buffers that the earlier
+	// frames point into, so nothing can be checked against them until now
+	for (i = 0; i < numBuild; ++i) {
+		if ( SV_PrepareClientSnapshot( build[i] ) ) {
+			encode[numEncode++] = build[i];
+		}
+	}
+
+	Sys_RunJobs( SV_EncodeJob, encode, numEncode );
+
+	for (i = 0; i < numJobs; ++i) {
+		snapshotJob_t* job = jobs[i];
+		client_t* c = job->client;
+		if ( job->fragment ) {
+			c->nextSnapshotTime = svs.time + 
+				SV_RateMsec( c, c->netchan.unsentLength - c->netchan.unsentFragmentStart );
+			SV_Netchan_TransmitNextFragment( c );
+		} else if ( job->send ) {
+			SV_FinishClientSnapshot( job );
+		}
+	}
+}
+
+
 /*
 =======================
 SV_SendClientMessages
@@ -637,6 +1062,18 @@ SV_SendClientMessages
 void SV_SendClientMessages( void ) {
 	int			i;
 	client_t	*c;
+	snapshotJob_t*	jobs[MAX_CLIENTS];
+	int			numJobs = 0;
+
+	Sys_SetJobThreads( sv_snapshotThreads->integer );
+
+	// the game may have changed svFlags without relinking anything,
+	// so the cluster index is always rebuilt once per frame
+	sv.snapshotIndexValid = qfalse;
+
+	// every snapshot built from here on shares the same entity states
+	SV_BeginSnapshotFrame();
+	snapFrameShared = qtrue;
 
 	// send a message to each connected client
 	for (i=0, c = svs.clients ; i < sv_maxclients->integer ; i++, c++) {
@@ -648,6 +1085,14 @@ void SV_SendClientMessages( void ) {
 			continue;		// not time yet
 		}
 
+		if ( sv_snapshotThreads->integer > 0 ) {
+			snapshotJob_t* job = &snapJobs[i];
+			job->client = c;
+			job->fragment = (c->netchan.unsentFragments != 0);
+			jobs[numJobs++] = job;
+			continue;
+		}
+
 		// send additional message fragments if the last message
 		// was too large to send at once
 		if ( c->netchan.unsentFragments ) {
@@ -660,5 +1105,10 @@ void SV_SendClientMessages( void ) {
 		// generate and send a new message
 		SV_SendClientSnapshot( c );
 	}
-}
 
+	if ( numJobs ) {
+		SV_SendThreadedClientMessages( jobs, numJobs );
+	}
+
+	snapFrameShared = qfalse;
+}
@@ -54,102 +54,292 @@ clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent ) {
 ENTITY CHECKING
 
 To avoid linearly searching through lists of entities during environment testing,
-the world is carved up with an evenly spaced, axially aligned bsp tree.  Entities
-are kept in chains either at the final leafs, or at the first node that splits
-them, which prevents having to deal with multiple fragments of a single entity.
+the linked entities are kept in a dynamic bounding box tree: every entity is a
+leaf with its box fattened by WORLD_MARGIN, and the inner nodes enclose their
+children. Relinking an entity that's still inside its fattened box doesn't
+touch the tree, otherwise its leaf is taken out and inserted again next to
+whatever makes the smallest tree, which is kept balanced by rotations.
 
 ===============================================================================
 */
 
-typedef struct worldSector_s {
-	int		axis;		// -1 = leaf node
-	float	dist;
-	struct worldSector_s	*children[2];
-	svEntity_t	*entities;
-} worldSector_t;
+typedef struct {
+	vec3_t	mins, maxs;		// fattened around the entity for leafs
+	int		parent;			// 0 for the root
+	int		children[2];	// 0 for leafs
+	int		height;			// 0 for leafs
+	int		entityNum;		// leafs only
+} worldNode_t;
 
-#define	AREA_DEPTH	4
-#define	AREA_NODES	64
+// a leaf and an inner node per entity, node 0 is never used so that it can mean none
+#define	WORLD_NODES		(2 * MAX_GENTITIES)
+#define	WORLD_MARGIN	16
 
-static worldSector_t sv_worldSectors[AREA_NODES];
-static int sv_numworldSectors;
+static worldNode_t sv_worldNodes[WORLD_NODES];
+static int sv_worldRoot;
+static int sv_worldFreeNodes;	// chained through parent
 
 
-/*
-===============
-SV_SectorList_f
-===============
-*/
-void SV_SectorList_f( void ) {
-	int				i, c;
-	worldSector_t	*sec;
-	svEntity_t		*ent;
+static int SV_AllocWorldNode()
+{
+	const int num = sv_worldFreeNodes;
+	if ( !num ) {
+		Com_Error( ERR_DROP, "SV_AllocWorldNode: no free nodes" );
+	}
 
-	for ( i = 0 ; i < AREA_NODES ; i++ ) {
-		sec = &sv_worldSectors[i];
+	worldNode_t* node = &sv_worldNodes[num];
+	sv_worldFreeNodes = node->parent;
+	Com_Memset( node, 0, sizeof(*node) );
 
-		c = 0;
-		for ( ent = sec->entities ; ent ; ent = ent->nextEntityInWorldSector ) {
-			c++;
-		}
-		Com_Printf( "sector %i: %i entities\n", i, c );
+	return num;
+}
+
+
+static void SV_FreeWorldNode( int num )
+{
+	sv_worldNodes[num].parent = sv_worldFreeNodes;
+	sv_worldNodes[num].height = -1;
+	sv_worldFreeNodes = num;
+}
+
+
+// half the surface area, which is what the cost of a node is based on
+static float SV_WorldNodeCost( const vec3_t mins, const vec3_t maxs )
+{
+	const float x = maxs[0] - mins[0];
+	const float y = maxs[1] - mins[1];
+	const float z = maxs[2] - mins[2];
+	return x * y + y * z + z * x;
+}
+
+
+static float SV_WorldNodeUnionCost( const worldNode_t* a, const worldNode_t* b )
+{
+	vec3_t mins, maxs;
+	for ( int i = 0; i < 3; ++i ) {
+		mins[i] = min( a->mins[i], b->mins[i] );
+		maxs[i] = max( a->maxs[i], b->maxs[i] );
 	}
+	return SV_WorldNodeCost( mins, maxs );
 }
 
-/*
-===============
-SV_CreateworldSector
 
-Builds a uniformly subdivided tree for the given world size
-===============
-*/
-static worldSector_t* SV_CreateworldSector( int depth, const vec3_t mins, const vec3_t maxs )
+static void SV_FitWorldNode( worldNode_t* node )
 {
-	worldSector_t	*anode;
-	vec3_t		size;
-	vec3_t		mins1, maxs1, mins2, maxs2;
+	const worldNode_t* a = &sv_worldNodes[node->children[0]];
+	const worldNode_t* b = &sv_worldNodes[node->children[1]];
+	for ( int i = 0; i < 3; ++i ) {
+		node->mins[i] = min( a->mins[i], b->mins[i] );
+		node->maxs[i] = max( a->maxs[i], b->maxs[i] );
+	}
+	node->height = 1 + max( a->height, b->height );
+}
 
-	anode = &sv_worldSectors[sv_numworldSectors];
-	sv_numworldSectors++;
 
-	if (depth == AREA_DEPTH) {
-		anode->axis = -1;
-		anode->children[0] = anode->children[1] = NULL;
-		return anode;
+static void SV_ReplaceWorldChild( int parent, int oldChild, int newChild )
+{
+	if ( !parent ) {
+		sv_worldRoot = newChild;
+		return;
 	}
 
-	VectorSubtract (maxs, mins, size);
-	if (size[0] > size[1]) {
-		anode->axis = 0;
+	worldNode_t* node = &sv_worldNodes[parent];
+	if ( node->children[0] == oldChild ) {
+		node->children[0] = newChild;
 	} else {
-		anode->axis = 1;
+		node->children[1] = newChild;
 	}
+}
 
-	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
-	VectorCopy (mins, mins1);
-	VectorCopy (mins, mins2);
-	VectorCopy (maxs, maxs1);
-	VectorCopy (maxs, maxs2);
 
-	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+// if one child of a is 2 levels taller than the other, its taller child takes a's place
+// returns the node that's now where a was
 
-	anode->children[0] = SV_CreateworldSector (depth+1, mins2, maxs2);
-	anode->children[1] = SV_CreateworldSector (depth+1, mins1, maxs1);
+static int SV_BalanceWorldNode( int a )
+{
+	worldNode_t* na = &sv_worldNodes[a];
+	if ( na->height < 2 ) {
+		return a;
+	}
 
-	return anode;
+	const int balance = sv_worldNodes[na->children[1]].height - sv_worldNodes[na->children[0]].height;
+	if ( balance >= -1 && balance <= 1 ) {
+		return a;
+	}
+
+	// up is the taller child, which moves up, and a keeps the other one
+	const int side = ( balance > 1 ) ? 1 : 0;
+	const int up = na->children[side];
+	worldNode_t* nu = &sv_worldNodes[up];
+
+	SV_ReplaceWorldChild( na->parent, a, up );
+	nu->parent = na->parent;
+	na->parent = up;
+
+	// up's taller child stays with it, the shorter one goes to a
+	const int f = nu->children[0];
+	const int g = nu->children[1];
+	const qbool keepF = ( sv_worldNodes[f].height > sv_worldNodes[g].height );
+	const int keep = keepF ? f : g;
+	const int give = keepF ? g : f;
+
+	nu->children[0] = a;
+	nu->children[1] = keep;
+	na->children[side] = give;
+	sv_worldNodes[give].parent = a;
+
+	SV_FitWorldNode( na );
+	SV_FitWorldNode( nu );
+
+	return up;
+}
+
+
+// refits and rebalances everything from num up to the root
+
+static void SV_RefitWorldNodes( int num )
+{
+	while ( num ) {
+		SV_FitWorldNode( &sv_worldNodes[num] );
+		num = SV_BalanceWorldNode( num );
+		num = sv_worldNodes[num].parent;
+	}
+}
+
+
+static void SV_InsertWorldLeaf( int leaf )
+{
+	if ( !sv_worldRoot ) {
+		sv_worldRoot = leaf;
+		sv_worldNodes[leaf].parent = 0;
+		return;
+	}
+
+	// find the sibling that makes for the smallest tree, going down while
+	// pushing the leaf further into a child is cheaper than pairing it here
+	const worldNode_t* nl = &sv_worldNodes[leaf];
+	int sibling = sv_worldRoot;
+	while ( sv_worldNodes[sibling].children[0] ) {
+		const worldNode_t* node = &sv_worldNodes[sibling];
+		const float combinedCost = SV_WorldNodeUnionCost( node, nl );
+
+		// cost of pairing the leaf with this node
+		const float cost = 2 * combinedCost;
+
+		// the minimum cost of pushing the leaf further down, which enlarges this node
+		const float inheritanceCost = 2 * ( combinedCost - SV_WorldNodeCost( node->mins, node->maxs ) );
+
+		float childCost[2];
+		for ( int i = 0; i < 2; ++i ) {
+			const worldNode_t* child = &sv_worldNodes[node->children[i]];
+			childCost[i] = SV_WorldNodeUnionCost( child, nl ) + inheritanceCost;
+			if ( child->children[0] ) {
+				childCost[i] -= SV_WorldNodeCost( child->mins, child->maxs );
+			}
+		}
+
+		if ( cost < childCost[0] && cost < childCost[1] ) {
+			break;
+		}
+
+		sibling = node->children[ childCost[1] < childCost[0] ];
+	}
+
+	// a new parent for the leaf and the sibling takes the sibling's place
+	const int oldParent = sv_worldNodes[sibling].parent;
+	const int parent = SV_AllocWorldNode();
+	SV_ReplaceWorldChild( oldParent, sibling, parent );
+
+	worldNode_t* np = &sv_worldNodes[parent];
+	np->parent = oldParent;
+	np->children[0] = sibling;
+	np->children[1] = leaf;
+	sv_worldNodes[sibling].parent = parent;
+	sv_worldNodes[leaf].parent = parent;
+
+	SV_RefitWorldNodes( parent );
+}
+
+
+static void SV_RemoveWorldLeaf( int leaf )
+{
+	if ( leaf == sv_worldRoot ) {
+		sv_worldRoot = 0;
+		return;
+	}
+
+	// the leaf's sibling takes the place of their parent
+	const int parent = sv_worldNodes[leaf].parent;
+	const worldNode_t* np = &sv_worldNodes[parent];
+	const int grandParent = np->parent;
+	const int sibling = ( np->children[0] == leaf ) ? np->children[1] : np->children[0];
+
+	SV_ReplaceWorldChild( grandParent, parent, sibling );
+	sv_worldNodes[sibling].parent = grandParent;
+	SV_FreeWorldNode( parent );
+
+	SV_RefitWorldNodes( grandParent );
+}
+
+
+static int SV_WorldNodeDepth( int num )
+{
+	int depth = 0;
+	while ( sv_worldNodes[num].parent ) {
+		num = sv_worldNodes[num].parent;
+		++depth;
+	}
+	return depth;
+}
+
+
+/*
+===============
+SV_SectorList_f
+===============
+*/
+void SV_SectorList_f( void ) {
+	enum { MAX_LISTED_DEPTH = 64 };
+	int		nodes[MAX_LISTED_DEPTH], entities[MAX_LISTED_DEPTH];
+	int		i, depth, maxDepth, numNodes, numEntities;
+
+	Com_Memset( nodes, 0, sizeof(nodes) );
+	Com_Memset( entities, 0, sizeof(entities) );
+	maxDepth = numNodes = numEntities = 0;
+
+	for ( i = 1 ; i < WORLD_NODES ; i++ ) {
+		const worldNode_t* node = &sv_worldNodes[i];
+		if ( node->height < 0 ) {
+			continue;	// free
+		}
+
+		depth = min( SV_WorldNodeDepth( i ), MAX_LISTED_DEPTH - 1 );
+		maxDepth = max( maxDepth, depth );
+		nodes[depth]++;
+		numNodes++;
+		if ( !node->children[0] ) {
+			entities[depth]++;
+			numEntities++;
+		}
+	}
+
+	for ( i = 0 ; i <= maxDepth && numNodes ; i++ ) {
+		Com_Printf( "depth %i: %i nodes, %i entities\n", i, nodes[i], entities[i] );
+	}
+	Com_Printf( "%i entities linked, %i nodes, height %i\n",
+			numEntities, numNodes, sv_worldRoot ? sv_worldNodes[sv_worldRoot].height : 0 );
 }
 
 
 void SV_ClearWorld()
 {
-	Com_Memset( sv_worldSectors, 0, sizeof(sv_worldSectors) );
-	sv_numworldSectors = 0;
+	Com_Memset( sv_worldNodes, 0, sizeof(sv_worldNodes) );
+	sv_worldRoot = 0;
 
-	// get world map bounds
-	vec3_t mins, maxs;
-	clipHandle_t h = CM_InlineModel( 0 );
-	CM_ModelBounds( h, mins, maxs );
-	SV_CreateworldSector( 0, mins, maxs );
+	sv_worldFreeNodes = 0;
+	for ( int i = WORLD_NODES - 1; i > 0; --i ) {
+		SV_FreeWorldNode( i );
+	}
 }
 
 
@@ -161,32 +351,18 @@ SV_UnlinkEntity
 */
 void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
 	svEntity_t		*ent;
-	svEntity_t		*scan;
-	worldSector_t	*ws;
 
 	ent = SV_SvEntityForGentity( gEnt );
 
 	gEnt->r.linked = qfalse;
 
-	ws = ent->worldSector;
-	if ( !ws ) {
+	if ( !ent->worldNode ) {
 		return;		// not linked in anywhere
 	}
-	ent->worldSector = NULL;
-
-	if ( ws->entities == ent ) {
-		ws->entities = ent->nextEntityInWorldSector;
-		return;
-	}
 
-	for ( scan = ws->entities ; scan ; scan = scan->nextEntityInWorldSector ) {
-		if ( scan->nextEntityInWorldSector == ent ) {
-			scan->nextEntityInWorldSector = ent->nextEntityInWorldSector;
-			return;
-		}
-	}
-
-	Com_Printf( "WARNING: SV_UnlinkEntity: not found in worldSector\n" );
+	SV_RemoveWorldLeaf( ent->worldNode );
+	SV_FreeWorldNode( ent->worldNode );
+	ent->worldNode = 0;
 }
 
 
@@ -198,7 +374,7 @@ SV_LinkEntity
 */
 #define MAX_TOTAL_ENT_LEAFS		128
 void SV_LinkEntity( sharedEntity_t *gEnt ) {
-	worldSector_t	*node;
+	worldNode_t	*node;
 	int			leafs[MAX_TOTAL_ENT_LEAFS];
 	int			cluster;
 	int			num_leafs;
@@ -210,9 +386,10 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 
 	ent = SV_SvEntityForGentity( gEnt );
 
-	if ( ent->worldSector ) {
-		SV_UnlinkEntity( gEnt );	// unlink from old position
-	}
+	// the entity's leaf is only moved at the end, if it has to be
+
+	// the snapshot cluster index no longer matches this entity
+	sv.snapshotIndexValid = qfalse;
 
 	// encode the size into the entityState_t for client prediction
 	if ( gEnt->r.bmodel ) {
@@ -287,6 +464,7 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 	// if none of the leafs were inside the map, the
 	// entity is outside the world and can be considered unlinked
 	if ( !num_leafs ) {
+		SV_UnlinkEntity( gEnt );
 		return;
 	}
 
@@ -328,24 +506,31 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 
 	gEnt->r.linkcount++;
 
-	// find the first world sector node that the ent's box crosses
-	node = sv_worldSectors;
-	while (1)
-	{
-		if (node->axis == -1)
-			break;
-		if ( gEnt->r.absmin[node->axis] > node->dist)
-			node = node->children[0];
-		else if ( gEnt->r.absmax[node->axis] < node->dist)
-			node = node->children[1];
-		else
-			break;		// crosses the node
+	// the tree doesn't change as long as the entity stays inside its leaf
+	if ( ent->worldNode ) {
+		node = &sv_worldNodes[ent->worldNode];
+		for ( i = 0 ; i < 3 ; i++ ) {
+			if ( gEnt->r.absmin[i] < node->mins[i] || gEnt->r.absmax[i] > node->maxs[i] ) {
+				break;
+			}
+		}
+		if ( i == 3 ) {
+			gEnt->r.linked = qtrue;
+			return;
+		}
+		SV_RemoveWorldLeaf( ent->worldNode );
+	} else {
+		ent->worldNode = SV_AllocWorldNode();
 	}
 
 	// link it in
-	ent->worldSector = node;
-	ent->nextEntityInWorldSector = node->entities;
-	node->entities = ent;
+	node = &sv_worldNodes[ent->worldNode];
+	node->entityNum = ent - sv.svEntities;
+	for ( i = 0 ; i < 3 ; i++ ) {
+		node->mins[i] = gEnt->r.absmin[i] - WORLD_MARGIN;
+		node->maxs[i] = gEnt->r.absmax[i] + WORLD_MARGIN;
+	}
+	SV_InsertWorldLeaf( ent->worldNode );
 
 	gEnt->r.linked = qtrue;
 }
@@ -365,13 +550,174 @@ typedef struct {
 	const float	*maxs;
 	int			*list;
 	int			count, maxcount;
+	int			nodes, tests;	// for sectorbench
 } areaParms_t;
 
 
-static void SV_AreaEntities_r( const worldSector_t* node, areaParms_t* ap )
+static void SV_AreaEntities_r( int num, areaParms_t* ap )
+{
+	const worldNode_t* node = &sv_worldNodes[num];
+	ap->nodes++;
+
+	if ( node->mins[0] > ap->maxs[0]
+	|| node->mins[1] > ap->maxs[1]
+	|| node->mins[2] > ap->maxs[2]
+	|| node->maxs[0] < ap->mins[0]
+	|| node->maxs[1] < ap->mins[1]
+	|| node->maxs[2] < ap->mins[2]) {
+		return;
+	}
+
+	// recurse down both sides, in a fixed order so that the entities of a smaller box
+	// come out in the same order as they do for a bigger one
+	if ( node->children[0] ) {
+		SV_AreaEntities_r( node->children[0], ap );
+		SV_AreaEntities_r( node->children[1], ap );
+		return;
+	}
+
+	// the leaf's box is fattened, the entity's own box has to be checked too
+	const sharedEntity_t* gcheck = SV_GentityNum( node->entityNum );
+	ap->tests++;
+
+	if ( gcheck->r.absmin[0] > ap->maxs[0]
+	|| gcheck->r.absmin[1] > ap->maxs[1]
+	|| gcheck->r.absmin[2] > ap->maxs[2]
+	|| gcheck->r.absmax[0] < ap->mins[0]
+	|| gcheck->r.absmax[1] < ap->mins[1]
+	|| gcheck->r.absmax[2] < ap->mins[2]) {
+		return;
+	}
+
+	if ( ap->count == ap->maxcount ) {
+		Com_Printf ("SV_AreaEntities: MAXCOUNT\n");
+		return;
+	}
+
+	ap->list[ap->count] = node->entityNum;
+	ap->count++;
+}
+
+
+int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount )
+{
+	areaParms_t ap;
+
+	ap.mins = mins;
+	ap.maxs = maxs;
+	ap.list = entityList;
+	ap.count = 0;
+	ap.maxcount = maxcount;
+	ap.nodes = ap.tests = 0;
+
+	if ( sv_worldRoot ) {
+		SV_AreaEntities_r( sv_worldRoot, &ap );
+	}
+
+	return ap.count;
+}
+
+
+/*
+============================================================================
+
+"sectorbench [queries]" runs random area queries around the linked entities
+through the tree and through the evenly spaced sectors the entities used to
+be linked in (built just for the benchmark), and compares the results
+
+============================================================================
+*/
+
+typedef struct worldSector_s {
+	int		axis;		// -1 = leaf node
+	float	dist;
+	struct worldSector_s	*children[2];
+	int		entities;	// first of the chain through sv_sectorNext, -1 if none
+} worldSector_t;
+
+#define	AREA_DEPTH	4
+#define	AREA_NODES	64
+
+static worldSector_t sv_worldSectors[AREA_NODES];
+static int sv_numworldSectors;
+static int sv_sectorNext[MAX_GENTITIES];
+
+
+/*
+===============
+SV_CreateworldSector
+
+Builds a uniformly subdivided tree for the given world size
+===============
+*/
+static worldSector_t* SV_CreateworldSector( int depth, const vec3_t mins, const vec3_t maxs )
 {
-	for (const svEntity_t* check = node->entities; check; check = check->nextEntityInWorldSector ) {
-		const sharedEntity_t* gcheck = SV_GEntityForSvEntity( check );
+	worldSector_t	*anode;
+	vec3_t		size;
+	vec3_t		mins1, maxs1, mins2, maxs2;
+
+	anode = &sv_worldSectors[sv_numworldSectors];
+	sv_numworldSectors++;
+	anode->entities = -1;
+
+	if (depth == AREA_DEPTH) {
+		anode->axis = -1;
+		anode->children[0] = anode->children[1] = NULL;
+		return anode;
+	}
+
+	VectorSubtract (maxs, mins, size);
+	if (size[0] > size[1]) {
+		anode->axis = 0;
+	} else {
+		anode->axis = 1;
+	}
+
+	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
+	VectorCopy (mins, mins1);
+	VectorCopy (mins, mins2);
+	VectorCopy (maxs, maxs1);
+	VectorCopy (maxs, maxs2);
+
+	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+
+	anode->children[0] = SV_CreateworldSector (depth+1, mins2, maxs2);
+	anode->children[1] = SV_CreateworldSector (depth+1, mins1, maxs1);
+
+	return anode;
+}
+
+
+static void SV_SectorLinkEntity( int entityNum )
+{
+	const sharedEntity_t* gEnt = SV_GentityNum( entityNum );
+
+	// find the first world sector node that the ent's box crosses
+	worldSector_t* node = sv_worldSectors;
+	while (1)
+	{
+		if (node->axis == -1)
+			break;
+		if ( gEnt->r.absmin[node->axis] > node->dist)
+			node = node->children[0];
+		else if ( gEnt->r.absmax[node->axis] < node->dist)
+			node = node->children[1];
+		else
+			break;		// crosses the node
+	}
+
+	sv_sectorNext[entityNum] = node->entities;
+	node->entities = entityNum;
+}
+
+
+static void SV_SectorAreaEntities_r( const worldSector_t* node, areaParms_t* ap )
+{
+	ap->nodes++;
+
+	for ( int num = node->entities; num != -1; num = sv_sectorNext[num] ) {
+		const sharedEntity_t* gcheck = SV_GentityNum( num );
+		ap->tests++;
 
 		if ( gcheck->r.absmin[0] > ap->maxs[0]
 		|| gcheck->r.absmin[1] > ap->maxs[1]
@@ -383,11 +729,10 @@ static void SV_AreaEntities_r( const worldSector_t* node, areaParms_t* ap )
 		}
 
 		if ( ap->count == ap->maxcount ) {
-			Com_Printf ("SV_AreaEntities: MAXCOUNT\n");
 			return;
 		}
 
-		ap->list[ap->count] = check - sv.svEntities;
+		ap->list[ap->count] = num;
 		ap->count++;
 	}
 
@@ -397,27 +742,126 @@ static void SV_AreaEntities_r( const worldSector_t* node, areaParms_t* ap )
 
 	// recurse down both sides
 	if ( ap->maxs[node->axis] > node->dist ) {
-		SV_AreaEntities_r( node->children[0], ap );
+		SV_SectorAreaEntities_r( node->children[0], ap );
 	}
 	if ( ap->mins[node->axis] < node->dist ) {
-		SV_AreaEntities_r( node->children[1], ap );
+		SV_SectorAreaEntities_r( node->children[1], ap );
 	}
 }
 
 
-int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount )
+static unsigned sv_benchSeed;
+
+static float SV_BenchRandom( float min, float max )
 {
-	areaParms_t ap;
+	sv_benchSeed = sv_benchSeed * 1664525 + 1013904223;
+	return min + (max - min) * (float)((sv_benchSeed >> 8) & 0xFFFF) / 65535.0f;
+}
 
-	ap.mins = mins;
-	ap.maxs = maxs;
-	ap.list = entityList;
-	ap.count = 0;
-	ap.maxcount = maxcount;
 
-	SV_AreaEntities_r( sv_worldSectors, &ap );
+static int QDECL SV_CompareEntityNums( const void* a, const void* b )
+{
+	return *(const int*)a - *(const int*)b;
+}
 
-	return ap.count;
+
+void SV_SectorBench_f()
+{
+	enum { BENCH_BOXES = 1024 };
+	int linked[MAX_GENTITIES];
+	int list[2][MAX_GENTITIES];
+	vec3_t worldMins, worldMaxs;
+	int i, j, numLinked;
+
+	if ( sv.state == SS_DEAD ) {
+		Com_Printf( "sectorbench: server not running\n" );
+		return;
+	}
+
+	// build the sectors the old way, around the linked entities
+	CM_ModelBounds( CM_InlineModel( 0 ), worldMins, worldMaxs );
+	Com_Memset( sv_worldSectors, 0, sizeof(sv_worldSectors) );
+	sv_numworldSectors = 0;
+	SV_CreateworldSector( 0, worldMins, worldMaxs );
+
+	numLinked = 0;
+	for ( i = 0 ; i < sv.num_entities ; i++ ) {
+		if ( sv.svEntities[i].worldNode ) {
+			linked[numLinked++] = i;
+			SV_SectorLinkEntity( i );
+		}
+	}
+
+	if ( !numLinked ) {
+		Com_Printf( "sectorbench: no entities linked\n" );
+		return;
+	}
+
+	const int queries = (Cmd_Argc() > 1) ? max( atoi( Cmd_Argv(1) ), 1 ) : 100000;
+	sv_benchSeed = 1234;
+
+	// touch queries around the entities and long moves across the map, like SV_Trace does
+	vec3_t (*boxes)[2] = (vec3_t(*)[2])Z_Malloc( BENCH_BOXES * sizeof(*boxes) );
+	for ( i = 0 ; i < BENCH_BOXES ; i++ ) {
+		if ( i & 1 ) {
+			const sharedEntity_t* gEnt = SV_GentityNum( linked[i % numLinked] );
+			for ( j = 0 ; j < 3 ; j++ ) {
+				boxes[i][0][j] = gEnt->r.absmin[j] - SV_BenchRandom( 0, 128 );
+				boxes[i][1][j] = gEnt->r.absmax[j] + SV_BenchRandom( 0, 128 );
+			}
+		} else {
+			for ( j = 0 ; j < 3 ; j++ ) {
+				const float a = SV_BenchRandom( worldMins[j], worldMaxs[j] );
+				const float b = SV_BenchRandom( worldMins[j], worldMaxs[j] );
+				boxes[i][0][j] = min( a, b ) - 16;
+				boxes[i][1][j] = max( a, b ) + 16;
+			}
+		}
+	}
+
+	int time[2] = { 0, 0 }, errors = 0;
+	double nodes[2] = { 0, 0 }, tests[2] = { 0, 0 }, results = 0;
+	for ( i = 0 ; i < queries ; i++ ) {
+		areaParms_t ap[2];
+		for ( j = 0 ; j < 2 ; j++ ) {
+			ap[j].mins = boxes[i % BENCH_BOXES][0];
+			ap[j].maxs = boxes[i % BENCH_BOXES][1];
+			ap[j].list = list[j];
+			ap[j].count = 0;
+			ap[j].maxcount = MAX_GENTITIES;
+			ap[j].nodes = ap[j].tests = 0;
+		}
+
+		int64_t start = Sys_Microseconds();
+		SV_SectorAreaEntities_r( sv_worldSectors, &ap[0] );
+		time[0] += (int)(Sys_Microseconds() - start);
+
+		start = Sys_Microseconds();
+		SV_AreaEntities_r( sv_worldRoot, &ap[1] );
+		time[1] += (int)(Sys_Microseconds() - start);
+
+		for ( j = 0 ; j < 2 ; j++ ) {
+			nodes[j] += ap[j].nodes;
+			tests[j] += ap[j].tests;
+		}
+		results += ap[1].count;
+
+		qsort( list[0], ap[0].count, sizeof(int), SV_CompareEntityNums );
+		qsort( list[1], ap[1].count, sizeof(int), SV_CompareEntityNums );
+		if ( ap[0].count != ap[1].count || memcmp( list[0], list[1], ap[0].count * sizeof(int) ) ) {
+			++errors;
+		}
+	}
+
+	Z_Free( boxes );
+
+	Com_Printf( "sectorbench: %i queries over %i linked entities, %.1f entities found per query\n",
+			queries, numLinked, results / queries );
+	Com_Printf( "sectors: %.3f us, %.1f nodes, %.1f entity tests per query\n",
+			(double)time[0] / queries, nodes[0] / queries, tests[0] / queries );
+	Com_Printf( "tree:    %.3f us, %.1f nodes, %.1f entity tests per query\n",
+			(double)time[1] / queries, nodes[1] / queries, tests[1] / queries );
+	Com_Printf( "sectorbench: %i queries differ\n", errors );
 }
 
 
@@ -477,18 +921,15 @@ void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, con
 }
 
 
-static void SV_ClipMoveToEntities( moveclip_t *clip )
+static void SV_ClipMoveToEntities( moveclip_t *clip, const int* touchlist, int num )
 {
-	int			i, num;
-	int			touchlist[MAX_GENTITIES];
+	int			i;
 	sharedEntity_t *touch;
 	int			passOwnerNum;
 	trace_t		trace;
 	clipHandle_t	clipHandle;
 	const float		*origin, *angles;
 
-	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
-
 	if ( clip->passEntityNum != ENTITYNUM_NONE ) {
 		passOwnerNum = ( SV_GentityNum( clip->passEntityNum ) )->r.ownerNum;
 		if ( passOwnerNum == ENTITYNUM_NONE ) {
@@ -559,6 +1000,37 @@ static void SV_ClipMoveToEntities( moveclip_t *clip )
 }
 
 
+// sets up the rest of a clip whose trace already has the world's result
+
+static void SV_SetupMoveClip( moveclip_t *clip, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule )
+{
+	int i;
+
+	clip->contentmask = contentmask;
+	clip->start = start;
+//	VectorCopy( clip->trace.endpos, clip->end );
+	VectorCopy( end, clip->end );
+	clip->mins = mins;
+	clip->maxs = maxs;
+	clip->passEntityNum = passEntityNum;
+	clip->capsule = capsule;
+
+	// create the bounding box of the entire move
+	// we can limit it to the part of the move not
+	// already clipped off by the world, which can be
+	// a significant savings for line of sight and shot traces
+	for ( i=0 ; i<3 ; i++ ) {
+		if ( end[i] > start[i] ) {
+			clip->boxmins[i] = clip->start[i] + clip->mins[i] - 1;
+			clip->boxmaxs[i] = clip->end[i] + clip->maxs[i] + 1;
+		} else {
+			clip->boxmins[i] = clip->end[i] + clip->mins[i] - 1;
+			clip->boxmaxs[i] = clip->start[i] + clip->maxs[i] + 1;
+		}
+	}
+}
+
+
 /*
 ==================
 SV_Trace
@@ -569,7 +1041,7 @@ passEntityNum and entities owned by passEntityNum are explicitly not checked.
 */
 void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule ) {
 	moveclip_t	clip;
-	int			i;
+	int			touchlist[MAX_GENTITIES];
 
 	if ( !mins ) {
 		mins = vec3_origin;
@@ -588,33 +1060,124 @@ void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const ve
 		return;		// blocked immediately by the world
 	}
 
-	clip.contentmask = contentmask;
-	clip.start = start;
-//	VectorCopy( clip.trace.endpos, clip.end );
-	VectorCopy( end, clip.end );
-	clip.mins = mins;
-	clip.maxs = maxs;
-	clip.passEntityNum = passEntityNum;
-	clip.capsule = capsule;
+	SV_SetupMoveClip( &clip, start, mins, maxs, end, passEntityNum, contentmask, capsule );
 
-	// create the bounding box of the entire move
-	// we can limit it to the part of the move not
-	// already clipped off by the world, which can be
-	// a significant savings for line of sight and shot traces
-	for ( i=0 ; i<3 ; i++ ) {
-		if ( end[i] > start[i] ) {
-			clip.boxmins[i] = clip.start[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.end[i] + clip.maxs[i] + 1;
-		} else {
-			clip.boxmins[i] = clip.end[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.start[i] + clip.maxs[i] + 1;
+	// clip to other solid entities
+	const int num = SV_AreaEntities( clip.boxmins, clip.boxmaxs, touchlist, MAX_GENTITIES );
+	SV_ClipMoveToEntities( &clip, touchlist, num );
+
+	*results = clip.trace;
+}
+
+
+#define TRACES_PER_JOB	8
+
+typedef struct {
+	batchTrace_t	*traces;
+	int				count;
+	int				capsule;
+} traceBatchJob_t;
+
+
+static void SV_TraceBatchJob( void* data, int index )
+{
+	const traceBatchJob_t* job = (const traceBatchJob_t*)data;
+	const int last = min( (index + 1) * TRACES_PER_JOB, job->count );
+
+	for ( int i = index * TRACES_PER_JOB; i < last; ++i ) {
+		batchTrace_t* t = &job->traces[i];
+		CM_BoxTrace( &t->trace, t->start, t->end, t->mins, t->maxs, 0, t->contentmask, job->capsule );
+		t->trace.entityNum = t->trace.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
+	}
+}
+
+
+// the entities of a shared gather that SV_AreaEntities would have returned
+// for this move's box on its own, in the same order
+
+static int SV_TouchedEntities( const moveclip_t *clip, const int* all, int numAll, int* list )
+{
+	int num = 0;
+
+	for ( int i = 0; i < numAll; ++i ) {
+		const sharedEntity_t* gcheck = SV_GentityNum( all[i] );
+		if ( gcheck->r.absmin[0] > clip->boxmaxs[0]
+		|| gcheck->r.absmin[1] > clip->boxmaxs[1]
+		|| gcheck->r.absmin[2] > clip->boxmaxs[2]
+		|| gcheck->r.absmax[0] < clip->boxmins[0]
+		|| gcheck->r.absmax[1] < clip->boxmins[1]
+		|| gcheck->r.absmax[2] < clip->boxmins[2]) {
+			continue;
 		}
+		list[num++] = all[i];
 	}
 
+	return num;
+}
+
+
+/*
+==================
+SV_TraceBatch
+
+Does the same as SV_Trace for every one of the traces, but the world
+part runs on the job threads, and the entities are only gathered once
+over the bounds of all the moves instead of once per trace
+
+The entities are still clipped on this thread, one trace after the other,
+since the boxes of the non-bmodel entities are built with CM_TempBoxModel
+==================
+*/
+void SV_TraceBatch( batchTrace_t *traces, int count, int capsule )
+{
+	int			i, j, numAll, num;
+	int			all[MAX_GENTITIES];
+	int			touchlist[MAX_GENTITIES];
+	vec3_t		mins, maxs;
+	moveclip_t	clip;
+
+	if ( count <= 0 ) {
+		return;
+	}
+
+	// clip to world
+	traceBatchJob_t job;
+	job.traces = traces;
+	job.count = count;
+	job.capsule = capsule;
+	Sys_RunJobs( SV_TraceBatchJob, &job, (count + TRACES_PER_JOB - 1) / TRACES_PER_JOB );
+
+	// gather the entities around every move the world didn't block immediately
+	ClearBounds( mins, maxs );
+	for ( i = 0; i < count; ++i ) {
+		const batchTrace_t* t = &traces[i];
+		if ( t->trace.fraction == 0 ) {
+			continue;
+		}
+		for ( j = 0; j < 3; ++j ) {
+			mins[j] = min( mins[j], min( t->start[j], t->end[j] ) + t->mins[j] - 1 );
+			maxs[j] = max( maxs[j], max( t->start[j], t->end[j] ) + t->maxs[j] + 1 );
+		}
+	}
+	if ( mins[0] > maxs[0] ) {
+		return;
+	}
+	numAll = SV_AreaEntities( mins, maxs, all, MAX_GENTITIES );
+
 	// clip to other solid entities
-	SV_ClipMoveToEntities ( &clip );
+	for ( i = 0; i < count; ++i ) {
+		batchTrace_t* t = &traces[i];
+		if ( t->trace.fraction == 0 ) {
+			continue;
+		}
 
-	*results = clip.trace;
+		Com_Memset( &clip, 0, sizeof( moveclip_t ) );
+		clip.trace = t->trace;
+		SV_SetupMoveClip( &clip, t->start, t->mins, t->maxs, t->end, t->passEntityNum, t->contentmask, capsule );
+		num = SV_TouchedEntities( &clip, all, numAll, touchlist );
+		SV_ClipMoveToEntities( &clip, touchlist, num );
+		t->trace = clip.trace;
+	}
 }
 
 
@@ -760,11 +760,11 @@ static void* try_dlopen(const char* base, const char* gamedir, const char* fname
 }
 
 void *Sys_LoadDll( const char *name, 
-                   intptr_t (**entryPoint)(intptr_t, ...),
+                   intptr_t (**entryPoint)(int, ...),
                    intptr_t (*systemcalls)(intptr_t, ...) ) 
 {
   void *libHandle;
-  void	(QDECL *dllEntry)( int (QDECL *syscallptr)(int, ...) );
+  void	(QDECL *dllEntry)( intptr_t (QDECL *syscallptr)(intptr_t, ...) );
   char  curpath[MAX_OSPATH];
   char  fname[MAX_OSPATH];
   const char*  err = NULL;
@@ -800,11 +800,11 @@ void *Sys_LoadDll( const char *name,
   }
 
 #if USE_SDL_VIDEO
-  dllEntry = ( void (QDECL *)( int (QDECL *)( int, ... ) ) )SDL_LoadFunction( libHandle, "dllEntry" );
-  *entryPoint = (int (QDECL *)(intptr_t,...))SDL_LoadFunction( libHandle, "vmMain" );
+  dllEntry = ( void (QDECL *)( intptr_t (QDECL *)( intptr_t, ... ) ) )SDL_LoadFunction( libHandle, "dllEntry" );
+  *entryPoint = (intptr_t (QDECL *)(int,...))SDL_LoadFunction( libHandle, "vmMain" );
 #else
-  dllEntry = ( void (QDECL *)( int (QDECL *)( int, ... ) ) )dlsym( libHandle, "dllEntry" );
-  *entryPoint = (int (QDECL *)(intptr_t,...))dlsym( libHandle, "vmMain" );
+  dllEntry = ( void (QDECL *)( intptr_t (QDECL *)( intptr_t, ... ) ) )dlsym( libHandle, "dllEntry" );
+  *entryPoint = (intptr_t (QDECL *)(int,...))dlsym( libHandle, "vmMain" );
 #endif
 
   if ( !*entryPoint || !dllEntry )
@@ -1047,55 +1047,28 @@ EVENT LOOP
 ========================================================================
 */
 
-// bk000306: upped this from 64
-#define	MAX_QUED_EVENTS		256
-#define	MASK_QUED_EVENTS	( MAX_QUED_EVENTS - 1 )
-
-sysEvent_t  eventQue[MAX_QUED_EVENTS];
-// bk000306: initialize
-int   eventHead = 0;
-int             eventTail = 0;
-byte    sys_packetReceived[MAX_MSGLEN];
-
 /*
 ================
 Sys_QueEvent
 
 A time of 0 will get the current time
-Ptr should either be null, or point to a block of data that can
-be freed by the game later.
+Ptr's data is copied into the queue, so it only has to live
+through the call, and any thread can queue events
 ================
 */
 void Sys_QueEvent( int time, sysEventType_t type, int value, int value2, int ptrLength, void *ptr ) {
-  sysEvent_t  *ev;
-
-  ev = &eventQue[ eventHead & MASK_QUED_EVENTS ];
-
-  // bk000305 - was missing
-  if ( eventHead - eventTail >= MAX_QUED_EVENTS )
-  {
-    Com_Printf("Sys_QueEvent: overflow\n");
-    // we are discarding an event, but don't leak memory
-    if ( ev->evPtr )
-    {
-      Z_Free( ev->evPtr );
-    }
-    eventTail++;
-  }
-
-  eventHead++;
+  sysEvent_t  ev;
 
-  if ( time == 0 )
-  {
-    time = Sys_Milliseconds();
-  }
+  if ( !com_sysEvents )
+    return;
 
-  ev->evTime = time;
-  ev->evType = type;
-  ev->evValue = value;
-  ev->evValue2 = value2;
-  ev->evPtrLength = ptrLength;
-  ev->evPtr = ptr;
+  ev.evTime = time;
+  ev.evType = type;
+  ev.evValue = value;
+  ev.evValue2 = value2;
+  ev.evPtrLength = ptrLength;
+  ev.evPtr = ptr;
+  EQ_Push( com_sysEvents, &ev );
 }
 
 /*
@@ -1107,14 +1080,11 @@ Sys_GetEvent
 sysEvent_t Sys_GetEvent( void ) {
   sysEvent_t  ev;
   char    *s;
-  msg_t   netmsg;
-  netadr_t  adr;
 
   // return if we have data
-  if ( eventHead > eventTail )
+  if ( EQ_Get( com_sysEvents, &ev ) )
   {
-    eventTail++;
-    return eventQue[ ( eventTail - 1 ) & MASK_QUED_EVENTS ];
+    return ev;
   }
 
   // pump the message loop
@@ -1125,32 +1095,18 @@ sysEvent_t Sys_GetEvent( void ) {
   s = Sys_ConsoleInput();
   if ( s )
   {
-    int len = strlen( s ) + 1;
-    char* b = (char*)Z_Malloc( len );
-    strcpy( b, s );
-    Sys_QueEvent( 0, SE_CONSOLE, 0, 0, len, b );
+    Sys_QueEvent( 0, SE_CONSOLE, 0, 0, strlen( s ) + 1, s );
   }
 
   // check for other input devices
   IN_Frame();
 
-  // check for network packets
-  MSG_Init( &netmsg, sys_packetReceived, sizeof( sys_packetReceived ) );
-  if ( Sys_GetPacket ( &adr, &netmsg ) )
-  {
-    // copy out to a seperate buffer for qeueing
-    int len = sizeof( netadr_t ) + netmsg.cursize;
-    netadr_t* buf = (netadr_t*)Z_Malloc( len );
-    *buf = adr;
-    memcpy( buf+1, netmsg.data, netmsg.cursize );
-    Sys_QueEvent( 0, SE_PACKET, 0, 0, len, buf );
-  }
+  // network packets don't go through here, Com_EventLoop reads them itself
 
   // return if we have data
-  if ( eventHead > eventTail )
+  if ( EQ_Get( com_sysEvents, &ev ) )
   {
-    eventTail++;
-    return eventQue[ ( eventTail - 1 ) & MASK_QUED_EVENTS ];
+    return ev;
   }
 
   // create an empty event to return
@@ -1319,9 +1275,6 @@ int main( int argc, char* argv[] )
     strcat(cmdline, argv[i]);
   }
 
-  memset( &eventQue[0], 0, MAX_QUED_EVENTS*sizeof(sysEvent_t) ); 
-  memset( &sys_packetReceived[0], 0, MAX_MSGLEN*sizeof(byte) );
-
   Com_Init(cmdline);
   NET_Init();
 
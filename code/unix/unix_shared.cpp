@@ -28,6 +28,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <sys/mman.h>
 #include <sys/time.h>
 #include <pwd.h>
+#include <pthread.h>
 
 #include "../qcommon/q_shared.h"
 #include "../qcommon/qcommon.h"
@@ -71,6 +72,15 @@ int Sys_Milliseconds()
 	return curtime;
 }
 
+
+int64_t Sys_Microseconds()
+{
+	struct timeval tp;
+	gettimeofday(&tp, NULL);
+
+	return (int64_t)tp.tv_sec * 1000000 + tp.tv_usec;
+}
+
 #if (defined(__linux__) || defined(__FreeBSD__) || defined(__sun)) && !defined(DEDICATED)
 /*
 ================
@@ -384,3 +394,135 @@ unsigned int Sys_ProcessorCount(void)
   return sysconf(_SC_NPROCESSORS_ONLN);
 }
 #endif
+
+
+int Sys_AtomicAdd( volatile int* p, int value )
+{
+	return __sync_add_and_fetch( p, value );
+}
+
+
+qbool Sys_AtomicCompareExchange( volatile int* p, int expected, int desired )
+{
+	return __sync_bool_compare_and_swap( p, expected, desired ) ? qtrue : qfalse;
+}
+
+
+/*
+=============================================================================
+
+JOB THREADS
+
+=============================================================================
+*/
+
+static struct {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	wake;		// a new batch has been started
+	pthread_cond_t	done;		// the last worker has finished the batch
+	pthread_t		threads[MAX_JOB_THREADS];
+	int				numThreads;
+	int				requested;	// the last count asked for, even if fewer could be started
+	int				batch;		// bumped by every Sys_RunJobs
+	int				busy;		// workers that haven't finished the current batch yet
+	qbool			quit;
+	sysJob_t		job;
+	void*			data;
+	int				count;
+	volatile int	next;		// the next job index to hand out
+} jobs = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+
+static void Sys_ProcessJobs()
+{
+	int i;
+	while ((i = __sync_fetch_and_add( &jobs.next, 1 )) < jobs.count)
+		jobs.job( jobs.data, i );
+}
+
+
+static void* Sys_JobThread( void* arg )
+{
+	// the batch that was current when the thread was created,
+	// so that it can't miss one that starts before it runs
+	int batch = (int)(intptr_t)arg;
+
+	pthread_mutex_lock( &jobs.mutex );
+	for (;;) {
+		while (jobs.batch == batch && !jobs.quit)
+			pthread_cond_wait( &jobs.wake, &jobs.mutex );
+		if (jobs.quit)
+			break;
+		batch = jobs.batch;
+		pthread_mutex_unlock( &jobs.mutex );
+
+		Sys_ProcessJobs();
+
+		pthread_mutex_lock( &jobs.mutex );
+		if (--jobs.busy == 0)
+			pthread_cond_signal( &jobs.done );
+	}
+	pthread_mutex_unlock( &jobs.mutex );
+
+	return NULL;
+}
+
+
+void Sys_SetJobThreads( int count )
+{
+	int i;
+
+	// a failure to start them all is only dealt with once,
+	// rather than every time the same count is asked for again
+	count = max( 0, min( count, MAX_JOB_THREADS ) );
+	if (count == jobs.requested)
+		return;
+	jobs.requested = count;
+
+	if (jobs.numThreads) {
+		pthread_mutex_lock( &jobs.mutex );
+		jobs.quit = qtrue;
+		pthread_cond_broadcast( &jobs.wake );
+		pthread_mutex_unlock( &jobs.mutex );
+		for (i = 0; i < jobs.numThreads; ++i)
+			pthread_join( jobs.threads[i], NULL );
+		jobs.quit = qfalse;
+		jobs.numThreads = 0;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (pthread_create( &jobs.threads[i], NULL, Sys_JobThread, (void*)(intptr_t)jobs.batch )) {
+			Com_Printf( "WARNING: only %i of %i job threads could be started\n", i, count );
+			break;
+		}
+		jobs.numThreads++;
+	}
+}
+
+
+void Sys_RunJobs( sysJob_t job, void* data, int count )
+{
+	if (!jobs.numThreads || count < 2) {
+		for (int i = 0; i < count; ++i)
+			job( data, i );
+		return;
+	}
+
+	pthread_mutex_lock( &jobs.mutex );
+	jobs.job = job;
+	jobs.data = data;
+	jobs.count = count;
+	jobs.next = 0;
+	jobs.busy = jobs.numThreads;
+	jobs.batch++;
+	pthread_cond_broadcast( &jobs.wake );
+	pthread_mutex_unlock( &jobs.mutex );
+
+	// the calling thread works on the batch too rather than just waiting for it
+	Sys_ProcessJobs();
+
+	pthread_mutex_lock( &jobs.mutex );
+	while (jobs.busy)
+		pthread_cond_wait( &jobs.done, &jobs.mutex );
+	pthread_mutex_unlock( &jobs.mutex );
+}
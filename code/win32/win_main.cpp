@@ -660,50 +660,33 @@ EVENT LOOP
 ========================================================================
 */
 
-#define	MAX_QUED_EVENTS		512
-#define	MASK_QUED_EVENTS	( MAX_QUED_EVENTS - 1 )
-
-static sysEvent_t	eventQue[MAX_QUED_EVENTS];
-static int			eventHead, eventTail;
-
-
 // a time of 0 will get the current time
-// ptr should either be null, or point to a block of data that can be freed by the game later
+// ptr's data is copied into the queue, so it only has to live through the call,
+// and any thread can queue events
 
 void Sys_QueEvent( int time, sysEventType_t type, int value, int value2, int ptrLength, void *ptr )
 {
-	sysEvent_t* ev = &eventQue[ eventHead & MASK_QUED_EVENTS ];
-
-	if ( eventHead - eventTail >= MAX_QUED_EVENTS ) {
-		Com_Printf("Sys_QueEvent: overflow\n");
-		// we are discarding an event, but don't leak memory
-		if ( ev->evPtr ) {
-			Z_Free( ev->evPtr );
-		}
-		eventTail++;
-	}
-
-	eventHead++;
-
-	if ( time == 0 ) {
-		time = Sys_Milliseconds();
-	}
+	if ( !com_sysEvents )
+		return;
 
-	ev->evTime = time;
-	ev->evType = type;
-	ev->evValue = value;
-	ev->evValue2 = value2;
-	ev->evPtrLength = ptrLength;
-	ev->evPtr = ptr;
+	sysEvent_t ev;
+	ev.evTime = time;
+	ev.evType = type;
+	ev.evValue = value;
+	ev.evValue2 = value2;
+	ev.evPtrLength = ptrLength;
+	ev.evPtr = ptr;
+	EQ_Push( com_sysEvents, &ev );
 }
 
 
 sysEvent_t Sys_GetEvent()
 {
+	sysEvent_t ev;
+
 	// return if we have data
-	if ( eventHead > eventTail ) {
-		eventTail++;
-		return eventQue[ ( eventTail - 1 ) & MASK_QUED_EVENTS ];
+	if ( EQ_Get( com_sysEvents, &ev ) ) {
+		return ev;
 	}
 
 	// pump the message loop
@@ -723,35 +706,17 @@ sysEvent_t Sys_GetEvent()
 	// check for console commands
 	const char* s = Sys_ConsoleInput();
 	if ( s ) {
-		int len = strlen( s ) + 1;
-		char* b = (char*)Z_Malloc( len );
-		Q_strncpyz( b, s, len-1 );
-		Sys_QueEvent( 0, SE_CONSOLE, 0, 0, len, b );
-	}
-
-	// check for network packets
-	msg_t		netmsg;
-	netadr_t	adr;
-	static byte sys_packetReceived[MAX_MSGLEN]; // static or it'll blow half the stack
-	MSG_Init( &netmsg, sys_packetReceived, sizeof( sys_packetReceived ) );
-	if ( Sys_GetPacket( &adr, &netmsg ) ) {
-		// copy out to a seperate buffer for qeueing
-		// the readcount stepahead is for SOCKS support
-		int len = sizeof( netadr_t ) + netmsg.cursize - netmsg.readcount;
-		netadr_t* buf = (netadr_t*)Z_Malloc( len );
-		*buf = adr;
-		memcpy( buf+1, &netmsg.data[netmsg.readcount], netmsg.cursize - netmsg.readcount );
-		Sys_QueEvent( 0, SE_PACKET, 0, 0, len, buf );
+		Sys_QueEvent( 0, SE_CONSOLE, 0, 0, strlen( s ) + 1, (void*)s );
 	}
 
+	// network packets don't go through here, Com_EventLoop reads them itself
+
 	// return if we have data
-	if ( eventHead > eventTail ) {
-		eventTail++;
-		return eventQue[ ( eventTail - 1 ) & MASK_QUED_EVENTS ];
+	if ( EQ_Get( com_sysEvents, &ev ) ) {
+		return ev;
 	}
 
 	// create an empty event to return
-	sysEvent_t ev;
 	memset( &ev, 0, sizeof( ev ) );
 	ev.evTime = Sys_Milliseconds();
 	return ev;
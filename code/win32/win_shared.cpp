@@ -36,6 +36,20 @@ int Sys_Milliseconds()
 }
 
 
+int64_t Sys_Microseconds()
+{
+	static LARGE_INTEGER frequency;
+
+	if (!frequency.QuadPart)
+		QueryPerformanceFrequency(&frequency);
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	return (now.QuadPart / frequency.QuadPart) * 1000000 + (now.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+
 // disable all optimizations temporarily so this code works correctly!
 #ifdef _MSC_VER
 #pragma optimize( "", off )
@@ -175,3 +189,120 @@ const char* Sys_DefaultHomePath()
 	return NULL;
 }
 
+
+int Sys_AtomicAdd( volatile int* p, int value )
+{
+	return InterlockedExchangeAdd( (volatile LONG*)p, value ) + value;
+}
+
+
+qbool Sys_AtomicCompareExchange( volatile int* p, int expected, int desired )
+{
+	return ( InterlockedCompareExchange( (volatile LONG*)p, desired, expected ) == expected );
+}
+
+
+/*
+=============================================================================
+
+JOB THREADS
+
+=============================================================================
+*/
+
+static struct {
+	HANDLE			threads[MAX_JOB_THREADS];
+	int				numThreads;
+	int				requested;	// the last count asked for, even if fewer could be started
+	HANDLE			wake;		// released once per worker for every batch
+	HANDLE			done;		// set by the last worker to finish a batch
+	volatile LONG	busy;		// wake-ups that haven't finished yet
+	volatile LONG	quit;
+	sysJob_t		job;
+	void*			data;
+	int				count;
+	volatile LONG	next;		// the next job index to hand out
+} jobs;
+
+
+static void Sys_ProcessJobs()
+{
+	int i;
+	while ((i = InterlockedIncrement( &jobs.next ) - 1) < jobs.count)
+		jobs.job( jobs.data, i );
+}
+
+
+// a worker that finishes early can take a second wake-up from the same
+// batch, but every wake-up is matched by exactly one decrement of busy,
+// so the batch still isn't done until they've all been consumed
+
+static DWORD WINAPI Sys_JobThread( LPVOID )
+{
+	for (;;) {
+		WaitForSingleObject( jobs.wake, INFINITE );
+		if (jobs.quit)
+			return 0;
+		Sys_ProcessJobs();
+		if (InterlockedDecrement( &jobs.busy ) == 0)
+			SetEvent( jobs.done );
+	}
+}
+
+
+void Sys_SetJobThreads( int count )
+{
+	int i;
+
+	// a failure to start them all is only dealt with once,
+	// rather than every time the same count is asked for again
+	count = max( 0, min( count, MAX_JOB_THREADS ) );
+	if (count == jobs.requested)
+		return;
+	jobs.requested = count;
+
+	if (!jobs.wake) {
+		jobs.wake = CreateSemaphore( NULL, 0, MAX_JOB_THREADS, NULL );
+		jobs.done = CreateEvent( NULL, FALSE, FALSE, NULL );
+	}
+
+	if (jobs.numThreads) {
+		jobs.quit = 1;
+		ReleaseSemaphore( jobs.wake, jobs.numThreads, NULL );
+		WaitForMultipleObjects( jobs.numThreads, jobs.threads, TRUE, INFINITE );
+		for (i = 0; i < jobs.numThreads; ++i)
+			CloseHandle( jobs.threads[i] );
+		jobs.quit = 0;
+		jobs.numThreads = 0;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (!(jobs.threads[i] = CreateThread( NULL, 0, Sys_JobThread, NULL, 0, NULL ))) {
+			Com_Printf( "WARNING: only %i of %i job threads could be started\n", i, count );
+			break;
+		}
+		jobs.numThreads++;
+	}
+}
+
+
+void Sys_RunJobs( sysJob_t job, void* data, int count )
+{
+	if (!jobs.numThreads || count < 2) {
+		for (int i = 0; i < count; ++i)
+			job( data, i );
+		return;
+	}
+
+	jobs.job = job;
+	jobs.data = data;
+	jobs.count = count;
+	jobs.next = 0;
+	jobs.busy = jobs.numThreads;
+	ReleaseSemaphore( jobs.wake, jobs.numThreads, NULL );
+
+	// the calling thread works on the batch too rather than just waiting for it
+	Sys_ProcessJobs();
+
+	WaitForSingleObject( jobs.done, INFINITE );
+}
@@ -79,7 +79,6 @@ static WinConData s_wcd;
 
 static LONG WINAPI ConWndProc( HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
-	char* cmdString;
 	static qbool s_timePolarity;
 
 	switch (uMsg)
@@ -113,8 +112,7 @@ static LONG WINAPI ConWndProc( HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPara
 	case WM_CLOSE:
 		if ( ( com_dedicated && com_dedicated->integer ) )
 		{
-			cmdString = CopyString( "quit" );
-			Sys_QueEvent( 0, SE_CONSOLE, 0, 0, strlen( cmdString ) + 1, cmdString );
+			Sys_QueEvent( 0, SE_CONSOLE, 0, 0, sizeof("quit"), (void*)"quit" );
 		}
 		else if ( s_wcd.quitOnClose )
 		{
@@ -176,8 +174,7 @@ static LONG WINAPI ConWndProc( HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPara
 			}
 			else
 			{
-				cmdString = CopyString( "quit" );
-				Sys_QueEvent( 0, SE_CONSOLE, 0, 0, strlen( cmdString ) + 1, cmdString );
+				Sys_QueEvent( 0, SE_CONSOLE, 0, 0, sizeof("quit"), (void*)"quit" );
 			}
 		}
 		else if ( wParam == CLEAR_ID )